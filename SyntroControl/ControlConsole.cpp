@@ -131,9 +131,11 @@ void ControlConsole::displayMulticast()
 
 	QMutexLocker locker(&(m_client->m_multicastManager.m_lock));
 
-	MM_MMAP *multicastMap = m_client->m_multicastManager.m_multicastMap;
+	QVector<MM_MMAP *>& multicastMaps = m_client->m_multicastManager.m_multicastMaps;
+
+	for (int i = 0; i < multicastMaps.count(); i++) {
+		MM_MMAP *multicastMap = multicastMaps[i];
 
-	for (int i = 0; i < SYNTROSERVER_MAX_MMAPS; i++, multicastMap++) {
 		if (!multicastMap->valid)
 			continue;
 
@@ -148,13 +150,14 @@ void ControlConsole::displayMulticast()
 				SyntroUtils::convertUC2ToUInt(multicastMap->serviceLookup.localPort), 
 				SyntroUtils::convertUC2ToUInt(multicastMap->serviceLookup.remotePort));
 
-		MM_REGISTEREDCOMPONENT *registeredComponent = multicastMap->head;
+		for (int j = 0; j < multicastMap->registeredCount; j++) {
+			MM_REGISTEREDCOMPONENT *registeredComponent = multicastMap->registrations + j;
 
-		while (registeredComponent != NULL) {
-			printf("          RC: UID=%s, port=%d, seq=%d, ack=%d\n", 
+			printf("          RC: UID=%s, port=%d, seq=%d, ack=%d, window=%d, rtt=%d, minrtt=%d, conflated=%d, dropped=%d\n", 
 				qPrintable(SyntroUtils::displayUID(&registeredComponent->registeredUID)), registeredComponent->port, 
-				registeredComponent->sendSeq, registeredComponent->lastAckSeq);
-			registeredComponent = registeredComponent->next;
+				registeredComponent->sendSeq, registeredComponent->lastAckSeq, registeredComponent->sendWindow.window,
+				(int)registeredComponent->sendWindow.rtt, (int)registeredComponent->sendWindow.minRTT,
+				(int)registeredComponent->conflated, (int)registeredComponent->dropped);
 		}
 	}
 
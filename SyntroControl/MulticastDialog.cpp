@@ -54,16 +54,18 @@ void MulticastDialog::layoutWindow()
 	vertLayout->addWidget(splitter);
 
 	m_table = new QTableWidget(splitter);
-	m_table->setColumnCount(4);
+	m_table->setColumnCount(6);
 
     m_table->setColumnWidth(0, 120);
     m_table->setColumnWidth(1, 80);
     m_table->setColumnWidth(2, 80);
     m_table->setColumnWidth(3, 80);
+    m_table->setColumnWidth(4, 80);
+    m_table->setColumnWidth(5, 80);
 
 	m_table->setHorizontalHeaderLabels(
                 QStringList() << tr("UID") << tr("Port")
-                << tr("Seq") << tr("Ack"));
+                << tr("Seq") << tr("Ack") << tr("Window") << tr("RTT"));
 
     m_table->setSelectionMode(QAbstractItemView::NoSelection);
 
@@ -87,8 +89,7 @@ void MulticastDialog::MMNewEntry(int index)
 	MM_MMAP *map;
 	QMutexLocker locker(&(m_multicastMgr->m_lock));
 
-	map = &(m_multicastMgr->m_multicastMap[index]);
-	if (!map->valid)
+	if ((map = m_multicastMgr->MMGetMMap(index)) == NULL)
 		return;												// must be historic
 
 	QTreeWidgetItem *twi = new QTreeWidgetItem((QTreeWidget*)0, QStringList(map->serviceLookup.servicePath));
@@ -143,25 +144,24 @@ void MulticastDialog::MMDisplay()
 	if (m_currentMapIndex == -1)
 		return;												// this means there is no selection
 
-	MM_MMAP	*map = &(m_multicastMgr->m_multicastMap[m_currentMapIndex]);
+	MM_MMAP	*map = m_multicastMgr->MMGetMMap(m_currentMapIndex);
 
-	if (!map->valid) {
+	if (map == NULL) {
 		clearTable();
 		return;
 	}
 
-	MM_REGISTEREDCOMPONENT *registeredComponent = map->head;
-	rowIndex = 0;
+	for (rowIndex = 0; rowIndex < map->registeredCount; rowIndex++) {
+		MM_REGISTEREDCOMPONENT *registeredComponent = map->registrations + rowIndex;
 
-	while (registeredComponent != NULL) {
 		if (rowIndex >= m_table->rowCount())
 			addTableRow(rowIndex);
 		m_table->item(rowIndex, 0)->setText(SyntroUtils::displayUID(&(registeredComponent->registeredUID)));
 		m_table->item(rowIndex, 1)->setText(QString::number(registeredComponent->port));
 		m_table->item(rowIndex, 2)->setText(QString::number(registeredComponent->sendSeq));
 		m_table->item(rowIndex, 3)->setText(QString::number(registeredComponent->lastAckSeq));
-		registeredComponent = registeredComponent->next;
-		rowIndex++;
+		m_table->item(rowIndex, 4)->setText(QString::number(registeredComponent->sendWindow.window));
+		m_table->item(rowIndex, 5)->setText(QString::number(registeredComponent->sendWindow.rtt));
 	}
 }
 
@@ -170,7 +170,7 @@ void MulticastDialog::addTableRow(int index)
 	m_table->insertRow(index);
 	m_table->setRowHeight(index, 20);
 
-	for (int col = 0; col < 4; col++) {
+	for (int col = 0; col < 6; col++) {
 		QTableWidgetItem *item = new QTableWidgetItem();
 		item->setTextAlignment(Qt::AlignLeft | Qt::AlignBottom);
 		item->setFlags(Qt::ItemIsEnabled);
@@ -283,7 +283,7 @@ bool DirectoryManager::DMFindService(SYNTRO_UID *sourceUID, SYNTRO_SERVICE_LOOKU
 
 	if (serviceLookup->response == SERVICE_LOOKUP_SUCCEED) {	// this is a refresh - check all important fields for validity
 		componentIndex = SyntroUtils::convertUC2ToInt(serviceLookup->componentIndex);
-		servicePort = SyntroUtils::convertUC2ToInt(serviceLookup->remotePort);
+		servicePort = SyntroUtils::convertUC2ToUInt(serviceLookup->remotePort);	// may be a multicast map port
 		if ((componentIndex < 0) || (componentIndex >= SYNTRO_MAX_CONNECTEDCOMPONENTS)) {
 			TRACE2("Lookup refresh with incorrect CompIndex %d for service %s", componentIndex, serviceLookup->servicePath);
 			goto fullLookup;
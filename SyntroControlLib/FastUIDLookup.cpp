@@ -20,148 +20,200 @@
 #include "SyntroLib.h"
 #include "FastUIDLookup.h"
 
-
-FastUIDLookup::FastUIDLookup(void)
+static inline int loadAcquire(QAtomicInt& val)
 {
-	int		i;
-
-	for (i = 0; i < FUL_LEVEL_SIZE; i++)
-		FULLevel0[i] = NULL;
+#if QT_VERSION < 0x050000
+	return val.fetchAndAddAcquire(0);
+#else
+	return val.loadAcquire();
+#endif
 }
 
-FastUIDLookup::~FastUIDLookup(void)
-{
-	int indexL0, indexL1, indexL2;
-	void **L1, **L2, **L3;
-
-	for (indexL0 = 0; indexL0 < FUL_LEVEL_SIZE; indexL0++) {
-		if (FULLevel0[indexL0] != NULL) {
-			L1 = (void **)FULLevel0[indexL0];
-			for (indexL1 = 0; indexL1 < FUL_LEVEL_SIZE; indexL1++) {
-				if (L1[indexL1] != NULL) {
-					L2 = (void **)L1[indexL1];
-					for (indexL2 = 0; indexL2 < FUL_LEVEL_SIZE; indexL2++) {
-						if (L2[indexL2] != NULL) {
-							L3 = (void **)L2[indexL2];
-							free(L3);
-						}
-					}
-					free(L2);
-				}
-			}
-			free(L1);
-		}
-	}
-}
+//	The key is the UID's 8 bytes as a 64 bit integer. Byte order doesn't matter as keys
+//	are only hashed and compared.
 
-void *FastUIDLookup::FULLookup(SYNTRO_UID *UID)
+static inline quint64 UIDKey(SYNTRO_UID *UID)
 {
-	unsigned int indexL0, indexL1, indexL2, indexL3;
-	void **ptr;
-	SYNTRO_UC2 *U2;
-	void *returnValue;
+	quint64 key;
 
-	U2 = (SYNTRO_UC2 *)UID;
-	indexL0 = SyntroUtils::convertUC2ToUInt(U2[0]);						// get UID as four separate unsigned ints
-	indexL1 = SyntroUtils::convertUC2ToUInt(U2[1]);
-	indexL2 = SyntroUtils::convertUC2ToUInt(U2[2]);
-	indexL3 = SyntroUtils::convertUC2ToUInt(U2[3]);
-
-	QMutexLocker locker (&m_lock);
-
-//	Do level 0 lookup
+	memcpy(&key, UID, sizeof(quint64));
+	return key;
+}
 
-	ptr = (void **)FULLevel0[indexL0];
-	if (ptr == NULL)
-		return NULL;
+static inline quint64 UIDHash(quint64 key)
+{
+	quint64 hash = key * Q_UINT64_C(0x9e3779b97f4a7c15);
 
-//	Do level 1 lookup
+	return hash ^ (hash >> 29);
+}
 
-	ptr = (void **)ptr[indexL1];
-	if (ptr == NULL)
-		return NULL;
+static inline unsigned char UIDControl(quint64 hash)
+{
+	return 0x80 | (unsigned char)(hash >> 57);
+}
 
-//	Do level 2 lookup
+FastUIDLookup::FastUIDLookup(void)
+{
+	m_table = allocTable(FUL_INITIAL_SIZE);
+	m_count = 0;
+}
 
-	ptr = (void **)ptr[indexL2];
-	if (ptr == NULL)
-		return NULL;
+FastUIDLookup::~FastUIDLookup(void)
+{
+	m_retiredTables.append(m_table);
+	for (int i = 0; i < m_retiredTables.count(); i++) {
+		free(m_retiredTables[i]->control);
+		free(m_retiredTables[i]->keys);
+		free(m_retiredTables[i]->data);
+		free(m_retiredTables[i]);
+	}
+}
 
-//	Do level 3 lookup
+FUL_TABLE *FastUIDLookup::allocTable(int size)
+{
+	FUL_TABLE *table = (FUL_TABLE *)malloc(sizeof(FUL_TABLE));
+
+	table->size = size;
+	table->mask = size - 1;
+	table->control = (unsigned char *)calloc(size, sizeof(unsigned char));
+	table->keys = (quint64 *)malloc(size * sizeof(quint64));
+	table->data = (void **)malloc(size * sizeof(void *));
+	return table;
+}
 
-	returnValue =  ptr[indexL3];
-	return returnValue;
+void *FastUIDLookup::FULLookup(SYNTRO_UID *UID)
+{
+	quint64 key = UIDKey(UID);
+	quint64 hash = UIDHash(key);
+	unsigned char control = UIDControl(hash);
+	FUL_TABLE *table;
+	void *returnValue;
+	int sequence;
+	int slot;
+
+	while (1) {
+		sequence = loadAcquire(m_sequence);
+		if (sequence & 1)
+			continue;										// an add or delete is in progress
+
+		table = m_table;
+		returnValue = NULL;
+		for (slot = (int)(hash & table->mask); table->control[slot] != 0; slot = (slot + 1) & table->mask) {
+			if ((table->control[slot] == control) && (table->keys[slot] == key)) {
+				returnValue = table->data[slot];
+				break;
+			}
+		}
+		if (m_sequence.fetchAndAddOrdered(0) == sequence)
+			return returnValue;								// nothing changed while looking
+	}
 }
 
 void	FastUIDLookup::FULAdd(SYNTRO_UID *UID, void *data)
 {
-	unsigned int indexL0, indexL1, indexL2, indexL3;
-	void **L1, **L2, **L3, *ptr;
-	SYNTRO_UC2 *U2;
-
-	U2 = (SYNTRO_UC2 *)UID;
-	indexL0 = SyntroUtils::convertUC2ToUInt(U2[0]);						// get UID as four separate unsigned ints
-	indexL1 = SyntroUtils::convertUC2ToUInt(U2[1]);
-	indexL2 = SyntroUtils::convertUC2ToUInt(U2[2]);
-	indexL3 = SyntroUtils::convertUC2ToUInt(U2[3]);
+	quint64 key = UIDKey(UID);
+	quint64 hash = UIDHash(key);
+	unsigned char control = UIDControl(hash);
+	int slot;
 
-	if ((ptr = FULLookup(UID)) != NULL)
+	if (data == NULL) {										// same as not being there
 		FULDelete(UID);
+		return;
+	}
 
 	QMutexLocker locker(&m_lock);
 
-	if ((L1 = (void **)FULLevel0[indexL0]) == NULL)
-	{														// need to add a level 1 array
-		FULLevel0[indexL0] = (void *)calloc(FUL_LEVEL_SIZE, sizeof (void *));
-		L1 = (void **)FULLevel0[indexL0];
+	for (slot = (int)(hash & m_table->mask); m_table->control[slot] != 0; slot = (slot + 1) & m_table->mask) {
+		if ((m_table->control[slot] == control) && (m_table->keys[slot] == key)) {
+			m_sequence.fetchAndAddOrdered(1);
+			m_table->data[slot] = data;						// already there - just replace the data
+			m_sequence.fetchAndAddOrdered(1);
+			return;
+		}
 	}
-	if ((L2 = (void **)L1[indexL1]) == NULL)
-	{														// need to add a level 2 array
-		L1[indexL1] = (void *)calloc(FUL_LEVEL_SIZE, sizeof(void *));
-		L2 = (void **)L1[indexL1];
-	}	
-	if ((L3 = (void **)L2[indexL2]) == NULL)
-	{														// need to add a level 2 array
-		L2[indexL2] = (void *)calloc(FUL_LEVEL_SIZE, sizeof(void *));
-		L3 = (void **)L2[indexL2];
-	}	
-	L3[indexL3] = data;										// finally, record the data
+
+	if ((m_count + 1) * 4 > m_table->size * 3)				// keep the load factor under 3/4
+		grow();
+
+	m_sequence.fetchAndAddOrdered(1);
+	insert(m_table, key, data);
+	m_count++;
+	m_sequence.fetchAndAddOrdered(1);
 }
 
+//	FULDelete uses backward shift deletion so the table never fills with deleted markers.
+//	Entries after the hole that would still be found from there are moved back into it.
+
 void FastUIDLookup::FULDelete(SYNTRO_UID *UID)
 {
-	unsigned int indexL0, indexL1, indexL2, indexL3;
-	void **L1, **L2, **L3;
+	quint64 key = UIDKey(UID);
+	quint64 hash = UIDHash(key);
+	unsigned char control = UIDControl(hash);
+	FUL_TABLE *table;
+	int slot, hole, home;
 
-	SYNTRO_UC2 *U2;
+	QMutexLocker locker(&m_lock);
 
-	U2 = (SYNTRO_UC2 *)UID;
-	indexL0 = SyntroUtils::convertUC2ToUInt(U2[0]);	// get UID as four separate unsigned ints
-	indexL1 = SyntroUtils::convertUC2ToUInt(U2[1]);
-	indexL2 = SyntroUtils::convertUC2ToUInt(U2[2]);
-	indexL3 = SyntroUtils::convertUC2ToUInt(U2[3]);
+	table = m_table;
+	for (slot = (int)(hash & table->mask); table->control[slot] != 0; slot = (slot + 1) & table->mask) {
+		if ((table->control[slot] == control) && (table->keys[slot] == key))
+			break;
+	}
+	if (table->control[slot] == 0)
+		return;												// not in the table
+
+	m_sequence.fetchAndAddOrdered(1);
+	hole = slot;
+	for (slot = (hole + 1) & table->mask; table->control[slot] != 0; slot = (slot + 1) & table->mask) {
+		home = (int)(UIDHash(table->keys[slot]) & table->mask);
+		if (((slot - home) & table->mask) >= ((slot - hole) & table->mask)) {
+			table->control[hole] = table->control[slot];	// the hole is on this entry's probe path
+			table->keys[hole] = table->keys[slot];
+			table->data[hole] = table->data[slot];
+			hole = slot;
+		}
+	}
+	table->control[hole] = 0;
+	m_count--;
+	m_sequence.fetchAndAddOrdered(1);
+}
 
+int FastUIDLookup::FULCount()
+{
 	QMutexLocker locker(&m_lock);
 
-//	Do level 0 lookup
+	return m_count;
+}
 
-	L1 = (void **)FULLevel0[indexL0];
-	if (L1 == NULL)
-		return;
-//	Do level 1 lookup
+//	insert puts a new key in the first free slot on its probe path. The control byte is set
+//	last so the slot is complete when it becomes visible.
 
-	L2 = (void **)L1[indexL1];
-	if (L2 == NULL)
-		return;
+void FastUIDLookup::insert(FUL_TABLE *table, quint64 key, void *data)
+{
+	quint64 hash = UIDHash(key);
+	int slot;
+
+	for (slot = (int)(hash & table->mask); table->control[slot] != 0; slot = (slot + 1) & table->mask)
+		;
+	table->keys[slot] = key;
+	table->data[slot] = data;
+	table->control[slot] = UIDControl(hash);
+}
 
-//	Do level 2 lookup
+//	grow builds a table twice the size while lookups carry on using the current one, then
+//	switches to it. Must be called with m_lock held.
 
-	L3 = (void **)L2[indexL2];
-	if (L3 == NULL)
-		return;
+void FastUIDLookup::grow()
+{
+	FUL_TABLE *table = allocTable(m_table->size * 2);
 
-//	Clear data pointer
+	for (int slot = 0; slot < m_table->size; slot++) {
+		if (m_table->control[slot] != 0)
+			insert(table, m_table->keys[slot], m_table->data[slot]);
+	}
 
-	L3[indexL3] = NULL;
+	m_sequence.fetchAndAddOrdered(1);
+	m_retiredTables.append(m_table);						// a lookup may still be using it
+	m_table = table;
+	m_sequence.fetchAndAddOrdered(1);
 }
-
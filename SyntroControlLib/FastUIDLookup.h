@@ -20,6 +20,26 @@
 #ifndef FASTUIDLOOKUP_H
 #define FASTUIDLOOKUP_H
 
+//	FastUIDLookup maps UIDs to data pointers using an open addressed hash table keyed on the
+//	UID as a 64 bit integer. Each slot has a control byte holding part of the key's hash so
+//	most probes never need to look at the key itself. Memory used is proportional to the
+//	number of entries.
+//
+//	Lookups don't take a lock. Adds and deletes make a sequence count odd while they change
+//	the table and a lookup that sees the count change is retried. Tables replaced as the
+//	lookup grows are kept until destruction as a lookup may still be reading one.
+
+#define	FUL_INITIAL_SIZE	64								// slots in the first table (must be a power of 2)
+
+typedef struct
+{
+	int size;												// number of slots - a power of 2
+	int mask;												// size - 1
+	unsigned char *control;									// 0 if the slot is free else 0x80 + 7 bits of the hash
+	quint64 *keys;											// the UIDs
+	void **data;											// and their data pointers
+} FUL_TABLE;
+
 class FastUIDLookup
 {
 
@@ -32,17 +52,22 @@ public:
 
 	//	Fast UID Lookup functions and variables
 
-#define	FUL_LEVEL_SIZE		0x10000							// 16 bits of lookup per array
-
 public:
 	void *FULLookup(SYNTRO_UID *UID);						// looks up a UID and returns the data pointer, NULL if not found
 	void FULAdd(SYNTRO_UID *UID, void *data);				// adds a UID to the fast lookup system
 	void FULDelete(SYNTRO_UID *UID);						// deletes a UID from the fast lookup system
+	int FULCount();											// the number of UIDs in the table
 
 protected:
-	void *FULLevel0[FUL_LEVEL_SIZE];						// the level 0 array
-	QMutex m_lock;											// to ensure consistency
+	FUL_TABLE *allocTable(int size);
+	void insert(FUL_TABLE *table, quint64 key, void *data);	// key must not be in the table
+	void grow();
+
+	FUL_TABLE *m_table;										// the current table
+	int m_count;											// entries in m_table
+	QAtomicInt m_sequence;									// odd while the table is being changed
+	QList<FUL_TABLE *> m_retiredTables;						// tables replaced by grow
+	QMutex m_lock;											// serializes adds and deletes
 };
 
 #endif // FASTUIDLOOKUP_h
-
@@ -24,21 +24,35 @@
 
 MulticastManager::MulticastManager(void)
 {
-	int		i;
-
 	m_logTag = "MulticastManager";
-	for (i = 0; i < SYNTROSERVER_MAX_MMAPS; i++) {
-		memset(m_multicastMap+i, 0, sizeof(MM_MMAP));
-		m_multicastMap[i].index = i;
-		m_multicastMap[i].valid = false;
-		m_multicastMap[i].head = NULL;
-	}
-	m_multicastMapSize = 0;
 	m_lastBackground = SyntroClock();
+	m_groupSock = NULL;
+	m_groupBase = 0;
+	m_groupPort = SYNTRO_SOCKET_MULTICAST_GROUP;
+	m_bestEffortSock = NULL;
+	m_bestEffortPort = 0;
+	m_sendWindowMin = SYNTRO_MAX_WINDOW;
+	m_sendWindowMax = SYNTRO_WINDOW_MAX;
+	m_recordFilter = false;
+	m_cache = false;
+	m_portMaps.fill(NULL, MM_PORTS);
+	m_nextPort = 0;
 }
 
 MulticastManager::~MulticastManager(void)
 {
+	MM_MMAP *multicastMap;
+
+	for (int i = 0; i < m_multicastMaps.count(); i++) {
+		multicastMap = m_multicastMaps[i];
+		for (int j = 0; j < multicastMap->registeredCount; j++)
+			setPending(multicastMap->registrations + j, NULL);
+		freeGroupCache(multicastMap);
+		clearCache(multicastMap);
+		free(multicastMap->cache);
+		free(multicastMap->registrations);
+		free(multicastMap);
+	}
 }
 
 
@@ -52,8 +66,20 @@ void MulticastManager::MMShutdown()
 {
 	int		i;
 
-	for (i = 0; i < SYNTROSERVER_MAX_MMAPS; i++)
-		MMFreeMMap(m_multicastMap+i);
+	for (i = 0; i < m_multicastMaps.count(); i++)
+		MMFreeMMap(m_multicastMaps[i]);
+}
+
+MM_MMAP *MulticastManager::MMGetMMap(int port)
+{
+	MM_MMAP *multicastMap;
+
+	if ((port < 0) || (port >= MM_PORTS))
+		return NULL;
+	multicastMap = m_portMaps[port];
+	if ((multicastMap == NULL) || !multicastMap->valid)
+		return NULL;										// not in use - may be a stale port
+	return multicastMap;
 }
 
 bool MulticastManager::MMAddRegistered(MM_MMAP *multicastMap, SYNTRO_UID *UID, int port)
@@ -66,20 +92,47 @@ bool MulticastManager::MMAddRegistered(MM_MMAP *multicastMap, SYNTRO_UID *UID, i
 		return false;
 	}
 
-	//	build REGISTEREDCOMPONENT for new registration
+	//	build REGISTEREDCOMPONENT for new registration at the end of the array
 
-	registeredComponent = (MM_REGISTEREDCOMPONENT *)malloc(sizeof(MM_REGISTEREDCOMPONENT));
+	if (multicastMap->registeredCount == multicastMap->registeredSize) {
+		multicastMap->registeredSize = (multicastMap->registeredSize == 0) ? MM_REGISTERED_INITIAL : multicastMap->registeredSize * 2;
+		multicastMap->registrations = (MM_REGISTEREDCOMPONENT *)realloc(multicastMap->registrations,
+					multicastMap->registeredSize * sizeof(MM_REGISTEREDCOMPONENT));
+	}
+	registeredComponent = multicastMap->registrations + multicastMap->registeredCount++;
 	registeredComponent->sendSeq = 0;
 	registeredComponent->lastAckSeq = 0;
+	SyntroUtils::sendWindowInit(&registeredComponent->sendWindow, m_sendWindowMin, m_sendWindowMax);
 	memcpy(&(registeredComponent->registeredUID), UID, sizeof(SYNTRO_UID));
 	registeredComponent->port = port;
+	registeredComponent->groupState = MM_GROUP_NONE;
+	registeredComponent->groupRepair = false;
+	registeredComponent->bestEffort = false;
+	registeredComponent->bestEffortSeq = 0;
+	registeredComponent->pending = NULL;
+	registeredComponent->conflated = 0;
+	registeredComponent->waitRefresh = false;
+	registeredComponent->dropped = 0;
+	registeredComponent->replay = false;
+	registeredComponent->replayNext = -1;
+	if ((multicastMap->cache != NULL) && (multicastMap->cache->count > 0)) {
+		registeredComponent->replay = true;
+		if (!m_cacheReplays.contains(multicastMap->index))
+			m_cacheReplays.append(multicastMap->index);
+	}
 
-	//	Now safe to link in the new one
+	//	Components directly connected to this SyntroControl that can use groups are offered one
+	//	once the lookup response has been sent
+
+	if ((m_groupSock != NULL) && m_server->isGroupCapable(UID)) {
+		registeredComponent->groupState = MM_GROUP_OFFER;
+		if (!m_groupOffers.contains(multicastMap->index))
+			m_groupOffers.append(multicastMap->index);
+	}
 
-	registeredComponent->next = multicastMap->head;
-	multicastMap->head = registeredComponent;
 	multicastMap->lastLookupRefresh = SyntroClock();		// don't time it out straightaway
 	sendLookupRequest(multicastMap, true);					// make sure there's a lookup request for the service
+	updateRefresh(multicastMap);
 	emit MMRegistrationChanged(multicastMap->index);
 	return true;									
 }
@@ -87,130 +140,119 @@ bool MulticastManager::MMAddRegistered(MM_MMAP *multicastMap, SYNTRO_UID *UID, i
 
 bool	MulticastManager::MMCheckRegistered(MM_MMAP *multicastMap, SYNTRO_UID *UID, int port)
 {
-	MM_REGISTEREDCOMPONENT	*registeredComponent;
-
 	QMutexLocker locker(&m_lock);
 
 	if (!multicastMap->valid) {
 		logError("Invalid MMAP referenced in CheckRegistered");
 		return false;
 	}
-	registeredComponent = multicastMap->head;
-	while (registeredComponent != NULL) {
-		if (SyntroUtils::compareUID(UID, &(registeredComponent->registeredUID)) && (registeredComponent->port == port)) {
-			multicastMap->lastLookupRefresh = SyntroClock();// somebody still wants it
-			return true;								// it is there
-		}
-		registeredComponent = registeredComponent->next;
-	}
-	return false;										// not found
+	if (findRegistered(multicastMap, UID, port) == NULL)
+		return false;									// not found
+	multicastMap->lastLookupRefresh = SyntroClock();	// somebody still wants it
+	return true;										// it is there
 }
 
 void MulticastManager::MMDeleteRegistered(SYNTRO_UID *UID, int port)
 {
-	MM_REGISTEREDCOMPONENT *registeredComponent, *previousRegisteredComponent, *deletedRegisteredComponent;
-	int i;
+	MM_REGISTEREDCOMPONENT *registeredComponent;
+	int i, index;
 	MM_MMAP *multicastMap;
 
 	QMutexLocker locker(&m_lock);
-	multicastMap = m_multicastMap;
 
-	for (i = 0; i < m_multicastMapSize; i++, multicastMap++) {
+	for (i = 0; i < m_multicastMaps.count(); i++) {
+		multicastMap = m_multicastMaps[i];
 		if (!multicastMap->valid)
 			continue;
-		registeredComponent = multicastMap->head;
-		previousRegisteredComponent = NULL;
-		while (registeredComponent != NULL) {
+		index = 0;
+		while (index < multicastMap->registeredCount) {
+			registeredComponent = multicastMap->registrations + index;
 			if (SyntroUtils::compareUID(UID, &(registeredComponent->registeredUID))) {
 				if ((port == -1) || (port == registeredComponent->port)) {	// this is a matched entry
 					TRACE3("Deleting multicast registration on %s port %d for %s",
 						qPrintable(SyntroUtils::displayUID(&registeredComponent->registeredUID)), registeredComponent->port, 
 							qPrintable(SyntroUtils::displayUID(UID)))
-					if (previousRegisteredComponent == NULL) {	// its the head of the list
-						multicastMap->head = registeredComponent->next;
-					} else {								// not the head so relink around
-						previousRegisteredComponent->next = registeredComponent->next;
-					}
-					deletedRegisteredComponent = registeredComponent;
-					registeredComponent = registeredComponent->next;
-					free(deletedRegisteredComponent);
+					leaveGroup(multicastMap, registeredComponent);
+					removeRegistered(multicastMap, index);	// the next one moves down into index
+					updateRefresh(multicastMap);
 					emit MMRegistrationChanged(multicastMap->index);
 					continue;
 				}
 			}
-			previousRegisteredComponent = registeredComponent;
-			registeredComponent = registeredComponent->next;
+			index++;
 		}
 	}
 }
 
 
-void	MulticastManager::MMForwardMulticastMessage(int cmd, SYNTRO_MESSAGE *message, int len)
+void	MulticastManager::MMForwardMulticastMessage(int cmd, SYNTRO_MESSAGE *message, int len, bool ack)
 {
 	MM_REGISTEREDCOMPONENT *registeredComponent;
-	SYNTRO_EHEAD *inEhead, *outEhead, *ackEhead;
-	unsigned char *msgCopy;
+	SYNTRO_EHEAD *inEhead, *ackEhead;
+	SyntroSharedBuffer *payload;
 	int multicastMapIndex;
 	MM_MMAP *multicastMap;
+	int index;
+	int recordClass;
 
 	QMutexLocker locker (&m_lock);
 	inEhead = (SYNTRO_EHEAD *)message;
-	multicastMapIndex = SyntroUtils::convertUC2ToUInt(inEhead->destPort);	// get the dest port number (i.e. my slot number)
-	if (multicastMapIndex >= m_multicastMapSize) {
-		logWarn(QString("Multicast message with illegal DPort %1").arg(multicastMapIndex));
-		return;										
-	}
-	multicastMap = m_multicastMap + multicastMapIndex;		// get pointer to entry
-	if (!multicastMap->valid) {
-		logWarn(QString("Multicast message on not in use map slot %1").arg(multicastMap->index));
-		return;										// not in use - hmmm. Should not happen!
-	}
 	if (len < (int)sizeof(SYNTRO_EHEAD)) {
 		logWarn(QString("Multicast message is too short %1").arg(len));
+		free(message);
 		return;										
 	}
+	multicastMapIndex = SyntroUtils::convertUC2ToUInt(inEhead->destPort);	// get the dest port number (i.e. my map's port)
+	if ((multicastMap = MMGetMMap(multicastMapIndex)) == NULL) {
+		logWarn(QString("Multicast message on not in use map port %1").arg(multicastMapIndex));
+		free(message);
+		return;										// not in use or stale - hmmm. Should not happen!
+	}
 	if (!SyntroUtils::compareUID(&(multicastMap->sourceUID), &(inEhead->sourceUID))) {
 		logWarn(QString("UID %1 of incoming multicast didn't match UID of slot %2")
 			.arg(SyntroUtils::displayUID(&inEhead->sourceUID)).arg(SyntroUtils::displayUID(&multicastMap->sourceUID)));
-
+		free(message);
 		return;
 	}
 	qint64 now = SyntroClock();
 	m_server->m_multicastIn++;
 	m_server->m_multicastInRate++;
 
-	registeredComponent = multicastMap->head;
-	while (registeredComponent != NULL) {
-		if (!SyntroUtils::isSendOK(registeredComponent->sendSeq, registeredComponent->lastAckSeq)) {	// see if we have timed out waiting for ack
-			if (!SyntroUtils::syntroTimerExpired(now, registeredComponent->lastSendTime, EXCHANGE_TIMEOUT)){
-				registeredComponent = registeredComponent->next;
-				continue;							// not yet long enough to declare a timeout
-			} else {
-				registeredComponent->lastAckSeq = registeredComponent->sendSeq;
-				logWarn(QString("WFAck timeout on %1").arg(SyntroUtils::displayUID(&registeredComponent->registeredUID)));
-			}
+	//	The payload after the SYNTRO_EHEAD is the same for every subscriber so it is shared between
+	//	all the SyntroLinks rather than copied. Each subscriber just gets its own SYNTRO_EHEAD.
+	//	The buffer is freed when the last SyntroLink has finished with it.
+
+	payload = new SyntroSharedBuffer((unsigned char *)message, len);
+	recordClass = multicastMap->video ? classifyRecord(payload) : MM_RECORD_OTHER;
+	if (m_cache)
+		updateCache(multicastMap, payload, recordClass);
+
+	for (index = 0; index < multicastMap->registeredCount; index++) {
+		registeredComponent = multicastMap->registrations + index;
+		if (registeredComponent->groupState == MM_GROUP_MEMBER)
+			continue;								// gets it from the group
+		if (registeredComponent->bestEffort && sendBestEffort(multicastMap, registeredComponent, inEhead, len))
+			continue;								// no ack expected
+		if (registeredComponent->replay || (registeredComponent->replayNext >= 0)) {
+			if (!registeredComponent->replay)
+				sendReplay(multicastMap, registeredComponent, now);	// this message is sent from the cache
+			continue;
 		}
-		msgCopy = (unsigned char *)malloc(len);
-		memcpy(msgCopy, message, len);
-		outEhead = (SYNTRO_EHEAD *)msgCopy;
-		SyntroUtils::convertIntToUC2(registeredComponent->port, outEhead->destPort);// this is the receiver's service index that was requested
-		SyntroUtils::convertIntToUC2(multicastMapIndex, outEhead->sourcePort);					// this is my slot number (needed for the ack)
-		outEhead->destUID = registeredComponent->registeredUID;
-		outEhead->sourceUID = multicastMap->sourceUID;
-		outEhead->seq = registeredComponent->sendSeq;
-		registeredComponent->sendSeq++;
-		TRACE2("Forwarding mcast from component %s to %s",
-				qPrintable(SyntroUtils::displayUID(&outEhead->sourceUID)), qPrintable(SyntroUtils::displayUID(&registeredComponent->registeredUID)));
-		m_server->sendSyntroMessage(&(registeredComponent->registeredUID), cmd, (SYNTRO_MESSAGE *)msgCopy, 
-					len, SYNTROLINK_LOWPRI);
-		m_server->m_multicastOut++;
-		m_server->m_multicastOutRate++;
-		registeredComponent->lastSendTime = now;
-		registeredComponent = registeredComponent->next;
+		if (!registeredComponent->bestEffort && multicastMap->recordFilter && (recordClass != MM_RECORD_OTHER) &&
+				!filterRecord(multicastMap, registeredComponent, cmd, payload, recordClass, now))
+			continue;								// dropped or sent already
+		if (!windowOpen(registeredComponent, now)) {	// also for best effort messages too big for a datagram
+			if (multicastMap->conflate)
+				setPending(registeredComponent, payload);	// keep the newest for when the window opens
+			continue;
+		}
+		if (registeredComponent->pending != NULL)
+			setPending(registeredComponent, NULL);	// this one is newer
+		sendRegistered(multicastMap, registeredComponent, cmd, payload, now);
 	}
 
 	// send an ACK unless the recipient is us
-	if (!SyntroUtils::compareUID(&m_myUID, &multicastMap->sourceUID)) {
+	if (ack && !SyntroUtils::compareUID(&m_myUID, &multicastMap->sourceUID)) {
 		ackEhead = (SYNTRO_EHEAD *)malloc(sizeof(SYNTRO_EHEAD));
 		ackEhead->sourceUID = m_myUID;
 		ackEhead->destUID = multicastMap->sourceUID;
@@ -223,6 +265,9 @@ void	MulticastManager::MMForwardMulticastMessage(int cmd, SYNTRO_MESSAGE *messag
 			logWarn(QString("Failed mcast ack to %1").arg(SyntroUtils::displayUID(&multicastMap->prevHopUID)));
 		}
 	}
+	if (multicastMap->groupMembers > 0)
+		sendGroupMessage(multicastMap, payload);	// one copy for all the group members
+	payload->release();								// release my reference (may free the message)
 }
 
 
@@ -238,14 +283,9 @@ void	MulticastManager::MMProcessMulticastAck(SYNTRO_EHEAD *ehead, int len)
 	}
 
 	slot = SyntroUtils::convertUC2ToUInt(ehead->destPort);					// get the port number
-	if (slot >= m_multicastMapSize) {
-		logWarn(QString("Invalid dest port %1 for multicast ack from %2").arg(slot).arg(SyntroUtils::displayUID(&ehead->sourceUID)));
-		return;
-	}
 	QMutexLocker locker(&m_lock);
 
-	multicastMap = m_multicastMap + slot;
-	if (!multicastMap->valid)
+	if ((multicastMap = MMGetMMap(slot)) == NULL)
 		return;									// probably disconnected or something
 	if (!SyntroUtils::compareUID(&(multicastMap->sourceUID), &(ehead->destUID))) {
 		logWarn(QString("Multicast ack dest %1 doesn't match source %2")
@@ -255,22 +295,60 @@ void	MulticastManager::MMProcessMulticastAck(SYNTRO_EHEAD *ehead, int len)
 		return;
 	}
 
-	registeredComponent = multicastMap->head;
-	while (registeredComponent != NULL) {
-		if (SyntroUtils::compareUID(&(ehead->sourceUID), &(registeredComponent->registeredUID)) && 
-					(SyntroUtils::convertUC2ToInt(ehead->sourcePort) == registeredComponent->port)) {
-			TRACE2("\nMatched ack from remote component %s port %d", 
-					qPrintable(SyntroUtils::displayUID(&ehead->sourceUID)), registeredComponent->port);
-			registeredComponent->lastAckSeq = ehead->seq;
-			return;
+	registeredComponent = findRegistered(multicastMap, &(ehead->sourceUID), SyntroUtils::convertUC2ToInt(ehead->sourcePort));
+	if (registeredComponent != NULL) {
+		TRACE2("\nMatched ack from remote component %s port %d", 
+				qPrintable(SyntroUtils::displayUID(&ehead->sourceUID)), registeredComponent->port);
+		qint64 now = SyntroClock();
+		if ((unsigned char)(registeredComponent->sendSeq - ehead->seq) >
+					(unsigned char)(registeredComponent->sendSeq - registeredComponent->lastAckSeq))
+			return;									// older than a datagram sent since
+		SyntroUtils::sendWindowAcked(&registeredComponent->sendWindow, registeredComponent->lastAckSeq, ehead->seq, now);
+		registeredComponent->lastAckSeq = ehead->seq;
+		if (registeredComponent->replayNext >= 0)
+			sendReplay(multicastMap, registeredComponent, now);
+		else if ((registeredComponent->pending != NULL) && SyntroUtils::sendWindowOpen(&registeredComponent->sendWindow,
+					registeredComponent->sendSeq, registeredComponent->lastAckSeq)) {
+			sendRegistered(multicastMap, registeredComponent, SYNTROMSG_MULTICAST_MESSAGE, registeredComponent->pending, now);
+			setPending(registeredComponent, NULL);
 		}
-		registeredComponent = registeredComponent->next;
+		return;
 	}
 
 	logWarn(QString("Failed to match ack from %1 port %2").arg(SyntroUtils::displayUID(&ehead->sourceUID))
 		.arg(SyntroUtils::convertUC2ToInt(ehead->sourcePort)));
 }
 
+void	MulticastManager::MMProcessMulticastAcks(SYNTRO_MULTICAST_ACKS *acks, int len)
+{
+	SYNTRO_MULTICAST_ACK_ENTRY *entry;
+	SYNTRO_EHEAD ehead;
+	int count;
+
+	if (len < (int)sizeof(SYNTRO_MULTICAST_ACKS)) {
+		logWarn(QString("Multicast ack batch is too short %1").arg(len));
+		return;
+	}
+	count = SyntroUtils::convertUC2ToInt(acks->count);
+	if (len != (int)(sizeof(SYNTRO_MULTICAST_ACKS) + count * sizeof(SYNTRO_MULTICAST_ACK_ENTRY))) {
+		logWarn(QString("Multicast ack batch of %1 has wrong length %2").arg(count).arg(len));
+		return;
+	}
+
+	//	Each entry is handled as the ack it replaces
+
+	memset(&ehead, 0, sizeof(SYNTRO_EHEAD));
+	ehead.sourceUID = acks->sourceUID;
+	entry = (SYNTRO_MULTICAST_ACK_ENTRY *)(acks + 1);
+	for (int i = 0; i < count; i++, entry++) {
+		ehead.destUID = entry->destUID;
+		SyntroUtils::copyUC2(ehead.sourcePort, entry->sourcePort);
+		SyntroUtils::copyUC2(ehead.destPort, entry->destPort);
+		ehead.seq = entry->seq;
+		MMProcessMulticastAck(&ehead, sizeof(SYNTRO_EHEAD));
+	}
+}
+
 
 
 MM_MMAP	*MulticastManager::MMAllocateMMap(SYNTRO_UID *prevHopUID, SYNTRO_UID *sourceUID, 
@@ -280,29 +358,49 @@ MM_MMAP	*MulticastManager::MMAllocateMMap(SYNTRO_UID *prevHopUID, SYNTRO_UID *so
 	MM_MMAP *multicastMap;
 
 	QMutexLocker locker(&m_lock);
-	multicastMap = m_multicastMap;
-	for (i = 0; i < SYNTROSERVER_MAX_MMAPS; i++, multicastMap++) {
-		if (!multicastMap->valid)
-			break;
-	}
-	if (i == SYNTROSERVER_MAX_MMAPS) {
-		logError("No more multicast maps");
-		return NULL;
+	if (!m_freeSlots.isEmpty()) {
+		multicastMap = m_multicastMaps[m_freeSlots.dequeue()];	// reuse the oldest free slot
+	} else {
+		if (m_multicastMaps.count() == SYNTROSERVER_MAX_MMAPS) {
+			logError("No more multicast maps");
+			return NULL;
+		}
+		multicastMap = (MM_MMAP *)calloc(1, sizeof(MM_MMAP));	// grow the table
+		multicastMap->slot = m_multicastMaps.count();
+		SyntroTimerWheel::initTimer(&(multicastMap->refreshTimer), multicastMap->slot, multicastMap);
+		m_multicastMaps.append(multicastMap);
 	}
-	if (i >= m_multicastMapSize)
-		m_multicastMapSize = i+1;							// update the in use map array size
-	multicastMap->head = NULL;
+	while (m_portMaps[m_nextPort] != NULL)
+		m_nextPort = (m_nextPort + 1) % MM_PORTS;			// always a free one as there are more ports than maps
+	multicastMap->index = m_nextPort;
+	m_portMaps[m_nextPort] = multicastMap;
+	m_nextPort = (m_nextPort + 1) % MM_PORTS;
+	i = multicastMap->index;
+	multicastMap->registeredCount = 0;
 	multicastMap->valid = true;
 	multicastMap->prevHopUID = *prevHopUID;					// this is the previous hop UID for the service (i.e. where the data comes from)
 	multicastMap->sourceUID = *sourceUID;					// this is the original source of the stream
 	sprintf(multicastMap->serviceLookup.servicePath, "%s%c%s", componentName, SYNTRO_SERVICEPATH_SEP, serviceName);
 	SyntroUtils::convertIntToUC2(port, multicastMap->serviceLookup.remotePort);// this is the target port (the service port)
-	SyntroUtils::convertIntToUC2(i, multicastMap->serviceLookup.localPort);	// this is the index into the MMap array
+	SyntroUtils::convertIntToUC2(i, multicastMap->serviceLookup.localPort);	// this is the port of the map
 	multicastMap->serviceLookup.response = SERVICE_LOOKUP_FAIL;// indicate lookup response not valid
 	multicastMap->serviceLookup.serviceType = SERVICETYPE_MULTICAST;// indicate multicast
 	multicastMap->registered = false;						// indicate not registered
+	multicastMap->conflate = m_conflateServices.contains(serviceName, Qt::CaseInsensitive) ||
+				m_conflateServices.contains(multicastMap->serviceLookup.servicePath, Qt::CaseInsensitive);
+	multicastMap->video = QString(serviceName).startsWith(SYNTRO_STREAMNAME_AVMUX, Qt::CaseInsensitive) ||
+				QString(serviceName).startsWith(SYNTRO_STREAMNAME_VIDEO, Qt::CaseInsensitive);
+	multicastMap->recordFilter = m_recordFilter && multicastMap->video;
+	multicastMap->refreshSeen = false;
 	multicastMap->lookupSent = SyntroClock();				// not important until something registered on it
-	TRACE3("Added %s from slot %d to multicast table in slot %d", serviceName, port, i);	
+	multicastMap->groupMembers = 0;
+	multicastMap->groupRepairMembers = 0;
+	multicastMap->groupSeq = 0;
+	multicastMap->groupCache = NULL;
+	multicastMap->cache = NULL;
+	multicastMap->bestEffortUpstream = false;
+	memset(&(multicastMap->bestEffortRX), 0, sizeof(SYNTRO_BESTEFFORT_RX));
+	TRACE3("Added %s from slot %d to multicast table on port %d", serviceName, port, i);	
 	emit MMNewEntry(i);
 	return multicastMap;
 }
@@ -316,14 +414,26 @@ void MulticastManager::MMFreeMMap(MM_MMAP *multicastMap)
 		return;
 	emit MMDeleteEntry(multicastMap->index);
 	multicastMap->valid = false;
-	while (multicastMap->head != NULL) {
-		registeredComponent = multicastMap->head;
+	for (int i = 0; i < multicastMap->registeredCount; i++) {
+		registeredComponent = multicastMap->registrations + i;
 		TRACE3("Freeing MMap %s, component %s port %d", 
 			multicastMap->serviceLookup.servicePath,
 			qPrintable(SyntroUtils::displayUID(&registeredComponent->registeredUID)), registeredComponent->port);
-		multicastMap->head = registeredComponent->next;
-		free(registeredComponent);
+		setPending(registeredComponent, NULL);
 	}
+	free(multicastMap->registrations);
+	multicastMap->registrations = NULL;
+	multicastMap->registeredCount = 0;
+	multicastMap->registeredSize = 0;
+	updateRefresh(multicastMap);
+	freeGroupCache(multicastMap);
+	clearCache(multicastMap);
+	free(multicastMap->cache);
+	multicastMap->cache = NULL;
+	multicastMap->groupMembers = 0;
+	multicastMap->groupRepairMembers = 0;
+	m_portMaps[multicastMap->index] = NULL;
+	m_freeSlots.enqueue(multicastMap->slot);
 }
 
 
@@ -337,19 +447,13 @@ void	MulticastManager::MMProcessLookupResponse(SYNTRO_SERVICE_LOOKUP *serviceLoo
 		return;			
 	}
 	index = SyntroUtils::convertUC2ToUInt(serviceLookup->localPort);		// get the local port
-	if (index >= m_multicastMapSize) {
-		logWarn(QString("Lookup response from %1 port %2 to incorrect local port %3")
-			.arg(SyntroUtils::displayUID(&serviceLookup->lookupUID))
-			.arg(SyntroUtils::convertUC2ToInt(serviceLookup->remotePort))
-			.arg(SyntroUtils::convertUC2ToInt(serviceLookup->localPort)));
-
-		return;
-	}
 
 	QMutexLocker locker(&m_lock);
-	multicastMap = m_multicastMap + index;
-	if (!multicastMap->valid) {
-		logWarn(QString("Lookup response to unused local mmap from %1").arg(serviceLookup->servicePath));
+	if ((multicastMap = MMGetMMap(index)) == NULL) {
+		logWarn(QString("Lookup response from %1 port %2 to unused local mmap port %3 for %4")
+			.arg(SyntroUtils::displayUID(&serviceLookup->lookupUID))
+			.arg(SyntroUtils::convertUC2ToInt(serviceLookup->remotePort))
+			.arg(index).arg(serviceLookup->servicePath));
 		return;
 	}
 
@@ -377,14 +481,264 @@ void	MulticastManager::MMProcessLookupResponse(SYNTRO_SERVICE_LOOKUP *serviceLoo
 		multicastMap->serviceLookup = *serviceLookup;		// record data
 	}
 	multicastMap->registered = true;
+	updateBestEffortUpstream(multicastMap);
 	emit MMDisplay();
 }
 
 
+void MulticastManager::MMInitGroups(SyntroSocket *sock, quint32 groupBase, int groupPort)
+{
+	QMutexLocker locker(&m_lock);
+	m_groupSock = sock;
+	m_groupBase = groupBase;
+	m_groupPort = groupPort;
+}
+
+void MulticastManager::MMSendGroupOffers()
+{
+	MM_MMAP *multicastMap;
+	MM_REGISTEREDCOMPONENT *registeredComponent;
+	SYNTRO_MULTICAST_GROUP *groupOffer;
+	QByteArray group;
+
+	QMutexLocker locker(&m_lock);
+	while (!m_groupOffers.isEmpty()) {
+		if ((multicastMap = MMGetMMap(m_groupOffers.takeFirst())) == NULL)
+			continue;
+		group = groupAddress(multicastMap->slot).toLatin1();
+		for (int i = 0; i < multicastMap->registeredCount; i++) {
+			registeredComponent = multicastMap->registrations + i;
+			if (registeredComponent->groupState != MM_GROUP_OFFER)
+				continue;
+			groupOffer = (SYNTRO_MULTICAST_GROUP *)malloc(sizeof(SYNTRO_MULTICAST_GROUP));
+			memset(groupOffer, 0, sizeof(SYNTRO_MULTICAST_GROUP));
+			groupOffer->ehead.sourceUID = m_myUID;
+			groupOffer->ehead.destUID = registeredComponent->registeredUID;
+			SyntroUtils::convertIntToUC2(multicastMap->index, groupOffer->ehead.sourcePort);
+			SyntroUtils::convertIntToUC2(registeredComponent->port, groupOffer->ehead.destPort);
+			SyntroUtils::convertIPStringToIPAddr(group.data(), groupOffer->groupAddr);
+			SyntroUtils::convertIntToUC2(m_groupPort, groupOffer->groupPort);
+			groupOffer->request = SYNTRO_MULTICAST_GROUP_OFFER;
+			registeredComponent->groupState = MM_GROUP_OFFERED;
+			TRACE3("Offering group %s for %s to %s", group.data(), multicastMap->serviceLookup.servicePath,
+				qPrintable(SyntroUtils::displayUID(&registeredComponent->registeredUID)));
+			m_server->sendSyntroMessage(&(registeredComponent->registeredUID), SYNTROMSG_MULTICAST_GROUP,
+				(SYNTRO_MESSAGE *)groupOffer, sizeof(SYNTRO_MULTICAST_GROUP), SYNTROLINK_MEDHIGHPRI);
+		}
+	}
+}
+
+void MulticastManager::MMSendCached()
+{
+	MM_MMAP *multicastMap;
+	MM_REGISTEREDCOMPONENT *registeredComponent;
+	qint64 now = SyntroClock();
+
+	QMutexLocker locker(&m_lock);
+	while (!m_cacheReplays.isEmpty()) {
+		if ((multicastMap = MMGetMMap(m_cacheReplays.takeFirst())) == NULL)
+			continue;
+		for (int i = 0; i < multicastMap->registeredCount; i++) {
+			registeredComponent = multicastMap->registrations + i;
+			if (!registeredComponent->replay)
+				continue;
+			registeredComponent->replay = false;
+			if (multicastMap->cache == NULL)
+				continue;
+			TRACE3("Sending %d cached messages for %s to %s", multicastMap->cache->count, multicastMap->serviceLookup.servicePath,
+				qPrintable(SyntroUtils::displayUID(&registeredComponent->registeredUID)));
+			registeredComponent->replayNext = 0;
+			sendReplay(multicastMap, registeredComponent, now);
+		}
+	}
+}
+
+void MulticastManager::MMProcessGroupRequest(SYNTRO_MULTICAST_GROUP *groupRequest, int len)
+{
+	MM_MMAP *multicastMap;
+	MM_REGISTEREDCOMPONENT *registeredComponent;
+	int slot;
+	int port;
+
+	if (len != (int)sizeof(SYNTRO_MULTICAST_GROUP)) {
+		logWarn(QString("Multicast group request wrong size %1").arg(len));
+		return;
+	}
+	slot = SyntroUtils::convertUC2ToUInt(groupRequest->ehead.destPort);
+	port = SyntroUtils::convertUC2ToInt(groupRequest->ehead.sourcePort);
+
+	QMutexLocker locker(&m_lock);
+	if ((multicastMap = MMGetMMap(slot)) == NULL)
+		return;										// probably just been removed
+	if ((registeredComponent = findRegistered(multicastMap, &(groupRequest->ehead.sourceUID), port)) == NULL) {
+		TRACE2("Multicast group request from unregistered %s port %d",
+			qPrintable(SyntroUtils::displayUID(&groupRequest->ehead.sourceUID)), port);
+		return;
+	}
+
+	switch (groupRequest->request) {
+		case SYNTRO_MULTICAST_GROUP_JOIN:
+		case SYNTRO_MULTICAST_GROUP_JOIN_REPAIR:
+			if (registeredComponent->groupState == MM_GROUP_MEMBER)
+				leaveGroup(multicastMap, registeredComponent);	// may be changing repair mode
+			registeredComponent->groupState = MM_GROUP_MEMBER;
+			setPending(registeredComponent, NULL);			// the group will have newer ones
+			registeredComponent->replay = false;
+			registeredComponent->replayNext = -1;
+			registeredComponent->groupRepair = groupRequest->request == SYNTRO_MULTICAST_GROUP_JOIN_REPAIR;
+			multicastMap->groupMembers++;
+			if (registeredComponent->groupRepair) {
+				multicastMap->groupRepairMembers++;
+				if (multicastMap->groupCache == NULL) {
+					multicastMap->groupCache = (MM_GROUPCACHE *)malloc(sizeof(MM_GROUPCACHE));
+					memset(multicastMap->groupCache, 0, sizeof(MM_GROUPCACHE));
+				}
+			}
+			logDebug(QString("%1 port %2 joined group for %3")
+				.arg(SyntroUtils::displayUID(&registeredComponent->registeredUID)).arg(port)
+				.arg(multicastMap->serviceLookup.servicePath));
+			emit MMRegistrationChanged(multicastMap->index);
+			break;
+
+		case SYNTRO_MULTICAST_GROUP_REFUSE:
+			leaveGroup(multicastMap, registeredComponent);
+			emit MMRegistrationChanged(multicastMap->index);
+			break;
+
+		case SYNTRO_MULTICAST_GROUP_NACK:
+			if ((registeredComponent->groupState == MM_GROUP_MEMBER) && registeredComponent->groupRepair)
+				sendGroupRepair(multicastMap, registeredComponent, (quint32)SyntroUtils::convertUC4ToInt(groupRequest->seq));
+			break;
+
+		default:
+			logWarn(QString("Unexpected multicast group request %1 from %2")
+				.arg(groupRequest->request).arg(SyntroUtils::displayUID(&groupRequest->ehead.sourceUID)));
+			break;
+	}
+}
+
+void MulticastManager::MMInitBestEffort(SyntroSocket *sock, int port)
+{
+	QMutexLocker locker(&m_lock);
+	m_bestEffortSock = sock;
+	m_bestEffortPort = port;
+}
+
+void MulticastManager::MMInitSendWindow(int minWindow, int maxWindow)
+{
+	QMutexLocker locker(&m_lock);
+	m_sendWindowMin = minWindow;
+	m_sendWindowMax = maxWindow;
+}
+
+void MulticastManager::MMInitConflate(const QStringList& services)
+{
+	QMutexLocker locker(&m_lock);
+	m_conflateServices = services;
+}
+
+void MulticastManager::MMInitRecordFilter(bool enable)
+{
+	QMutexLocker locker(&m_lock);
+	m_recordFilter = enable;
+}
+
+void MulticastManager::MMInitCache(bool enable)
+{
+	QMutexLocker locker(&m_lock);
+	m_cache = enable;
+}
+
+void MulticastManager::MMForwardBestEffort(SYNTRO_UID *senderUID, quint32 seq, SYNTRO_MESSAGE *message, int len)
+{
+	SYNTRO_EHEAD *ehead = (SYNTRO_EHEAD *)message;
+	MM_MMAP *multicastMap;
+	int slot;
+
+	m_lock.lock();
+	slot = SyntroUtils::convertUC2ToUInt(ehead->destPort);
+	multicastMap = MMGetMMap(slot);
+	if ((multicastMap == NULL) || !SyntroUtils::compareUID(&(multicastMap->prevHopUID), senderUID)) {
+		m_lock.unlock();
+		TRACE2("Best effort datagram from %s for slot %d that it doesn't feed", qPrintable(SyntroUtils::displayUID(senderUID)), slot);
+		free(message);
+		return;
+	}
+	if (!SyntroUtils::bestEffortAccept(&(multicastMap->bestEffortRX), seq)) {
+		m_lock.unlock();
+		free(message);
+		return;										// a later one has already been forwarded
+	}
+	m_lock.unlock();
+	MMForwardMulticastMessage(SYNTROMSG_MULTICAST_MESSAGE, message, len, false);
+}
+
+bool MulticastManager::MMProcessBestEffortRequest(SYNTRO_BESTEFFORT *request, const char *addr, quint32 key, quint32 *seq)
+{
+	MM_MMAP *multicastMap;
+	MM_REGISTEREDCOMPONENT *registeredComponent;
+	int slot;
+	int port;
+
+	slot = SyntroUtils::convertUC2ToUInt(request->ehead.destPort);
+	port = SyntroUtils::convertUC2ToInt(request->ehead.sourcePort);
+
+	QMutexLocker locker(&m_lock);
+
+	if (request->request == SYNTRO_BESTEFFORT_ACCEPT) {	// the previous hop has accepted my SUBSCRIBE
+		if ((multicastMap = MMGetMMap(SyntroUtils::convertUC2ToUInt(request->ehead.sourcePort))) == NULL)
+			return false;
+		if (SyntroUtils::compareUID(&(multicastMap->prevHopUID), &(request->ehead.destUID)))
+			SyntroUtils::bestEffortSync(&(multicastMap->bestEffortRX), (quint32)SyntroUtils::convertUC4ToInt(request->seq));
+		return false;
+	}
+
+	if ((multicastMap = MMGetMMap(slot)) == NULL)
+		return false;									// probably just been removed
+	if ((registeredComponent = findRegistered(multicastMap, &(request->ehead.sourceUID), port)) == NULL) {
+		TRACE2("Best effort request from unregistered %s port %d",
+			qPrintable(SyntroUtils::displayUID(&request->ehead.sourceUID)), port);
+		return false;
+	}
+
+	switch (request->request) {
+		case SYNTRO_BESTEFFORT_SUBSCRIBE:
+			if ((m_bestEffortSock == NULL) || (SyntroUtils::convertUC2ToInt(request->udpPort) == 0))
+				return false;
+			if (!registeredComponent->bestEffort)
+				logDebug(QString("%1 port %2 receiving %3 as best effort")
+					.arg(SyntroUtils::displayUID(&registeredComponent->registeredUID)).arg(port)
+					.arg(multicastMap->serviceLookup.servicePath));
+			registeredComponent->bestEffort = true;
+			strncpy(registeredComponent->bestEffortAddr, addr, SYNTRO_IPSTR_LEN - 1);
+			registeredComponent->bestEffortAddr[SYNTRO_IPSTR_LEN - 1] = 0;
+			registeredComponent->bestEffortPort = SyntroUtils::convertUC2ToInt(request->udpPort);
+			registeredComponent->bestEffortKey = key;
+			*seq = registeredComponent->bestEffortSeq;
+			emit MMRegistrationChanged(multicastMap->index);
+			return true;
+
+		case SYNTRO_BESTEFFORT_UNSUBSCRIBE:
+			if (registeredComponent->bestEffort) {
+				registeredComponent->bestEffort = false;
+				registeredComponent->lastAckSeq = registeredComponent->sendSeq;	// open the window again
+				SyntroUtils::sendWindowReset(&registeredComponent->sendWindow);
+				emit MMRegistrationChanged(multicastMap->index);
+			}
+			return false;
+
+		default:
+			logWarn(QString("Unexpected best effort request %1 from %2")
+				.arg(request->request).arg(SyntroUtils::displayUID(&request->ehead.sourceUID)));
+			return false;
+	}
+}
+
+
 void	MulticastManager::MMBackground()
 {
 	MM_MMAP *multicastMap;
-	int index;
+	SYNTRO_TIMER *timer;
 
 	qint64 now = SyntroClock();
 
@@ -394,23 +748,22 @@ void	MulticastManager::MMBackground()
 	m_lastBackground = now;
 	emit MMDisplay();
 	QMutexLocker locker(&m_lock);
-	multicastMap = m_multicastMap;
-	for (index = 0; index < m_multicastMapSize; index++, multicastMap++) {
-		if (!multicastMap->valid)
-			continue;
-		if (SyntroUtils::compareUID(&(multicastMap->sourceUID), &m_myUID))
-			continue;										// don't do anything more for SyntroCOntrol services
-		if (multicastMap->head == NULL)
-			continue;										// no registrations so don't refresh
+
+	//	Only maps that have registrations and aren't SyntroControl services have refresh timers
+
+	while ((timer = m_timerWheel.expired(now)) != NULL) {
+		multicastMap = (MM_MMAP *)timer->context;
 		// Note - this timer check is only if there's a stuck registration for some reason - it
 		// stops continual data transfer when nobody really wants it. Hopefully someone will time the
 		// stuck registration out!
 		if (SyntroUtils::syntroTimerExpired(SyntroClock(), multicastMap->lastLookupRefresh, MULTICAST_REFRESH_TIMEOUT)) {
 			TRACE2("Too long since last incoming lookup request on %s local port %d",
-					qPrintable(SyntroUtils::displayUID(&multicastMap->sourceUID)), index);
+					qPrintable(SyntroUtils::displayUID(&multicastMap->sourceUID)), multicastMap->index);
+			startRefreshTimer(multicastMap, now);
 			continue;										// don't send a lookup request as nobody interested
 		}
 		sendLookupRequest(multicastMap);
+		startRefreshTimer(multicastMap, now);
 	}
 }
 
@@ -455,5 +808,488 @@ void	MulticastManager::sendLookupRequest(MM_MMAP *multicastMap, bool rightNow)
 	multicastMap->lookupSent = now;
 }
 
+//	sendGroupMessage sends a message as fragments to the map's group. The SyntroLink copies only
+//	use the data after the ehead so the ehead in the shared buffer is rewritten for the group.
+//	Each member puts its own port and UID in when the message has been reassembled.
+
+void MulticastManager::sendGroupMessage(MM_MMAP *multicastMap, SyntroSharedBuffer *payload)
+{
+	unsigned char datagram[sizeof(SYNTRO_MULTICAST_DGRAM) + SYNTRO_MULTICAST_DGRAM_DATA];
+	SYNTRO_MULTICAST_DGRAM *header = (SYNTRO_MULTICAST_DGRAM *)datagram;
+	SYNTRO_EHEAD *ehead = (SYNTRO_EHEAD *)payload->data();
+	MM_GROUPCACHE *groupCache;
+	int len = payload->length();
+	int fragCount, fragIndex, fragLen, offset;
+	quint32 seq;
+
+	QByteArray group = groupAddress(multicastMap->slot).toLatin1();
+	seq = multicastMap->groupSeq++;
+
+	SyntroUtils::convertIntToUC2(multicastMap->index, ehead->sourcePort);
+	memset(&(ehead->destUID), 0, sizeof(SYNTRO_UID));
+	ehead->seq = (unsigned char)seq;
+
+	fragCount = (len + SYNTRO_MULTICAST_DGRAM_DATA - 1) / SYNTRO_MULTICAST_DGRAM_DATA;
+	memset(header, 0, sizeof(SYNTRO_MULTICAST_DGRAM));
+	header->controlUID = m_myUID;
+	SyntroUtils::convertIntToUC2(multicastMap->index, header->slot);
+	SyntroUtils::convertIntToUC2(fragCount, header->fragCount);
+	SyntroUtils::convertIntToUC4(seq, header->seq);
+	SyntroUtils::convertIntToUC4(len, header->len);
+
+	for (fragIndex = 0, offset = 0; fragIndex < fragCount; fragIndex++, offset += fragLen) {
+		fragLen = qMin(SYNTRO_MULTICAST_DGRAM_DATA, len - offset);
+		SyntroUtils::convertIntToUC2(fragIndex, header->fragIndex);
+		memcpy(datagram + sizeof(SYNTRO_MULTICAST_DGRAM), payload->data() + offset, fragLen);
+		if (m_groupSock->sockSendTo(datagram, sizeof(SYNTRO_MULTICAST_DGRAM) + fragLen, m_groupPort, group.data())
+					!= (int)sizeof(SYNTRO_MULTICAST_DGRAM) + fragLen) {
+			TRACE2("Group send failed on %s seq %u", group.data(), seq);
+			break;									// the rest of the message is no use to anyone
+		}
+	}
+	m_server->m_multicastOut++;
+	m_server->m_multicastOutRate++;
+
+	if ((groupCache = multicastMap->groupCache) == NULL)
+		return;
+	if (groupCache->message[groupCache->next] != NULL)
+		groupCache->message[groupCache->next]->release();
+	payload->addRef();
+	groupCache->message[groupCache->next] = payload;
+	groupCache->seq[groupCache->next] = seq;
+	groupCache->next = (groupCache->next + 1) % MM_GROUP_REPAIR;
+}
+
+//	sendGroupRepair resends a lost group message over the member's SyntroLink if it's still cached
+
+void MulticastManager::sendGroupRepair(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, quint32 seq)
+{
+	MM_GROUPCACHE *groupCache = multicastMap->groupCache;
+	SyntroSharedBuffer *payload;
+	SYNTRO_EHEAD *outEhead;
+	int i;
+
+	if (groupCache == NULL)
+		return;
+	for (i = 0; i < MM_GROUP_REPAIR; i++) {
+		if ((groupCache->message[i] != NULL) && (groupCache->seq[i] == seq))
+			break;
+	}
+	if (i == MM_GROUP_REPAIR) {
+		TRACE2("Group seq %u on %s too old to repair", seq, multicastMap->serviceLookup.servicePath);
+		return;
+	}
+	payload = groupCache->message[i];
+	outEhead = (SYNTRO_EHEAD *)malloc(sizeof(SYNTRO_EHEAD));
+	memcpy(outEhead, payload->data(), sizeof(SYNTRO_EHEAD));
+	SyntroUtils::convertIntToUC2(registeredComponent->port, outEhead->destPort);
+	outEhead->destUID = registeredComponent->registeredUID;
+	m_server->sendSyntroSharedMessage(&(registeredComponent->registeredUID), SYNTROMSG_MULTICAST_MESSAGE, (SYNTRO_MESSAGE *)outEhead,
+				sizeof(SYNTRO_EHEAD), payload, payload->data() + sizeof(SYNTRO_EHEAD),
+				payload->length() - sizeof(SYNTRO_EHEAD), SYNTROLINK_LOWPRI);
+	m_server->m_multicastOut++;
+	m_server->m_multicastOutRate++;
+}
+
+//	leaveGroup puts a registration back onto its SyntroLink
+
+void MulticastManager::leaveGroup(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent)
+{
+	if (registeredComponent->groupState == MM_GROUP_MEMBER) {
+		multicastMap->groupMembers--;
+		if (registeredComponent->groupRepair) {
+			if (--multicastMap->groupRepairMembers == 0)
+				freeGroupCache(multicastMap);
+		}
+		registeredComponent->lastAckSeq = registeredComponent->sendSeq;	// open the window again
+		SyntroUtils::sendWindowReset(&registeredComponent->sendWindow);
+	}
+	registeredComponent->groupState = MM_GROUP_NONE;
+	registeredComponent->groupRepair = false;
+}
+
+void MulticastManager::freeGroupCache(MM_MMAP *multicastMap)
+{
+	if (multicastMap->groupCache == NULL)
+		return;
+	for (int i = 0; i < MM_GROUP_REPAIR; i++) {
+		if (multicastMap->groupCache->message[i] != NULL)
+			multicastMap->groupCache->message[i]->release();
+	}
+	free(multicastMap->groupCache);
+	multicastMap->groupCache = NULL;
+}
+
+QString MulticastManager::groupAddress(int slot)
+{
+	return QHostAddress(m_groupBase + (quint32)slot).toString();
+}
+
+//	sendBestEffort sends a message to a registration as one datagram. It returns false if the
+//	message has to go over the SyntroLink instead.
+
+bool MulticastManager::sendBestEffort(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, SYNTRO_EHEAD *inEhead, int len)
+{
+	unsigned char datagram[sizeof(SYNTRO_BESTEFFORT_DGRAM) + SYNTRO_BESTEFFORT_MAXMESSAGE];
+	SYNTRO_BESTEFFORT_DGRAM *header = (SYNTRO_BESTEFFORT_DGRAM *)datagram;
+	SYNTRO_EHEAD *outEhead = (SYNTRO_EHEAD *)(datagram + sizeof(SYNTRO_BESTEFFORT_DGRAM));
+
+	if ((m_bestEffortSock == NULL) || (len > SYNTRO_BESTEFFORT_MAXMESSAGE))
+		return false;
+
+	header->senderUID = m_myUID;
+	SyntroUtils::convertIntToUC4(registeredComponent->bestEffortKey, header->key);
+	SyntroUtils::convertIntToUC4(registeredComponent->bestEffortSeq++, header->seq);
+	memcpy(outEhead, inEhead, len);
+	SyntroUtils::convertIntToUC2(registeredComponent->port, outEhead->destPort);
+	SyntroUtils::convertIntToUC2(multicastMap->index, outEhead->sourcePort);
+	outEhead->destUID = registeredComponent->registeredUID;
+	outEhead->sourceUID = multicastMap->sourceUID;
+	outEhead->seq = registeredComponent->sendSeq++;
+	registeredComponent->lastAckSeq = registeredComponent->sendSeq;	// datagrams aren't acked
+	m_bestEffortSock->sockSendTo(datagram, sizeof(SYNTRO_BESTEFFORT_DGRAM) + len,
+				registeredComponent->bestEffortPort, registeredComponent->bestEffortAddr);
+	m_server->m_multicastOut++;
+	m_server->m_multicastOutRate++;
+	return true;										// if the send failed it's just lost
+}
+
+//	updateBestEffortUpstream is called on each lookup response from the previous hop SyntroControl.
+//	The map is fed with datagrams only if every registration on it is best effort as otherwise the
+//	losses on the previous hop would be passed on to registrations that wanted every message.
+
+void MulticastManager::updateBestEffortUpstream(MM_MMAP *multicastMap)
+{
+	SYNTRO_BESTEFFORT *request;
+	bool wanted;
+
+	wanted = (m_bestEffortSock != NULL) && (multicastMap->registeredCount > 0)
+				&& m_server->isBestEffortCapable(&(multicastMap->prevHopUID));
+	for (int i = 0; wanted && (i < multicastMap->registeredCount); i++)
+		wanted = multicastMap->registrations[i].bestEffort;
+	if (!wanted && !multicastMap->bestEffortUpstream)
+		return;
+
+	request = (SYNTRO_BESTEFFORT *)malloc(sizeof(SYNTRO_BESTEFFORT));
+	memset(request, 0, sizeof(SYNTRO_BESTEFFORT));
+	request->ehead.sourceUID = m_myUID;
+	request->ehead.destUID = multicastMap->prevHopUID;
+	SyntroUtils::copyUC2(request->ehead.sourcePort, multicastMap->serviceLookup.localPort);
+	SyntroUtils::copyUC2(request->ehead.destPort, multicastMap->serviceLookup.remotePort);
+	SyntroUtils::convertIntToUC2(m_bestEffortPort, request->udpPort);
+	request->request = wanted ? SYNTRO_BESTEFFORT_SUBSCRIBE : SYNTRO_BESTEFFORT_UNSUBSCRIBE;
+	multicastMap->bestEffortUpstream = wanted;
+	m_server->sendSyntroMessage(&(multicastMap->prevHopUID), SYNTROMSG_BESTEFFORT,
+				(SYNTRO_MESSAGE *)request, sizeof(SYNTRO_BESTEFFORT), SYNTROLINK_MEDHIGHPRI);
+}
+
+MM_REGISTEREDCOMPONENT *MulticastManager::findRegistered(MM_MMAP *multicastMap, SYNTRO_UID *UID, int port)
+{
+	MM_REGISTEREDCOMPONENT *registeredComponent = multicastMap->registrations;
+
+	for (int i = 0; i < multicastMap->registeredCount; i++, registeredComponent++) {
+		if (SyntroUtils::compareUID(UID, &(registeredComponent->registeredUID)) && (registeredComponent->port == port))
+			return registeredComponent;
+	}
+	return NULL;
+}
+
+//	removeRegistered keeps the array in registration order by moving the later entries down
 
+void MulticastManager::removeRegistered(MM_MMAP *multicastMap, int index)
+{
+	setPending(multicastMap->registrations + index, NULL);
+	memmove(multicastMap->registrations + index, multicastMap->registrations + index + 1,
+				(multicastMap->registeredCount - index - 1) * sizeof(MM_REGISTEREDCOMPONENT));
+	multicastMap->registeredCount--;
+}
+
+//	sendRegistered gives a registration its own SYNTRO_EHEAD for a message and queues it on the
+//	registration's SyntroLink with the payload shared
+
+void MulticastManager::sendRegistered(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, int cmd,
+					SyntroSharedBuffer *payload, qint64 now)
+{
+	SYNTRO_EHEAD *outEhead;
+
+	outEhead = (SYNTRO_EHEAD *)malloc(sizeof(SYNTRO_EHEAD));
+	memcpy(outEhead, payload->data(), sizeof(SYNTRO_EHEAD));
+	SyntroUtils::convertIntToUC2(registeredComponent->port, outEhead->destPort);// this is the receiver's service index that was requested
+	SyntroUtils::convertIntToUC2(multicastMap->index, outEhead->sourcePort);	// this is my slot number (needed for the ack)
+	outEhead->destUID = registeredComponent->registeredUID;
+	outEhead->sourceUID = multicastMap->sourceUID;
+	outEhead->seq = registeredComponent->sendSeq;
+	SyntroUtils::sendWindowSent(&registeredComponent->sendWindow, registeredComponent->sendSeq, now);
+	registeredComponent->sendSeq++;
+	TRACE2("Forwarding mcast from component %s to %s",
+			qPrintable(SyntroUtils::displayUID(&outEhead->sourceUID)), qPrintable(SyntroUtils::displayUID(&registeredComponent->registeredUID)));
+	m_server->sendSyntroSharedMessage(&(registeredComponent->registeredUID), cmd, (SYNTRO_MESSAGE *)outEhead, 
+				sizeof(SYNTRO_EHEAD), payload, payload->data() + sizeof(SYNTRO_EHEAD), 
+				payload->length() - sizeof(SYNTRO_EHEAD), SYNTROLINK_LOWPRI);
+	m_server->m_multicastOut++;
+	m_server->m_multicastOutRate++;
+	registeredComponent->lastSendTime = now;
+}
+
+//	setPending holds a reference to payload for a registration, releasing any older message.
+//	Each one that's replaced before it could be sent is counted as conflated.
+
+void MulticastManager::setPending(MM_REGISTEREDCOMPONENT *registeredComponent, SyntroSharedBuffer *payload)
+{
+	if (registeredComponent->pending != NULL) {
+		if (payload != NULL)
+			registeredComponent->conflated++;
+		registeredComponent->pending->release();
+	}
+	if (payload != NULL)
+		payload->addRef();
+	registeredComponent->pending = payload;
+}
+
+//	windowOpen checks the send window of a registration. If the acks have stopped for too long
+//	the window is reset rather than waiting forever.
+
+bool MulticastManager::windowOpen(MM_REGISTEREDCOMPONENT *registeredComponent, qint64 now)
+{
+	if (SyntroUtils::sendWindowOpen(&registeredComponent->sendWindow,
+				registeredComponent->sendSeq, registeredComponent->lastAckSeq))
+		return true;
+	if (!SyntroUtils::syntroTimerExpired(now, registeredComponent->lastSendTime, EXCHANGE_TIMEOUT))
+		return false;								// not yet long enough to declare a timeout
+	registeredComponent->lastAckSeq = registeredComponent->sendSeq;
+	SyntroUtils::sendWindowReset(&registeredComponent->sendWindow);
+	logWarn(QString("WFAck timeout on %1").arg(SyntroUtils::displayUID(&registeredComponent->registeredUID)));
+	return true;
+}
+
+//	sendReplay sends a registration the cached messages it hasn't had yet while the window is open.
+//	New messages join the cache while it's replaying so they are sent in order after the older ones.
+//	Once it has caught up with the cache the registration is sent new messages directly.
+
+void MulticastManager::sendReplay(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, qint64 now)
+{
+	MM_CACHE *cache = multicastMap->cache;
+
+	while ((cache != NULL) && (registeredComponent->replayNext < cache->count)) {
+		if (!windowOpen(registeredComponent, now))
+			return;									// the rest go as acks open the window
+		sendRegistered(multicastMap, registeredComponent, SYNTROMSG_MULTICAST_MESSAGE,
+					cache->message[registeredComponent->replayNext++], now);
+	}
+	registeredComponent->replayNext = -1;
+}
+
+//	classifyRecord looks at the record header of a video or avmux message to see how it can be dropped
+
+int MulticastManager::classifyRecord(SyntroSharedBuffer *payload)
+{
+	SYNTRO_RECORD_HEADER *recordHeader;
+	SYNTRO_RECORD_AVMUX *avmuxHead;
+	int length = payload->length() - (int)sizeof(SYNTRO_EHEAD);
+	int muxLength, videoLength, audioLength;
+	int param;
+
+	if (length < (int)sizeof(SYNTRO_RECORD_HEADER))
+		return MM_RECORD_OTHER;
+	recordHeader = (SYNTRO_RECORD_HEADER *)(payload->data() + sizeof(SYNTRO_EHEAD));
+	param = SyntroUtils::convertUC2ToInt(recordHeader->param);
+
+	switch (SyntroUtils::convertUC2ToInt(recordHeader->type)) {
+		case SYNTRO_RECORD_TYPE_VIDEO:
+			if (param == SYNTRO_RECORDHEADER_PARAM_NOOP)
+				return MM_RECORD_NOOP;
+			if (param == SYNTRO_RECORDHEADER_PARAM_REFRESH)
+				return MM_RECORD_REFRESH;
+			if (SyntroUtils::convertUC2ToInt(recordHeader->subType) == SYNTRO_RECORD_TYPE_VIDEO_MJPEG)
+				return MM_RECORD_FRAME;
+			return MM_RECORD_DELTA;
+
+		case SYNTRO_RECORD_TYPE_AUDIO:
+			return MM_RECORD_AUDIO;
+
+		case SYNTRO_RECORD_TYPE_AVMUX:
+			if (length < (int)sizeof(SYNTRO_RECORD_AVMUX))
+				return MM_RECORD_OTHER;
+			avmuxHead = (SYNTRO_RECORD_AVMUX *)recordHeader;
+			if (!SyntroUtils::avmuxHeaderValidate(avmuxHead, length, NULL, muxLength, NULL, videoLength, NULL, audioLength))
+				return MM_RECORD_OTHER;
+			if (param == SYNTRO_RECORDHEADER_PARAM_NOOP)
+				return MM_RECORD_NOOP;
+			if ((muxLength == 0) && (videoLength == 0))
+				return (audioLength > 0) ? MM_RECORD_AUDIO : MM_RECORD_OTHER;
+			if (param == SYNTRO_RECORDHEADER_PARAM_REFRESH)
+				return MM_RECORD_REFRESH;
+			if (avmuxHead->videoSubtype == SYNTRO_RECORD_TYPE_VIDEO_MJPEG)
+				return MM_RECORD_FRAME;
+			return MM_RECORD_DELTA;
+
+		default:
+			return MM_RECORD_OTHER;
+	}
+}
+
+//	filterRecord decides what happens to a video or avmux record for a registration. It returns
+//	true if the record should go through the normal send path and false if it has been dropped
+//	or sent here.
+
+bool MulticastManager::filterRecord(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, int cmd,
+					SyntroSharedBuffer *payload, int recordClass, qint64 now)
+{
+	int inFlight = (unsigned char)(registeredComponent->sendSeq - registeredComponent->lastAckSeq);
+	int window = registeredComponent->sendWindow.window;
+	bool open = inFlight < window;
+
+	if (!open && SyntroUtils::syntroTimerExpired(now, registeredComponent->lastSendTime, EXCHANGE_TIMEOUT))
+		return true;										// the window is about to be reset anyway
+
+	switch (recordClass) {
+		case MM_RECORD_NOOP:
+			if (inFlight < (window + 1) / 2)
+				return true;
+			registeredComponent->dropped++;					// nothing in it so don't let it fill the window
+			return false;
+
+		case MM_RECORD_REFRESH:
+			multicastMap->refreshSeen = true;
+			registeredComponent->waitRefresh = false;
+			if (!open && !multicastMap->conflate)
+				registeredComponent->waitRefresh = true;	// lost so need the next one
+			return true;
+
+		case MM_RECORD_FRAME:
+		case MM_RECORD_DELTA:
+			if ((recordClass == MM_RECORD_FRAME) || !registeredComponent->waitRefresh) {
+				if (open)
+					return true;
+				if (multicastMap->conflate && (registeredComponent->pending == NULL))
+					return true;							// held until the window opens
+				if ((recordClass == MM_RECORD_DELTA) && multicastMap->refreshSeen)
+					registeredComponent->waitRefresh = true;	// the frames after this one can't be decoded
+			}
+			registeredComponent->dropped++;
+			if (inFlight < window + MM_AUDIO_RESERVE)
+				sendAudioOnly(multicastMap, registeredComponent, payload, now);
+			return false;
+
+		case MM_RECORD_AUDIO:
+			if (open)
+				return true;
+			if (inFlight < window + MM_AUDIO_RESERVE) {
+				sendRegistered(multicastMap, registeredComponent, cmd, payload, now);
+				return false;
+			}
+			registeredComponent->dropped++;
+			return false;
+	}
+	return true;
+}
+
+//	sendAudioOnly sends the audio from an avmux record whose video has been dropped. Records with
+//	mux data are left alone as the audio can't be separated.
+
+void MulticastManager::sendAudioOnly(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent,
+					SyntroSharedBuffer *payload, qint64 now)
+{
+	SYNTRO_RECORD_AVMUX *avmuxHead;
+	SyntroSharedBuffer *audio;
+	unsigned char *audioPtr;
+	unsigned char *message;
+	int length = payload->length() - (int)sizeof(SYNTRO_EHEAD);
+	int muxLength, videoLength, audioLength;
+
+	avmuxHead = (SYNTRO_RECORD_AVMUX *)(payload->data() + sizeof(SYNTRO_EHEAD));
+	if ((length < (int)sizeof(SYNTRO_RECORD_AVMUX))
+			|| (SyntroUtils::convertUC2ToInt(avmuxHead->recordHeader.type) != SYNTRO_RECORD_TYPE_AVMUX))
+		return;
+	if (!SyntroUtils::avmuxHeaderValidate(avmuxHead, length, NULL, muxLength, NULL, videoLength, &audioPtr, audioLength))
+		return;
+	if ((muxLength != 0) || (audioLength == 0))
+		return;
+
+	message = (unsigned char *)malloc(sizeof(SYNTRO_EHEAD) + sizeof(SYNTRO_RECORD_AVMUX) + audioLength);
+	memcpy(message, payload->data(), sizeof(SYNTRO_EHEAD) + sizeof(SYNTRO_RECORD_AVMUX));
+	avmuxHead = (SYNTRO_RECORD_AVMUX *)(message + sizeof(SYNTRO_EHEAD));
+	SyntroUtils::convertIntToUC2(SYNTRO_RECORDHEADER_PARAM_NORMAL, avmuxHead->recordHeader.param);
+	SyntroUtils::convertIntToUC4(0, avmuxHead->videoSize);
+	memcpy(avmuxHead + 1, audioPtr, audioLength);
+	audio = new SyntroSharedBuffer(message, sizeof(SYNTRO_EHEAD) + sizeof(SYNTRO_RECORD_AVMUX) + audioLength);
+	sendRegistered(multicastMap, registeredComponent, SYNTROMSG_MULTICAST_MESSAGE, audio, now);
+	audio->release();
+}
+
+//	updateCache keeps the newest message of a map. Video keeps the last frame that can be decoded
+//	on its own and the inter frames since. If there are too many of those nothing is kept until
+//	the next REFRESH frame. NOOP and audio records aren't worth sending to a new registration.
+
+void MulticastManager::updateCache(MM_MMAP *multicastMap, SyntroSharedBuffer *payload, int recordClass)
+{
+	MM_CACHE *cache = multicastMap->cache;
+
+	switch (recordClass) {
+		case MM_RECORD_NOOP:
+		case MM_RECORD_AUDIO:
+			return;
+
+		case MM_RECORD_DELTA:
+			if ((cache == NULL) || (cache->count == 0))
+				return;								// nothing to decode it from
+			if (cache->count == MM_CACHE_MAX) {
+				clearCache(multicastMap);
+				return;
+			}
+			break;
+
+		default:
+			clearCache(multicastMap);
+			break;
+	}
+
+	if (cache == NULL) {
+		cache = (MM_CACHE *)malloc(sizeof(MM_CACHE));
+		cache->count = 0;
+		multicastMap->cache = cache;
+	}
+	payload->addRef();
+	cache->message[cache->count++] = payload;
+}
+
+void MulticastManager::clearCache(MM_MMAP *multicastMap)
+{
+	MM_CACHE *cache = multicastMap->cache;
+
+	if (cache == NULL)
+		return;
+	for (int i = 0; i < cache->count; i++)
+		cache->message[i]->release();
+	cache->count = 0;
+	for (int i = 0; i < multicastMap->registeredCount; i++) {
+		if (multicastMap->registrations[i].replayNext >= 0)
+			multicastMap->registrations[i].replayNext = 0;	// replays what replaces the old messages
+	}
+}
+
+//	updateRefresh keeps refresh timers running only for the maps that MMBackground has to send lookups for
+
+void MulticastManager::updateRefresh(MM_MMAP *multicastMap)
+{
+	if (multicastMap->valid && (multicastMap->registeredCount > 0)
+				&& !SyntroUtils::compareUID(&(multicastMap->sourceUID), &m_myUID)) {
+		if (!SyntroTimerWheel::isActive(&(multicastMap->refreshTimer)))
+			startRefreshTimer(multicastMap, SyntroClock());
+	} else {
+		m_timerWheel.stop(&(multicastMap->refreshTimer));
+	}
+}
+
+//	startRefreshTimer sets the timer for when the next lookup can be sent. If that has already
+//	passed (nothing was sent) the map is looked at again on the next background.
+
+void MulticastManager::startRefreshTimer(MM_MMAP *multicastMap, qint64 now)
+{
+	qint64 deadline = multicastMap->lookupSent + SERVICE_LOOKUP_INTERVAL;
+
+	if (deadline <= now)
+		deadline = now + SYNTRO_CLOCKS_PER_SEC;
+	m_timerWheel.start(&(multicastMap->refreshTimer), deadline);
+}
 
@@ -21,11 +21,47 @@
 #define MULTICASTMANAGER_H
 
 #include "SyntroLib.h"
+#include "syntrocontrollib_global.h"
 
-#define	SYNTROSERVER_MAX_MMAPS		100000					// max simultaneous multicast registrations 
+#include <qvector.h>
+#include <qqueue.h>
+
+//	A map's port is separate from its slot in the table. Ports are handed out in turn from the whole
+//	16 bit range, skipping any still in use, so a freed port isn't seen again until roughly
+//	MM_PORTS - SYNTROSERVER_MAX_MMAPS other maps have been allocated. Messages for an old map are
+//	then rejected instead of going to a new one that happens to have the same port. Ports must be
+//	read back with convertUC2ToUInt.
+
+#define	MM_PORTS				0x10000						// number of map ports
+#define	SYNTROSERVER_MAX_MMAPS	0x8000						// max simultaneous multicast maps
+
+#define	MM_REGISTERED_INITIAL	4							// initial size of a map's registration array
 
 #define	MM_REFRESH_INTERVAL		(SYNTRO_CLOCKS_PER_SEC * 5)	// multicast refresh interval
 
+#define	MM_GROUP_REPAIR			8							// group messages kept per map for repair requests
+
+//	Record classes used to drop video under backpressure on avmux and video services. Publishers
+//	of codecs with inter frames should mark frames that can be decoded on their own as REFRESH.
+
+#define	MM_RECORD_OTHER			0							// not filtered
+#define	MM_RECORD_NOOP			1							// filler - dropped first
+#define	MM_RECORD_REFRESH		2							// a frame that can be decoded on its own
+#define	MM_RECORD_FRAME			3							// a normal MJPEG frame - also complete
+#define	MM_RECORD_DELTA			4							// a normal frame that needs the previous ones
+#define	MM_RECORD_AUDIO			5							// audio only - kept if at all possible
+
+#define	MM_AUDIO_RESERVE		4							// messages audio may send beyond the ack window
+
+#define	MM_CACHE_MAX			64							// most messages cached for a map - a REFRESH frame and the ones after it
+
+//	Registration group states
+
+#define	MM_GROUP_NONE			0							// data is sent over the SyntroLink
+#define	MM_GROUP_OFFER			1							// an offer needs to be sent
+#define	MM_GROUP_OFFERED		2							// waiting for the component to join or refuse
+#define	MM_GROUP_MEMBER			3							// the component gets the data from the group
+
 //	MM_REGISTEREDCOMPONENT is used to record who has requested multicast data 
 
 typedef struct _REGISTEREDCOMPONENT
@@ -34,28 +70,74 @@ typedef struct _REGISTEREDCOMPONENT
 	int port;												// the registered port to send data to
 	unsigned char sendSeq;									// the next send sequence number
 	unsigned char lastAckSeq;								// last received ack sequence number
+	SYNTRO_SEND_WINDOW sendWindow;							// sizes the ack window from the measured RTT
 	qint64 lastSendTime;									// in order to timeout the WFAck condition
-	struct _REGISTEREDCOMPONENT	*next;						// so they can be linked together
+	SyntroSharedBuffer *pending;							// newest message held while the window is closed (conflated maps)
+	qint64 conflated;										// messages replaced by a newer one before they could be sent
+	bool waitRefresh;										// true if video is dropped until the next REFRESH frame
+	bool replay;											// true if the map's cached messages are due to be sent
+	int replayNext;											// next cached message to send or -1 if not replaying
+	qint64 dropped;											// video records dropped by the record filter
+	int groupState;											// MM_GROUP_* state
+	bool groupRepair;										// if a group member that wants repairs
+	bool bestEffort;										// if the data is sent as best effort datagrams
+	char bestEffortAddr[SYNTRO_IPSTR_LEN];					// where to send them
+	int bestEffortPort;
+	quint32 bestEffortKey;									// the key of the component's SyntroLink
+	quint32 bestEffortSeq;									// seq of the next datagram
 } MM_REGISTEREDCOMPONENT;
 
+//	MM_GROUPCACHE keeps the most recent group messages of a map so that lost ones can be resent
+
+typedef struct
+{
+	int next;												// next entry to use
+	quint32 seq[MM_GROUP_REPAIR];							// group seq of each message
+	SyntroSharedBuffer *message[MM_GROUP_REPAIR];			// a reference to each message or NULL
+} MM_GROUPCACHE;
+
+//	MM_CACHE keeps the newest message of a map so that a new registration can be sent it straight
+//	away. For video it is the last REFRESH frame and the frames since, so the first is decodable.
+
+typedef struct
+{
+	int count;												// messages in the cache
+	SyntroSharedBuffer *message[MM_CACHE_MAX];				// a reference to each message, oldest first
+} MM_CACHE;
+
 //	MM_MMAP records info about a multicast service
 
 typedef struct
 {
 	bool valid;												// true if the entry is in use
-	int index;												// index of entry
+	int index;												// the port of the entry
+	int slot;												// the entry's slot in the table
 	SYNTRO_UID sourceUID;									// the original UID (i.e. where message came from)
 	SYNTRO_UID prevHopUID;									// previous hop UID (which may be different if via tunnel(s))
-	MM_REGISTEREDCOMPONENT *head;							// head of the registered component list
+	MM_REGISTEREDCOMPONENT *registrations;					// the registered components
+	int registeredCount;									// number in use
+	int registeredSize;										// size of the array
 	SYNTRO_SERVICE_LOOKUP serviceLookup;					// the lookup structure
+	bool conflate;											// true if slow registrations only get the newest message
+	bool video;												// true if an avmux or video service
+	bool recordFilter;										// true if video records are dropped selectively
+	MM_CACHE *cache;										// last value cache or NULL if nothing cached
+	bool refreshSeen;										// true once a REFRESH frame has been forwarded
 	bool registered;										// true if successfully registered for a service
 	qint64 lookupSent;										// time last lookup was sent
 	qint64 lastLookupRefresh;							// last time a subscriber refreshed its lookup
+	SYNTRO_TIMER refreshTimer;								// when the next lookup request is due
+	int groupMembers;										// registrations receiving from the group
+	int groupRepairMembers;									// how many of those want repairs
+	quint32 groupSeq;										// seq of the next group message
+	MM_GROUPCACHE *groupCache;								// recent messages if there are repair members
+	bool bestEffortUpstream;								// if the previous hop has been asked for datagrams
+	SYNTRO_BESTEFFORT_RX bestEffortRX;						// datagrams received from the previous hop
 } MM_MMAP;
 
 class	SyntroServer;
 
-class MulticastManager : public QObject
+class SYNTROCONTROLLIB_EXPORT MulticastManager : public QObject
 {
 	Q_OBJECT
 public:
@@ -91,26 +173,93 @@ public:
 
 	void MMDeleteRegistered(SYNTRO_UID *UID, int port);
 
-//	MMForwardMulticastMessage forwards a message to all registered endpoints
+//	MMForwardMulticastMessage forwards a message to all registered endpoints. The message
+//	is consumed - the payload is shared by all the copies and is freed when the last one has been sent.
+//	ack is false for best effort datagrams as the sender doesn't expect one.
 
-	void MMForwardMulticastMessage(int cmd, SYNTRO_MESSAGE *message, int len);
+	void MMForwardMulticastMessage(int cmd, SYNTRO_MESSAGE *message, int len, bool ack = true);
 
 //	MMProcessMulticastAck - handles an ack from a multicast sink
 
 	void MMProcessMulticastAck(SYNTRO_EHEAD *ehead, int len);
 
+//	MMProcessMulticastAcks - handles a batch of acks from a multicast sink
+
+	void MMProcessMulticastAcks(SYNTRO_MULTICAST_ACKS *acks, int len);
+
 //	MMProcessLookupResponse - handles lookup responses
 
 	void MMProcessLookupResponse(SYNTRO_SERVICE_LOOKUP *serviceLookup, int len);
 
+//	MMInitGroups enables IP multicast groups. sock is the UDP socket to send from. The group for
+//	map slot n is groupBase + n.
+
+	void MMInitGroups(SyntroSocket *sock, quint32 groupBase, int groupPort);
+
+//	MMSendGroupOffers sends any group offers for new registrations. It must be called after the
+//	lookup response has been sent so that the component has the registration when the offer arrives.
+
+	void MMSendGroupOffers();
+
+//	MMProcessGroupRequest - handles join, refuse and repair requests from group members
+
+	void MMProcessGroupRequest(SYNTRO_MULTICAST_GROUP *groupRequest, int len);
+
+//	MMInitBestEffort enables best effort registrations. sock is the UDP socket to send from and
+//	port is the port it's bound to.
+
+	void MMInitBestEffort(SyntroSocket *sock, int port);
+
+//	MMInitSendWindow sets the smallest and largest ack windows of new registrations
+
+	void MMInitSendWindow(int minWindow, int maxWindow);
+
+//	MMInitConflate sets the services that are conflated. Each entry is a service name or a full
+//	service path. A registration on a conflated service whose window is closed has only the newest
+//	message kept for it and that is sent as soon as the window opens.
+
+	void MMInitConflate(const QStringList& services);
+
+//	MMInitRecordFilter enables keyframe aware dropping on avmux and video services. Registrations
+//	whose window is filling drop NOOP records, then frames. After a lost inter frame the rest are
+//	dropped until the next REFRESH frame. Audio is kept and may use a small reserve beyond the window.
+
+	void MMInitRecordFilter(bool enable);
+
+//	MMInitCache enables the last value cache. Each map keeps its newest message, or for video its
+//	last REFRESH frame and those since, and a new registration is sent them as soon as it's made.
+
+	void MMInitCache(bool enable);
+
+//	MMSendCached starts sending cached messages to new registrations. Like MMSendGroupOffers it must be
+//	called after the lookup response has been sent. Only as many as the send window allows are sent
+//	straight away, the rest follow as acks open the window.
+
+	void MMSendCached();
+
+//	MMForwardBestEffort checks a best effort datagram from senderUID and forwards it if it's
+//	the newest so far. The message is consumed.
+
+	void MMForwardBestEffort(SYNTRO_UID *senderUID, quint32 seq, SYNTRO_MESSAGE *message, int len);
+
+//	MMProcessBestEffortRequest handles SUBSCRIBE and UNSUBSCRIBE from a registered component and
+//	ACCEPT from a previous hop. addr and key are those of the sender's SyntroLink. Returns true
+//	if a SUBSCRIBE was accepted, in which case seq is set to the next datagram's seq.
+
+	bool MMProcessBestEffortRequest(SYNTRO_BESTEFFORT *request, const char *addr, quint32 key, quint32 *seq);
+
 //	MMBackground - must be called once per second
 
 	void MMBackground();
 
-//	Access to m_pMMap should only be made while locked
+//	MMGetMMap returns the valid map with the port or NULL. Must be called while locked.
+
+	MM_MMAP *MMGetMMap(int port);
+
+//	Access to m_multicastMaps should only be made while locked. Entries are allocated as the
+//	table grows and are reused through the free list, so a pointer to one stays valid.
 
-	MM_MMAP	m_multicastMap[SYNTROSERVER_MAX_MMAPS];				// the multicast map array
-	int m_multicastMapSize;										// size of the array actually used
+	QVector<MM_MMAP *> m_multicastMaps;							// the multicast map table
 	QMutex m_lock;
 	SYNTRO_UID m_myUID;
 
@@ -121,7 +270,47 @@ signals:
 	void MMRegistrationChanged(int index);
 
 protected:
+	MM_REGISTEREDCOMPONENT *findRegistered(MM_MMAP *multicastMap, SYNTRO_UID *UID, int port);
+	void removeRegistered(MM_MMAP *multicastMap, int index);	// removes entry index from the registration array
+	void sendRegistered(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, int cmd,
+					SyntroSharedBuffer *payload, qint64 now);	// sends a message over the registration's SyntroLink
+	void setPending(MM_REGISTEREDCOMPONENT *registeredComponent, SyntroSharedBuffer *payload);	// replaces the held message (NULL to clear)
+	bool windowOpen(MM_REGISTEREDCOMPONENT *registeredComponent, qint64 now);	// true if a message can be sent now
+	void sendReplay(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, qint64 now);	// sends cached messages while the window is open
+	static int classifyRecord(SyntroSharedBuffer *payload);	// MM_RECORD_* class of a message
+	bool filterRecord(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, int cmd,
+					SyntroSharedBuffer *payload, int recordClass, qint64 now);	// false if the record has been dealt with
+	void sendAudioOnly(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent,
+					SyntroSharedBuffer *payload, qint64 now);	// sends just the audio of a dropped avmux record
+	void updateCache(MM_MMAP *multicastMap, SyntroSharedBuffer *payload, int recordClass);	// adds a forwarded message to the cache
+	void clearCache(MM_MMAP *multicastMap);				// releases the cached messages
+	void updateRefresh(MM_MMAP *multicastMap);			// starts or stops the map's refresh timer
+	void startRefreshTimer(MM_MMAP *multicastMap, qint64 now);	// times the next lookup request from the last
 	void sendLookupRequest(MM_MMAP *multicastMap, bool rightNow = false);	// sends a multicast service lookup request
+	void sendGroupMessage(MM_MMAP *multicastMap, SyntroSharedBuffer *payload);	// sends a message to the map's group
+	void sendGroupRepair(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, quint32 seq);
+	void leaveGroup(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent);
+	void freeGroupCache(MM_MMAP *multicastMap);
+	QString groupAddress(int slot);						// the group address string for a map slot
+	bool sendBestEffort(MM_MMAP *multicastMap, MM_REGISTEREDCOMPONENT *registeredComponent, SYNTRO_EHEAD *inEhead, int len);
+	void updateBestEffortUpstream(MM_MMAP *multicastMap);	// asks the previous hop for datagrams if every registration wants them
+
+	SyntroSocket *m_groupSock;							// sends group datagrams - NULL if groups not in use
+	quint32 m_groupBase;								// address of the group for slot 0
+	int m_groupPort;									// the group UDP port
+	QQueue<int> m_freeSlots;							// free slots - oldest first
+	QVector<MM_MMAP *> m_portMaps;						// the map with each port or NULL
+	int m_nextPort;										// where to start looking for a free port
+	SyntroTimerWheel m_timerWheel;						// refresh timers of maps that need lookups sent
+	QList<int> m_groupOffers;							// maps with offers waiting to be sent
+	SyntroSocket *m_bestEffortSock;						// sends best effort datagrams - NULL if not in use
+	int m_bestEffortPort;								// the port it's bound to
+	int m_sendWindowMin;								// smallest ack window of a registration
+	int m_sendWindowMax;								// and the largest
+	QStringList m_conflateServices;						// service names and paths that are conflated
+	bool m_recordFilter;								// true if avmux and video services are filtered
+	bool m_cache;										// true if maps keep a last value cache
+	QList<int> m_cacheReplays;							// maps with cached messages waiting to be sent
 	qint64 m_lastBackground;						// keeps track of interval between backgrounds
 
 	QString m_logTag;
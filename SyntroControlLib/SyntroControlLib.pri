@@ -25,6 +25,7 @@ HEADERS += $$PWD/SyntroTunnel.h \
     $$PWD/SyntroControlLib.h \
     $$PWD/syntrocontrollib_global.h \
     $$PWD/SyntroServer.h \
+    $$PWD/SyntroServerWorker.h \
     $$PWD/DirectoryManager.h \
     $$PWD/MulticastManager.h
 SOURCES += $$PWD/DirectoryManager.cpp \
@@ -32,4 +33,5 @@ SOURCES += $$PWD/DirectoryManager.cpp \
     $$PWD/MulticastManager.cpp \
     $$PWD/SyntroControLlib.cpp \
     $$PWD/SyntroServer.cpp \
+    $$PWD/SyntroServerWorker.cpp \
     $$PWD/SyntroTunnel.cpp
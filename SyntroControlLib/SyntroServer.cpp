@@ -18,6 +18,7 @@
 //
 
 #include "SyntroServer.h"
+#include "SyntroServerWorker.h"
 #include "SyntroTunnel.h"
 #include "SyntroControlLib.h"
 #include "SyntroThread.h"
@@ -58,6 +59,71 @@ SyntroServer::SyntroServer() : SyntroThread(QString("SyntroServer"), COMPTYPE_CO
     if (!settings->contains(SYNTROCONTROL_PARAMS_ENCRYPT_STATICTUNNEL_SERVER))
         settings->setValue(SYNTROCONTROL_PARAMS_ENCRYPT_STATICTUNNEL_SERVER, false);
  
+	if (!settings->contains(SYNTROCONTROL_PARAMS_TXQUEUE_MAXMESSAGES))
+		settings->setValue(SYNTROCONTROL_PARAMS_TXQUEUE_MAXMESSAGES, SYNTROSERVER_TXQUEUE_MAXMESSAGES);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_TXQUEUE_MAXBYTES))
+		settings->setValue(SYNTROCONTROL_PARAMS_TXQUEUE_MAXBYTES, SYNTROSERVER_TXQUEUE_MAXBYTES);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_TXQUEUE_POLICY))
+		settings->setValue(SYNTROCONTROL_PARAMS_TXQUEUE_POLICY, SYNTROLINK_TXPOLICY_DROPOLDEST);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_TXFRAGMENT_SIZE))
+		settings->setValue(SYNTROCONTROL_PARAMS_TXFRAGMENT_SIZE, 0);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_TXSCHEDULER))
+		settings->setValue(SYNTROCONTROL_PARAMS_TXSCHEDULER, SYNTROLINK_SCHED_STRICT);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_TXSCHEDULER_WEIGHTS))
+		settings->setValue(SYNTROCONTROL_PARAMS_TXSCHEDULER_WEIGHTS, QStringList()
+				<< QString::number(SYNTROLINK_SCHED_HIGHPRI_WEIGHT) << QString::number(SYNTROLINK_SCHED_MEDHIGHPRI_WEIGHT)
+				<< QString::number(SYNTROLINK_SCHED_MEDPRI_WEIGHT) << QString::number(SYNTROLINK_SCHED_LOWPRI_WEIGHT));
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCKET_POLLER))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCKET_POLLER, false);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SHAREDMEMORY))
+		settings->setValue(SYNTROCONTROL_PARAMS_SHAREDMEMORY, false);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_UNIXSOCKET))
+		settings->setValue(SYNTROCONTROL_PARAMS_UNIXSOCKET, true);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_THREAD_MAILBOX))
+		settings->setValue(SYNTROCONTROL_PARAMS_THREAD_MAILBOX, false);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_IO_WORKERS))
+		settings->setValue(SYNTROCONTROL_PARAMS_IO_WORKERS, 0);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_MULTICASTGROUPS))
+		settings->setValue(SYNTROCONTROL_PARAMS_MULTICASTGROUPS, false);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_MULTICASTGROUP_BASE))
+		settings->setValue(SYNTROCONTROL_PARAMS_MULTICASTGROUP_BASE, SYNTROSERVER_MULTICASTGROUP_BASE);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_MULTICASTGROUP_PORT))
+		settings->setValue(SYNTROCONTROL_PARAMS_MULTICASTGROUP_PORT, SYNTRO_SOCKET_MULTICAST_GROUP);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_MULTICASTGROUP_TTL))
+		settings->setValue(SYNTROCONTROL_PARAMS_MULTICASTGROUP_TTL, 1);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_BESTEFFORT))
+		settings->setValue(SYNTROCONTROL_PARAMS_BESTEFFORT, false);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_BESTEFFORT_PORT))
+		settings->setValue(SYNTROCONTROL_PARAMS_BESTEFFORT_PORT, SYNTRO_SOCKET_BESTEFFORT);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_MULTICAST_WINDOW_MIN))
+		settings->setValue(SYNTROCONTROL_PARAMS_MULTICAST_WINDOW_MIN, SYNTRO_MAX_WINDOW);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_MULTICAST_WINDOW_MAX))
+		settings->setValue(SYNTROCONTROL_PARAMS_MULTICAST_WINDOW_MAX, SYNTRO_WINDOW_MAX);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_VIDEODROP))
+		settings->setValue(SYNTROCONTROL_PARAMS_VIDEODROP, true);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_LASTVALUE_CACHE))
+		settings->setValue(SYNTROCONTROL_PARAMS_LASTVALUE_CACHE, false);
+
 	m_socketNumber = settings->value(SYNTROCONTROL_PARAMS_LISTEN_LOCAL_SOCKET).toInt();
 	m_staticTunnelSocketNumber = settings->value(SYNTROCONTROL_PARAMS_LISTEN_STATICTUNNEL_SOCKET).toInt();
 
@@ -75,6 +141,56 @@ SyntroServer::SyntroServer() : SyntroThread(QString("SyntroServer"), COMPTYPE_CO
         }
     }
 
+	m_TXQueueMaxMessages = settings->value(SYNTROCONTROL_PARAMS_TXQUEUE_MAXMESSAGES).toInt();
+	m_TXQueueMaxBytes = settings->value(SYNTROCONTROL_PARAMS_TXQUEUE_MAXBYTES).toInt();
+	m_TXQueuePolicy = settings->value(SYNTROCONTROL_PARAMS_TXQUEUE_POLICY).toInt();
+	m_TXFragmentSize = settings->value(SYNTROCONTROL_PARAMS_TXFRAGMENT_SIZE).toInt();
+	m_TXScheduler = settings->value(SYNTROCONTROL_PARAMS_TXSCHEDULER).toInt();
+	m_TXSchedulerWeights[SYNTROLINK_HIGHPRI] = SYNTROLINK_SCHED_HIGHPRI_WEIGHT;
+	m_TXSchedulerWeights[SYNTROLINK_MEDHIGHPRI] = SYNTROLINK_SCHED_MEDHIGHPRI_WEIGHT;
+	m_TXSchedulerWeights[SYNTROLINK_MEDPRI] = SYNTROLINK_SCHED_MEDPRI_WEIGHT;
+	m_TXSchedulerWeights[SYNTROLINK_LOWPRI] = SYNTROLINK_SCHED_LOWPRI_WEIGHT;
+	loadTXSchedulerWeights(settings, SYNTROCONTROL_PARAMS_TXSCHEDULER_WEIGHTS, m_TXSchedulerWeights);
+	m_useSocketPoller = settings->value(SYNTROCONTROL_PARAMS_SOCKET_POLLER).toBool();
+	m_sharedMemory = settings->value(SYNTROCONTROL_PARAMS_SHAREDMEMORY).toBool();
+	m_unixSocket = settings->value(SYNTROCONTROL_PARAMS_UNIXSOCKET).toBool();
+	if (settings->value(SYNTROCONTROL_PARAMS_THREAD_MAILBOX).toBool())
+		useMailbox();										// socket notifications are the bulk of our messages
+	m_IOWorkerCount = settings->value(SYNTROCONTROL_PARAMS_IO_WORKERS).toInt();
+	if (m_IOWorkerCount < 0)
+		m_IOWorkerCount = 0;
+	if (m_IOWorkerCount > SYNTROSERVER_MAX_IOWORKERS)
+		m_IOWorkerCount = SYNTROSERVER_MAX_IOWORKERS;
+	m_multicastGroups = settings->value(SYNTROCONTROL_PARAMS_MULTICASTGROUPS).toBool();
+	m_multicastGroupBase = settings->value(SYNTROCONTROL_PARAMS_MULTICASTGROUP_BASE).toString();
+	m_multicastGroupPort = settings->value(SYNTROCONTROL_PARAMS_MULTICASTGROUP_PORT).toInt();
+	m_multicastGroupTTL = settings->value(SYNTROCONTROL_PARAMS_MULTICASTGROUP_TTL).toInt();
+	m_bestEffort = settings->value(SYNTROCONTROL_PARAMS_BESTEFFORT).toBool();
+	m_bestEffortPort = settings->value(SYNTROCONTROL_PARAMS_BESTEFFORT_PORT).toInt();
+	m_multicastManager.MMInitSendWindow(settings->value(SYNTROCONTROL_PARAMS_MULTICAST_WINDOW_MIN).toInt(),
+		settings->value(SYNTROCONTROL_PARAMS_MULTICAST_WINDOW_MAX).toInt());
+	m_multicastManager.MMInitConflate(settings->value(SYNTROCONTROL_PARAMS_CONFLATE_SERVICES).toStringList());
+	m_multicastManager.MMInitRecordFilter(settings->value(SYNTROCONTROL_PARAMS_VIDEODROP).toBool());
+	m_multicastManager.MMInitCache(settings->value(SYNTROCONTROL_PARAMS_LASTVALUE_CACHE).toBool());
+
+	//	Component and LAN tunnel links carry control traffic so send immediately. Static tunnels
+	//	may be carrying video over a WAN so need larger buffers and keepalives to hold NAT state.
+
+	memset(m_socketOptions, 0, sizeof(m_socketOptions));
+	m_socketOptions[SYNTROSERVER_LINK_LOCAL].sendBufSize = SYNTROSERVER_LINK_BUFSIZE;
+	m_socketOptions[SYNTROSERVER_LINK_LOCAL].receiveBufSize = SYNTROSERVER_LINK_BUFSIZE;
+	m_socketOptions[SYNTROSERVER_LINK_LOCAL].noDelay = true;
+	m_socketOptions[SYNTROSERVER_LINK_LOCALTUNNEL] = m_socketOptions[SYNTROSERVER_LINK_LOCAL];
+	m_socketOptions[SYNTROSERVER_LINK_STATICTUNNEL].sendBufSize = SYNTROSERVER_STATICTUNNEL_BUFSIZE;
+	m_socketOptions[SYNTROSERVER_LINK_STATICTUNNEL].receiveBufSize = SYNTROSERVER_STATICTUNNEL_BUFSIZE;
+	m_socketOptions[SYNTROSERVER_LINK_STATICTUNNEL].noDelay = true;
+	m_socketOptions[SYNTROSERVER_LINK_STATICTUNNEL].keepAliveIdle = 60;
+	m_socketOptions[SYNTROSERVER_LINK_STATICTUNNEL].keepAliveInterval = 10;
+	m_socketOptions[SYNTROSERVER_LINK_STATICTUNNEL].keepAliveCount = 6;
+	loadSocketOptions(settings, SYNTROCONTROL_PARAMS_LOCALLINK_OPTIONS, m_socketOptions + SYNTROSERVER_LINK_LOCAL);
+	loadSocketOptions(settings, SYNTROCONTROL_PARAMS_LOCALTUNNEL_OPTIONS, m_socketOptions + SYNTROSERVER_LINK_LOCALTUNNEL);
+	loadSocketOptions(settings, SYNTROCONTROL_PARAMS_STATICTUNNEL_OPTIONS, m_socketOptions + SYNTROSERVER_LINK_STATICTUNNEL);
+
 	int hbInterval = settings->value(SYNTROCONTROL_PARAMS_HBINTERVAL).toInt();
 	m_heartbeatSendInterval =  hbInterval * SYNTRO_CLOCKS_PER_SEC;
 	m_heartbeatTimeoutCount = settings->value(SYNTROCONTROL_PARAMS_HBTIMEOUT).toInt();
@@ -88,6 +204,12 @@ SyntroServer::SyntroServer() : SyntroThread(QString("SyntroServer"), COMPTYPE_CO
 				settings->value(SYNTRO_PARAMS_LOCALCONTROL_PRI).toInt());
 	m_listSyntroLinkSock = NULL;
 	m_listStaticTunnelSock = NULL;
+	m_listLocalSock = NULL;
+	m_socketPoller = NULL;
+	for (int i = 0; i < SYNTROSERVER_MAX_IOWORKERS; i++)
+		m_IOWorkers[i] = NULL;
+	m_groupSock = NULL;
+	m_bestEffortSock = NULL;
 	m_hello = NULL;
 
 	delete settings;
@@ -108,8 +230,12 @@ void SyntroServer::initThread()
 
 	QSettings *settings = SyntroUtils::getSettings();
 
-	for (i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++)
+	for (i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++) {
 		m_components[i].inUse = false;
+		m_components[i].worker = NULL;
+		SyntroTimerWheel::initTimer(&(m_components[i].heartbeatTimer), i, m_components + i);
+		SyntroTimerWheel::initTimer(&(m_components[i].serviceTimer), i, m_components + i);
+	}
 	for (i = 0; i < SYNTRO_MAX_CONNECTIONIDS; i++)
 		m_connectionIDMap[i] = -1;
 
@@ -130,6 +256,66 @@ void SyntroServer::initThread()
 	m_myUID = m_componentData.getMyUID();
 	m_appName = settings->value(SYNTRO_PARAMS_APPNAME).toString();
 
+	if (m_useSocketPoller) {								// must be created in this thread
+		m_socketPoller = new SyntroSocketPoller(this);
+		if (!m_socketPoller->isValid()) {
+			logWarn("Socket poller not available - using Qt sockets");
+			delete m_socketPoller;
+			m_socketPoller = NULL;
+		}
+	}
+
+	//	I/O workers take over the poller driven links so aren't used without the poller
+
+	if ((m_IOWorkerCount > 0) && (m_socketPoller == NULL)) {
+		logWarn("I/O workers need the socket poller - not in use");
+		m_IOWorkerCount = 0;
+	}
+	for (i = 0; i < m_IOWorkerCount; i++) {
+		m_IOWorkers[i] = new SyntroServerWorker(this, i);
+		m_IOWorkers[i]->resumeThread();
+	}
+	if (m_IOWorkerCount > 0)
+		logInfo(QString("Using %1 I/O workers").arg(m_IOWorkerCount));
+
+	if (m_multicastGroups) {								// must be created in this thread
+		quint32 groupBase = QHostAddress(m_multicastGroupBase).toIPv4Address();
+		if ((groupBase >> 28) != 0xe) {
+			logWarn(QString("Multicast group base %1 is not a multicast address - groups not in use").arg(m_multicastGroupBase));
+		} else {
+			m_groupSock = new SyntroSocket(m_logTag);
+			if (!m_groupSock->sockCreate(0, SOCK_DGRAM) || !m_groupSock->sockSetMulticastTTL(m_multicastGroupTTL)) {
+				logWarn("Failed to create multicast group socket - groups not in use");
+				delete m_groupSock;
+				m_groupSock = NULL;
+			} else {
+				m_groupSock->sockSetSendBufSize(SYNTROSERVER_MULTICASTGROUP_BUFSIZE);
+				m_multicastManager.MMInitGroups(m_groupSock, groupBase, m_multicastGroupPort);
+				logInfo(QString("Multicast groups active from %1 port %2").arg(m_multicastGroupBase).arg(m_multicastGroupPort));
+			}
+		}
+	}
+
+	if (m_bestEffort) {										// must be created in this thread
+		m_bestEffortSock = new SyntroSocket(this, 0, false);
+		if (!m_bestEffortSock->sockCreate(m_bestEffortPort, SOCK_DGRAM)) {
+			logWarn(QString("Failed to open best effort port %1 - best effort not in use").arg(m_bestEffortPort));
+			delete m_bestEffortSock;
+			m_bestEffortSock = NULL;
+		} else {
+			m_bestEffortSock->sockSetReceiveBufSize(SYNTROSERVER_BESTEFFORT_BUFSIZE);
+			m_bestEffortSock->sockSetSendBufSize(SYNTROSERVER_BESTEFFORT_BUFSIZE);
+			m_bestEffortSock->sockSetReceiveMsg(SYNTROSERVER_ONRECEIVE_BESTEFFORT_MESSAGE);
+			m_bestEffortPort = m_bestEffortSock->sockLocalPort();
+			m_multicastManager.MMInitBestEffort(m_bestEffortSock, m_bestEffortPort);
+			m_componentData.addMyHelloFlags(HELLO_FLAG_BESTEFFORT);
+			logInfo(QString("Best effort multicast active on port %1").arg(m_bestEffortPort));
+		}
+	}
+	m_componentData.addMyHelloFlags(HELLO_FLAG_ACKBATCH);
+	if (m_sharedMemory)
+		m_componentData.addMyHelloFlags(HELLO_FLAG_SHAREDMEMORY);
+
 	m_timer = startTimer(SYNTROSERVER_INTERVAL);
 	m_lastOpenSocketsTime = SyntroClock();
 
@@ -144,8 +330,23 @@ void SyntroServer::finishThread()
 	for (int i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++)
 		syCleanup(m_components + i);
 
+	for (int i = 0; i < m_IOWorkerCount; i++) {			// all their sockets have gone now
+		m_IOWorkers[i]->exitThread();
+		m_IOWorkers[i] = NULL;
+	}
+
 	m_dirManager.DMShutdown();
 	m_multicastManager.MMShutdown();
+	if (m_groupSock != NULL) {
+		m_multicastManager.MMInitGroups(NULL, 0, 0);
+		delete m_groupSock;
+		m_groupSock = NULL;
+	}
+	if (m_bestEffortSock != NULL) {
+		m_multicastManager.MMInitBestEffort(NULL, 0);
+		delete m_bestEffortSock;
+		m_bestEffortSock = NULL;
+	}
 
 	if (m_hello != NULL)
 		m_hello->exitThread();
@@ -154,6 +355,10 @@ void SyntroServer::finishThread()
 		delete m_listSyntroLinkSock;
 	if (m_listStaticTunnelSock != NULL)
 		delete m_listStaticTunnelSock;
+	if (m_listLocalSock != NULL)
+		delete m_listLocalSock;
+	if (m_socketPoller != NULL)
+		delete m_socketPoller;
 }
 
 void SyntroServer::loadStaticTunnels(QSettings *settings)
@@ -169,6 +374,7 @@ void SyntroServer::loadStaticTunnels(QSettings *settings)
 		settings->setValue(SYNTROCONTROL_PARAMS_STATIC_DESTIP_PRIMARY, "0.0.0.0");
 		settings->setValue(SYNTROCONTROL_PARAMS_STATIC_DESTIP_BACKUP, "");
 		settings->setValue(SYNTROCONTROL_PARAMS_STATIC_ENCRYPT, false);
+		settings->setValue(SYNTROCONTROL_PARAMS_STATIC_TXSCHEDULER, -1);
 
 		settings->endArray();
 		return;
@@ -197,6 +403,9 @@ void SyntroServer::loadStaticTunnels(QSettings *settings)
 		component->tunnelStaticBackup = backup;
 		component->tunnelStaticName = settings->value(SYNTROCONTROL_PARAMS_STATIC_NAME).toString();
         component->tunnelEncrypt = settings->value(SYNTROCONTROL_PARAMS_STATIC_ENCRYPT).toBool();
+		component->tunnelTXScheduler = settings->value(SYNTROCONTROL_PARAMS_STATIC_TXSCHEDULER, -1).toInt();
+		memcpy(component->tunnelTXSchedulerWeights, m_TXSchedulerWeights, sizeof(m_TXSchedulerWeights));
+		loadTXSchedulerWeights(settings, SYNTROCONTROL_PARAMS_STATIC_TXSCHEDULER_WEIGHTS, component->tunnelTXSchedulerWeights);
 
         if (component->tunnelEncrypt && !QSslSocket::supportsSsl()) {
             logWarn("Static tunnel uses encryption but SSL not available. Turning off encryption");
@@ -210,6 +419,58 @@ void SyntroServer::loadStaticTunnels(QSettings *settings)
 	settings->endArray();
 }
 
+//	loadTXSchedulerWeights reads a list of scheduler weights, high priority first. Anything
+//	missing or invalid is left as it was.
+
+void SyntroServer::loadTXSchedulerWeights(QSettings *settings, const char *key, int *weights)
+{
+	QStringList list = settings->value(key).toStringList();
+	int weight;
+	bool ok;
+
+	for (int priority = SYNTROLINK_HIGHPRI; (priority <= SYNTROLINK_LOWPRI) && (priority < list.count()); priority++) {
+		weight = list.at(priority).trimmed().toInt(&ok);
+		if (ok && (weight > 0))
+			weights[priority] = weight;
+	}
+}
+
+//	loadSocketOptions reads the socket options in group. On entry options holds the defaults
+//	which are written to the settings if not already there.
+
+void SyntroServer::loadSocketOptions(QSettings *settings, const char *group, SYNTRO_SOCKET_OPTIONS *options)
+{
+	settings->beginGroup(group);
+
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCK_SENDBUFSIZE))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCK_SENDBUFSIZE, options->sendBufSize);
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCK_RECEIVEBUFSIZE))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCK_RECEIVEBUFSIZE, options->receiveBufSize);
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCK_NODELAY))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCK_NODELAY, options->noDelay);
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCK_QUICKACK))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCK_QUICKACK, options->quickAck);
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCK_NOTSENT_LOWAT))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCK_NOTSENT_LOWAT, options->notSentLowat);
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_IDLE))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_IDLE, options->keepAliveIdle);
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_INTERVAL))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_INTERVAL, options->keepAliveInterval);
+	if (!settings->contains(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_COUNT))
+		settings->setValue(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_COUNT, options->keepAliveCount);
+
+	options->sendBufSize = settings->value(SYNTROCONTROL_PARAMS_SOCK_SENDBUFSIZE).toInt();
+	options->receiveBufSize = settings->value(SYNTROCONTROL_PARAMS_SOCK_RECEIVEBUFSIZE).toInt();
+	options->noDelay = settings->value(SYNTROCONTROL_PARAMS_SOCK_NODELAY).toBool();
+	options->quickAck = settings->value(SYNTROCONTROL_PARAMS_SOCK_QUICKACK).toBool();
+	options->notSentLowat = settings->value(SYNTROCONTROL_PARAMS_SOCK_NOTSENT_LOWAT).toInt();
+	options->keepAliveIdle = settings->value(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_IDLE).toInt();
+	options->keepAliveInterval = settings->value(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_INTERVAL).toInt();
+	options->keepAliveCount = settings->value(SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_COUNT).toInt();
+
+	settings->endGroup();
+}
+
 void SyntroServer::loadValidTunnelSources(QSettings *settings)
 {
     int count = 0;
@@ -270,6 +531,17 @@ bool SyntroServer::openSockets()
 				m_listSyntroLinkSock = NULL;
 			} else {
 				logInfo("Local listener active");
+				if (m_unixSocket && !m_encryptLocal) {		// components on this machine can skip TCP/IP
+					m_listLocalSock = getNewSocket(false, true);
+					if ((m_listLocalSock != NULL) && (m_listLocalSock->sockListenLocal() == 0)) {
+						delete m_listLocalSock;
+						m_listLocalSock = NULL;
+					}
+					if (m_listLocalSock != NULL) {
+						m_componentData.addMyHelloFlags(HELLO_FLAG_UNIXSOCKET);
+						logInfo("Unix domain listener active");
+					}
+				}
 				m_hello = new Hello(&m_componentData, m_logTag);
 				m_hello->m_parentThread = this;
 				m_hello->m_socketFlags = 1;			
@@ -308,6 +580,71 @@ void SyntroServer::setComponentSocket(SS_COMPONENT *syntroComponent, SyntroSocke
 	m_connectionIDMap[syntroComponent->connectionID] = syntroComponent->index;	// set the map entry
 }
 
+//	setComponentLink creates the component's SyntroLink. Only the data queues are limited. The high
+//	and medium high priority queues carry the heartbeats, lookups, acks and binds that keep the
+//	link working so nothing is ever dropped from them. Static tunnels may have their own scheduler settings.
+
+void SyntroServer::setComponentLink(SS_COMPONENT *syntroComponent)
+{
+	SyntroLinkScheduler *scheduler;
+	int *weights = m_TXSchedulerWeights;
+	int mode = m_TXScheduler;
+
+	if (syntroComponent->tunnelStatic) {
+		if (syntroComponent->tunnelTXScheduler != -1)
+			mode = syntroComponent->tunnelTXScheduler;
+		weights = syntroComponent->tunnelTXSchedulerWeights;
+	}
+
+	scheduler = SyntroLinkScheduler::create(mode);
+	for (int priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++)
+		scheduler->setWeight(priority, weights[priority]);
+
+	syntroComponent->syntroLink = new SyntroLink(m_logTag);
+	syntroComponent->syntroLink->setBackpressureHandler(this);
+	syntroComponent->syntroLink->setTXFragmentSize(m_TXFragmentSize);
+	syntroComponent->syntroLink->setTXScheduler(scheduler);
+	for (int priority = SYNTROLINK_MEDPRI; priority <= SYNTROLINK_LOWPRI; priority++)
+		syntroComponent->syntroLink->setTXQueueLimits(priority, m_TXQueueMaxMessages, m_TXQueueMaxBytes, m_TXQueuePolicy);
+	syntroComponent->TXCongested = false;
+}
+
+//	linkBackpressure is called by a component's SyntroLink when one of its TX queues fills up or drains.
+//	That may be in a worker thread so the change is dealt with in the server thread.
+
+void SyntroServer::linkBackpressure(SyntroLink *link, int priority, bool)
+{
+	postThreadMessage(SYNTROSERVER_ONBACKPRESSURE_MESSAGE, priority, link);
+}
+
+//	processBackpressure reads the link's current state as it may have changed again since the message was posted
+
+void SyntroServer::processBackpressure(SyntroLink *link, int priority)
+{
+	SS_COMPONENT *syntroComponent = m_components;
+	bool anyCongested = false;
+	bool congested;
+
+	for (int i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++, syntroComponent++) {
+		if (!syntroComponent->inUse || (syntroComponent->syntroLink != link))
+			continue;								// link may have gone since the message was posted
+
+		congested = link->isTXCongested(priority);
+		for (int pri = SYNTROLINK_HIGHPRI; pri <= SYNTROLINK_LOWPRI; pri++)
+			anyCongested |= link->isTXCongested(pri);
+		syntroComponent->TXCongested = anyCongested;
+
+		if (congested) {
+			logWarn(QString("TX queue priority %1 congested to %2").arg(priority)
+				.arg(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
+		} else {
+			logInfo(QString("TX queue priority %1 cleared to %2").arg(priority)
+				.arg(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
+		}
+		return;
+	}
+}
+
 SS_COMPONENT *SyntroServer::getComponentFromConnectionID(int connectionID)
 {
 	int componentIndex;
@@ -323,7 +660,7 @@ SS_COMPONENT *SyntroServer::getComponentFromConnectionID(int connectionID)
 	return m_components + componentIndex;
 }
 
-SyntroSocket *SyntroServer::getNewSocket(bool staticTunnel)
+SyntroSocket *SyntroServer::getNewSocket(bool staticTunnel, bool local)
 {
 	SyntroSocket *sock;
 	int	retVal;
@@ -351,10 +688,14 @@ SyntroSocket *SyntroServer::getNewSocket(bool staticTunnel)
 		delete sock;
 		return NULL;
 	}
-	if (!staticTunnel)
-		sock->sockSetAcceptMsg(SYNTROSERVER_ONACCEPT_MESSAGE);
-	else
+	if (!staticTunnel) {
+		sock->sockSetAcceptMsg(local ? SYNTROSERVER_ONACCEPT_LOCAL_MESSAGE : SYNTROSERVER_ONACCEPT_MESSAGE);
+		sock->sockSetSharedMemory(m_sharedMemory);			// refuses requests if not enabled
+	} else {
 		sock->sockSetAcceptMsg(SYNTROSERVER_ONACCEPT_STATICTUNNEL_MESSAGE);
+	}
+	if (m_socketPoller != NULL)
+		sock->sockSetPoller(m_socketPoller);				// accepted links bypass Qt's socket signals
 	return sock;
 }
 
@@ -371,6 +712,47 @@ int SyntroServer::getNextConnectionID()
     return -1;                                              // none available
 }
 
+//	getIOWorker returns the I/O worker that should own a new poller driven link. Links are shared out
+//	by connection ID as that's known before the call is accepted.
+
+SyntroServerWorker *SyntroServer::getIOWorker(int connectionID)
+{
+	if (m_IOWorkerCount == 0)
+		return NULL;
+	return m_IOWorkers[connectionID % m_IOWorkerCount];
+}
+
+//	deleteComponentLink deletes a component's SyntroLink and socket. If they belong to an I/O worker
+//	its shard lock is held so that the worker can't be using them.
+
+void SyntroServer::deleteComponentLink(SS_COMPONENT *syntroComponent)
+{
+	QMutexLocker locker((syntroComponent->worker != NULL) ? syntroComponent->worker->shardLock() : NULL);
+
+	if (syntroComponent->syntroLink != NULL) {
+		delete syntroComponent->syntroLink;
+		syntroComponent->syntroLink = NULL;
+	}
+	if (syntroComponent->sock != NULL) {
+		delete syntroComponent->sock;
+		syntroComponent->sock = NULL;
+	}
+	syntroComponent->worker = NULL;
+}
+
+//	trySending sends a component's queued messages. If an I/O worker owns the link it is asked to
+//	do the sending instead.
+
+void SyntroServer::trySending(SS_COMPONENT *syntroComponent)
+{
+	if (syntroComponent->syntroLink == NULL)
+		return;
+	if (syntroComponent->worker != NULL)
+		syntroComponent->worker->requestSend(syntroComponent);
+	else
+		syntroComponent->syntroLink->trySending(syntroComponent->sock);
+}
+
 //	syConnected - handle connected outgoing calls (tunnel sources)
 
 bool SyntroServer::syConnected(SS_COMPONENT *syntroComponent)
@@ -387,16 +769,19 @@ bool SyntroServer::syConnected(SS_COMPONENT *syntroComponent)
 	syntroComponent->lastHeartbeatReceived = SyntroClock();
 	syntroComponent->lastHeartbeatSent = SyntroClock() - m_heartbeatSendInterval;
 	syntroComponent->heartbeatInterval = m_heartbeatSendInterval;
+	startHeartbeatTimer(syntroComponent, syntroComponent->lastHeartbeatReceived);
 	syntroComponent->state = ConnWFHeartbeat;
+	syntroComponent->bestEffortKey = 0;						// wait for a new bind from the far end
 	if (syntroComponent->dirManagerConnComp == NULL)
 		syntroComponent->dirManagerConnComp = m_dirManager.DMAllocateConnectedComponent(syntroComponent);
+	addRoute(syntroComponent, &(syntroComponent->heartbeat.hello.componentUID), true);
 	return	true;
 }
 
 
 //	SyAccept - handle incoming calls
 
-bool	SyntroServer::syAccept(bool staticTunnel)
+bool	SyntroServer::syAccept(SyntroSocket *listenSock, bool staticTunnel)
 {
 
 	char IPStr[SYNTRO_MAX_NONTAG];
@@ -404,22 +789,24 @@ bool	SyntroServer::syAccept(bool staticTunnel)
 	int componentPort;
 	SS_COMPONENT *component;
 	SyntroSocket *sock;
-	int bufSize = SYNTRO_MESSAGE_MAX * 3;
+	SyntroServerWorker *worker;
 	bool retVal;
 
     int id = getNextConnectionID();
     if (id == -1)
         return false;
 
+	worker = getIOWorker(id);
+	QMutexLocker shardLocker((worker != NULL) ? worker->shardLock() : NULL);	// the worker can't see the link until it's set up
+
 	sock = new SyntroSocket(this, id, false);
-	if (!staticTunnel)
-		retVal = m_listSyntroLinkSock->sockAccept(*sock, IPStr, &componentPort);
-	else
-		retVal = m_listStaticTunnelSock->sockAccept(*sock, IPStr, &componentPort);
+	retVal = listenSock->sockAccept(*sock, IPStr, &componentPort, (worker != NULL) ? worker->poller() : NULL);
 	if (!retVal) {
 		delete sock;
 		return false;
 	}
+	if ((worker != NULL) && ((worker->poller() == NULL) || !sock->sockIsPolled()))
+		worker = NULL;										// SSL or the worker isn't ready - stays with this thread
 	sock->sockSetConnectMsg(SYNTROSERVER_ONCONNECT_MESSAGE);
 	sock->sockSetCloseMsg(SYNTROSERVER_ONCLOSE_MESSAGE);
 	sock->sockSetReceiveMsg(SYNTROSERVER_ONRECEIVE_MESSAGE);
@@ -429,13 +816,10 @@ bool	SyntroServer::syAccept(bool staticTunnel)
 
 	component = findComponent(componentIPAddr, componentPort);	// see if know about this client already
 	if (component != NULL) {								// do know about this one
-		if (component->sock != NULL) {
-			delete component->sock;
-			delete component->syntroLink;
-		}
+		deleteComponentLink(component);
 		memcpy(component->compIPAddr, componentIPAddr, SYNTRO_IPADDR_LEN);
 		component->compPort = componentPort;
-		component->syntroLink = new SyntroLink(m_logTag);
+		setComponentLink(component);
 	} else {
 		component = getFreeComponent();
 		if (component == NULL) {							// too many components!
@@ -444,16 +828,21 @@ bool	SyntroServer::syAccept(bool staticTunnel)
 		}
 		memcpy(component->compIPAddr, componentIPAddr, SYNTRO_IPADDR_LEN);
 		component->compPort = componentPort;
-		component->syntroLink = new SyntroLink(m_logTag);
+		setComponentLink(component);
 	}
 	component->inUse = true;
+	m_addressLookup.insert(addressKey(componentIPAddr, componentPort), component);
 	setComponentSocket(component, sock);					// configure component to use this socket
-	sock->sockSetReceiveBufSize(bufSize);
-	sock->sockSetSendBufSize(bufSize);
+	component->worker = worker;
+	if (worker != NULL)
+		sock->sockSetThread(worker);						// socket events now go to the worker
+	sock->sockSetOptions(m_socketOptions + (staticTunnel ? SYNTROSERVER_LINK_STATICTUNNEL : SYNTROSERVER_LINK_LOCAL));
 
 	component->lastHeartbeatReceived = SyntroClock();
 	component->heartbeatInterval = m_heartbeatSendInterval;	// use this until we get it from received heartbeat
+	startHeartbeatTimer(component, component->lastHeartbeatReceived);
 	component->state = ConnWFHeartbeat;
+	component->bestEffortKey = 0;
     if (staticTunnel) {
         component->tunnelDest = true;
         component->tunnelStatic = true;
@@ -473,6 +862,8 @@ void	SyntroServer::syClose(SS_COMPONENT *syntroComponent)
 
 void	SyntroServer::syCleanup(SS_COMPONENT *syntroComponent)
 {
+	bool hadSocket;
+
 	if (syntroComponent != NULL) {
 		if (syntroComponent->inUse) {
 			m_dirManager.DMDeleteConnectedComponent(syntroComponent->dirManagerConnComp);
@@ -481,25 +872,26 @@ void	SyntroServer::syCleanup(SS_COMPONENT *syntroComponent)
 				free(syntroComponent->dirEntry);
 				syntroComponent->dirEntry = NULL;
 			}
+			removeRoutes(syntroComponent);
 			if (syntroComponent->tunnelSource) {
 				syntroComponent->syntroTunnel->close();
 			} else {
 				syntroComponent->inUse = false;				// only if not tunnel source - tunnel source reuses component
+				m_timerWheel.stop(&(syntroComponent->heartbeatTimer));
+				if (m_addressLookup.value(addressKey(syntroComponent->compIPAddr, syntroComponent->compPort), NULL) == syntroComponent)
+					m_addressLookup.remove(addressKey(syntroComponent->compIPAddr, syntroComponent->compPort));
 			}
-			if (syntroComponent->syntroLink != NULL) {
-				delete syntroComponent->syntroLink;
-				syntroComponent->syntroLink = NULL;
-			}
-			if (syntroComponent->sock != NULL) {
-				delete syntroComponent->sock;
+			hadSocket = syntroComponent->sock != NULL;
+			deleteComponentLink(syntroComponent);			// before the map entry goes as a worker may be using it
+			if (hadSocket) {
 				if ((syntroComponent->connectionID >= 0) && (syntroComponent->connectionID < SYNTRO_MAX_CONNECTIONIDS))
 					m_connectionIDMap[syntroComponent->connectionID] = -1;
 				else
 					logWarn(QString("Slot %1 has out of range connection ID %2")
 						.arg(syntroComponent->index).arg(syntroComponent->connectionID));
 			}
-			syntroComponent->sock = NULL;
 			syntroComponent->state = ConnIdle;
+			syntroComponent->bestEffortKey = 0;				// datagrams for the old link are now ignored
 		}
 	}
 }
@@ -520,12 +912,18 @@ SS_COMPONENT	*SyntroServer::getFreeComponent()
 			component->tunnelSource = false;
 			component->tunnelStatic = false;
             component->tunnelEncrypt = false;
+			component->tunnelTXScheduler = -1;
 			component->syntroLink = NULL;
 			component->sock = NULL;
+			component->worker = NULL;
+			component->routeUIDs.clear();
 			component->syntroTunnel = NULL;
 			component->dirEntry = NULL;
 			component->dirEntryLength = 0;
+			component->bestEffortKey = 0;
 			component->index = i;
+			m_timerWheel.start(&(component->heartbeatTimer), SyntroClock() + SYNTRO_CLOCKS_PER_SEC);	// checked once it's set up
+			m_serviceWheel.start(&(component->serviceTimer), SyntroClock());	// on the next background tick
 			component->dirManagerConnComp = m_dirManager.DMAllocateConnectedComponent(component);
 
 			component->tempRXByteCount = 0;
@@ -543,6 +941,10 @@ SS_COMPONENT	*SyntroServer::getFreeComponent()
 			component->RXByteCount = 0;
 			component->TXByteCount = 0;
 
+			component->TXDropCount = 0;
+			component->TXCongested = false;
+			memset(component->TXLatency, 0, sizeof(component->TXLatency));
+
 			component->lastStatsTime = SyntroClock();
 			return component;
 		}
@@ -556,22 +958,17 @@ SS_COMPONENT	*SyntroServer::getFreeComponent()
 
 bool SyntroServer::sendSyntroMessage(SYNTRO_UID *uid, int cmd, SYNTRO_MESSAGE *message, int length, int priority)
 {
-	SS_COMPONENT *syntroComponent = m_components;
+	SS_COMPONENT *syntroComponent;
 
-	for (int i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++, syntroComponent++) {
-		if (syntroComponent->inUse && (syntroComponent->state >= ConnWFHeartbeat)) {
-			if (!SyntroUtils::compareUID(uid, &(syntroComponent->heartbeat.hello.componentUID)))
-				continue;
+	// send over link to component
 
-			// send over link to component
-			if (syntroComponent->syntroLink != NULL) {
-				TRACE1("\nSend to %s", qPrintable(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
-				syntroComponent->syntroLink->send(cmd, length, priority, (SYNTRO_MESSAGE *)message);
-				updateTXStats(syntroComponent, length);
-				syntroComponent->syntroLink->trySending(syntroComponent->sock);
-				return true;
-			}
-		}
+	if ((syntroComponent = findRoute(uid)) != NULL) {
+		TRACE1("\nSend to %s", qPrintable(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
+		if (!syntroComponent->syntroLink->send(cmd, length, priority, (SYNTRO_MESSAGE *)message))
+			return false;									// rejected by full TX queue
+		updateTXStats(syntroComponent, length);
+		trySending(syntroComponent);
+		return true;
 	}
 
 	free(message);
@@ -579,6 +976,178 @@ bool SyntroServer::sendSyntroMessage(SYNTRO_UID *uid, int cmd, SYNTRO_MESSAGE *m
 	return false;
 }
 
+//	sendSyntroSharedMessage is the same as sendSyntroMessage except that the message consists of
+//	a private header followed by data from a shared buffer. The header is always consumed. The caller's
+//	reference to the shared buffer is not affected.
+
+bool SyntroServer::sendSyntroSharedMessage(SYNTRO_UID *uid, int cmd, SYNTRO_MESSAGE *header, int headerLength,
+				SyntroSharedBuffer *shared, unsigned char *sharedPtr, int sharedLength, int priority)
+{
+	SS_COMPONENT *syntroComponent;
+
+	// send over link to component
+
+	if ((syntroComponent = findRoute(uid)) != NULL) {
+		TRACE1("\nSend shared to %s", qPrintable(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
+		if (!syntroComponent->syntroLink->sendShared(cmd, headerLength, priority, header, shared, sharedPtr, sharedLength))
+			return false;									// rejected by full TX queue
+		updateTXStats(syntroComponent, headerLength + sharedLength);
+		trySending(syntroComponent);
+		return true;
+	}
+
+	free(header);
+	logWarn(QString("Failed sending message to %1").arg(qPrintable(SyntroUtils::displayUID(uid))));
+	return false;
+}
+
+//	isGroupCapable returns true if uid is a component connected directly to this SyntroControl
+//	whose heartbeat says that it can receive multicast services from an IP multicast group.
+//	Tunnels always stay on the SyntroLink.
+
+bool SyntroServer::isGroupCapable(SYNTRO_UID *uid)
+{
+	SS_COMPONENT *syntroComponent = findDirectRoute(uid);
+
+	if ((syntroComponent == NULL) || (syntroComponent->state != ConnNormal))
+		return false;
+	if (syntroComponent->tunnelSource || syntroComponent->tunnelDest)
+		return false;
+	return (syntroComponent->heartbeat.hello.flags & HELLO_FLAG_MCASTGROUP) != 0;
+}
+
+//	isBestEffortCapable returns true if uid is at the far end of a SyntroLink that has been
+//	bound for best effort datagrams, either by us (we accepted it) or by the far end.
+
+bool SyntroServer::isBestEffortCapable(SYNTRO_UID *uid)
+{
+	SS_COMPONENT *syntroComponent = findDirectRoute(uid);
+
+	if ((syntroComponent == NULL) || (syntroComponent->state != ConnNormal))
+		return false;
+	return !syntroComponent->tunnelStatic && (syntroComponent->bestEffortKey != 0);
+}
+
+//	sendBestEffortBind - tells the far end of a newly accepted SyntroLink where to send
+//	best effort datagrams and the key that must be in them. The key changes with every
+//	link so stray datagrams from an earlier link are ignored.
+
+void SyntroServer::sendBestEffortBind(SS_COMPONENT *syntroComponent)
+{
+	SYNTRO_BESTEFFORT *bind;
+
+	syntroComponent->bestEffortKey = ((quint32)qrand() << 16) ^ (quint32)qrand() ^
+				(quint32)SyntroClock() ^ ((quint32)syntroComponent->index << 24);
+	if (syntroComponent->bestEffortKey == 0)
+		syntroComponent->bestEffortKey = 1;					// 0 means not bound
+
+	bind = (SYNTRO_BESTEFFORT *)malloc(sizeof(SYNTRO_BESTEFFORT));
+	memset(bind, 0, sizeof(SYNTRO_BESTEFFORT));
+	bind->ehead.sourceUID = m_myUID;
+	bind->ehead.destUID = syntroComponent->heartbeat.hello.componentUID;
+	SyntroUtils::convertIntToUC4(syntroComponent->bestEffortKey, bind->key);
+	SyntroUtils::convertIntToUC2(m_bestEffortPort, bind->udpPort);
+	bind->request = SYNTRO_BESTEFFORT_BIND;
+	sendSyntroMessage(&(syntroComponent->heartbeat.hello.componentUID), SYNTROMSG_BESTEFFORT,
+				(SYNTRO_MESSAGE *)bind, sizeof(SYNTRO_BESTEFFORT), SYNTROLINK_MEDHIGHPRI);
+}
+
+//	processBestEffortRequest - handles best effort control messages received on a SyntroLink.
+//	A bind is only valid from the end that accepted a tunnel that we started. Subscriptions
+//	must come from the component at the far end of a bound link and are answered with an
+//	accept carrying the sequence number the next datagram will have.
+
+void SyntroServer::processBestEffortRequest(SS_COMPONENT *syntroComponent, SYNTRO_BESTEFFORT *request)
+{
+	SYNTRO_BESTEFFORT *accept;
+	quint32 seq;
+
+	switch (request->request) {
+		case SYNTRO_BESTEFFORT_BIND:
+			if (!syntroComponent->tunnelSource || syntroComponent->tunnelStatic) {
+				logWarn(QString("Unexpected best effort bind from %1")
+					.arg(SyntroUtils::displayUID(&request->ehead.sourceUID)));
+				return;
+			}
+			syntroComponent->bestEffortKey = SyntroUtils::convertUC4ToInt(request->key);
+			return;
+
+		case SYNTRO_BESTEFFORT_ACCEPT:
+			if (syntroComponent->bestEffortKey == 0)
+				return;
+			m_multicastManager.MMProcessBestEffortRequest(request,
+				qPrintable(SyntroUtils::displayIPAddr(syntroComponent->heartbeat.hello.IPAddr)),
+				syntroComponent->bestEffortKey, &seq);
+			return;
+
+		case SYNTRO_BESTEFFORT_SUBSCRIBE:
+		case SYNTRO_BESTEFFORT_UNSUBSCRIBE:
+			if (syntroComponent->bestEffortKey == 0)
+				return;											// link was never bound
+			if (!SyntroUtils::compareUID(&(request->ehead.sourceUID), &(syntroComponent->heartbeat.hello.componentUID))) {
+				logWarn(QString("Best effort request from %1 on link to %2")
+					.arg(SyntroUtils::displayUID(&request->ehead.sourceUID))
+					.arg(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
+				return;
+			}
+			if (!m_multicastManager.MMProcessBestEffortRequest(request,
+						qPrintable(SyntroUtils::displayIPAddr(syntroComponent->heartbeat.hello.IPAddr)),
+						syntroComponent->bestEffortKey, &seq))
+				return;
+			accept = (SYNTRO_BESTEFFORT *)malloc(sizeof(SYNTRO_BESTEFFORT));
+			memcpy(accept, request, sizeof(SYNTRO_BESTEFFORT));
+			accept->request = SYNTRO_BESTEFFORT_ACCEPT;
+			SyntroUtils::convertIntToUC4(seq, accept->seq);
+			sendSyntroMessage(&(syntroComponent->heartbeat.hello.componentUID), SYNTROMSG_BESTEFFORT,
+				(SYNTRO_MESSAGE *)accept, sizeof(SYNTRO_BESTEFFORT), SYNTROLINK_MEDHIGHPRI);
+			return;
+
+		default:
+			logWarn(QString("Unknown best effort request %1").arg(request->request));
+			return;
+	}
+}
+
+//	processBestEffortData - reads best effort datagrams. Each must carry the key of the
+//	SyntroLink to its sender, then it is handled just like a multicast from that link.
+
+void SyntroServer::processBestEffortData()
+{
+	unsigned char datagram[sizeof(SYNTRO_BESTEFFORT_DGRAM) + SYNTRO_BESTEFFORT_MAXMESSAGE];
+	SYNTRO_BESTEFFORT_DGRAM *header = (SYNTRO_BESTEFFORT_DGRAM *)datagram;
+	SS_COMPONENT *syntroComponent;
+	SYNTRO_MESSAGE *message;
+	char IPAddr[SYNTRO_IPSTR_LEN];
+	unsigned int port;
+	quint32 key;
+	int length;
+
+	QMutexLocker locker(&m_lock);
+
+	while ((m_bestEffortSock != NULL) && (m_bestEffortSock->sockPendingDatagramSize() != -1)) {
+		length = m_bestEffortSock->sockReceiveFrom(datagram, sizeof(datagram), IPAddr, &port);
+		length -= sizeof(SYNTRO_BESTEFFORT_DGRAM);
+		if (length < (int)sizeof(SYNTRO_EHEAD))
+			continue;
+
+		key = SyntroUtils::convertUC4ToInt(header->key);
+		syntroComponent = findDirectRoute(&(header->senderUID));
+		if ((syntroComponent == NULL) || (syntroComponent->state != ConnNormal) ||
+				(syntroComponent->bestEffortKey == 0) || (syntroComponent->bestEffortKey != key)) {
+			TRACE2("Rejected best effort datagram from %s port %d", IPAddr, port);
+			continue;
+		}
+		syntroComponent->tempRXPacketCount++;
+		syntroComponent->RXPacketCount++;
+		syntroComponent->tempRXByteCount += length;
+		syntroComponent->RXByteCount += length;
+
+		message = (SYNTRO_MESSAGE *)malloc(length);
+		memcpy(message, datagram + sizeof(SYNTRO_BESTEFFORT_DGRAM), length);
+		m_multicastManager.MMForwardBestEffort(&(header->senderUID), SyntroUtils::convertUC4ToInt(header->seq), message, length);
+	}
+}
+
 //	processReceivedData - handles data received from SyntroLinks
 //
 
@@ -596,33 +1165,40 @@ void	SyntroServer::processReceivedData(SS_COMPONENT *syntroComponent)
 		logWarn("Received data on socket with no SCL");
 		return;
 	}
-	syntroComponent->syntroLink->tryReceiving(syntroComponent->sock);
+	if (syntroComponent->worker == NULL)
+		syntroComponent->syntroLink->tryReceiving(syntroComponent->sock);	// else the worker has done it
+
+	//	The socket has been read dry so every whole message it held must be processed now. There
+	//	won't be another receive notification for the ones still queued.
 
 	for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
-		if (!syntroComponent->syntroLink->receive(priority, &cmd, &length, &message))
-			continue;
-		if (syntroComponent->state < ConnNormal) {
-			if (syntroComponent->tunnelSource) {
-				TRACE2("Received %d from %s", cmd, qPrintable(SyntroUtils::displayUID(&syntroComponent->syntroTunnel->m_helloEntry.hello.componentUID)));
+		while ((syntroComponent->syntroLink != NULL) &&		// processing may have closed the link
+				syntroComponent->syntroLink->receive(priority, &cmd, &length, &message)) {
+			if (syntroComponent->state < ConnNormal) {
+				if (syntroComponent->tunnelSource) {
+					TRACE2("Received %d from %s", cmd, qPrintable(SyntroUtils::displayUID(&syntroComponent->syntroTunnel->m_helloEntry.hello.componentUID)));
+				} else {
+					TRACE3("Received %d from %s port %d", cmd, qPrintable(SyntroUtils::displayIPAddr(syntroComponent->compIPAddr)), syntroComponent->compPort);
+				}
 			} else {
-				TRACE3("Received %d from %s port %d", cmd, qPrintable(SyntroUtils::displayIPAddr(syntroComponent->compIPAddr)), syntroComponent->compPort);
+				TRACE2("Received %d from %s", cmd, qPrintable(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
 			}
-		} else {
-			TRACE2("Received %d from %s", cmd, qPrintable(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
-		}
-		syntroComponent->tempRXPacketCount++;
-		syntroComponent->RXPacketCount++;
-		syntroComponent->tempRXByteCount += length;
-		syntroComponent->RXByteCount += length;
+			syntroComponent->tempRXPacketCount++;
+			syntroComponent->RXPacketCount++;
+			syntroComponent->tempRXByteCount += length;
+			syntroComponent->RXByteCount += length;
 
-		processReceivedDataDemux(syntroComponent, cmd, length, message);
+			processReceivedDataDemux(syntroComponent, cmd, length, message);
+		}
 	}
 }
 
 void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int cmd, int length, SYNTRO_MESSAGE *message)
 {
 	SYNTRO_HEARTBEAT *heartbeat;
+	bool UIDChanged;
 	SYNTRO_SERVICE_LOOKUP *serviceLookup;
+	bool bindBestEffort = false;
 
 	switch (cmd) {
 		case SYNTROMSG_HEARTBEAT:						// Syntro client heartbeat
@@ -638,7 +1214,12 @@ void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int c
 			syntroComponent->lastHeartbeatReceived = SyntroClock();
 			if (!syntroComponent->tunnelSource)			// tunnel sources use their configured value
 				syntroComponent->heartbeatInterval = SyntroUtils::convertUC2ToInt(heartbeat->hello.interval) * SYNTRO_CLOCKS_PER_SEC;	// record advertised heartbeat interval
+			UIDChanged = !SyntroUtils::compareUID(&(heartbeat->hello.componentUID), &(syntroComponent->heartbeat.hello.componentUID));
 			memcpy(&(syntroComponent->heartbeat), message, sizeof(SYNTRO_HEARTBEAT));
+			if (UIDChanged)
+				updateRoutes(syntroComponent);
+			else
+				addRoute(syntroComponent, &(syntroComponent->heartbeat.hello.componentUID), true);
 			if (syntroComponent->state == ConnWFHeartbeat) {	// first time for heartbeat
 
                 //  Only SyntroControls can connect via tunnels
@@ -652,8 +1233,10 @@ void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int c
                 // check is this is dynamic tunnel dest
 
                 if (!syntroComponent->tunnelSource && !syntroComponent->tunnelStatic &&
-				    (strcmp(syntroComponent->heartbeat.hello.componentType, COMPTYPE_CONTROL) == 0))
+				    (strcmp(syntroComponent->heartbeat.hello.componentType, COMPTYPE_CONTROL) == 0)) {
                     syntroComponent->tunnelDest = true;
+					syntroComponent->sock->sockSetOptions(m_socketOptions + SYNTROSERVER_LINK_LOCALTUNNEL);
+				}
 
                 //  Validate tunnel source against local UID list
 
@@ -673,6 +1256,13 @@ void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int c
 
 				syntroComponent->state = ConnNormal;
 				logInfo(QString("New component %1").arg(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
+
+				//	The end that accepted the link binds it for best effort datagrams. Static tunnels
+				//	are often NATed so stay on the SyntroLink.
+
+				if (!syntroComponent->tunnelSource && !syntroComponent->tunnelStatic && (m_bestEffortSock != NULL) &&
+						(syntroComponent->heartbeat.hello.flags & HELLO_FLAG_BESTEFFORT))
+					bindBestEffort = true;
 			}
 			updateSyntroStatus(syntroComponent);
 			length -= sizeof(SYNTRO_HEARTBEAT);
@@ -682,6 +1272,8 @@ void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int c
 				sendHeartbeat(syntroComponent);			// need to respond if a normal component
 			if (syntroComponent->tunnelDest)
 				sendTunnelHeartbeat(syntroComponent);	// send a tunnel heartbeat if it is a tunnel dest
+			if (bindBestEffort)
+				sendBestEffortBind(syntroComponent);	// after the heartbeat so the far end knows who it is from
 			free(message);
 			break;
 
@@ -690,8 +1282,7 @@ void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int c
 			break;
 
 		case SYNTROMSG_MULTICAST_MESSAGE:				// a multicast message 
-			forwardMulticastMessage(syntroComponent, cmd, message, length);	// forward on to the interested remotes
-			free(message);
+			forwardMulticastMessage(syntroComponent, cmd, message, length);	// forward on to the interested remotes (consumes message)
 			break;
 
 		case SYNTROMSG_MULTICAST_ACK:					// pMsg is multicast header
@@ -699,6 +1290,11 @@ void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int c
 			free(message);
 			break;
 
+		case SYNTROMSG_MULTICAST_ACKS:					// a batch of acks from a component
+			m_multicastManager.MMProcessMulticastAcks((SYNTRO_MULTICAST_ACKS *)message, length);
+			free(message);
+			break;
+
 		case SYNTROMSG_SERVICE_LOOKUP_REQUEST:			// a Component has requested a service lookup
 			if (length != sizeof(SYNTRO_SERVICE_LOOKUP)) {
 				logWarn(QString("Wrong size service lookup request %1").arg(length));
@@ -710,6 +1306,13 @@ void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int c
 			m_dirManager.DMFindService(&(syntroComponent->heartbeat.hello.componentUID), serviceLookup);
 			sendSyntroMessage(&(syntroComponent->heartbeat.hello.componentUID), 
 						SYNTROMSG_SERVICE_LOOKUP_RESPONSE, message, length, SYNTROLINK_MEDHIGHPRI);	
+			m_multicastManager.MMSendGroupOffers();		// any offers must follow the response
+			m_multicastManager.MMSendCached();			// and so must any cached messages
+			break;
+
+		case SYNTROMSG_MULTICAST_GROUP:
+			m_multicastManager.MMProcessGroupRequest((SYNTRO_MULTICAST_GROUP *)message, length);
+			free(message);
 			break;
 
 		case SYNTROMSG_SERVICE_LOOKUP_RESPONSE:
@@ -717,6 +1320,16 @@ void SyntroServer::processReceivedDataDemux(SS_COMPONENT *syntroComponent, int c
 			free(message);
 			break;
 
+		case SYNTROMSG_BESTEFFORT:
+			if (length != sizeof(SYNTRO_BESTEFFORT)) {
+				logWarn(QString("Wrong size best effort request %1").arg(length));
+				free(message);
+				break;
+			}
+			processBestEffortRequest(syntroComponent, (SYNTRO_BESTEFFORT *)message);
+			free(message);
+			break;
+
 		case SYNTROMSG_DIRECTORY_REQUEST:
 			free(message);								// nothing useful in the request itself
 			m_dirManager.DMBuildDirectoryMessage(sizeof(SYNTRO_DIRECTORY_RESPONSE), (char **)&message, &length, false);
@@ -750,6 +1363,7 @@ void	SyntroServer::setComponentDE(char *dirEntry, int length, SS_COMPONENT *synt
 	memcpy(syntroComponent->dirEntry, dirEntry, length);	// remember new DE
 	syntroComponent->dirManagerConnComp->connectedComponentUID = syntroComponent->heartbeat.hello.componentUID;
 	m_dirManager.DMProcessDE(syntroComponent->dirManagerConnComp, dirEntry, length);
+	updateRoutes(syntroComponent);							// the UIDs reached via the link may have changed
 	TRACE1("Updated component %s", qPrintable(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
 	emit DMDisplay(&m_dirManager);
 }
@@ -767,7 +1381,7 @@ void	SyntroServer::sendHeartbeat(SS_COMPONENT *syntroComponent)
 	memcpy(pMsg, &hb, sizeof(SYNTRO_HEARTBEAT));
 	syntroComponent->syntroLink->send(SYNTROMSG_HEARTBEAT, sizeof(SYNTRO_HEARTBEAT), SYNTROLINK_MEDHIGHPRI, (SYNTRO_MESSAGE *)pMsg);
 	updateTXStats(syntroComponent, sizeof(SYNTRO_HEARTBEAT));
-	syntroComponent->syntroLink->trySending(syntroComponent->sock);
+	trySending(syntroComponent);
 	TRACE2("Sent response HB to %s from slot %d", qPrintable(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)), syntroComponent->index);
 }
 
@@ -794,7 +1408,7 @@ void SyntroServer::sendTunnelHeartbeat(SS_COMPONENT *syntroComponent)
 				syntroComponent->syntroLink->send(SYNTROMSG_HEARTBEAT, messageLength, 
 								SYNTROLINK_MEDHIGHPRI, (SYNTRO_MESSAGE *)message);
 				updateTXStats(syntroComponent, messageLength);
-				syntroComponent->syntroLink->trySending(syntroComponent->sock);
+				trySending(syntroComponent);
 			}
 		}
 	} else {
@@ -805,7 +1419,7 @@ void SyntroServer::sendTunnelHeartbeat(SS_COMPONENT *syntroComponent)
 				syntroComponent->syntroLink->send(SYNTROMSG_HEARTBEAT, messageLength, 
 								SYNTROLINK_MEDHIGHPRI, (SYNTRO_MESSAGE *)message);
 				updateTXStats(syntroComponent, messageLength);
-				syntroComponent->syntroLink->trySending(syntroComponent->sock);
+				trySending(syntroComponent);
 			}
 		}
 	}
@@ -859,11 +1473,15 @@ bool SyntroServer::processMessage(SyntroThreadMsg* msg)
 			break;
 
 		case SYNTROSERVER_ONACCEPT_MESSAGE:
-			syAccept(false);
+			syAccept(m_listSyntroLinkSock, false);
 			return true;
 	
 		case SYNTROSERVER_ONACCEPT_STATICTUNNEL_MESSAGE:
-			syAccept(true);
+			syAccept(m_listStaticTunnelSock, true);
+			return true;
+
+		case SYNTROSERVER_ONACCEPT_LOCAL_MESSAGE:
+			syAccept(m_listLocalSock, false);
 			return true;
 
 		case SYNTROSERVER_ONCLOSE_MESSAGE:
@@ -892,6 +1510,23 @@ bool SyntroServer::processMessage(SyntroThreadMsg* msg)
 			processReceivedData(syntroComponent);
 			return true;
 
+		case SYNTROSERVER_ONRECEIVE_WORKER_MESSAGE:
+			if ((msg->intParam < 0) || (msg->intParam >= SYNTRO_MAX_CONNECTEDCOMPONENTS))
+				return true;
+			syntroComponent = m_components + msg->intParam;
+			syntroComponent->workerRXPending.fetchAndStoreOrdered(0);	// clear before processing so no notification is lost
+			if (syntroComponent->inUse && (syntroComponent->syntroLink != NULL))
+				processReceivedData(syntroComponent);
+			return true;
+
+		case SYNTROSERVER_ONRECEIVE_BESTEFFORT_MESSAGE:
+			processBestEffortData();
+			return true;
+
+		case SYNTROSERVER_ONBACKPRESSURE_MESSAGE:
+			processBackpressure((SyntroLink *)msg->ptrParam, msg->intParam);
+			return true;
+
 		case SYNTROSERVER_ONSEND_MESSAGE:
 			syntroComponent = getComponentFromConnectionID(msg->intParam);
 			if (syntroComponent == NULL) {
@@ -903,7 +1538,7 @@ bool SyntroServer::processMessage(SyntroThreadMsg* msg)
 				return true;
 			}
 			if (syntroComponent->syntroLink != NULL)
-				syntroComponent->syntroLink->trySending(syntroComponent->sock);
+				trySending(syntroComponent);
 			return true;
 	}
 	return true;
@@ -956,6 +1591,7 @@ void	SyntroServer::processHelloUp(HELLOENTRY *helloEntry)
 
 	component->heartbeat.hello = helloEntry->hello;
 	component->state = ConnWFHeartbeat;
+	addRoute(component, &(component->heartbeat.hello.componentUID), true);
 }
 
 void	SyntroServer::processHelloDown(HELLOENTRY *helloEntry)
@@ -1003,8 +1639,6 @@ void	SyntroServer::processHelloDown(HELLOENTRY *helloEntry)
 
 void	SyntroServer::syntroBackground()
 {
-	int i;
-	SS_COMPONENT *syntroComponent;
 	qint64 now;
 
 	if (!openSockets())
@@ -1018,49 +1652,97 @@ void	SyntroServer::syntroBackground()
 		m_counterStart += SYNTRO_CLOCKS_PER_SEC;
 		m_multicastInRate = m_multicastOutRate = m_E2EInRate = m_E2EOutRate = 0;
 	}
-	syntroComponent = m_components;
-	for (i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++, syntroComponent++)
-	{
-		if (syntroComponent->inUse)
-		{
-			updateSyntroData(syntroComponent);
-			if (syntroComponent->tunnelSource) {			
-				syntroComponent->syntroTunnel->tunnelBackground();
-				if (syntroComponent->syntroTunnel->m_connected) {
-					if (SyntroUtils::syntroTimerExpired(now, syntroComponent->lastHeartbeatSent, syntroComponent->heartbeatInterval)) {
-						sendTunnelHeartbeat(syntroComponent);
-						syntroComponent->lastHeartbeatSent = now;
-					}
-					processReceivedData(syntroComponent);
-					syntroComponent->syntroLink->trySending(syntroComponent->sock);
-				}
+	serviceComponents(now);
+	checkHeartbeatTimeouts(SyntroClock());
+	m_multicastManager.MMBackground();
+}
 
-				if (syntroComponent->syntroTunnel->m_connectInProgress || syntroComponent->syntroTunnel->m_connected) {
-					if (SyntroUtils::syntroTimerExpired(now, syntroComponent->lastHeartbeatReceived,	m_heartbeatTimeoutCount * syntroComponent->heartbeatInterval)) {
-						if (!syntroComponent->tunnelStatic) {
-							logWarn(QString("Timeout on tunnel source to %1").arg(syntroComponent->syntroTunnel->m_helloEntry.hello.appName));
-						} else {
-							logWarn(QString("Timeout on tunnel source ") + syntroComponent->tunnelStaticName);
-						}
-						syCleanup(syntroComponent);
-						updateSyntroStatus(syntroComponent);
-					}
-				}
-			} else {										// if not tunnel source
-				if (syntroComponent->syntroLink != NULL) {
-					processReceivedData(syntroComponent);
-					syntroComponent->syntroLink->trySending(syntroComponent->sock);
-				}
+//	serviceComponents only looks at components whose service timers have expired rather than
+//	scanning the whole table every tick. Tunnel sources run their state machines every tick. Other
+//	links are driven by socket events so they are just polled every SYNTROSERVER_SERVICE_INTERVAL
+//	in case one was missed. A timer that expires on a free component isn't started again - that
+//	happens when the component is reused.
 
-				if (SyntroUtils::syntroTimerExpired(SyntroClock(), syntroComponent->lastHeartbeatReceived, m_heartbeatTimeoutCount * syntroComponent->heartbeatInterval)) {
-					logWarn(QString("Timeout on %1").arg(syntroComponent->index));
-					syCleanup(syntroComponent);
-					updateSyntroStatus(syntroComponent);
+void SyntroServer::serviceComponents(qint64 now)
+{
+	SYNTRO_TIMER *timer;
+	SS_COMPONENT *syntroComponent;
+
+	while ((timer = m_serviceWheel.expired(now)) != NULL) {
+		syntroComponent = (SS_COMPONENT *)timer->context;
+		if (!syntroComponent->inUse)
+			continue;
+		updateSyntroData(syntroComponent);
+		if (syntroComponent->tunnelSource) {			
+			syntroComponent->syntroTunnel->tunnelBackground();
+			if (syntroComponent->syntroTunnel->m_connected) {
+				if (SyntroUtils::syntroTimerExpired(now, syntroComponent->lastHeartbeatSent, syntroComponent->heartbeatInterval)) {
+					sendTunnelHeartbeat(syntroComponent);
+					syntroComponent->lastHeartbeatSent = now;
 				}
+				processReceivedData(syntroComponent);
+				trySending(syntroComponent);
 			}
+			m_serviceWheel.start(timer, now + SYNTROSERVER_INTERVAL);
+		} else {										// if not tunnel source
+			if (syntroComponent->syntroLink != NULL) {
+				processReceivedData(syntroComponent);
+				trySending(syntroComponent);
+			}
+			m_serviceWheel.start(timer, now + SYNTROSERVER_SERVICE_INTERVAL);
 		}
 	}
-	m_multicastManager.MMBackground();
+}
+
+//	startHeartbeatTimer sets the component's timer for when the link would time out if no more
+//	heartbeats arrive. If there's no timeout it's just checked again in a second.
+
+void SyntroServer::startHeartbeatTimer(SS_COMPONENT *syntroComponent, qint64 now)
+{
+	qint64 timeout = m_heartbeatTimeoutCount * syntroComponent->heartbeatInterval;
+	qint64 deadline = syntroComponent->lastHeartbeatReceived + timeout;
+
+	if ((timeout <= 0) || (deadline <= now))
+		deadline = now + SYNTRO_CLOCKS_PER_SEC;
+	m_timerWheel.start(&(syntroComponent->heartbeatTimer), deadline);
+}
+
+//	checkHeartbeatTimeouts only looks at components whose timers have expired. Heartbeats don't
+//	restart the timer so one that has had heartbeats since is just started again from the latest.
+
+void SyntroServer::checkHeartbeatTimeouts(qint64 now)
+{
+	SYNTRO_TIMER *timer;
+	SS_COMPONENT *syntroComponent;
+
+	while ((timer = m_timerWheel.expired(now)) != NULL) {
+		syntroComponent = (SS_COMPONENT *)timer->context;
+		if (!syntroComponent->inUse)
+			continue;
+		if (syntroComponent->tunnelSource && !syntroComponent->syntroTunnel->m_connectInProgress
+					&& !syntroComponent->syntroTunnel->m_connected) {
+			m_timerWheel.start(timer, now + SYNTRO_CLOCKS_PER_SEC);	// nothing to time out until it tries to connect
+			continue;
+		}
+		if (!SyntroUtils::syntroTimerExpired(now, syntroComponent->lastHeartbeatReceived,
+					m_heartbeatTimeoutCount * syntroComponent->heartbeatInterval)) {
+			startHeartbeatTimer(syntroComponent, now);
+			continue;
+		}
+		if (syntroComponent->tunnelSource) {
+			if (!syntroComponent->tunnelStatic) {
+				logWarn(QString("Timeout on tunnel source to %1").arg(syntroComponent->syntroTunnel->m_helloEntry.hello.appName));
+			} else {
+				logWarn(QString("Timeout on tunnel source ") + syntroComponent->tunnelStaticName);
+			}
+		} else {
+			logWarn(QString("Timeout on %1").arg(syntroComponent->index));
+		}
+		syCleanup(syntroComponent);
+		updateSyntroStatus(syntroComponent);
+		if (syntroComponent->inUse)
+			m_timerWheel.start(timer, now + SYNTRO_CLOCKS_PER_SEC);	// tunnel sources keep the component
+	}
 }
 
 void	SyntroServer::forwardE2EMessage(SYNTRO_MESSAGE *syntroMessage, int len)
@@ -1084,7 +1766,7 @@ void	SyntroServer::forwardE2EMessage(SYNTRO_MESSAGE *syntroMessage, int len)
 				TRACE1("Send to %s", qPrintable(SyntroUtils::displayUID(&component->heartbeat.hello.componentUID)));
 				component->syntroLink->send(SYNTROMSG_E2E, len, syntroMessage->flags & SYNTROLINK_PRI, syntroMessage);
 				updateTXStats(component, len);
-				component->syntroLink->trySending(component->sock);
+				trySending(component);
 				m_E2EOut++;
 				m_E2EOutRate++;
 			} else {
@@ -1105,10 +1787,12 @@ void	SyntroServer::forwardMulticastMessage(SS_COMPONENT *syntroComponent, int cm
 {
 	if (!syntroComponent->inUse) {
 		logWarn(QString("ForwardMessage on not in use component %1").arg(SyntroUtils::displayUID(&syntroComponent->heartbeat.hello.componentUID)));
+		free(message);
 		return;												// not in use - hmmm. Should not happen!
 	}
 	if (length < (int)sizeof(SYNTRO_EHEAD)) {
 		logWarn(QString("ForwardMessage is too short %1").arg(length));
+		free(message);
 		return;												// not in use - hmmm. Should not happen!
 	}
 	m_multicastManager.MMForwardMulticastMessage(cmd, message, length);
@@ -1119,16 +1803,89 @@ void	SyntroServer::forwardMulticastMessage(SS_COMPONENT *syntroComponent, int cm
 
 SS_COMPONENT	*SyntroServer::findComponent(SYNTRO_IPADDR compAddr, int compPort)
 {
-	int	i;
+	SS_COMPONENT *component = m_addressLookup.value(addressKey(compAddr, compPort), NULL);
 
-	for (i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++) {
-		if (m_components[i].inUse) {
-			if ((memcmp(m_components[i].compIPAddr, compAddr, SYNTRO_IPADDR_LEN) == 0) &&
-				(m_components[i].compPort == compPort))
-				return m_components+i;
+	if ((component == NULL) || !component->inUse)
+		return NULL;
+	if ((memcmp(component->compIPAddr, compAddr, SYNTRO_IPADDR_LEN) != 0) || (component->compPort != compPort))
+		return NULL;
+	return component;
+}
+
+quint64 SyntroServer::addressKey(SYNTRO_IPADDR compAddr, int compPort)
+{
+	return ((quint64)(quint32)SyntroUtils::convertUC4ToInt(compAddr) << 32) | (quint32)compPort;
+}
+
+//	findRoute - the route table holds the far end UID of every link plus the UIDs in each
+//	link's DE. Entries are checked here so a stale one is never used.
+
+SS_COMPONENT *SyntroServer::findRoute(SYNTRO_UID *uid)
+{
+	SS_COMPONENT *syntroComponent = (SS_COMPONENT *)m_routeLookup.FULLookup(uid);
+
+	if (syntroComponent == NULL)
+		return NULL;
+	if (!syntroComponent->inUse || (syntroComponent->state < ConnWFHeartbeat) || (syntroComponent->syntroLink == NULL))
+		return NULL;
+	return syntroComponent;
+}
+
+SS_COMPONENT *SyntroServer::findDirectRoute(SYNTRO_UID *uid)
+{
+	SS_COMPONENT *syntroComponent = findRoute(uid);
+
+	if ((syntroComponent == NULL) || !SyntroUtils::compareUID(uid, &(syntroComponent->heartbeat.hello.componentUID)))
+		return NULL;
+	return syntroComponent;
+}
+
+//	addRoute - an existing route to a directly connected component is never replaced, so
+//	a DE can't steal a component's own link and the first of two links with the same UID
+//	is kept until it goes.
+
+void SyntroServer::addRoute(SS_COMPONENT *syntroComponent, SYNTRO_UID *uid, bool direct)
+{
+	SS_COMPONENT *existing = (SS_COMPONENT *)m_routeLookup.FULLookup(uid);
+	int i;
+
+	if (existing == syntroComponent)
+		return;
+	if ((existing != NULL) && existing->inUse && (existing->state >= ConnWFHeartbeat) &&
+			SyntroUtils::compareUID(uid, &(existing->heartbeat.hello.componentUID))) {
+		if (direct) {
+			TRACE2("Slot %d has the same UID as slot %d", syntroComponent->index, existing->index);
 		}
+		return;
 	}
-	return NULL;
+	m_routeLookup.FULAdd(uid, syntroComponent);
+
+	for (i = 0; i < syntroComponent->routeUIDs.count(); i++) {
+		if (SyntroUtils::compareUID(uid, &(syntroComponent->routeUIDs[i])))
+			return;											// already on the list
+	}
+	syntroComponent->routeUIDs.append(*uid);
+}
+
+void SyntroServer::updateRoutes(SS_COMPONENT *syntroComponent)
+{
+	DM_COMPONENT *component;
+
+	removeRoutes(syntroComponent);
+	addRoute(syntroComponent, &(syntroComponent->heartbeat.hello.componentUID), true);
+	if (syntroComponent->dirManagerConnComp == NULL)
+		return;
+	for (component = syntroComponent->dirManagerConnComp->componentDE; component != NULL; component = component->next)
+		addRoute(syntroComponent, &(component->componentUID), false);
+}
+
+void SyntroServer::removeRoutes(SS_COMPONENT *syntroComponent)
+{
+	for (int i = 0; i < syntroComponent->routeUIDs.count(); i++) {
+		if (m_routeLookup.FULLookup(&(syntroComponent->routeUIDs[i])) == syntroComponent)
+			m_routeLookup.FULDelete(&(syntroComponent->routeUIDs[i]));
+	}
+	syntroComponent->routeUIDs.clear();
 }
 
 void SyntroServer::updateSyntroStatus(SS_COMPONENT *syntroComponent)
@@ -1191,6 +1948,14 @@ void SyntroServer::updateSyntroStatus(SS_COMPONENT *syntroComponent)
 
 void SyntroServer::updateSyntroData(SS_COMPONENT *syntroComponent)
 {
+	if (syntroComponent->syntroLink != NULL) {
+		syntroComponent->TXDropCount = 0;
+		for (int priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+			syntroComponent->TXDropCount += syntroComponent->syntroLink->getTXDropped(priority);
+			syntroComponent->syntroLink->getTXLatency(priority, syntroComponent->TXLatency + priority);
+		}
+	}
+
 	if (receivers(SIGNAL(UpdateSyntroDataBox(int, QStringList))) == 0)
 		return;
 
@@ -28,6 +28,7 @@
 #include "SyntroComponentData.h"
 
 #include <qstringlist.h>
+#include <qhash.h>
 
 //	SyntroServer settings
 
@@ -44,6 +45,44 @@
 #define SYNTROCONTROL_PARAMS_HBINTERVAL					"controlHeartbeatInterval"	// interval between heartbeats in seconds
 #define SYNTROCONTROL_PARAMS_HBTIMEOUT					"controlHeartbeatTimeout"	// heartbeat intervals before timeout
 
+#define SYNTROCONTROL_PARAMS_TXQUEUE_MAXMESSAGES		"TXQueueMaxMessages"	// max messages queued per priority on a link (0 = no limit)
+#define SYNTROCONTROL_PARAMS_TXQUEUE_MAXBYTES			"TXQueueMaxBytes"		// max bytes queued per priority on a link (0 = no limit)
+#define SYNTROCONTROL_PARAMS_TXQUEUE_POLICY				"TXQueuePolicy"			// SYNTROLINK_TXPOLICY_* value used when a limit is hit
+#define SYNTROCONTROL_PARAMS_TXFRAGMENT_SIZE			"TXFragmentSize"		// max bytes per fragment of large messages sent (0 = don't fragment)
+#define SYNTROCONTROL_PARAMS_TXSCHEDULER				"TXScheduler"			// SYNTROLINK_SCHED_* value used to pick the next priority to send
+#define SYNTROCONTROL_PARAMS_TXSCHEDULER_WEIGHTS		"TXSchedulerWeights"	// list of scheduler weights, high priority first
+#define SYNTROCONTROL_PARAMS_SOCKET_POLLER				"SocketPoller"			// true to drive unencrypted accepted links from epoll (Linux only)
+#define SYNTROCONTROL_PARAMS_SHAREDMEMORY				"SharedMemory"			// true to let components on this machine use shared memory links
+#define SYNTROCONTROL_PARAMS_UNIXSOCKET					"UnixSocket"			// true to also listen on a Unix domain socket for local links (Linux only)
+#define SYNTROCONTROL_PARAMS_THREAD_MAILBOX				"ThreadMailbox"			// true to post thread messages through a lock free mailbox
+#define SYNTROCONTROL_PARAMS_IO_WORKERS					"IOWorkers"				// threads that share the socket I/O of poller driven links (0 = none)
+#define SYNTROCONTROL_PARAMS_MULTICASTGROUPS			"MulticastGroups"		// true to send multicast services to LAN components using IP multicast groups
+#define SYNTROCONTROL_PARAMS_MULTICASTGROUP_BASE		"MulticastGroupBase"	// group address of multicast map slot 0 - slot n uses base + n
+#define SYNTROCONTROL_PARAMS_MULTICASTGROUP_PORT		"MulticastGroupPort"	// UDP port for group datagrams
+#define SYNTROCONTROL_PARAMS_MULTICASTGROUP_TTL			"MulticastGroupTTL"		// group datagram TTL (1 = this subnet only)
+#define SYNTROCONTROL_PARAMS_BESTEFFORT					"BestEffort"			// true to let best effort multicast services use UDP
+#define SYNTROCONTROL_PARAMS_BESTEFFORT_PORT			"BestEffortPort"		// UDP port for best effort datagrams
+#define SYNTROCONTROL_PARAMS_MULTICAST_WINDOW_MIN		"MulticastWindowMin"	// smallest ack window for each multicast registration
+#define SYNTROCONTROL_PARAMS_MULTICAST_WINDOW_MAX		"MulticastWindowMax"	// largest ack window for each multicast registration
+#define SYNTROCONTROL_PARAMS_VIDEODROP					"VideoDrop"				// true to drop avmux and video records selectively under backpressure
+#define SYNTROCONTROL_PARAMS_LASTVALUE_CACHE			"LastValueCache"		// true to send new subscribers the last record (or keyframe) straight away
+#define SYNTROCONTROL_PARAMS_CONFLATE_SERVICES			"ConflateServices"		// list of service names or paths where slow subscribers only get the newest message
+
+//	Kernel socket option groups, one per link class, and the keys used in each
+
+#define SYNTROCONTROL_PARAMS_LOCALLINK_OPTIONS			"LocalLinkOptions"		// links accepted from local components
+#define SYNTROCONTROL_PARAMS_LOCALTUNNEL_OPTIONS		"LocalTunnelOptions"	// dynamic tunnels between SyntroControls on the LAN
+#define SYNTROCONTROL_PARAMS_STATICTUNNEL_OPTIONS		"StaticTunnelOptions"	// static tunnels, typically over a WAN
+
+#define SYNTROCONTROL_PARAMS_SOCK_SENDBUFSIZE			"SendBufSize"			// SO_SNDBUF in bytes (0 = system default)
+#define SYNTROCONTROL_PARAMS_SOCK_RECEIVEBUFSIZE		"ReceiveBufSize"		// SO_RCVBUF in bytes (0 = system default)
+#define SYNTROCONTROL_PARAMS_SOCK_NODELAY				"NoDelay"				// true to set TCP_NODELAY
+#define SYNTROCONTROL_PARAMS_SOCK_QUICKACK				"QuickAck"				// true to keep TCP_QUICKACK set
+#define SYNTROCONTROL_PARAMS_SOCK_NOTSENT_LOWAT			"NotSentLowat"			// TCP_NOTSENT_LOWAT in bytes (0 = system default)
+#define SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_IDLE		"KeepAliveIdle"			// seconds idle before keepalive probes (0 = no keepalive)
+#define SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_INTERVAL	"KeepAliveInterval"		// seconds between keepalive probes
+#define SYNTROCONTROL_PARAMS_SOCK_KEEPALIVE_COUNT		"KeepAliveCount"		// unanswered probes before the link is dropped
+
 #define SYNTROCONTROL_PARAMS_VALID_TUNNEL_SOURCES   "ValidTunnelSources"    // UIDs of valid tunnel sources
 #define SYNTROCONTROL_PARAMS_VALID_TUNNEL_UID       "ValidTunnelUID"        // the array entry
 
@@ -54,6 +93,8 @@
 #define	SYNTROCONTROL_PARAMS_STATIC_DESTIP_PRIMARY	"StaticPrimary"	// the primary destination IP address
 #define	SYNTROCONTROL_PARAMS_STATIC_DESTIP_BACKUP	"StaticBackup"	// the backup IP port
 #define SYNTROCONTROL_PARAMS_STATIC_ENCRYPT         "StaticEncrypt" // true if use SSL
+#define	SYNTROCONTROL_PARAMS_STATIC_TXSCHEDULER		"StaticTXScheduler"	// scheduler for the tunnel (-1 = same as other links)
+#define	SYNTROCONTROL_PARAMS_STATIC_TXSCHEDULER_WEIGHTS	"StaticTXSchedulerWeights" // scheduler weights for the tunnel
 
 //		SyntroControl SyntroServer Thread Messages
 
@@ -63,11 +104,37 @@
 #define	SYNTROSERVER_ONRECEIVE_MESSAGE		(SYNTRO_MSTART+3)
 #define	SYNTROSERVER_ONSEND_MESSAGE			(SYNTRO_MSTART+4)
 #define	SYNTROSERVER_ONACCEPT_STATICTUNNEL_MESSAGE (SYNTRO_MSTART+5)
+#define	SYNTROSERVER_ONACCEPT_LOCAL_MESSAGE	(SYNTRO_MSTART+6)
+#define	SYNTROSERVER_ONRECEIVE_BESTEFFORT_MESSAGE (SYNTRO_MSTART+7)
+#define	SYNTROSERVER_ONRECEIVE_WORKER_MESSAGE (SYNTRO_MSTART+8)	// from a worker - intParam is the component index
+#define	SYNTROSERVER_WORKER_SEND_MESSAGE	(SYNTRO_MSTART+9)	// to a worker - intParam is the component index
+#define	SYNTROSERVER_ONBACKPRESSURE_MESSAGE	(SYNTRO_MSTART+10)	// intParam is the priority, ptrParam the SyntroLink
 
 #define	SYNTROSERVER_SOCKET_RETRY			(2 * SYNTRO_CLOCKS_PER_SEC)
 #define	SYNTROSERVER_STATS_INTERVAL			(2 * SYNTRO_CLOCKS_PER_SEC)
+#define	SYNTROSERVER_SERVICE_INTERVAL		(SYNTRO_CLOCKS_PER_SEC / 10)	// how often an event driven link is polled as a backstop
+
+#define	SYNTROSERVER_TXQUEUE_MAXMESSAGES	2000				// default TX queue message limit
+#define	SYNTROSERVER_TXQUEUE_MAXBYTES		(SYNTRO_MESSAGE_MAX * 16)	// default TX queue byte limit
+
+//	Link classes used to select socket options
+
+#define	SYNTROSERVER_LINK_LOCAL				0					// accepted local component link
+#define	SYNTROSERVER_LINK_LOCALTUNNEL		1					// dynamic tunnel, either end
+#define	SYNTROSERVER_LINK_STATICTUNNEL		2					// static tunnel, either end
+#define	SYNTROSERVER_LINK_CLASSES			3
+
+#define	SYNTROSERVER_LINK_BUFSIZE			(SYNTRO_MESSAGE_MAX * 3)	// default socket buffer size
+#define	SYNTROSERVER_STATICTUNNEL_BUFSIZE	(SYNTRO_MESSAGE_MAX * 8)	// default static tunnel socket buffer size
+
+#define	SYNTROSERVER_MULTICASTGROUP_BASE	"239.255.0.0"		// default group address for slot 0 (organization local scope)
+#define	SYNTROSERVER_MULTICASTGROUP_BUFSIZE	(SYNTRO_MESSAGE_MAX * 4)	// group socket send buffer size
+#define	SYNTROSERVER_BESTEFFORT_BUFSIZE		(SYNTRO_MESSAGE_MAX * 4)	// best effort socket buffer size
+
+#define	SYNTROSERVER_MAX_IOWORKERS			16					// max I/O worker threads
 
 class SyntroTunnel;
+class SyntroServerWorker;
 
 
 enum ConnState
@@ -90,6 +157,8 @@ typedef struct
 	QString tunnelStaticName;								// name of the static tunnel
 	QString tunnelStaticPrimary;							// static tunnel primary IP address
 	QString tunnelStaticBackup;								// static tunnel backup IP address
+	int tunnelTXScheduler;									// static tunnel scheduler (-1 = server default)
+	int tunnelTXSchedulerWeights[SYNTROLINK_PRIORITIES];	// static tunnel scheduler weights
 
 	SyntroThread *widgetThread;								// the thread pointer if a widget link
 	int widgetMessageID;
@@ -99,6 +168,9 @@ typedef struct
 	int compPort;											// the component's port
 	SyntroSocket *sock;										// socket for SyntroLink connection
 	int connectionID;										// its connection ID
+	SyntroServerWorker *worker;								// the I/O worker that owns the socket or NULL if it's this thread
+	QAtomicInt workerRXPending;								// set while a receive notification from the worker is waiting
+	QAtomicInt workerTXPending;								// set while a send request to the worker is waiting
   
 	// Heartbeat system vars
 
@@ -107,6 +179,8 @@ typedef struct
 	qint64 lastHeartbeatSent;								// time last heartbeat was send (used by tunnel source)
 	qint64 heartbeatInterval;								// expected receive interval (from heartbeat itself) or send interval if tunnel source
 	qint64 heartbeatTimeoutPeriod;							// if no heartbeats received for this time, time out the SyntroLink
+	SYNTRO_TIMER heartbeatTimer;							// expires when the link may have timed out
+	SYNTRO_TIMER serviceTimer;								// expires when the component's background work is due
 
 	int state;												// the connection's state
 	SyntroTunnel *syntroTunnel;								// the tunnel class if it is a tunnel source
@@ -128,17 +202,26 @@ typedef struct
 	quint32 RXPacketRate;									// receive byte rate
 	quint32 TXPacketRate;									// transmit byte rate
 
+	quint32 TXDropCount;									// messages dropped or rejected by the TX queues
+	bool TXCongested;										// true if any TX queue is congested
+	SYNTROLINK_LATENCY TXLatency[SYNTROLINK_PRIORITIES];	// TX latency stats for each priority
+
+	quint32 bestEffortKey;									// key for best effort datagrams on this link (0 = not bound)
+
+	QList<SYNTRO_UID> routeUIDs;							// UIDs this component has entries for in m_routeLookup
+
 	qint64 lastStatsTime;									// last time stats were updated
 
 } SS_COMPONENT;
 
 // SyntroServer
 
-class SYNTROCONTROLLIB_EXPORT SyntroServer : public SyntroThread
+class SYNTROCONTROLLIB_EXPORT SyntroServer : public SyntroThread, public SyntroLinkBackpressure
 {
 	Q_OBJECT
 
     friend class SyntroTunnel;
+    friend class SyntroServerWorker;
 
 public:
 	SyntroServer();						
@@ -161,9 +244,20 @@ public:
 	DirectoryManager m_dirManager;							// the directory manager object
 	MulticastManager m_multicastManager;					// the multicast manager object
 	FastUIDLookup m_fastUIDLookup;						// the fast UID lookup object
+	FastUIDLookup m_routeLookup;							// maps link and DE UIDs to the component that reaches them
+	SyntroTimerWheel m_timerWheel;							// the components' heartbeat timers
+	SyntroTimerWheel m_serviceWheel;						// the components' background work timers
 
 	bool sendSyntroMessage(SYNTRO_UID *uid, int cmd, SYNTRO_MESSAGE *message, int length, int priority);
+	bool sendSyntroSharedMessage(SYNTRO_UID *uid, int cmd, SYNTRO_MESSAGE *header, int headerLength,
+				SyntroSharedBuffer *shared, unsigned char *sharedPtr, int sharedLength, int priority);
 	void setComponentSocket(SS_COMPONENT *syntroComponent, SyntroSocket *sock); // allocate a socket to this component
+	void setComponentLink(SS_COMPONENT *syntroComponent);	// allocate and configure a SyntroLink for this component
+
+	void linkBackpressure(SyntroLink *link, int priority, bool congested);	// any thread - passes it on to the server thread
+
+	bool isGroupCapable(SYNTRO_UID *uid);					// if uid is a directly connected component that can use IP multicast groups
+	bool isBestEffortCapable(SYNTRO_UID *uid);				// if uid is at the end of a link bound for best effort datagrams
 
 	qint64 m_multicastIn;									// total multicast in count
 	unsigned m_multicastInRate;								// rate accumulator
@@ -191,19 +285,24 @@ protected:
 	void timerEvent(QTimerEvent *event);
 	void loadStaticTunnels(QSettings *settings);
     void loadValidTunnelSources(QSettings *settings);
+	void loadTXSchedulerWeights(QSettings *settings, const char *key, int *weights);
+	void loadSocketOptions(QSettings *settings, const char *group, SYNTRO_SOCKET_OPTIONS *options);
 	bool processMessage(SyntroThreadMsg* msg);
 	bool openSockets();										// open the sockets SyntroControl needs
     int getNextConnectionID();                              // gets the next free connection ID
 
 	bool syConnected(SS_COMPONENT *syntroComponent);
-	bool syAccept(bool staticTunnel);
+	bool syAccept(SyntroSocket *listenSock, bool staticTunnel);
 	void syClose(SS_COMPONENT *syntroComponent);
-	SyntroSocket *getNewSocket(bool staticTunnel);
+	SyntroSocket *getNewSocket(bool staticTunnel, bool local = false);
 	SS_COMPONENT *getFreeComponent();
 	void processHelloBeacon(HELLO *hello);
 	void processHelloUp(HELLOENTRY *helloEntry);
 	void processHelloDown(HELLOENTRY *helloEntry);
 	void syntroBackground();
+	void startHeartbeatTimer(SS_COMPONENT *syntroComponent, qint64 now);	// times the link from its last heartbeat
+	void checkHeartbeatTimeouts(qint64 now);				// times out links whose heartbeat timers have expired
+	void serviceComponents(qint64 now);						// does the background work of components whose service timers have expired
 	void sendHeartbeat(SS_COMPONENT *syntroComponent);
 	void sendTunnelHeartbeat(SS_COMPONENT *syntroComponent);
 	void setupComponentStatus();
@@ -219,23 +318,62 @@ protected:
 
 	void forwardE2EMessage(SYNTRO_MESSAGE *message, int length);
 
-//	forwardMulticastMessage - forwards a multicastmessage to the registered remote Components
+//	forwardMulticastMessage - forwards a multicastmessage to the registered remote Components.
+//	The message is consumed.
 
 	void forwardMulticastMessage(SS_COMPONENT *syntroComponent, int cmd, SYNTRO_MESSAGE *message, int length);
 
 //	findComponent - maps an identifier to a component
 
 	SS_COMPONENT *findComponent(SYNTRO_IPADDR compAddr, int compPort);
+	QHash<quint64, SS_COMPONENT *> m_addressLookup;		// accepted components keyed by address and port
+	quint64 addressKey(SYNTRO_IPADDR compAddr, int compPort);
+
+//	findRoute - maps a UID to the component whose link reaches it. Directly connected
+//	components take precedence over those listed in another link's DE.
+
+	SS_COMPONENT *findRoute(SYNTRO_UID *uid);
+	SS_COMPONENT *findDirectRoute(SYNTRO_UID *uid);		// as findRoute but only if uid is at the far end of the link
+	void addRoute(SS_COMPONENT *syntroComponent, SYNTRO_UID *uid, bool direct);
+	void updateRoutes(SS_COMPONENT *syntroComponent);		// resets the component's routes from its hello and DE
+	void removeRoutes(SS_COMPONENT *syntroComponent);
 
 	SyntroSocket *m_listSyntroLinkSock;						// local listener socket
 
 	SyntroSocket *m_listStaticTunnelSock;					// static tunnel listener socket
 
+	SyntroSocket *m_listLocalSock;							// Unix domain listener socket or NULL if not in use
+	bool m_unixSocket;										// if the Unix domain listener should be opened
+
+	bool m_useSocketPoller;									// if accepted links should use the poller
+	SyntroSocketPoller *m_socketPoller;						// drives raw accepted links or NULL if not in use
+	bool m_sharedMemory;									// if local links may use shared memory
+
+	int m_IOWorkerCount;									// number of entries in m_IOWorkers
+	SyntroServerWorker *m_IOWorkers[SYNTROSERVER_MAX_IOWORKERS];	// the I/O workers
+	SyntroServerWorker *getIOWorker(int connectionID);		// the worker for a new poller driven link or NULL
+	void deleteComponentLink(SS_COMPONENT *syntroComponent);	// deletes the link and socket
+	void trySending(SS_COMPONENT *syntroComponent);			// sends queued messages here or via the component's worker
+
+	bool m_multicastGroups;									// if multicast services may be sent to IP multicast groups
+	QString m_multicastGroupBase;							// group address for slot 0
+	int m_multicastGroupPort;								// group UDP port
+	int m_multicastGroupTTL;								// group datagram TTL
+	SyntroSocket *m_groupSock;								// sends the group datagrams or NULL if not in use
+
+	bool m_bestEffort;										// if best effort multicast is enabled
+	int m_bestEffortPort;									// best effort UDP port
+	SyntroSocket *m_bestEffortSock;							// best effort datagram socket or NULL if not in use
+	void sendBestEffortBind(SS_COMPONENT *syntroComponent);	// give the far end a key and port for datagrams
+	void processBestEffortRequest(SS_COMPONENT *syntroComponent, SYNTRO_BESTEFFORT *request);
+	void processBestEffortData();							// reads datagrams from m_bestEffortSock
+
 	QMutex m_lock;
 	Hello *m_hello;
 
 	SS_COMPONENT *getComponentFromConnectionID(int connectionID); // uses m_connectioIDMap to get a component pointer
 	void processReceivedData(SS_COMPONENT *syntroComponent);
+	void processBackpressure(SyntroLink *link, int priority);	// records a TX queue congestion change
 	void processReceivedDataDemux(SS_COMPONENT *syntroComponent, int cmd, int length, SYNTRO_MESSAGE *message);
 	qint64 m_heartbeatSendInterval;							// the initial interval for apps and the send interval for tunnel sources
 	int m_heartbeatTimeoutCount;							// number of heartbeat periods before SyntroLink timed out
@@ -254,6 +392,15 @@ protected:
 
 	qint64 m_lastOpenSocketsTime;							// last time open sockets failed
 
+	int m_TXQueueMaxMessages;								// TX queue limits applied to non high priority queues
+	int m_TXQueueMaxBytes;
+	int m_TXQueuePolicy;
+	int m_TXFragmentSize;									// link fragment size (0 = don't fragment)
+	int m_TXScheduler;										// link scheduler
+	int m_TXSchedulerWeights[SYNTROLINK_PRIORITIES];		// and its weights
+
+	SYNTRO_SOCKET_OPTIONS m_socketOptions[SYNTROSERVER_LINK_CLASSES];	// kernel socket options for each link class
+
     QList<SYNTRO_UID> m_validTunnelSources;                 // list of valid UIDs that can be tunnel sources
 
 private:
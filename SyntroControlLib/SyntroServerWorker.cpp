@@ -0,0 +1,132 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroControlLib
+//
+//  SyntroControlLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroControlLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroControlLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "SyntroServerWorker.h"
+#include "SyntroControlLib.h"
+#include "SyntroThread.h"
+
+// SyntroServerWorker
+
+SyntroServerWorker::SyntroServerWorker(SyntroServer *server, int shard)
+	: SyntroThread(QString("SyntroServerWorker%1").arg(shard), server->m_logTag), m_shardLock(QMutex::Recursive)
+{
+	m_server = server;
+	m_shard = shard;
+	m_poller = NULL;
+	useMailbox();											// send requests come from the server thread
+}
+
+SyntroServerWorker::~SyntroServerWorker()
+{
+}
+
+void SyntroServerWorker::initThread()
+{
+	QMutexLocker locker(&m_shardLock);
+
+	m_poller = new SyntroSocketPoller(this);				// must be created in this thread
+	if (!m_poller->isValid()) {
+		logWarn(QString("Socket poller not available for I/O worker %1").arg(m_shard));
+		delete m_poller;
+		m_poller = NULL;
+		return;
+	}
+	m_poller->setDispatchLock(&m_shardLock);
+}
+
+void SyntroServerWorker::finishThread()
+{
+	QMutexLocker locker(&m_shardLock);
+
+	if (m_poller != NULL)
+		delete m_poller;
+	m_poller = NULL;
+}
+
+SyntroSocketPoller *SyntroServerWorker::poller()
+{
+	return m_poller;
+}
+
+//	requestSend asks the worker to send a component's queued messages. Requests are coalesced so
+//	there is at most one waiting for each component.
+
+void SyntroServerWorker::requestSend(SS_COMPONENT *syntroComponent)
+{
+	if (syntroComponent->workerTXPending.testAndSetOrdered(0, 1))
+		postThreadMessage(SYNTROSERVER_WORKER_SEND_MESSAGE, syntroComponent->index, NULL);
+}
+
+SS_COMPONENT *SyntroServerWorker::getMyComponent(int connectionID)
+{
+	SS_COMPONENT *syntroComponent;
+
+	if ((syntroComponent = m_server->getComponentFromConnectionID(connectionID)) == NULL)
+		return NULL;
+	if ((syntroComponent->worker != this) || (syntroComponent->syntroLink == NULL) || (syntroComponent->sock == NULL))
+		return NULL;
+	if (syntroComponent->sock->sockGetConnectionID() != connectionID)
+		return NULL;
+	return syntroComponent;
+}
+
+//	Socket messages are dispatched by the poller with the shard lock held. Only the close is
+//	passed on unchanged as SyntroServer must do the cleanup.
+
+bool SyntroServerWorker::processMessage(SyntroThreadMsg* msg)
+{
+	SS_COMPONENT *syntroComponent;
+
+	switch(msg->message) {
+		case SYNTROSERVER_ONRECEIVE_MESSAGE:
+			if ((syntroComponent = getMyComponent(msg->intParam)) == NULL)
+				return true;
+			syntroComponent->syntroLink->tryReceiving(syntroComponent->sock);
+			if (syntroComponent->workerRXPending.testAndSetOrdered(0, 1))
+				m_server->postThreadMessage(SYNTROSERVER_ONRECEIVE_WORKER_MESSAGE, syntroComponent->index, NULL);
+			return true;
+
+		case SYNTROSERVER_ONSEND_MESSAGE:
+			if ((syntroComponent = getMyComponent(msg->intParam)) == NULL)
+				return true;
+			syntroComponent->syntroLink->trySending(syntroComponent->sock);
+			return true;
+
+		case SYNTROSERVER_ONCLOSE_MESSAGE:
+			if (getMyComponent(msg->intParam) == NULL)
+				return true;
+			m_server->postThreadMessage(SYNTROSERVER_ONCLOSE_MESSAGE, msg->intParam, NULL);
+			return true;
+
+		case SYNTROSERVER_WORKER_SEND_MESSAGE:
+		{
+			QMutexLocker locker(&m_shardLock);
+
+			if ((msg->intParam < 0) || (msg->intParam >= SYNTRO_MAX_CONNECTEDCOMPONENTS))
+				return true;
+			syntroComponent = m_server->m_components + msg->intParam;
+			syntroComponent->workerTXPending.fetchAndStoreOrdered(0);	// clear before sending so no request is lost
+			if ((syntroComponent->worker != this) || (syntroComponent->syntroLink == NULL) || (syntroComponent->sock == NULL))
+				return true;
+			syntroComponent->syntroLink->trySending(syntroComponent->sock);
+			return true;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroControlLib
+//
+//  SyntroControlLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroControlLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroControlLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef SYNTROSERVERWORKER_H
+#define SYNTROSERVERWORKER_H
+
+#include "SyntroLib.h"
+#include "SyntroServer.h"
+
+//	SyntroServerWorker is an I/O thread that owns a shard of SyntroServer's poller driven links.
+//	It does the socket reads, framing and socket writes for its links. Received messages are left
+//	in the links' RX queues and SyntroServer is told to process them. SyntroServer queues messages
+//	to a link as before and then asks the link's worker to send them.
+//
+//	Only socket I/O and framing are sharded. Message processing, heartbeats, directory processing
+//	and multicast forwarding all stay on the SyntroServer thread, so throughput only scales with
+//	workers as far as socket I/O was the limit.
+//
+//	The shard lock is held while the worker is using its links. SyntroServer must hold it while it
+//	attaches or deletes a link or socket that belongs to the worker.
+
+class SyntroServerWorker : public SyntroThread
+{
+public:
+	SyntroServerWorker(SyntroServer *server, int shard);
+	virtual ~SyntroServerWorker();
+
+	QMutex *shardLock() { return &m_shardLock; }
+	SyntroSocketPoller *poller();							// call with the shard lock held - NULL if not ready
+	void requestSend(SS_COMPONENT *syntroComponent);		// any thread - send the component's queued messages
+
+protected:
+	void initThread();
+	void finishThread();
+	bool processMessage(SyntroThreadMsg* msg);
+
+private:
+	SS_COMPONENT *getMyComponent(int connectionID);		// returns NULL if the link isn't in this shard
+
+	SyntroServer *m_server;
+	int m_shard;
+	QMutex m_shardLock;
+	SyntroSocketPoller *m_poller;							// drives the shard's sockets
+};
+
+#endif // SYNTROSERVERWORKER_H
@@ -46,7 +46,6 @@ bool SyntroTunnel::connect()
 {
 	int	returnValue;
 	char str[1024];
-	int bufSize = SYNTRO_MESSAGE_MAX * 3;
 	qint64 now = SyntroClock();
 
 	m_connectInProgress = false;
@@ -85,15 +84,15 @@ bool SyntroTunnel::connect()
     else
         m_comp->sock = new SyntroSocket(m_server, id, m_server->m_encryptLocal);
 	m_server->setComponentSocket(m_comp, m_comp->sock);
-	m_comp->syntroLink = new SyntroLink(m_logTag);
+	m_server->setComponentLink(m_comp);
 	returnValue = m_comp->sock->sockCreate(0, SOCK_STREAM);
 
 	m_comp->sock->sockSetConnectMsg(SYNTROSERVER_ONCONNECT_MESSAGE);
 	m_comp->sock->sockSetCloseMsg(SYNTROSERVER_ONCLOSE_MESSAGE);
 	m_comp->sock->sockSetReceiveMsg(SYNTROSERVER_ONRECEIVE_MESSAGE);
 
-	m_comp->sock->sockSetReceiveBufSize(bufSize);
-	m_comp->sock->sockSetSendBufSize(bufSize);
+	m_comp->sock->sockSetOptions(m_server->m_socketOptions +
+		(m_comp->tunnelStatic ? SYNTROSERVER_LINK_STATICTUNNEL : SYNTROSERVER_LINK_LOCALTUNNEL));
 
 	if (returnValue == 0)
 		return false;
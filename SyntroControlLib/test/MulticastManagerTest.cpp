@@ -0,0 +1,158 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroControlLib
+//
+//  SyntroControlLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroControlLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroControlLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <QtTest>
+
+#include "MulticastManager.h"
+
+class MulticastManagerTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void portReuse();
+	void freeSlotReuse();
+	void staleRegistration();
+};
+
+//	portReuse frees and reallocates the same slot until the ports have gone all the way round twice.
+//	Each allocation must get the next port, every port must survive the trip through a SYNTRO_UC2
+//	and the port of the freed map must be rejected.
+
+void MulticastManagerTest::portReuse()
+{
+	MulticastManager manager;
+	MM_MMAP *multicastMap;
+	SYNTRO_UID uid;
+	SYNTRO_UC2 uc2;
+	int port;
+	int lastPort = -1;
+
+	memset(&uid, 0, sizeof(SYNTRO_UID));
+	manager.m_server = NULL;
+
+	for (int pass = 0; pass < 2 * MM_PORTS; pass++) {
+		multicastMap = manager.MMAllocateMMap(&uid, &uid, "Test", SYNTRO_STREAMNAME_VIDEO, 1);
+		QVERIFY(multicastMap != NULL);
+		QCOMPARE(multicastMap->slot, 0);
+
+		port = multicastMap->index;
+		QCOMPARE(port, pass % MM_PORTS);
+		SyntroUtils::convertIntToUC2(port, uc2);
+		QCOMPARE(SyntroUtils::convertUC2ToUInt(uc2), port);
+		QVERIFY(manager.MMGetMMap(SyntroUtils::convertUC2ToUInt(uc2)) == multicastMap);
+		if (lastPort != -1)
+			QVERIFY(manager.MMGetMMap(lastPort) == NULL);
+
+		manager.MMFreeMMap(multicastMap);
+		QVERIFY(manager.MMGetMMap(port) == NULL);
+		lastPort = port;
+	}
+}
+
+//	freeSlotReuse checks that freed slots are reused oldest first, that the table only grows when
+//	there are none left and that a reused slot still gets a new port.
+
+void MulticastManagerTest::freeSlotReuse()
+{
+	MulticastManager manager;
+	MM_MMAP *multicastMaps[3];
+	MM_MMAP *multicastMap;
+	SYNTRO_UID uid;
+
+	memset(&uid, 0, sizeof(SYNTRO_UID));
+	manager.m_server = NULL;
+
+	for (int i = 0; i < 3; i++) {
+		multicastMaps[i] = manager.MMAllocateMMap(&uid, &uid, "Test", SYNTRO_STREAMNAME_VIDEO, 1);
+		QVERIFY(multicastMaps[i] != NULL);
+		QCOMPARE(multicastMaps[i]->slot, i);
+		QCOMPARE(multicastMaps[i]->index, i);
+	}
+
+	manager.MMFreeMMap(multicastMaps[1]);
+	manager.MMFreeMMap(multicastMaps[0]);
+
+	multicastMap = manager.MMAllocateMMap(&uid, &uid, "Test", SYNTRO_STREAMNAME_VIDEO, 1);
+	QVERIFY(multicastMap == multicastMaps[1]);				// freed first so reused first
+	QCOMPARE(multicastMap->index, 3);
+	QVERIFY(manager.MMGetMMap(1) == NULL);
+	QVERIFY(manager.MMGetMMap(3) == multicastMap);
+
+	multicastMap = manager.MMAllocateMMap(&uid, &uid, "Test", SYNTRO_STREAMNAME_VIDEO, 1);
+	QVERIFY(multicastMap == multicastMaps[0]);
+	QCOMPARE(multicastMap->index, 4);
+	QVERIFY(manager.MMGetMMap(0) == NULL);
+	QCOMPARE(manager.m_multicastMaps.count(), 3);
+
+	multicastMap = manager.MMAllocateMMap(&uid, &uid, "Test", SYNTRO_STREAMNAME_VIDEO, 1);
+	QVERIFY(multicastMap != NULL);
+	QCOMPARE(multicastMap->slot, 3);							// no free slots left so the table grows
+	QCOMPARE(multicastMap->index, 5);
+	QCOMPARE(manager.m_multicastMaps.count(), 4);
+}
+
+//	staleRegistration registers on a map, frees it and reallocates its slot. The registration
+//	mustn't carry over to the new map and an ack sent to the old port must be ignored.
+
+void MulticastManagerTest::staleRegistration()
+{
+	MulticastManager manager;
+	MM_MMAP *multicastMap;
+	SYNTRO_UID uid;
+	SYNTRO_EHEAD ehead;
+	int oldPort;
+
+	memset(&uid, 0, sizeof(SYNTRO_UID));
+	manager.m_server = NULL;
+	manager.m_myUID = uid;										// so no lookup requests are sent
+
+	multicastMap = manager.MMAllocateMMap(&uid, &uid, "Test", SYNTRO_STREAMNAME_VIDEO, 1);
+	QVERIFY(multicastMap != NULL);
+	oldPort = multicastMap->index;
+	QVERIFY(manager.MMAddRegistered(multicastMap, &uid, 5));
+	QVERIFY(manager.MMCheckRegistered(multicastMap, &uid, 5));
+	manager.MMFreeMMap(multicastMap);
+	QVERIFY(!manager.MMAddRegistered(multicastMap, &uid, 5));	// the map isn't valid any more
+
+	QVERIFY(manager.MMAllocateMMap(&uid, &uid, "Test", SYNTRO_STREAMNAME_VIDEO, 1) == multicastMap);
+	QVERIFY(multicastMap->index != oldPort);
+	QCOMPARE(multicastMap->registeredCount, 0);
+	QVERIFY(!manager.MMCheckRegistered(multicastMap, &uid, 5));
+
+	QVERIFY(manager.MMAddRegistered(multicastMap, &uid, 5));
+	multicastMap->registrations[0].sendSeq = 1;					// as if a message had been sent
+
+	memset(&ehead, 0, sizeof(SYNTRO_EHEAD));
+	ehead.sourceUID = uid;
+	ehead.destUID = uid;
+	SyntroUtils::convertIntToUC2(5, ehead.sourcePort);
+	SyntroUtils::convertIntToUC2(oldPort, ehead.destPort);
+	ehead.seq = 1;
+	manager.MMProcessMulticastAck(&ehead, sizeof(SYNTRO_EHEAD));
+	QCOMPARE((int)multicastMap->registrations[0].lastAckSeq, 0);	// the old port is rejected
+
+	SyntroUtils::convertIntToUC2(multicastMap->index, ehead.destPort);
+	manager.MMProcessMulticastAck(&ehead, sizeof(SYNTRO_EHEAD));
+	QCOMPARE((int)multicastMap->registrations[0].lastAckSeq, 1);
+}
+
+QTEST_APPLESS_MAIN(MulticastManagerTest)
+
+#include "MulticastManagerTest.moc"
@@ -0,0 +1,40 @@
+#
+#  Copyright (c) 2014 Scott Ellis and Richard Barnett
+#	
+#  This file is part of SyntroControlLib
+#
+#  SyntroControlLib is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU Lesser General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  SyntroControlLib is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU Lesser General Public License for more details.
+#
+#  You should have received a copy of the GNU Lesser General Public License
+#  along with SyntroControlLib.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+TEMPLATE = app
+TARGET = MulticastManagerTest
+
+QT += core network testlib
+QT -= gui
+
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+DEFINES += QT_NETWORK_LIB
+
+INCLUDEPATH += ../../SyntroLib \
+	../../SyntroControlLib
+
+win32* {
+    LIBS += -L../Release -L../../SyntroLib/Release -lSyntroControlLib -lSyntroLib
+} else {
+    LIBS += -L.. -L../../SyntroLib -lSyntroControlLib -lSyntroLib
+}
+
+SOURCES += MulticastManagerTest.cpp
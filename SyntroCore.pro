@@ -26,11 +26,15 @@ SUBDIRS = SyntroLib \
         SyntroControlLib \
         SyntroControl \
         SyntroDB \
-        SyntroAlert
+        SyntroAlert \
+        SyntroControlLibTest
+
+SyntroControlLibTest.subdir = SyntroControlLib/test
 
 SyntroGUI.depends = SyntroLib
 SyntroControlLib.depends = SyntroLib
 SyntroControl.depends = SyntroLib SyntroGUI SyntroControlLib
 SyntroDB.depends = SyntroLib SyntroGUI
 SyntroAlert.depends = SyntroLib SyntroGUI SyntroControlLib
+SyntroControlLibTest.depends = SyntroLib SyntroControlLib
 
@@ -153,13 +153,15 @@ bool Endpoint::clientLoadServices(bool enabled, int *serviceCount, int *serviceS
 	cloud directory and subscribe to the service if it is multicast. If \a enabled is true then 
 	Endpoint will regard the service as active perform look ups etc as necessary. If it is false, 
 	Endpoint will not process the service apart from adding it to the service table. The service 
-	can be enabled later by calling clientEnableService().
+	can be enabled later by calling clientEnableService(). If \a bestEffort is true, a multicast 
+	service is carried in UDP datagrams between Endpoint and SyntroControl whenever a message fits 
+	in one. Datagrams are not acked or retransmitted and one that arrives after a later one is dropped.
 
 	The function returns -1 if there is an error. Otherwise, the return value is the servicePort 
 	that should be used for further interactions with this service.
 */
 
-int Endpoint::clientAddService(QString servicePath, int serviceType, bool local, bool enabled)
+int Endpoint::clientAddService(QString servicePath, int serviceType, bool local, bool enabled, bool bestEffort)
 {
 	int servicePort;
 	SYNTRO_SERVICE_INFO *service;
@@ -188,6 +190,13 @@ int Endpoint::clientAddService(QString servicePath, int serviceType, bool local,
 	service->state = SYNTRO_LOCAL_SERVICE_STATE_INACTIVE;
 	service->serviceData = -1;
 	service->serviceDataPointer = NULL;
+	if (service->groupJoined)
+		groupLeave(servicePort, false);					// left over from a removed service
+	service->groupRepair = false;
+	service->bestEffort = bestEffort && (serviceType == SERVICETYPE_MULTICAST);
+	service->bestEffortSeq = 0;
+	service->bestEffortLastDatagram = false;
+	memset(&(service->bestEffortRX), 0, sizeof(SYNTRO_BESTEFFORT_RX));
 	if (!local) {
 		strcpy(service->serviceLookup.servicePath, qPrintable(servicePath));
 		service->serviceLookup.serviceType = serviceType;
@@ -578,6 +587,110 @@ bool Endpoint::clientIsConnected()
 	return m_connected;
 }
 
+/*!
+	Limits the SyntroLink transmit queue for \a priority to \a maxMessages messages and \a maxBytes bytes.
+	A value of 0 means no limit. \a policy is one of SYNTROLINK_TXPOLICY_DROPOLDEST, SYNTROLINK_TXPOLICY_DROPNEWEST
+	or SYNTROLINK_TXPOLICY_REJECT and determines what happens when a limit is reached. appClientBackpressure()
+	is called when the queue becomes congested and when it clears again. The limits take effect when the
+	SyntroLink is next created so this should normally be called from appClientInit().
+*/
+
+void Endpoint::clientSetTXQueueLimits(int priority, int maxMessages, int maxBytes, int policy)
+{
+	if ((priority < SYNTROLINK_HIGHPRI) || (priority > SYNTROLINK_LOWPRI)) {
+		logWarn(QString("clientSetTXQueueLimits with illegal priority %1").arg(priority));
+		return;
+	}
+	m_TXMaxMessages[priority] = maxMessages;
+	m_TXMaxBytes[priority] = maxBytes;
+	m_TXPolicy[priority] = policy;
+}
+
+/*!
+	Sets whether messages lost on the IP multicast group used for the remote multicast service
+	\a servicePort are resent by SyntroControl. If \a repair is false (the default) a lost message
+	is just counted. If it is true, SyntroControl resends it over the SyntroLink if it still has a copy.
+	Repaired messages arrive late and out of order. Returns false if \a servicePort isn't a remote
+	multicast service.
+*/
+
+bool Endpoint::clientSetServiceGroupRepair(int servicePort, bool repair)
+{
+	SYNTRO_SERVICE_INFO *service;
+
+	QMutexLocker locker(&m_serviceLock);
+
+	if ((servicePort < 0) || (servicePort >= SYNTRO_MAX_SERVICESPERCOMPONENT)) {
+		logWarn(QString("Tried to set group repair for service in out of range port %1").arg(servicePort));
+		return false;
+	}
+	service = m_serviceInfo + servicePort;
+	if (!service->inUse || service->local || (service->serviceType != SERVICETYPE_MULTICAST)) {
+		logWarn(QString("Tried to set group repair on port %1 that is not a remote multicast service").arg(servicePort));
+		return false;
+	}
+	if (service->groupRepair == repair)
+		return true;
+	service->groupRepair = repair;
+	if (service->groupJoined)								// let SyntroControl know about the change
+		sendGroupRequest(&(service->groupControlUID), service->groupSlot, servicePort,
+			repair ? SYNTRO_MULTICAST_GROUP_JOIN_REPAIR : SYNTRO_MULTICAST_GROUP_JOIN);
+	return true;
+}
+
+/*!
+	Returns the number of messages \a received and \a lost on the IP multicast group used for the
+	remote multicast service \a servicePort. Returns false if the service isn't being received from a group.
+*/
+
+bool Endpoint::clientGetServiceGroupStats(int servicePort, qint64 *received, qint64 *lost)
+{
+	SYNTRO_SERVICE_INFO *service;
+
+	QMutexLocker locker(&m_serviceLock);
+
+	if ((servicePort < 0) || (servicePort >= SYNTRO_MAX_SERVICESPERCOMPONENT))
+		return false;
+	service = m_serviceInfo + servicePort;
+	if (!service->inUse || !service->groupJoined)
+		return false;
+	*received = service->groupReceived;
+	*lost = service->groupLost;
+	return true;
+}
+
+/*!
+	Returns the number of datagrams \a received, \a lost and dropped because they arrived \a late on
+	the best effort remote multicast service \a servicePort. Messages that were too big for a datagram
+	and so came over the SyntroLink aren't counted. Returns false if the service isn't best effort.
+*/
+
+bool Endpoint::clientGetServiceBestEffortStats(int servicePort, qint64 *received, qint64 *lost, qint64 *late)
+{
+	SYNTRO_SERVICE_INFO *service;
+
+	QMutexLocker locker(&m_serviceLock);
+
+	if ((servicePort < 0) || (servicePort >= SYNTRO_MAX_SERVICESPERCOMPONENT))
+		return false;
+	service = m_serviceInfo + servicePort;
+	if (!service->inUse || service->local || !service->bestEffort)
+		return false;
+	*received = service->bestEffortRX.received;
+	*lost = service->bestEffortRX.lost;
+	*late = service->bestEffortRX.late;
+	return true;
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::linkBackpressure(SyntroLink *, int priority, bool)
+{
+	postThreadMessage(ENDPOINT_ONBACKPRESSURE_MESSAGE, priority, NULL);	// tell the app from the Endpoint thread
+}
+
 /*!
 	This function allows an integer user data \a value to be added to the service entry indicated by \a servicePort.
 */
@@ -703,7 +816,8 @@ qint64 Endpoint::clientGetLastSendTime(int servicePort)
 /*!
 	Returns true if the service referenced by \a servicePort is a local multicast service and 
 	the acknowledge window is open. This function should always be called before sending 
-	multicast data on a local service.
+	multicast data on a local service. A best effort service is always clear to send once 
+	SyntroControl has bound the SyntroLink for datagrams.
 */
 
 bool Endpoint::clientClearToSend(int servicePort)
@@ -727,8 +841,12 @@ bool Endpoint::clientClearToSend(int servicePort)
 		return false;
 	}
 
+	// datagrams aren't acked
+	if (service->bestEffort && (m_bestEffortKey != 0))
+		return true;
+
 	// within the send/ack window ?
-	if (SyntroUtils::isSendOK(service->nextSendSeqNo, service->lastReceivedAck)) {
+	if (SyntroUtils::sendWindowOpen(&service->sendWindow, service->nextSendSeqNo, service->lastReceivedAck)) {
 		return true;
 	}
 
@@ -739,6 +857,7 @@ bool Endpoint::clientClearToSend(int servicePort)
 
 	// we timed out, reset our sequence numbers
 	service->lastReceivedAck = service->nextSendSeqNo;
+	SyntroUtils::sendWindowReset(&service->sendWindow);
 	return true;
 }
 
@@ -899,7 +1018,12 @@ bool Endpoint::clientSendMessage(int servicePort, SYNTRO_EHEAD *message, int len
 			return false;
 		}
 		message->seq = service->nextSendSeqNo++;
-		syntroSendMessage(SYNTROMSG_MULTICAST_MESSAGE, (SYNTRO_MESSAGE *)message, sizeof(SYNTRO_EHEAD) + length, priority);
+		if (service->bestEffort && sendBestEffort(service, message, sizeof(SYNTRO_EHEAD) + length))
+			service->lastReceivedAck = service->nextSendSeqNo;	// SyntroControl doesn't ack datagrams
+		else {
+			SyntroUtils::sendWindowSent(&service->sendWindow, message->seq, SyntroClock());
+			syntroSendMessage(SYNTROMSG_MULTICAST_MESSAGE, (SYNTRO_MESSAGE *)message, sizeof(SYNTRO_EHEAD) + length, priority);
+		}
 	} else {
 		if (!service->local && (service->state != SYNTRO_REMOTE_SERVICE_STATE_REGISTERED)) {
 			logWarn(QString("Tried to send E2E message on remote service without successful lookup on port %1").arg(servicePort));
@@ -952,8 +1076,22 @@ bool Endpoint::clientSendMulticastAck(int servicePort)
 		return false;
 	}
 
-	sendMulticastAck(servicePort, service->lastReceivedSeqNo + 1);
+	if (service->bestEffortLastDatagram)
+		return true;										// SyntroControl doesn't wait for acks on datagrams
 
+	if (m_configMulticastAckCount <= 1) {
+		sendMulticastAck(servicePort, service->lastReceivedSeqNo + 1);
+		return true;
+	}
+
+	//	The ack is held until enough messages have been received or the ack timer goes off.
+	//	Then the acks of all the services are sent together. The timer only runs while an ack
+	//	is held and can only be started from the Endpoint's thread, so elsewhere the ack is sent now.
+
+	if ((++service->ackPending >= m_configMulticastAckCount) || (QThread::currentThread() != thread()))
+		flushMulticastAcks();
+	else if (m_ackTimer == -1)
+		m_ackTimer = startTimer(m_configMulticastAckInterval);
 	return true;
 }
 
@@ -1047,10 +1185,42 @@ Endpoint::Endpoint(qint64 backgroundInterval, const char *compType)
 	m_backgroundInterval = backgroundInterval;
 	m_logTag = compType;
 
+	for (int i = 0; i < SYNTROLINK_PRIORITIES; i++) {
+		m_TXMaxMessages[i] = 0;
+		m_TXMaxBytes[i] = 0;
+		m_TXPolicy[i] = SYNTROLINK_TXPOLICY_DROPOLDEST;
+	}
+
 	QSettings *settings = SyntroUtils::getSettings();
 
 	m_configHeartbeatInterval = settings->value(SYNTRO_PARAMS_HBINTERVAL, SYNTRO_HEARTBEAT_INTERVAL).toInt();
 	m_configHeartbeatTimeout = settings->value(SYNTRO_PARAMS_HBTIMEOUT, SYNTRO_HEARTBEAT_TIMEOUT).toInt();
+	m_configTXFragmentSize = settings->value(SYNTRO_PARAMS_TXFRAGMENT_SIZE, 0).toInt();
+	m_configTXScheduler = settings->value(SYNTRO_PARAMS_TXSCHEDULER, SYNTROLINK_SCHED_STRICT).toInt();
+	m_configSharedMemory = settings->value(SYNTRO_PARAMS_SHAREDMEMORY, true).toBool();
+	m_configUnixSocket = settings->value(SYNTRO_PARAMS_UNIXSOCKET, true).toBool();
+	m_configMulticastGroups = settings->value(SYNTRO_PARAMS_MULTICASTGROUPS, true).toBool();
+	m_configBestEffort = settings->value(SYNTRO_PARAMS_BESTEFFORT, false).toBool();
+	m_configMulticastWindowMin = settings->value(SYNTRO_PARAMS_MULTICAST_WINDOW_MIN, SYNTRO_MAX_WINDOW).toInt();
+	m_configMulticastWindowMax = settings->value(SYNTRO_PARAMS_MULTICAST_WINDOW_MAX, SYNTRO_WINDOW_MAX).toInt();
+	m_configMulticastAckCount = settings->value(SYNTRO_PARAMS_MULTICAST_ACK_COUNT, SYNTRO_ACK_COUNT).toInt();
+	m_configMulticastAckInterval = settings->value(SYNTRO_PARAMS_MULTICAST_ACK_INTERVAL, SYNTRO_ACK_INTERVAL).toInt();
+	if (m_configMulticastAckInterval < 1)
+		m_configMulticastAckInterval = 1;
+	m_ackTimer = -1;
+	m_controlFlags = 0;
+
+	m_configTXSchedulerWeights[SYNTROLINK_HIGHPRI] = SYNTROLINK_SCHED_HIGHPRI_WEIGHT;
+	m_configTXSchedulerWeights[SYNTROLINK_MEDHIGHPRI] = SYNTROLINK_SCHED_MEDHIGHPRI_WEIGHT;
+	m_configTXSchedulerWeights[SYNTROLINK_MEDPRI] = SYNTROLINK_SCHED_MEDPRI_WEIGHT;
+	m_configTXSchedulerWeights[SYNTROLINK_LOWPRI] = SYNTROLINK_SCHED_LOWPRI_WEIGHT;
+
+	QStringList weights = settings->value(SYNTRO_PARAMS_TXSCHEDULER_WEIGHTS).toStringList();
+	for (int priority = SYNTROLINK_HIGHPRI; (priority <= SYNTROLINK_LOWPRI) && (priority < weights.count()); priority++) {
+		int weight = weights.at(priority).trimmed().toInt();
+		if (weight > 0)
+			m_configTXSchedulerWeights[priority] = weight;
+	}
 
 	delete settings;
 }
@@ -1067,6 +1237,8 @@ Endpoint::~Endpoint(void)
 void Endpoint::finishThread()
 {
 	killTimer(m_timer);
+	if (m_ackTimer != -1)
+		killTimer(m_ackTimer);
 
 	appClientExit();
 
@@ -1086,10 +1258,19 @@ void Endpoint::initThread()
 	m_sock = NULL;
 	m_syntroLink = NULL;
 	m_hello = NULL;
+	m_groupSock = NULL;
+	m_groupPort = 0;
+	m_bestEffortSock = NULL;
+	m_bestEffortControlPort = 0;
+	m_bestEffortKey = 0;
 
 	QSettings *settings = SyntroUtils::getSettings();
 
 	m_componentData.init(qPrintable(m_compType), m_configHeartbeatInterval);
+	if (m_configMulticastGroups)
+		m_componentData.addMyHelloFlags(HELLO_FLAG_MCASTGROUP);
+	if (m_configBestEffort)
+		m_componentData.addMyHelloFlags(HELLO_FLAG_BESTEFFORT);
 	m_UID = m_componentData.getMyUID();
 
 	serviceInit();
@@ -1142,8 +1323,13 @@ void Endpoint::setHeartbeatTimers(int interval, int timeout)
 	\internal
 */
 
-void Endpoint::timerEvent(QTimerEvent *)
+void Endpoint::timerEvent(QTimerEvent *event)
 {
+	if (event->timerId() == m_ackTimer) {
+		QMutexLocker locker(&m_serviceLock);
+		flushMulticastAcks();								// also stops the timer
+		return;
+	}
 	endpointBackground();
 	appClientBackground();
 }
@@ -1318,6 +1504,14 @@ bool Endpoint::endpointSocketMessage(SyntroThreadMsg *msg)
 			return true;
 
 		case ENDPOINT_ONRECEIVE_MESSAGE:
+			if (msg->intParam == ENDPOINT_GROUP_CONNECTIONID) {
+				processGroupData();
+				return true;
+			}
+			if (msg->intParam == ENDPOINT_BESTEFFORT_CONNECTIONID) {
+				processBestEffortData();
+				return true;
+			}
 			if (m_sock != NULL) {
 #ifdef ENDPOINT_TRACE
 				TRACE0("Endpoint data received");
@@ -1335,6 +1529,11 @@ bool Endpoint::endpointSocketMessage(SyntroThreadMsg *msg)
 				return true;
 			}
 			return true;
+
+		case ENDPOINT_ONBACKPRESSURE_MESSAGE:
+			if (m_syntroLink != NULL)
+				appClientBackpressure(msg->intParam, m_syntroLink->isTXCongested(msg->intParam));
+			return true;
 	}
 
 	return false;
@@ -1421,6 +1620,7 @@ void Endpoint::processReceivedDataDemux(int cmd, int len, SYNTRO_MESSAGE*syntroM
 				break;
 			}
 
+			m_serviceInfo[destPort].bestEffortLastDatagram = false;
 			processMulticast(ehead, len, destPort);
 			break;
 
@@ -1494,6 +1694,26 @@ void Endpoint::processReceivedDataDemux(int cmd, int len, SYNTRO_MESSAGE*syntroM
 				processE2E(ehead, len, destPort);
 			break;
 
+		case SYNTROMSG_MULTICAST_GROUP:
+			if (len != (int)sizeof(SYNTRO_MULTICAST_GROUP)) {
+				logWarn(QString("Multicast group message size error %1").arg(len));
+				free(syntroMessage);
+				break;
+			}
+			processGroupOffer((SYNTRO_MULTICAST_GROUP *)syntroMessage);
+			free(syntroMessage);
+			break;
+
+		case SYNTROMSG_BESTEFFORT:
+			if (len != (int)sizeof(SYNTRO_BESTEFFORT)) {
+				logWarn(QString("Best effort message size error %1").arg(len));
+				free(syntroMessage);
+				break;
+			}
+			processBestEffortRequest((SYNTRO_BESTEFFORT *)syntroMessage);
+			free(syntroMessage);
+			break;
+
 		default:
 			TRACE1("Unexpected message %d", cmd);
 			free(syntroMessage);
@@ -1526,6 +1746,56 @@ void Endpoint::sendMulticastAck(int servicePort, int seq)
 	\internal
 */
 
+void Endpoint::flushMulticastAcks()
+{
+	SYNTRO_SERVICE_INFO *service;
+	SYNTRO_MULTICAST_ACKS *acks;
+	SYNTRO_MULTICAST_ACK_ENTRY *entry;
+	int ports[SYNTRO_MULTICAST_ACKS_MAX];
+	int count = 0;
+
+	if ((m_ackTimer != -1) && (QThread::currentThread() == thread())) {
+		killTimer(m_ackTimer);								// nothing held once this is done
+		m_ackTimer = -1;
+	}
+
+	service = m_serviceInfo;
+	for (int i = 0; i < SYNTRO_MAX_SERVICESPERCOMPONENT; i++, service++) {
+		if (service->ackPending == 0)
+			continue;
+		service->ackPending = 0;
+		if (service->inUse && !service->local && (service->serviceType == SERVICETYPE_MULTICAST))
+			ports[count++] = i;
+	}
+	if (count == 0)
+		return;
+
+	if ((count == 1) || !(m_controlFlags & HELLO_FLAG_ACKBATCH)) {
+		for (int i = 0; i < count; i++)
+			sendMulticastAck(ports[i], m_serviceInfo[ports[i]].lastReceivedSeqNo + 1);
+		return;
+	}
+
+	int length = sizeof(SYNTRO_MULTICAST_ACKS) + count * sizeof(SYNTRO_MULTICAST_ACK_ENTRY);
+	acks = (SYNTRO_MULTICAST_ACKS *)malloc(length);
+	acks->sourceUID = m_componentData.getMyHeartbeat().hello.componentUID;
+	SyntroUtils::convertIntToUC2(count, acks->count);
+	entry = (SYNTRO_MULTICAST_ACK_ENTRY *)(acks + 1);
+	for (int i = 0; i < count; i++, entry++) {
+		service = m_serviceInfo + ports[i];
+		entry->destUID = service->serviceLookup.lookupUID;
+		SyntroUtils::copyUC2(entry->sourcePort, service->serviceLookup.localPort);
+		SyntroUtils::copyUC2(entry->destPort, service->serviceLookup.remotePort);
+		entry->seq = service->lastReceivedSeqNo + 1;
+		entry->spare = 0;
+	}
+	syntroSendMessage(SYNTROMSG_MULTICAST_ACKS, (SYNTRO_MESSAGE *)acks, length, SYNTROLINK_HIGHPRI);
+}
+
+/*!
+	\internal
+*/
+
 void Endpoint::sendE2EAck(SYNTRO_EHEAD *originalEhead)
 {
 	SYNTRO_EHEAD *ehead;
@@ -1568,6 +1838,9 @@ void Endpoint::serviceBackground()
 	now = SyntroClock();
 	service = m_serviceInfo;
 	for (servicePort = 0; servicePort < SYNTRO_MAX_SERVICESPERCOMPONENT; servicePort++, service++) {
+		if (service->groupJoined && (!service->inUse || !service->enabled
+				|| (service->state != SYNTRO_REMOTE_SERVICE_STATE_REGISTERED) || (service->destPort != service->groupSlot)))
+			groupLeave(servicePort, true);					// registration has changed so go back to the SyntroLink
 		if (!service->inUse)
 			continue;										// not being used
 		if (!service->enabled)
@@ -1664,7 +1937,20 @@ void Endpoint::serviceInit()
 		service->lastReceivedSeqNo = -1;
 		service->nextSendSeqNo = 0;
 		service->lastReceivedAck = 0;
+		SyntroUtils::sendWindowInit(&service->sendWindow, m_configMulticastWindowMin, m_configMulticastWindowMax);
+		service->ackPending = 0;
 		service->lastSendTime = 0;
+
+		service->groupRepair = false;
+		service->groupJoined = false;
+		service->groupMessage = NULL;
+		service->groupReceived = 0;
+		service->groupLost = 0;
+
+		service->bestEffort = false;
+		service->bestEffortSeq = 0;
+		service->bestEffortLastDatagram = false;
+		memset(&(service->bestEffortRX), 0, sizeof(SYNTRO_BESTEFFORT_RX));
 	}	
 }
 
@@ -1796,7 +2082,9 @@ void Endpoint::processLookupResponse(SYNTRO_SERVICE_LOOKUP *serviceLookup)
 				remoteService->state = SYNTRO_REMOTE_SERVICE_STATE_REGISTERED; // this is now active
 				remoteService->tLastLookupResponse = SyntroClock();		// reset the timeout timer
 				remoteService->serviceLookup.response = SERVICE_LOOKUP_SUCCEED;
-				remoteService->destPort = SyntroUtils::convertUC2ToInt(remoteService->serviceLookup.remotePort);
+				remoteService->destPort = SyntroUtils::convertUC2ToUInt(remoteService->serviceLookup.remotePort);
+				if (remoteService->bestEffort)
+					bestEffortSubscribe(remoteService);
 			}
 			break;
 
@@ -1831,8 +2119,10 @@ void Endpoint::processLookupResponse(SYNTRO_SERVICE_LOOKUP *serviceLookup)
 					memcpy(remoteService->serviceLookup.componentIndex, serviceLookup->componentIndex, sizeof(SYNTRO_UC2));
 					memcpy(remoteService->serviceLookup.ID, serviceLookup->ID, sizeof(SYNTRO_UC4));
 					remoteService->serviceLookup.response = SERVICE_LOOKUP_SUCCEED;
-					remoteService->destPort = SyntroUtils::convertUC2ToInt(remoteService->serviceLookup.remotePort);
+					remoteService->destPort = SyntroUtils::convertUC2ToUInt(remoteService->serviceLookup.remotePort);
 				}
+				if (remoteService->bestEffort)
+					bestEffortSubscribe(remoteService);	// also repairs a registration that SyntroControl recreated
 			}
 			break;
 
@@ -1918,6 +2208,9 @@ void Endpoint::linkCloseCleanup()
 {
 	SYNTRO_SERVICE_INFO *service = m_serviceInfo;
 
+	groupClose();
+	bestEffortClose();
+
 	for (int i = 0; i < SYNTRO_MAX_SERVICESPERCOMPONENT; i++, service++) {
 		if (!service->inUse)
 			continue;
@@ -1995,6 +2288,16 @@ bool Endpoint::syntroConnect()
 
 	m_sock = new SyntroSocket(this, 0, m_encryptLink);
 	m_syntroLink = new SyntroLink(m_logTag);
+	m_syntroLink->setBackpressureHandler(this);
+	m_syntroLink->setTXFragmentSize(m_configTXFragmentSize);
+
+	SyntroLinkScheduler *scheduler = SyntroLinkScheduler::create(m_configTXScheduler);
+	for (int priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++)
+		scheduler->setWeight(priority, m_configTXSchedulerWeights[priority]);
+	m_syntroLink->setTXScheduler(scheduler);
+
+	for (int priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++)
+		m_syntroLink->setTXQueueLimits(priority, m_TXMaxMessages[priority], m_TXMaxBytes[priority], m_TXPolicy[priority]);
 
 	returnValue = m_sock->sockCreate(0, SOCK_STREAM);
 
@@ -2004,10 +2307,25 @@ bool Endpoint::syntroConnect()
 	m_sock->sockSetConnectMsg(ENDPOINT_ONCONNECT_MESSAGE);
 	m_sock->sockSetCloseMsg(ENDPOINT_ONCLOSE_MESSAGE);
 	m_sock->sockSetReceiveMsg(ENDPOINT_ONRECEIVE_MESSAGE);
+	m_sock->sockSetSendMsg(ENDPOINT_ONSEND_MESSAGE);		// resumes sending when the socket drains
 	m_sock->sockSetReceiveBufSize(size);
 
+	//	a SyntroControl on this machine can be reached through shared memory and a Unix domain socket
+
+	bool localControl = !m_encryptLink &&
+			(SyntroUtils::IPLoopback(m_helloEntry.hello.IPAddr) ||
+			(memcmp(m_helloEntry.hello.IPAddr, SyntroUtils::getMyIPAddr(), SYNTRO_IPADDR_LEN) == 0));
+
+	//	only a SyntroControl that advertises shared memory understands the preamble
+
+	if (localControl && m_configSharedMemory && (m_helloEntry.hello.flags & HELLO_FLAG_SHAREDMEMORY))
+		m_sock->sockSetSharedMemory(true);
+
     if (m_encryptLink)
     	returnValue = m_sock->sockConnect(m_helloEntry.IPAddr, SYNTRO_SOCKET_LOCAL_ENCRYPT);
+	else if (localControl && m_configUnixSocket && (m_helloEntry.hello.flags & HELLO_FLAG_UNIXSOCKET) &&
+			m_sock->sockConnectLocal(SYNTRO_SOCKET_LOCAL))
+		returnValue = true;
     else
     	returnValue = m_sock->sockConnect(m_helloEntry.IPAddr, SYNTRO_SOCKET_LOCAL);
 	if (!returnValue) {
@@ -2042,6 +2360,8 @@ void Endpoint::syntroClose()
 		m_syntroLink = NULL;
 	}
 
+	groupClose();
+	bestEffortClose();
 	updateState("Connection closed");
 }
 
@@ -2058,7 +2378,8 @@ bool Endpoint::syntroSendMessage(int cmd, SYNTRO_MESSAGE *syntroMessage, int len
 		return false;										
 	}
 
-	m_syntroLink->send(cmd, len, priority, syntroMessage);
+	if (!m_syntroLink->send(cmd, len, priority, syntroMessage))
+		return false;										// rejected by full TX queue
 	m_syntroLink->trySending(m_sock);
 	return true;
 }
@@ -2099,6 +2420,8 @@ void Endpoint::endpointConnected()
 		service->lastReceivedSeqNo = -1;
 		service->nextSendSeqNo = 0;
 		service->lastReceivedAck = 0;
+		SyntroUtils::sendWindowInit(&service->sendWindow, m_configMulticastWindowMin, m_configMulticastWindowMax);
+		service->ackPending = 0;
 		service->lastSendTime = SyntroClock();
 	}
 
@@ -2112,6 +2435,7 @@ void Endpoint::endpointConnected()
 void Endpoint::endpointClosed()
 {
 	m_connected = false;
+	m_controlFlags = 0;
 	m_connectInProgress = false;
 	m_beaconDelay = false;
 	appClientClosed();
@@ -2124,6 +2448,7 @@ void Endpoint::endpointClosed()
 void Endpoint::endpointHeartbeat(SYNTRO_HEARTBEAT *heartbeat, int length)
 {
 	m_connected = true;
+	m_controlFlags = heartbeat->hello.flags;
 	appClientHeartbeat(heartbeat, length);
 }
 
@@ -2181,6 +2506,7 @@ void Endpoint::processMulticastAck(SYNTRO_EHEAD *message, int length, int destPo
 		return;								
 	}
 
+	SyntroUtils::sendWindowAcked(&service->sendWindow, service->lastReceivedAck, message->seq, SyntroClock());
 	service->lastReceivedAck = message->seq;
 
 	appClientReceiveMulticastAck(destPort, message, length);
@@ -2209,6 +2535,430 @@ void Endpoint::processE2E(SYNTRO_EHEAD *message, int length, int destPort)
 	appClientReceiveE2E(destPort, message, length);
 }
 
+//-------------------------------------------------------------------------------------------
+//	IP multicast groups
+//
+//	SyntroControl may offer a group for a registered remote multicast service. Once joined, the
+//	service's messages arrive as datagrams on m_groupSock instead of over the SyntroLink. Each
+//	message is reassembled from its fragments and then processed exactly as if it had come over
+//	the SyntroLink. A message is lost if any fragment is lost.
+
+/*!
+	\internal
+*/
+
+void Endpoint::processGroupOffer(SYNTRO_MULTICAST_GROUP *groupOffer)
+{
+	SYNTRO_SERVICE_INFO *remoteService;
+	int servicePort;
+	int slot;
+
+	if (groupOffer->request != SYNTRO_MULTICAST_GROUP_OFFER) {
+		logWarn(QString("Unexpected multicast group request %1").arg(groupOffer->request));
+		return;
+	}
+	servicePort = SyntroUtils::convertUC2ToInt(groupOffer->ehead.destPort);
+	slot = SyntroUtils::convertUC2ToUInt(groupOffer->ehead.sourcePort);
+	if ((servicePort < 0) || (servicePort >= SYNTRO_MAX_SERVICESPERCOMPONENT)) {
+		logWarn(QString("Multicast group offer with out of range port number %1").arg(servicePort));
+		return;
+	}
+
+	remoteService = m_serviceInfo + servicePort;
+	if (!m_configMulticastGroups || !remoteService->inUse || remoteService->local
+			|| (remoteService->serviceType != SERVICETYPE_MULTICAST)
+			|| (remoteService->state != SYNTRO_REMOTE_SERVICE_STATE_REGISTERED)
+			|| (remoteService->destPort != slot) || !groupJoin(remoteService, groupOffer)) {
+		sendGroupRequest(&(groupOffer->ehead.sourceUID), slot, servicePort, SYNTRO_MULTICAST_GROUP_REFUSE);
+		return;
+	}
+	sendGroupRequest(&(groupOffer->ehead.sourceUID), slot, servicePort,
+		remoteService->groupRepair ? SYNTRO_MULTICAST_GROUP_JOIN_REPAIR : SYNTRO_MULTICAST_GROUP_JOIN);
+}
+
+/*!
+	\internal
+*/
+
+bool Endpoint::groupJoin(SYNTRO_SERVICE_INFO *remoteService, SYNTRO_MULTICAST_GROUP *groupOffer)
+{
+	SYNTRO_SERVICE_INFO *service;
+	QString group = SyntroUtils::displayIPAddr(groupOffer->groupAddr);
+	int port = SyntroUtils::convertUC2ToInt(groupOffer->groupPort);
+	int slot = SyntroUtils::convertUC2ToUInt(groupOffer->ehead.sourcePort);
+	int servicePort = remoteService - m_serviceInfo;
+	int i;
+
+	if (remoteService->groupJoined) {
+		if ((remoteService->groupSlot == slot) && (group == remoteService->groupAddr)
+				&& SyntroUtils::compareUID(&(remoteService->groupControlUID), &(groupOffer->ehead.sourceUID)))
+			return true;									// already there
+		groupLeave(servicePort, false);
+	}
+
+	if (m_groupSock == NULL) {
+		m_groupSock = new SyntroSocket(this, ENDPOINT_GROUP_CONNECTIONID, false);
+		if (!m_groupSock->sockCreate(port, SOCK_DGRAM, true)) {
+			logWarn(QString("Failed to open multicast group port %1").arg(port));
+			delete m_groupSock;
+			m_groupSock = NULL;
+			return false;
+		}
+		m_groupSock->sockSetReceiveBufSize(ENDPOINT_GROUP_BUFSIZE);
+		m_groupSock->sockSetReceiveMsg(ENDPOINT_ONRECEIVE_MESSAGE);
+		m_groupPort = port;
+	}
+	if (port != m_groupPort) {
+		logWarn(QString("Multicast group port %1 doesn't match open port %2").arg(port).arg(m_groupPort));
+		return false;
+	}
+
+	//	Another service may already be receiving the same stream
+
+	service = m_serviceInfo;
+	for (i = 0; i < SYNTRO_MAX_SERVICESPERCOMPONENT; i++, service++) {
+		if (service->groupJoined && (group == service->groupAddr))
+			break;
+	}
+	if ((i == SYNTRO_MAX_SERVICESPERCOMPONENT) && !m_groupSock->sockJoinGroup(qPrintable(group)))
+		return false;
+
+	remoteService->groupJoined = true;
+	remoteService->groupSlot = slot;
+	remoteService->groupControlUID = groupOffer->ehead.sourceUID;
+	strcpy(remoteService->groupAddr, qPrintable(group));
+	remoteService->groupMessage = NULL;
+	remoteService->groupStarted = false;
+	remoteService->groupReceived = 0;
+	remoteService->groupLost = 0;
+	logInfo(QString("Receiving %1 from multicast group %2").arg(remoteService->servicePath).arg(group));
+	return true;
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::groupLeave(int servicePort, bool tellControl)
+{
+	SYNTRO_SERVICE_INFO *service = m_serviceInfo + servicePort;
+	SYNTRO_SERVICE_INFO *other;
+
+	if (!service->groupJoined)
+		return;
+	service->groupJoined = false;
+	if (service->groupMessage != NULL) {
+		free(service->groupMessage);
+		service->groupMessage = NULL;
+	}
+	if (tellControl)										// puts the registration back on the SyntroLink
+		sendGroupRequest(&(service->groupControlUID), service->groupSlot, servicePort, SYNTRO_MULTICAST_GROUP_REFUSE);
+
+	other = m_serviceInfo;
+	for (int i = 0; i < SYNTRO_MAX_SERVICESPERCOMPONENT; i++, other++) {
+		if (other->groupJoined && (strcmp(other->groupAddr, service->groupAddr) == 0))
+			return;											// still needed
+	}
+	if (m_groupSock != NULL)
+		m_groupSock->sockLeaveGroup(service->groupAddr);
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::groupClose()
+{
+	for (int servicePort = 0; servicePort < SYNTRO_MAX_SERVICESPERCOMPONENT; servicePort++)
+		groupLeave(servicePort, false);
+	if (m_groupSock != NULL) {
+		delete m_groupSock;
+		m_groupSock = NULL;
+	}
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::processGroupData()
+{
+	unsigned char datagram[sizeof(SYNTRO_MULTICAST_DGRAM) + SYNTRO_MULTICAST_DGRAM_DATA];
+	SYNTRO_MULTICAST_DGRAM *header = (SYNTRO_MULTICAST_DGRAM *)datagram;
+	SYNTRO_SERVICE_INFO *service;
+	char IPAddr[SYNTRO_IPSTR_LEN];
+	unsigned int port;
+	int len;
+	int slot;
+
+	QMutexLocker locker(&m_RXLock);
+
+	while ((m_groupSock != NULL) && (m_groupSock->sockPendingDatagramSize() != -1)) {
+		len = m_groupSock->sockReceiveFrom(datagram, sizeof(datagram), IPAddr, &port);
+		if (len <= (int)sizeof(SYNTRO_MULTICAST_DGRAM))
+			continue;
+		slot = SyntroUtils::convertUC2ToUInt(header->slot);
+		service = m_serviceInfo;
+		for (int servicePort = 0; servicePort < SYNTRO_MAX_SERVICESPERCOMPONENT; servicePort++, service++) {
+			if (!service->groupJoined || (service->groupSlot != slot))
+				continue;
+			if (service->state != SYNTRO_REMOTE_SERVICE_STATE_REGISTERED)
+				continue;
+			if (!SyntroUtils::compareUID(&(service->groupControlUID), &(header->controlUID)))
+				continue;
+			processGroupFragment(servicePort, header, datagram + sizeof(SYNTRO_MULTICAST_DGRAM),
+					len - sizeof(SYNTRO_MULTICAST_DGRAM));
+		}
+	}
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::processGroupFragment(int servicePort, SYNTRO_MULTICAST_DGRAM *header, unsigned char *data, int len)
+{
+	SYNTRO_SERVICE_INFO *service = m_serviceInfo + servicePort;
+	SYNTRO_EHEAD *ehead;
+	quint32 seq = (quint32)SyntroUtils::convertUC4ToInt(header->seq);
+	int messageLength = SyntroUtils::convertUC4ToInt(header->len);
+	int fragIndex = SyntroUtils::convertUC2ToUInt(header->fragIndex);
+	int fragCount = SyntroUtils::convertUC2ToUInt(header->fragCount);
+	int offset = fragIndex * SYNTRO_MULTICAST_DGRAM_DATA;
+
+	if ((messageLength < (int)(sizeof(SYNTRO_EHEAD) + sizeof(SYNTRO_RECORD_HEADER)))
+			|| (messageLength > (int)sizeof(SYNTRO_EHEAD) + SYNTRO_MESSAGE_MAX)
+			|| (fragCount != (messageLength + SYNTRO_MULTICAST_DGRAM_DATA - 1) / SYNTRO_MULTICAST_DGRAM_DATA)
+			|| (fragIndex >= fragCount) || (len != qMin(SYNTRO_MULTICAST_DGRAM_DATA, messageLength - offset))) {
+		logWarn(QString("Invalid multicast group datagram on port %1").arg(servicePort));
+		return;
+	}
+
+	if (service->groupMessage != NULL) {
+		if (seq != service->groupSeq) {
+			if ((qint32)(seq - service->groupSeq) < 0)
+				return;										// a late fragment of a message already given up
+			free(service->groupMessage);					// a later message has started so this one can't finish
+			service->groupMessage = NULL;
+			groupLoss(servicePort, service->groupSeq, 1);
+		} else if (messageLength != service->groupLen) {
+			return;
+		}
+	} else if (service->groupStarted && ((qint32)(seq - service->groupNextSeq) < 0)) {
+		return;												// a late fragment of a message already finished or given up
+	}
+
+	if (service->groupMessage == NULL) {					// start a new message
+		if (service->groupStarted && (seq != service->groupNextSeq))
+			groupLoss(servicePort, service->groupNextSeq, seq - service->groupNextSeq);	// whole messages missing
+		service->groupStarted = true;
+		service->groupNextSeq = seq + 1;
+		service->groupSeq = seq;
+		service->groupLen = messageLength;
+		service->groupFragsLeft = fragCount;
+		memset(service->groupFrags, 0, sizeof(service->groupFrags));
+		service->groupMessage = (unsigned char *)malloc(messageLength);
+	}
+
+	if (service->groupFrags[fragIndex >> 3] & (1 << (fragIndex & 7)))
+		return;												// duplicate
+	service->groupFrags[fragIndex >> 3] |= 1 << (fragIndex & 7);
+	memcpy(service->groupMessage + offset, data, len);
+	if (--service->groupFragsLeft > 0)
+		return;
+
+	ehead = (SYNTRO_EHEAD *)service->groupMessage;
+	service->groupMessage = NULL;
+	service->groupReceived++;
+	SyntroUtils::convertIntToUC2(servicePort, ehead->destPort);
+	ehead->destUID = m_UID;
+	processMulticast(ehead, messageLength - sizeof(SYNTRO_EHEAD), servicePort);
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::groupLoss(int servicePort, quint32 seq, quint32 count)
+{
+	SYNTRO_SERVICE_INFO *service = m_serviceInfo + servicePort;
+
+	service->groupLost += count;
+	if (!service->groupRepair)
+		return;
+	if (count > ENDPOINT_GROUP_MAXNACKS) {					// older ones won't be cached anyway
+		seq += count - ENDPOINT_GROUP_MAXNACKS;
+		count = ENDPOINT_GROUP_MAXNACKS;
+	}
+	for (; count > 0; count--, seq++)
+		sendGroupRequest(&(service->groupControlUID), service->groupSlot, servicePort, SYNTRO_MULTICAST_GROUP_NACK, seq);
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::sendGroupRequest(SYNTRO_UID *controlUID, int slot, int servicePort, int request, quint32 seq)
+{
+	SYNTRO_MULTICAST_GROUP *groupRequest;
+
+	groupRequest = (SYNTRO_MULTICAST_GROUP *)malloc(sizeof(SYNTRO_MULTICAST_GROUP));
+	memset(groupRequest, 0, sizeof(SYNTRO_MULTICAST_GROUP));
+	groupRequest->ehead.sourceUID = m_UID;
+	groupRequest->ehead.destUID = *controlUID;
+	SyntroUtils::convertIntToUC2(servicePort, groupRequest->ehead.sourcePort);
+	SyntroUtils::convertIntToUC2(slot, groupRequest->ehead.destPort);
+	groupRequest->request = request;
+	SyntroUtils::convertIntToUC4(seq, groupRequest->seq);
+	syntroSendMessage(SYNTROMSG_MULTICAST_GROUP, (SYNTRO_MESSAGE *)groupRequest, sizeof(SYNTRO_MULTICAST_GROUP), SYNTROLINK_MEDHIGHPRI);
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::processBestEffortRequest(SYNTRO_BESTEFFORT *request)
+{
+	SYNTRO_SERVICE_INFO *service;
+	int servicePort;
+
+	switch (request->request) {
+		case SYNTRO_BESTEFFORT_BIND:
+			if (m_bestEffortSock == NULL) {
+				m_bestEffortSock = new SyntroSocket(this, ENDPOINT_BESTEFFORT_CONNECTIONID, false);
+				if (!m_bestEffortSock->sockCreate(0, SOCK_DGRAM)) {
+					logWarn("Failed to open best effort socket - best effort services will use the SyntroLink");
+					delete m_bestEffortSock;
+					m_bestEffortSock = NULL;
+					return;
+				}
+				m_bestEffortSock->sockSetReceiveBufSize(ENDPOINT_BESTEFFORT_BUFSIZE);
+				m_bestEffortSock->sockSetReceiveMsg(ENDPOINT_ONRECEIVE_MESSAGE);
+			}
+			m_bestEffortControlPort = SyntroUtils::convertUC2ToInt(request->udpPort);
+			m_bestEffortControlUID = request->ehead.sourceUID;
+			m_bestEffortKey = SyntroUtils::convertUC4ToInt(request->key);
+
+			service = m_serviceInfo;
+			for (servicePort = 0; servicePort < SYNTRO_MAX_SERVICESPERCOMPONENT; servicePort++, service++) {
+				if (service->inUse && !service->local && service->bestEffort
+						&& (service->state == SYNTRO_REMOTE_SERVICE_STATE_REGISTERED))
+					bestEffortSubscribe(service);
+			}
+			break;
+
+		case SYNTRO_BESTEFFORT_ACCEPT:
+			servicePort = SyntroUtils::convertUC2ToInt(request->ehead.sourcePort);
+			if ((servicePort < 0) || (servicePort >= SYNTRO_MAX_SERVICESPERCOMPONENT))
+				break;
+			service = m_serviceInfo + servicePort;
+			if (service->inUse && !service->local && service->bestEffort)
+				SyntroUtils::bestEffortSync(&(service->bestEffortRX), SyntroUtils::convertUC4ToInt(request->seq));
+			break;
+
+		default:
+			TRACE1("Unexpected best effort request %d", request->request);
+			break;
+	}
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::bestEffortSubscribe(SYNTRO_SERVICE_INFO *remoteService)
+{
+	SYNTRO_BESTEFFORT *request;
+
+	if ((m_bestEffortSock == NULL) || (m_bestEffortKey == 0))
+		return;												// wait for the bind
+	request = (SYNTRO_BESTEFFORT *)malloc(sizeof(SYNTRO_BESTEFFORT));
+	memset(request, 0, sizeof(SYNTRO_BESTEFFORT));
+	request->ehead.sourceUID = m_UID;
+	request->ehead.destUID = m_bestEffortControlUID;
+	SyntroUtils::copyUC2(request->ehead.sourcePort, remoteService->serviceLookup.localPort);
+	SyntroUtils::copyUC2(request->ehead.destPort, remoteService->serviceLookup.remotePort);
+	SyntroUtils::convertIntToUC2(m_bestEffortSock->sockLocalPort(), request->udpPort);
+	request->request = SYNTRO_BESTEFFORT_SUBSCRIBE;
+	syntroSendMessage(SYNTROMSG_BESTEFFORT, (SYNTRO_MESSAGE *)request, sizeof(SYNTRO_BESTEFFORT), SYNTROLINK_MEDHIGHPRI);
+}
+
+/*!
+	\internal
+*/
+
+bool Endpoint::sendBestEffort(SYNTRO_SERVICE_INFO *service, SYNTRO_EHEAD *message, int len)
+{
+	unsigned char datagram[sizeof(SYNTRO_BESTEFFORT_DGRAM) + SYNTRO_BESTEFFORT_MAXMESSAGE];
+	SYNTRO_BESTEFFORT_DGRAM *header = (SYNTRO_BESTEFFORT_DGRAM *)datagram;
+
+	if ((m_bestEffortSock == NULL) || (m_bestEffortKey == 0) || (len > SYNTRO_BESTEFFORT_MAXMESSAGE))
+		return false;										// caller uses the SyntroLink
+
+	header->senderUID = m_UID;
+	SyntroUtils::convertIntToUC4(m_bestEffortKey, header->key);
+	SyntroUtils::convertIntToUC4(service->bestEffortSeq++, header->seq);
+	memcpy(datagram + sizeof(SYNTRO_BESTEFFORT_DGRAM), message, len);
+	m_bestEffortSock->sockSendTo(datagram, sizeof(SYNTRO_BESTEFFORT_DGRAM) + len, m_bestEffortControlPort, m_IPAddr);
+	free(message);
+	return true;											// if the send failed it's just lost
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::processBestEffortData()
+{
+	unsigned char datagram[sizeof(SYNTRO_BESTEFFORT_DGRAM) + SYNTRO_BESTEFFORT_MAXMESSAGE];
+	SYNTRO_BESTEFFORT_DGRAM *header = (SYNTRO_BESTEFFORT_DGRAM *)datagram;
+	SYNTRO_EHEAD *ehead = (SYNTRO_EHEAD *)(datagram + sizeof(SYNTRO_BESTEFFORT_DGRAM));
+	SYNTRO_SERVICE_INFO *service;
+	SYNTRO_EHEAD *message;
+	char IPAddr[SYNTRO_IPSTR_LEN];
+	unsigned int port;
+	int len;
+	int servicePort;
+
+	QMutexLocker locker(&m_RXLock);
+
+	while ((m_bestEffortSock != NULL) && (m_bestEffortSock->sockPendingDatagramSize() != -1)) {
+		len = m_bestEffortSock->sockReceiveFrom(datagram, sizeof(datagram), IPAddr, &port);
+		len -= sizeof(SYNTRO_BESTEFFORT_DGRAM);
+		if (len < (int)(sizeof(SYNTRO_EHEAD) + sizeof(SYNTRO_RECORD_HEADER)))
+			continue;
+		if ((m_bestEffortKey == 0) || ((quint32)SyntroUtils::convertUC4ToInt(header->key) != m_bestEffortKey)
+				|| !SyntroUtils::compareUID(&(header->senderUID), &m_bestEffortControlUID))
+			continue;										// not from our SyntroControl on this SyntroLink
+		servicePort = SyntroUtils::convertUC2ToInt(ehead->destPort);
+		if ((servicePort < 0) || (servicePort >= SYNTRO_MAX_SERVICESPERCOMPONENT))
+			continue;
+		service = m_serviceInfo + servicePort;
+		if (!service->inUse || service->local || !service->bestEffort
+				|| (service->state != SYNTRO_REMOTE_SERVICE_STATE_REGISTERED))
+			continue;
+		if (!SyntroUtils::bestEffortAccept(&(service->bestEffortRX), SyntroUtils::convertUC4ToInt(header->seq)))
+			continue;										// a later one has already arrived
+		service->bestEffortLastDatagram = true;
+		message = (SYNTRO_EHEAD *)malloc(len);
+		memcpy(message, ehead, len);
+		processMulticast(message, len - sizeof(SYNTRO_EHEAD), servicePort);
+	}
+}
+
+/*!
+	\internal
+*/
+
+void Endpoint::bestEffortClose()
+{
+	if (m_bestEffortSock != NULL) {
+		delete m_bestEffortSock;
+		m_bestEffortSock = NULL;
+	}
+	m_bestEffortKey = 0;
+}
+
 
 //-------------------------------------------------------------------------------------------
 //	SyntroCFS API functions
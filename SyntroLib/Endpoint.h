@@ -37,6 +37,13 @@
 
 #define ENDPOINT_MAX_SYNTROCONTROLS	3						// max number of SyntroControls in priority list
 
+#define	ENDPOINT_GROUP_CONNECTIONID		1					// connection ID of the IP multicast group socket (the SyntroLink is 0)
+#define	ENDPOINT_GROUP_BUFSIZE			(SYNTRO_MESSAGE_MAX * 4)	// group socket receive buffer size
+#define	ENDPOINT_GROUP_MAXNACKS			8					// max repairs requested for one gap
+
+#define	ENDPOINT_BESTEFFORT_CONNECTIONID	2				// connection ID of the best effort datagram socket
+#define	ENDPOINT_BESTEFFORT_BUFSIZE		(SYNTRO_MESSAGE_MAX * 4)	// best effort socket receive buffer size
+
 
 //-------------------------------------------------------------------------------------------
 //	Service structure defs
@@ -64,7 +71,29 @@ typedef struct
 	int lastReceivedSeqNo;									// sequence number on last received multicast message
 	unsigned char nextSendSeqNo;							// the number to use on the next sent multicast message
 	unsigned char lastReceivedAck;							// the last ack received
+	SYNTRO_SEND_WINDOW sendWindow;							// sizes the ack window from the measured RTT
+	int ackPending;											// messages received that haven't been acked yet
 	qint64 lastSendTime;									// time the last multicast frame was sent
+
+	bool groupRepair;										// true if lost group messages should be resent
+	bool groupJoined;										// true if the service is received from an IP multicast group
+	int groupSlot;											// the SyntroControl's multicast map slot sending to the group
+	SYNTRO_UID groupControlUID;								// the SyntroControl sending to the group
+	char groupAddr[SYNTRO_IPSTR_LEN];						// the group address
+	unsigned char *groupMessage;							// the message being reassembled or NULL
+	quint32 groupSeq;										// seq of the message being reassembled
+	int groupLen;											// its length
+	int groupFragsLeft;										// fragments still to come
+	unsigned char groupFrags[(SYNTRO_MULTICAST_MAXFRAGS + 7) / 8];	// bit map of received fragments
+	bool groupStarted;										// true once groupNextSeq is valid
+	quint32 groupNextSeq;									// the next seq expected
+	qint64 groupReceived;									// messages received from the group
+	qint64 groupLost;										// messages lost on the group
+
+	bool bestEffort;										// true if the service should use best effort datagrams
+	quint32 bestEffortSeq;									// datagram seq for a local service
+	bool bestEffortLastDatagram;							// true if the last message received was a datagram
+	SYNTRO_BESTEFFORT_RX bestEffortRX;						// receive state for a remote service
 } SYNTRO_SERVICE_INFO;
 
 //	local service state defs
@@ -130,7 +159,7 @@ typedef struct
 //	The CEndpoint class itself
 //
 
-class SYNTROLIB_EXPORT Endpoint : public SyntroThread
+class SYNTROLIB_EXPORT Endpoint : public SyntroThread, public SyntroLinkBackpressure
 {
 
 public:
@@ -180,8 +209,13 @@ protected:
 //	to this service.
 //	
 //	The initial service enable state is set by the enabled flag on the call.
+//
+//	If bestEffort is true, a multicast service is carried in UDP datagrams between Endpoint and
+//	SyntroControl whenever a message fits in one. There are no acks or retransmissions and a
+//	datagram that arrives after a later one is dropped. Datagrams are only used if BestEffort is
+//	set in the settings of both the Endpoint and SyntroControl - otherwise the SyntroLink is used.
 
-	int clientAddService(QString servicePath, int serviceType, bool local, bool enabled = true);
+	int clientAddService(QString servicePath, int serviceType, bool local, bool enabled = true, bool bestEffort = false);
 
 //	clientSetServiceData allows an integer value to be set in the service entry
 
@@ -255,6 +289,23 @@ protected:
 
 	qint64 clientGetLastSendTime(int servicePort);
 
+//	clientSetServiceGroupRepair controls what happens when a remote multicast service is received from
+//	an IP multicast group and a message is lost. By default it is just counted. If repair is true,
+//	SyntroControl resends it over the SyntroLink if it still has it. Repaired messages arrive late
+//	and out of order.
+
+	bool clientSetServiceGroupRepair(int servicePort, bool repair);
+
+//	clientGetServiceGroupStats returns the messages received and lost on a remote multicast service's
+//	IP multicast group. Returns false if the service isn't being received from a group.
+
+	bool clientGetServiceGroupStats(int servicePort, qint64 *received, qint64 *lost);
+
+//	clientGetServiceBestEffortStats returns the datagrams received, lost and dropped for arriving late
+//	on a best effort remote multicast service. Returns false if the service isn't best effort.
+
+	bool clientGetServiceBestEffortStats(int servicePort, qint64 *received, qint64 *lost, qint64 *late);
+
 //	clientIsConnected returns true if the SyntroLink is up.
 
 	bool clientIsConnected();
@@ -272,6 +323,12 @@ protected:
 								int priority = SYNTROLINK_LOWPRI);
 	bool clientSendMulticastAck(int servicePort);			// acks a received multicast message
 
+//	clientSetTXQueueLimits limits the SyntroLink TX queue for priority. maxMessages and maxBytes of 0
+//	mean no limit. policy is one of the SYNTROLINK_TXPOLICY_* values. Call from appClientInit - the limits
+//	are applied each time the SyntroLink is created.
+
+	void clientSetTXQueueLimits(int priority, int maxMessages, int maxBytes, int policy);
+
 //----------------------------------------------------------
 //	Client app overrides
 //
@@ -331,6 +388,12 @@ protected:
 
 	virtual bool appClientProcessThreadMessage(SyntroThreadMsg *) { return false; }
 
+//	appClientBackpressure is called when the SyntroLink TX queue for priority hits its limits
+//	(congested is true) and again when it has drained (congested is false). An app can use this
+//	to reduce what it sends, for example by only sending refresh video frames while congested.
+
+	virtual void appClientBackpressure(int, bool) { return; }
+
 
 //-------------------------------------------------------------------------------------------
 //	SyntroCFS API definitions
@@ -496,8 +559,35 @@ private:
 	bool m_priorityMode;									// true if in priority mode
 	int m_controlIndex;										// index in SyntroControl list if not in priority mode
 
+	int m_TXMaxMessages[SYNTROLINK_PRIORITIES];				// TX queue limits applied to each new SyntroLink
+	int m_TXMaxBytes[SYNTROLINK_PRIORITIES];
+	int m_TXPolicy[SYNTROLINK_PRIORITIES];
+
+	void linkBackpressure(SyntroLink *link, int priority, bool congested);
+
 	int m_configHeartbeatInterval;							// the configured heartbeat interval in seconds
 	int m_configHeartbeatTimeout;							// the number of intervals before a timeout
+	int m_configTXFragmentSize;								// the configured link fragment size
+	int m_configTXScheduler;								// the configured link scheduler
+	int m_configTXSchedulerWeights[SYNTROLINK_PRIORITIES];	// and its weights
+	bool m_configSharedMemory;								// true if shared memory may be used for a local SyntroControl
+	bool m_configUnixSocket;								// true if a Unix domain socket may be used for a local SyntroControl
+	bool m_configMulticastGroups;							// true if multicast services may be received from IP multicast groups
+	bool m_configBestEffort;								// true if best effort services may use UDP datagrams
+	int m_configMulticastWindowMin;							// the smallest ack window for multicast services
+	int m_configMulticastWindowMax;							// and the largest
+	int m_configMulticastAckCount;							// messages received per multicast ack
+	int m_configMulticastAckInterval;						// longest time an ack is held back
+	int m_ackTimer;											// single shot flush of held acks or -1 if none held
+	unsigned char m_controlFlags;							// HELLO_FLAG_* of the SyntroControl from its heartbeat
+
+	SyntroSocket *m_groupSock;								// receives IP multicast group data or NULL if no groups joined
+	int m_groupPort;										// the port it's bound to
+
+	SyntroSocket *m_bestEffortSock;							// best effort datagram socket or NULL if not bound
+	int m_bestEffortControlPort;							// SyntroControl's best effort UDP port
+	quint32 m_bestEffortKey;								// key for datagrams on this SyntroLink (0 = not bound)
+	SYNTRO_UID m_bestEffortControlUID;						// the SyntroControl that sent the bind
 
 	void initThread();
 	bool processMessage(SyntroThreadMsg *msg);
@@ -529,12 +619,28 @@ private:
 	void forceDE();
 	bool sentDE();
 	void sendMulticastAck(int servicePort, int seq);		// sends back an ack to the endpoint
+	void flushMulticastAcks();								// sends all held acks - m_serviceLock must be held
 	void sendE2EAck(SYNTRO_EHEAD *originalEhead);			// sends an E2E ack back
 
 	bool syntroSendMessage(int cmd, SYNTRO_MESSAGE *syntroMessage, int len, int priority); 
 
 	void linkCloseCleanup();								// do what needs to be done when the SyntroLink goes down
 
+	void processGroupOffer(SYNTRO_MULTICAST_GROUP *groupOffer);	// handles an IP multicast group offer
+	bool groupJoin(SYNTRO_SERVICE_INFO *remoteService, SYNTRO_MULTICAST_GROUP *groupOffer);
+	void groupLeave(int servicePort, bool tellControl);
+	void groupClose();										// leaves all groups
+	void processGroupData();								// reads the group socket
+	void processGroupFragment(int servicePort, SYNTRO_MULTICAST_DGRAM *header, unsigned char *data, int len);
+	void groupLoss(int servicePort, quint32 seq, quint32 count);	// records lost group messages
+	void sendGroupRequest(SYNTRO_UID *controlUID, int slot, int servicePort, int request, quint32 seq = 0);
+
+	void processBestEffortRequest(SYNTRO_BESTEFFORT *request);	// handles a bind or accept from SyntroControl
+	void bestEffortSubscribe(SYNTRO_SERVICE_INFO *remoteService);	// asks for a remote service as datagrams
+	bool sendBestEffort(SYNTRO_SERVICE_INFO *service, SYNTRO_EHEAD *message, int len);
+	void processBestEffortData();							// reads the best effort socket
+	void bestEffortClose();									// closes the socket and forgets the bind
+
 
 //-------------------------------------------------------------------------------------------
 //	SyntroCFS API variables and local functions
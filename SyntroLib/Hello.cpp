@@ -32,8 +32,10 @@ Hello::Hello(SyntroComponentData *data, const QString& logTag) : SyntroThread(QS
 	m_componentData = data;
 	m_logTag = logTag;
 	helloEntry = m_helloArray;
-	for (i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++, helloEntry++)
+	for (i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++, helloEntry++) {
 		helloEntry->inUse = false;
+		SyntroTimerWheel::initTimer(m_helloTimers + i, i, helloEntry);
+	}
 	m_parentThread = NULL;				// default to do not send messages to parent thread
 	m_helloSocket = NULL;
 	m_socketFlags = 0;					// set to 1 for reuse socket port
@@ -234,6 +236,7 @@ void Hello::processHello()
 			}
 			if (matchHello(&(helloEntry->hello), &m_RXHello)) {
 				helloEntry->lastHello = SyntroClock();		// up date last received time
+				m_timerWheel.start(m_helloTimers + i, helloEntry->lastHello + HELLO_LIFETIME);
 				memcpy(&(helloEntry->hello), &m_RXHello, sizeof(HELLO)); // copy information just in case
 				sprintf(helloEntry->IPAddr, "%d.%d.%d.%d",
 				m_RXHello.IPAddr[0], m_RXHello.IPAddr[1], m_RXHello.IPAddr[2], m_RXHello.IPAddr[3]);
@@ -248,6 +251,7 @@ void Hello::processHello()
 			helloEntry = m_helloArray+free;					// setup new entry
 			helloEntry->inUse = true;
 			helloEntry->lastHello = SyntroClock();			// up date last received time
+			m_timerWheel.start(m_helloTimers + free, helloEntry->lastHello + HELLO_LIFETIME);
 			memcpy(&(helloEntry->hello), &m_RXHello, sizeof(HELLO));
 			sprintf(helloEntry->IPAddr, "%d.%d.%d.%d",
 			m_RXHello.IPAddr[0], m_RXHello.IPAddr[1], m_RXHello.IPAddr[2], m_RXHello.IPAddr[3]);
@@ -279,10 +283,13 @@ bool Hello::matchHello(HELLO *a, HELLO *b)
 }
 
 
+//	Only entries whose timers have expired are looked at. Each hello restarts the entry's timer.
+
 void Hello::processTimers()
 {
-	int	i;
 	HELLOENTRY *helloEntry;
+	HELLOENTRY *messageHelloEntry;
+	SYNTRO_TIMER *timer;
 	qint64 now = SyntroClock();
 
 	if (m_control && SyntroUtils::syntroTimerExpired(now, m_controlTimer, HELLO_CONTROL_HELLO_INTERVAL)) {
@@ -290,24 +297,21 @@ void Hello::processTimers()
 		sendHelloBeacon();
 	}
 
-	helloEntry = m_helloArray;
-	for (i = 0; i < SYNTRO_MAX_CONNECTEDCOMPONENTS; i++, helloEntry++) {
+	while ((timer = m_timerWheel.expired(now)) != NULL) {
+		helloEntry = (HELLOENTRY *)timer->context;
 		if (!helloEntry->inUse)
 			continue;								// not in use
 
-		if (SyntroUtils::syntroTimerExpired(now, helloEntry->lastHello, HELLO_LIFETIME)) {	// entry has timed out
-
-			HELLOENTRY	*messageHelloEntry;
+		//	entry has timed out
 
-			if (m_parentThread != NULL) {
-				messageHelloEntry = (HELLOENTRY *)malloc(sizeof(HELLOENTRY));
-				memcpy(messageHelloEntry, helloEntry, sizeof(HELLOENTRY));
-				m_parentThread->postThreadMessage(HELLO_STATUS_CHANGE_MESSAGE, HELLO_DOWN, messageHelloEntry);
-			}
-//			TRACE1("Hello deleted %s", helloEntry->IPAddr);
-			helloEntry->inUse = false;
-			emit helloDisplayEvent(this);
+		if (m_parentThread != NULL) {
+			messageHelloEntry = (HELLOENTRY *)malloc(sizeof(HELLOENTRY));
+			memcpy(messageHelloEntry, helloEntry, sizeof(HELLOENTRY));
+			m_parentThread->postThreadMessage(HELLO_STATUS_CHANGE_MESSAGE, HELLO_DOWN, messageHelloEntry);
 		}
+//		TRACE1("Hello deleted %s", helloEntry->IPAddr);
+		helloEntry->inUse = false;
+		emit helloDisplayEvent(this);
 	}
 }
 
@@ -331,6 +335,7 @@ void Hello::sendHelloBeaconResponse(HELLO *reqHello)
 
 void Hello::deleteEntry(HELLOENTRY *helloEntry)
 {
+	m_timerWheel.stop(m_helloTimers + (helloEntry - m_helloArray));
 	helloEntry->inUse = false;
 	emit helloDisplayEvent(this);
 }
@@ -23,6 +23,7 @@
 #include "syntrolib_global.h"
 #include "SyntroUtils.h"
 #include "SyntroThread.h"
+#include "SyntroTimerWheel.h"
 #include"SyntroComponentData.h"
 
 #define HELLO_CONTROL_HELLO_INTERVAL	2000				// send hello every two seconds if control
@@ -91,6 +92,8 @@ protected:
 	SyntroComponentData *m_componentData;
 	bool m_control;
 	qint64 m_controlTimer;
+	SyntroTimerWheel m_timerWheel;							// times out hello entries
+	SYNTRO_TIMER m_helloTimers[SYNTRO_MAX_CONNECTEDCOMPONENTS];	// one for each entry in m_helloArray
 
 private:
 	int m_timer;
@@ -51,10 +51,20 @@ typedef struct
 	SYNTRO_APPNAME appName;									// the app name of the sender
 	SYNTRO_COMPTYPE componentType;							// the component type of the sender
 	unsigned char priority;									// priority of SyntroControl
-	unsigned char unused1;									// was operating mode
+	unsigned char flags;									// HELLO_FLAG_* capabilities of the sender
 	SYNTRO_UC2 interval;									// heartbeat send interval
 } HELLO;
 
+//	HELLO flags. Bit 0 was the old operating mode and is always set so that older components
+//	see the value they expect. The other bits advertise optional features of the SyntroLink.
+
+#define	HELLO_FLAG_LEGACY			0x01					// always set
+#define	HELLO_FLAG_MCASTGROUP		0x02					// can receive multicast services from an IP multicast group
+#define	HELLO_FLAG_BESTEFFORT		0x04					// can send and receive best effort multicast over UDP
+#define	HELLO_FLAG_ACKBATCH			0x08					// accepts SYNTROMSG_MULTICAST_ACKS
+#define	HELLO_FLAG_SHAREDMEMORY		0x10					// accepts shared memory links from components on the same machine
+#define	HELLO_FLAG_UNIXSOCKET		0x20					// listens on a Unix domain socket for local links
+
 //	SYNTRO_HEARTBEAT is the type sent on the SyntroLink. It is the hello but with the SYNTRO_MESSAGE header
 
 typedef struct
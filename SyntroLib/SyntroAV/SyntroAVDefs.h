@@ -27,7 +27,7 @@
 typedef enum
 {
     SYNTRO_RECORDHEADER_PARAM_NOOP = 0,                     // indicates a filler record
-	SYNTRO_RECORDHEADER_PARAM_REFRESH,						// indicates a refresh MJPEG frame
+	SYNTRO_RECORDHEADER_PARAM_REFRESH,						// indicates a refresh MJPEG frame or a keyframe
     SYNTRO_RECORDHEADER_PARAM_NORMAL,                       // indicates a normal record
     SYNTRO_RECORDHEADER_PARAM_PREROLL,                      // indicates a preroll frame
     SYNTRO_RECORDHEADER_PARAM_POSTROLL,                     // indicates a postroll frame
@@ -63,7 +63,7 @@ void SyntroComponentData::init(const char *compType, int hbInterval, int priorit
 	SyntroUtils::convertIntToUC2(hbInterval, hello->interval);
 
 	hello->priority = priority;							
-	hello->unused1 = 1;		
+	hello->flags = HELLO_FLAG_LEGACY;
 
 	// generate empty DE
 	DESetup();
@@ -58,6 +58,10 @@ public:
 
 	inline SYNTRO_HEARTBEAT getMyHeartbeat() {return m_myHeartbeat;};
 
+	// adds HELLO_FLAG_* capabilities to the heartbeat
+
+	inline void addMyHelloFlags(unsigned char flags) {m_myHeartbeat.hello.flags |= flags;};
+
 	// returns the component type
 
 	inline const char *getMyComponentType() {return m_myComponentType;};
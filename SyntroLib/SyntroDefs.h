@@ -54,6 +54,8 @@
 
 #define	SYNTRO_SOCKET_LOCAL		        1661				// socket for the SyntroControl
 #define	SYNTRO_SOCKET_LOCAL_ENCRYPT 	1662				// SSL socket for the SyntroControl
+#define	SYNTRO_SOCKET_MULTICAST_GROUP	1663				// UDP port for IP multicast group data
+#define	SYNTRO_SOCKET_BESTEFFORT		1664				// SyntroControl's UDP port for best effort data
 
 #define	SYNTRO_PRIMARY_SOCKET_STATICTUNNEL	1806			// socket for primary static SyntroControl tunnels
 #define	SYNTRO_BACKUP_SOCKET_STATICTUNNEL	1807			// socket for backup static SyntroControl tunnels
@@ -288,7 +290,27 @@ typedef char	SYNTRO_SERVPATH[SYNTRO_MAX_SERVPATH];		// the service path type
 
 #define	SYNTROMSG_E2E						18
 
-#define	SYNTROMSG_MAX						18				// highest legal message value
+//	MULTICAST_GROUP
+//	This message is used to move a multicast registration onto an IP multicast group and
+//	to request repairs of lost group messages. The data is a SYNTRO_MULTICAST_GROUP. It is
+//	only sent to components whose heartbeat has HELLO_FLAG_MCASTGROUP set.
+
+#define	SYNTROMSG_MULTICAST_GROUP			19
+
+//	BESTEFFORT
+//	This message sets up best effort delivery of multicast services over UDP. The data is a
+//	SYNTRO_BESTEFFORT. It is only sent over SyntroLinks where the heartbeat of the other end
+//	has HELLO_FLAG_BESTEFFORT set.
+
+#define	SYNTROMSG_BESTEFFORT				20
+
+//	MULTICAST_ACKS
+//	Acks for several multicast registrations of one component in one message. The data is a
+//	SYNTRO_MULTICAST_ACKS. It is only sent to a SyntroControl whose heartbeat has HELLO_FLAG_ACKBATCH set.
+
+#define	SYNTROMSG_MULTICAST_ACKS			21
+
+#define	SYNTROMSG_MAX						21				// highest legal message value
 
 //-------------------------------------------------------------------------------------------
 //	SYNTRO_MESSAGE - the structure that defines the object transferred across
@@ -314,7 +336,15 @@ typedef struct
 //	and increments with each new message. Acknowledgements indicate the next acceptable send
 //	seq and so open the window again.
 
-#define	SYNTRO_MAX_WINDOW	4								// the maximum number of outstanding messages
+#define	SYNTRO_MAX_WINDOW	4								// the maximum number of outstanding messages with a fixed window
+
+//	Senders normally size the window from the measured ack RTT and delivery rate. SYNTRO_MAX_WINDOW
+//	is the smallest it gets by default. It can never exceed SYNTRO_WINDOW_LIMIT as seqs are 8 bits.
+
+#define	SYNTRO_WINDOW_MAX	64								// default largest adaptive window
+#define	SYNTRO_WINDOW_LIMIT	120								// hard limit on the adaptive window
+#define	SYNTRO_WINDOW_GAIN	2								// window = gain * max delivery rate * min RTT
+#define	SYNTRO_WINDOW_FILTER	(10 * SYNTRO_CLOCKS_PER_SEC)	// period over which the max rate and min RTT are kept
 
 typedef struct
 {
@@ -365,9 +395,123 @@ typedef struct
 } SYNTRO_SERVICE_ACTIVATE;
 
 
+//-------------------------------------------------------------------------------------------
+//	IP multicast groups
+//
+//	A SyntroControl can send a multicast service to the components on its LAN as one set of
+//	UDP datagrams to an IP multicast group rather than one copy per SyntroLink. The SyntroControl
+//	offers the group after a successful lookup. If the component joins, the SyntroControl stops
+//	sending it the service over the SyntroLink. The ehead ports are those of the registration -
+//	sourcePort is the SyntroControl's multicast map slot and destPort the component's service port.
+
+#define	SYNTRO_MULTICAST_GROUP_OFFER		0				// SyntroControl to component - the group for the service
+#define	SYNTRO_MULTICAST_GROUP_JOIN			1				// component has joined the group
+#define	SYNTRO_MULTICAST_GROUP_JOIN_REPAIR	2				// joined and wants lost messages resent over the SyntroLink
+#define	SYNTRO_MULTICAST_GROUP_REFUSE		3				// component will stay on the SyntroLink
+#define	SYNTRO_MULTICAST_GROUP_NACK			4				// component lost group message seq
+
+typedef struct
+{
+	SYNTRO_EHEAD ehead;										// the registration
+	SYNTRO_IPADDR groupAddr;								// the group address
+	SYNTRO_UC2 groupPort;									// the group UDP port
+	unsigned char request;									// SYNTRO_MULTICAST_GROUP_* code
+	unsigned char spare;
+	SYNTRO_UC4 seq;											// the lost group message for a NACK
+} SYNTRO_MULTICAST_GROUP;
+
+//	SYNTRO_MULTICAST_DGRAM is the header on every group datagram. The message sent to the group is
+//	a multicast SYNTRO_EHEAD and its record, split into fragments of up to SYNTRO_MULTICAST_DGRAM_DATA
+//	bytes so that no datagram needs IP fragmentation. seq increments for each message on the slot.
+
+#define	SYNTRO_MULTICAST_DGRAM_DATA			1400			// max message bytes per datagram
+#define	SYNTRO_MULTICAST_MAXFRAGS	\
+		((sizeof(SYNTRO_EHEAD) + SYNTRO_MESSAGE_MAX + SYNTRO_MULTICAST_DGRAM_DATA - 1) / SYNTRO_MULTICAST_DGRAM_DATA)
+
+typedef struct
+{
+	SYNTRO_UID controlUID;									// the sending SyntroControl
+	SYNTRO_UC2 slot;										// its multicast map slot
+	SYNTRO_UC2 fragIndex;									// this fragment
+	SYNTRO_UC2 fragCount;									// number of fragments in the message
+	SYNTRO_UC2 spare;
+	SYNTRO_UC4 seq;											// message sequence number
+	SYNTRO_UC4 len;											// total message length
+} SYNTRO_MULTICAST_DGRAM;
+
+//-------------------------------------------------------------------------------------------
+//	Multicast ack batches
+//
+//	A component can ack its multicast registrations every few messages rather than every message.
+//	Each ack carries the next seq it will accept so one ack covers everything received before it.
+//	The acks that are due at the same time are sent as one SYNTRO_MULTICAST_ACKS followed by count
+//	SYNTRO_MULTICAST_ACK_ENTRYs. The fields of an entry are those of the SYNTRO_EHEAD that would
+//	have been sent on its own.
+
+#define	SYNTRO_MULTICAST_ACKS_MAX			SYNTRO_MAX_SERVICESPERCOMPONENT	// max entries in one batch
+#define	SYNTRO_ACK_COUNT					(SYNTRO_MAX_WINDOW / 2)	// default messages per ack - must be less than the smallest window
+#define	SYNTRO_ACK_INTERVAL					10				// default longest time an ack is held in SyntroClock units
+
+typedef struct
+{
+	SYNTRO_UID destUID;										// the multicast source that is acked
+	SYNTRO_UC2 sourcePort;									// the component's service port
+	SYNTRO_UC2 destPort;									// the source's port
+	unsigned char seq;										// the next seq the component will accept
+	unsigned char spare;
+} SYNTRO_MULTICAST_ACK_ENTRY;
+
+typedef struct
+{
+	SYNTRO_MESSAGE syntroMessage;							// the message header
+	SYNTRO_UID sourceUID;									// the component sending the acks
+	SYNTRO_UC2 count;										// number of entries that follow
+} SYNTRO_MULTICAST_ACKS;
+
+//-------------------------------------------------------------------------------------------
+//	Best effort multicast
+//
+//	A multicast service can be carried over UDP instead of the SyntroLink for streams where the
+//	newest sample matters more than getting every sample. Each datagram is a SYNTRO_BESTEFFORT_DGRAM
+//	followed by the usual multicast SYNTRO_EHEAD and record. There are no acks or retransmissions -
+//	the receiver uses seq to count lost datagrams and drops any that arrive after a later one.
+//
+//	When a SyntroLink comes up, the SyntroControl that accepted it sends a BIND with its UDP port and
+//	a key for the link. Datagrams in either direction on that link must carry the key. A subscriber
+//	then asks for each registration it wants over UDP with SUBSCRIBE, giving its own UDP port. The
+//	ehead ports are those of the registration - sourcePort is the subscriber's port and destPort the
+//	publisher's multicast map slot. A component that publishes a best effort service just sends its
+//	datagrams to the SyntroControl's port once it has the BIND.
+
+#define	SYNTRO_BESTEFFORT_BIND				0				// SyntroControl's UDP port and the link key
+#define	SYNTRO_BESTEFFORT_SUBSCRIBE			1				// send this registration over UDP
+#define	SYNTRO_BESTEFFORT_UNSUBSCRIBE		2				// put this registration back on the SyntroLink
+#define	SYNTRO_BESTEFFORT_ACCEPT			3				// reply to SUBSCRIBE with the seq of the next datagram
+
+typedef struct
+{
+	SYNTRO_EHEAD ehead;										// the registration for SUBSCRIBE and UNSUBSCRIBE
+	SYNTRO_UC4 key;											// the link key for BIND
+	SYNTRO_UC4 seq;											// the next datagram seq for ACCEPT
+	SYNTRO_UC2 udpPort;										// the sender's UDP port for BIND and SUBSCRIBE
+	unsigned char request;									// SYNTRO_BESTEFFORT_* code
+	unsigned char spare;
+} SYNTRO_BESTEFFORT;
+
+#define	SYNTRO_BESTEFFORT_MAXMESSAGE		1400			// larger messages go over the SyntroLink
+#define	SYNTRO_BESTEFFORT_RESYNC			1024			// seq jumps bigger than this mean the sender restarted
+
+typedef struct
+{
+	SYNTRO_UID senderUID;									// the component or SyntroControl that sent the datagram
+	SYNTRO_UC4 key;											// the key of the SyntroLink between them
+	SYNTRO_UC4 seq;											// increments for each datagram on the registration
+} SYNTRO_BESTEFFORT_DGRAM;
+
 //	SYNTROMESSAGE nFlags masks
 
 #define	SYNTROLINK_PRI			0x03						// bits 0 and 1 are priority bits
+#define	SYNTROLINK_FRAGMENT		0x04						// more fragments of this message follow at the same priority
 
 #define	SYNTROLINK_PRIORITIES	4							// four priority levels
 
@@ -22,6 +22,10 @@
 
 #include "SyntroDefs.h"
 #include "SyntroClock.h"
+#include "SyntroPool.h"
+#include "SyntroLinkScheduler.h"
+#include "SyntroSharedRing.h"
+#include "SyntroTimerWheel.h"
 #include "Endpoint.h"
 #include "SyntroSocket.h"
 #include "SyntroRecord.h"
@@ -31,6 +31,10 @@ HEADERS += $$PWD/Endpoint.h \
     $$PWD/SyntroThread.h \
     $$PWD/SyntroSocket.h \
     $$PWD/SyntroClock.h \
+    $$PWD/SyntroPool.h \
+    $$PWD/SyntroLinkScheduler.h \
+    $$PWD/SyntroSharedRing.h \
+    $$PWD/SyntroTimerWheel.h \
     $$PWD/LogWrapper.h \
     $$PWD/Logger.h \
     $$PWD/SyntroComponentData.h \
@@ -44,6 +48,10 @@ SOURCES += $$PWD/Endpoint.cpp \
     $$PWD/SyntroThread.cpp \
     $$PWD/SyntroUtils.cpp \
     $$PWD/SyntroClock.cpp \
+    $$PWD/SyntroPool.cpp \
+    $$PWD/SyntroLinkScheduler.cpp \
+    $$PWD/SyntroSharedRing.cpp \
+    $$PWD/SyntroTimerWheel.cpp \
     $$PWD/LogWrapper.cpp \
     $$PWD/Logger.cpp \
     $$PWD/SyntroComponentData.cpp \
@@ -19,8 +19,47 @@
 
 #include "SyntroLib.h"
 
+#include <qelapsedtimer.h>
+
 //#define SYNTROLINK_TRACE
 
+//	latencyTimer provides the uS clock for the TX latency stats
+
+static struct LatencyTimer
+{
+	LatencyTimer() { timer.start(); }
+	qint64 now() { return timer.nsecsElapsed() / 1000; }
+	QElapsedTimer timer;
+} latencyTimer;
+
+//	SyntroSharedBuffer
+//
+
+SyntroSharedBuffer::SyntroSharedBuffer(unsigned char *data, int len) : m_refCount(1)
+{
+	m_data = data;
+	m_len = len;
+}
+
+SyntroSharedBuffer::~SyntroSharedBuffer()
+{
+	if (m_data != NULL) {
+		free(m_data);
+		m_data = NULL;
+	}
+}
+
+void SyntroSharedBuffer::addRef()
+{
+	m_refCount.ref();
+}
+
+void SyntroSharedBuffer::release()
+{
+	if (!m_refCount.deref())
+		delete this;
+}
+
 //	CSyntroMessage
 //
 
@@ -32,6 +71,14 @@ SyntroMessageWrapper::SyntroMessageWrapper()
 	m_msg = NULL;
 	m_ptr = NULL;
 	m_bytesLeft = 0;
+	m_shared = NULL;
+	m_sharedPtr = NULL;
+	m_sharedLen = 0;
+	m_fragment = false;
+	m_fragHeaderLeft = 0;
+	m_fragBodyLeft = 0;
+	m_queueTime = 0;
+	m_RXSize = 0;
 }
 
 SyntroMessageWrapper::~SyntroMessageWrapper()
@@ -40,12 +87,147 @@ SyntroMessageWrapper::~SyntroMessageWrapper()
 		free(m_msg);
 		m_msg = NULL;
 	}
+	if (m_shared != NULL) {
+		m_shared->release();
+		m_shared = NULL;
+	}
 }
 
+//	SyntroLinkQueue
+//
+//	Qt4 doesn't have the explicit load and store functions so these helpers hide the difference.
+
+static inline SyntroMessageWrapper *loadAcquire(QAtomicPointer<SyntroMessageWrapper>& ptr)
+{
+#if QT_VERSION < 0x050000
+	return ptr.fetchAndAddAcquire(0);
+#else
+	return ptr.loadAcquire();
+#endif
+}
+
+static inline void storeRelease(QAtomicPointer<SyntroMessageWrapper>& ptr, SyntroMessageWrapper *value)
+{
+#if QT_VERSION < 0x050000
+	ptr.fetchAndStoreRelease(value);
+#else
+	ptr.storeRelease(value);
+#endif
+}
+
+static inline int loadInt(QAtomicInt& value)
+{
+#if QT_VERSION < 0x050000
+	return value;
+#else
+	return value.load();
+#endif
+}
+
+SyntroLinkQueue::SyntroLinkQueue()
+{
+	m_stub.m_next = NULL;
+	m_tail = &m_stub;
+	m_head = &m_stub;
+	m_depth = 0;
+	m_highWater = 0;
+	m_bytes = 0;
+}
+
+void SyntroLinkQueue::add(SyntroMessageWrapper *wrapper)
+{
+	int depth;
+	int highWater;
+
+	//	the counts are updated first as wrapper may be removed as soon as it's linked
+
+	m_bytes.fetchAndAddRelaxed(wrapper->m_len);
+	depth = m_depth.fetchAndAddRelaxed(1) + 1;
+	while (depth > (highWater = loadInt(m_highWater))) {
+		if (m_highWater.testAndSetRelaxed(highWater, depth))
+			break;
+	}
+
+	link(wrapper);
+}
+
+void SyntroLinkQueue::link(SyntroMessageWrapper *wrapper)
+{
+	SyntroMessageWrapper *prev;
+
+	wrapper->m_next = NULL;
+	prev = m_tail.fetchAndStoreOrdered(wrapper);
+	storeRelease(prev->m_next, wrapper);					// now visible to the consumer
+}
+
+//	remove only returns NULL if the queue is empty. If a producer has been caught between
+//	swapping the tail and linking in its message, this waits for it to finish.
+
+SyntroMessageWrapper *SyntroLinkQueue::remove()
+{
+	SyntroMessageWrapper *head = m_head;
+	SyntroMessageWrapper *next = loadAcquire(head->m_next);
+
+	if (head == &m_stub) {									// skip over the stub
+		if (next == NULL)
+			return NULL;									// empty
+		m_head = next;
+		head = next;
+		next = loadAcquire(next->m_next);
+	}
+
+	if (next == NULL) {										// head may be the last one
+		if (head == loadAcquire(m_tail))
+			link(&m_stub);									// put the stub back so head can be removed
+		while ((next = loadAcquire(head->m_next)) == NULL)
+			QThread::yieldCurrentThread();					// a producer is part way through an add
+	}
+
+	m_head = next;
+	m_depth.fetchAndAddRelaxed(-1);
+	m_bytes.fetchAndAddRelaxed(-head->m_len);
+	return head;
+}
+
+SyntroMessageWrapper *SyntroLinkQueue::peek()
+{
+	if (m_head == &m_stub)
+		return loadAcquire(m_stub.m_next);
+	return m_head;
+}
+
+SyntroMessageWrapper *SyntroLinkQueue::next(SyntroMessageWrapper *wrapper)
+{
+	SyntroMessageWrapper *next = loadAcquire(wrapper->m_next);
+
+	if (next == &m_stub)
+		next = loadAcquire(m_stub.m_next);
+	return next;
+}
+
+int SyntroLinkQueue::depth()
+{
+	return loadInt(m_depth);
+}
+
+int SyntroLinkQueue::highWater()
+{
+	return loadInt(m_highWater);
+}
+
+int SyntroLinkQueue::bytes()
+{
+	return loadInt(m_bytes);
+}
+
+
 //	Public routines
 //
 
-void SyntroLink::send(int cmd, int len, int priority, SYNTRO_MESSAGE *syntroMessage)
+//	send and sendShared always consume the message. They return false if it was rejected
+//	because the TX queue is full.
+
+bool SyntroLink::send(int cmd, int len, int priority, SYNTRO_MESSAGE *syntroMessage)
 {
 	SyntroMessageWrapper *wrapper;
 
@@ -53,7 +235,37 @@ void SyntroLink::send(int cmd, int len, int priority, SYNTRO_MESSAGE *syntroMess
 	TRACE3("Send - cmd = %d, len = %d, priority= %d", cmd, len, priority);
 #endif
 
-	QMutexLocker locker(&m_TXLock);
+	wrapper = new SyntroMessageWrapper();
+	wrapper->m_len = len;
+	wrapper->m_msg = syntroMessage;
+	wrapper->m_ptr = (unsigned char *)syntroMessage;
+	wrapper->m_bytesLeft = len;
+
+//	set up SYNTROMESSAGE header 
+
+	syntroMessage->cmd = cmd;
+	syntroMessage->flags = priority;
+	syntroMessage->spare = 0;
+	SyntroUtils::convertIntToUC4(len, syntroMessage->len);
+	computeChecksum(syntroMessage);
+
+	return queueTX(wrapper, priority);
+}
+
+//	sendShared queues a message that consists of a private header (syntroMessage, headerLen bytes long)
+//	followed by sharedLen bytes at sharedPtr within a shared buffer. A reference to the shared buffer
+//	is taken for as long as the message is queued so the caller should release its own reference
+//	as usual. The SYNTRO_MESSAGE length covers both parts.
+
+bool SyntroLink::sendShared(int cmd, int headerLen, int priority, SYNTRO_MESSAGE *syntroMessage,
+				SyntroSharedBuffer *shared, unsigned char *sharedPtr, int sharedLen)
+{
+	SyntroMessageWrapper *wrapper;
+	int len = headerLen + sharedLen;
+
+#ifdef SYNTROLINK_TRACE
+	TRACE3("SendShared - cmd = %d, len = %d, priority= %d", cmd, len, priority);
+#endif
 
 	wrapper = new SyntroMessageWrapper();
 	wrapper->m_len = len;
@@ -61,6 +273,11 @@ void SyntroLink::send(int cmd, int len, int priority, SYNTRO_MESSAGE *syntroMess
 	wrapper->m_ptr = (unsigned char *)syntroMessage;
 	wrapper->m_bytesLeft = len;
 
+	shared->addRef();
+	wrapper->m_shared = shared;
+	wrapper->m_sharedPtr = sharedPtr;
+	wrapper->m_sharedLen = sharedLen;
+
 //	set up SYNTROMESSAGE header 
 
 	syntroMessage->cmd = cmd;
@@ -69,15 +286,119 @@ void SyntroLink::send(int cmd, int len, int priority, SYNTRO_MESSAGE *syntroMess
 	SyntroUtils::convertIntToUC4(len, syntroMessage->len);
 	computeChecksum(syntroMessage);
 
+	return queueTX(wrapper, priority);
+}
+
+//	queueTX applies the queue limits and adds the message to the TX queue if allowed
+
+bool SyntroLink::queueTX(SyntroMessageWrapper *wrapper, int priority)
+{
+	wrapper->m_queueTime = latencyTimer.now();
+
+	if (TXQueueFull(priority, wrapper->m_len)) {
+		setTXCongested(priority, true);
+		if (m_TXPolicy[priority] != SYNTROLINK_TXPOLICY_DROPOLDEST) {
+			m_TXDropped[priority].fetchAndAddRelaxed(1);
+			delete wrapper;
+			return m_TXPolicy[priority] != SYNTROLINK_TXPOLICY_REJECT;
+		}
+	}
+
 	addToTXQueue(wrapper, priority);
+
+	//	if trySending isn't running, make room now rather than waiting for it
+
+	if ((m_TXPolicy[priority] == SYNTROLINK_TXPOLICY_DROPOLDEST) && TXQueueOverLimit(priority)) {
+		if (m_TXLock.tryLock()) {
+			trimTXQueue(priority);
+			m_TXLock.unlock();
+		}
+	}
+	return true;
+}
+
+void SyntroLink::setTXQueueLimits(int priority, int maxMessages, int maxBytes, int policy)
+{
+	QMutexLocker locker(&m_TXLock);
+
+	m_TXMaxMessages[priority] = maxMessages;
+	m_TXMaxBytes[priority] = maxBytes;
+	m_TXPolicy[priority] = policy;
+}
+
+int SyntroLink::getTXDropped(int priority)
+{
+	return loadInt(m_TXDropped[priority]);
+}
+
+bool SyntroLink::isTXCongested(int priority)
+{
+	return loadInt(m_TXCongested[priority]) != 0;
+}
+
+//	TXQueueFull returns true if adding a message of length len would exceed the limits
+
+bool SyntroLink::TXQueueFull(int priority, int len)
+{
+	int depth = m_TXQueue[priority].depth();
+
+	if (depth == 0)
+		return false;										// always allow one
+	if ((m_TXMaxMessages[priority] > 0) && (depth >= m_TXMaxMessages[priority]))
+		return true;
+	if ((m_TXMaxBytes[priority] > 0) && ((m_TXQueue[priority].bytes() + len) > m_TXMaxBytes[priority]))
+		return true;
+	return false;
+}
+
+bool SyntroLink::TXQueueOverLimit(int priority)
+{
+	if (m_TXQueue[priority].depth() <= 1)
+		return false;
+	if ((m_TXMaxMessages[priority] > 0) && (m_TXQueue[priority].depth() > m_TXMaxMessages[priority]))
+		return true;
+	if ((m_TXMaxBytes[priority] > 0) && (m_TXQueue[priority].bytes() > m_TXMaxBytes[priority]))
+		return true;
+	return false;
+}
+
+//	TXQueueDrained returns true if the queue is back down to half its limits
+
+bool SyntroLink::TXQueueDrained(int priority)
+{
+	if ((m_TXMaxMessages[priority] > 0) && (m_TXQueue[priority].depth() > (m_TXMaxMessages[priority] / 2)))
+		return false;
+	if ((m_TXMaxBytes[priority] > 0) && (m_TXQueue[priority].bytes() > (m_TXMaxBytes[priority] / 2)))
+		return false;
+	return true;
+}
+
+//	trimTXQueue discards the oldest messages until the queue is within its limits.
+//	Must be called with m_TXLock held.
+
+void SyntroLink::trimTXQueue(int priority)
+{
+	while (TXQueueOverLimit(priority)) {
+		delete getTXHead(priority);
+		m_TXDropped[priority].fetchAndAddRelaxed(1);
+	}
+}
+
+//	setTXCongested records a change in congestion state and tells the handler
+
+void SyntroLink::setTXCongested(int priority, bool congested)
+{
+	if (!m_TXCongested[priority].testAndSetOrdered(congested ? 0 : 1, congested ? 1 : 0))
+		return;												// no change
+
+	if (m_backpressureHandler != NULL)
+		m_backpressureHandler->linkBackpressure(this, priority, congested);
 }
 
 bool SyntroLink::receive(int priority, int *cmd, int *len, SYNTRO_MESSAGE **syntroMessage)
 {
 	SyntroMessageWrapper *wrapper;
 
-	QMutexLocker locker(&m_RXLock);
-
 	if ((wrapper = getRXHead(priority)) != NULL) {
 		*cmd = wrapper->m_cmd;
 		*len = wrapper->m_len;
@@ -92,45 +413,67 @@ bool SyntroLink::receive(int priority, int *cmd, int *len, SYNTRO_MESSAGE **synt
 	return false;
 }
 
+//	tryReceiving reads as much as is available into the link's receive buffer and then parses
+//	as many messages out of that as possible. Small messages are copied out of the buffer so one
+//	read can deliver many of them. A large body that isn't in the buffer is read directly into
+//	the message to avoid copying it twice.
+
 int SyntroLink::tryReceiving(SyntroSocket *sock)
 {
 	int bytesRead;
+	int bytesUsed;
 	int len;
 	SyntroMessageWrapper *wrapper;
 
 	QMutexLocker locker(&m_RXLock);
 
 	while (1) {
-		if (m_RXSM) {										// still waiting for message header
-			bytesRead = sock->sockReceive((unsigned char *)&m_syntroMessage + sizeof(SYNTRO_MESSAGE) - m_RXIPBytesLeft , m_RXIPBytesLeft);
+		if (m_RXBufferNext == m_RXBufferEnd) {				// nothing buffered
+			if (!m_RXSM && (m_RXIP[m_RXIPPriority]->m_bytesLeft >= SYNTROLINK_RXBUFFER_SIZE)) {
+				wrapper = m_RXIP[m_RXIPPriority];
+				bytesRead = sock->sockReceive(wrapper->m_ptr, wrapper->m_bytesLeft);
+				if (bytesRead <= 0)
+					return 0;
+				wrapper->m_bytesLeft -= bytesRead;
+				wrapper->m_ptr += bytesRead;
+				if (wrapper->m_bytesLeft == 0)
+					receiveComplete();
+				continue;
+			}
+			bytesRead = sock->sockReceive(m_RXBuffer, SYNTROLINK_RXBUFFER_SIZE);
 			if (bytesRead <= 0)
 				return 0;
-			m_RXIPBytesLeft -= bytesRead;
+			m_RXBufferNext = 0;
+			m_RXBufferEnd = bytesRead;
+		}
+
+		if (m_RXSM) {										// still waiting for message header
+			bytesUsed = qMin(m_RXBufferEnd - m_RXBufferNext, m_RXIPBytesLeft);
+			memcpy((unsigned char *)&m_syntroMessage + sizeof(SYNTRO_MESSAGE) - m_RXIPBytesLeft,
+					m_RXBuffer + m_RXBufferNext, bytesUsed);
+			m_RXBufferNext += bytesUsed;
+			m_RXIPBytesLeft -= bytesUsed;
 			if (m_RXIPBytesLeft == 0) {						// got complete SYNTRO_MESSAGE header
 				if (!checkChecksum(&m_syntroMessage)) {
 					logError(QString("Incorrect header cksm"));
 					flushReceive(sock);
+					m_RXIPBytesLeft = sizeof(SYNTRO_MESSAGE);
 					continue;
 				}
 #ifdef SYNTROLINK_TRACE
 				TRACE2("Received hdr %d %d", m_syntroMessage.cmd, SyntroUtils::convertUC4ToInt(m_syntroMessage.len));
 #endif
 				m_RXIPPriority = m_syntroMessage.flags & SYNTROLINK_PRI;
+				m_RXIPFragment = (m_syntroMessage.flags & SYNTROLINK_FRAGMENT) != 0;
 				len = SyntroUtils::convertUC4ToInt(m_syntroMessage.len);
 				if (m_RXIP[m_RXIPPriority] == NULL) {		// nothing in progress at this priority
 					m_RXIP[m_RXIPPriority] = new SyntroMessageWrapper();
 					m_RXIP[m_RXIPPriority]->m_cmd = m_syntroMessage.cmd;
-					if (len > (int)sizeof(SYNTRO_MESSAGE)) {
-						m_RXIP[m_RXIPPriority]->m_msg = (SYNTRO_MESSAGE *)malloc(len);
-						m_RXIP[m_RXIPPriority]->m_ptr = (unsigned char *)m_RXIP[m_RXIPPriority]->m_msg + sizeof(SYNTRO_MESSAGE); // we've already received that
-					}
+					m_RXIP[m_RXIPPriority]->m_len = sizeof(SYNTRO_MESSAGE);
 				}
 				wrapper = m_RXIP[m_RXIPPriority];
-				wrapper->m_len = len;
 				if (len == sizeof(SYNTRO_MESSAGE)) {		// no message part
-					addToRXQueue(wrapper, m_RXIPPriority);
-					m_RXIP[m_RXIPPriority] = NULL;
-					resetReceive(m_RXIPPriority);
+					receiveComplete();
 					continue;
 				}
 				else
@@ -141,162 +484,513 @@ int SyntroLink::tryReceiving(SyntroSocket *sock)
 						resetReceive(m_RXIPPriority);
 						continue;
 					}
-					if (len >= SYNTRO_MESSAGE_MAX) {
-						logError(QString("Illegal length message cmd %1, len %2").arg(m_syntroMessage.cmd).arg(len));
+					if (m_syntroMessage.cmd != wrapper->m_cmd) {
+						logError(QString("Fragment cmd %1 doesn't match cmd %2").arg(m_syntroMessage.cmd).arg(wrapper->m_cmd));
 						flushReceive(sock);
 						resetReceive(m_RXIPPriority);
 						continue;
 					}
-					wrapper->m_bytesLeft = len - sizeof(SYNTRO_MESSAGE);	// since we've already received that
+					if ((len < (int)sizeof(SYNTRO_MESSAGE)) || ((wrapper->m_len + len - (int)sizeof(SYNTRO_MESSAGE)) >= SYNTRO_MESSAGE_MAX)) {
+						logError(QString("Illegal length message cmd %1, len %2").arg(m_syntroMessage.cmd).arg(wrapper->m_len + len));
+						flushReceive(sock);
+						resetReceive(m_RXIPPriority);
+						continue;
+					}
+
+					//	the data of each fragment is appended to what has been received so far. For an
+					//	unfragmented message this just allocates it. The buffer at least doubles each
+					//	time it has to grow so a message in many fragments isn't copied over and over.
+
+					len -= sizeof(SYNTRO_MESSAGE);			// since we've already received that
+					if ((wrapper->m_len + len) > wrapper->m_RXSize) {
+						wrapper->m_RXSize = qMax(wrapper->m_len + len, qMin(wrapper->m_RXSize * 2, SYNTRO_MESSAGE_MAX));
+						wrapper->m_msg = (SYNTRO_MESSAGE *)realloc(wrapper->m_msg, wrapper->m_RXSize);
+					}
+					wrapper->m_ptr = (unsigned char *)wrapper->m_msg + wrapper->m_len;
+					wrapper->m_len += len;
+					wrapper->m_bytesLeft = len;
 					m_RXSM = false;
 				}
 			}
 		} else {											// now waiting for data
 			wrapper = m_RXIP[m_RXIPPriority];
-			bytesRead = sock->sockReceive(wrapper->m_ptr, wrapper->m_bytesLeft);
-			if (bytesRead <= 0)
-				return 0;
-			wrapper->m_bytesLeft -= bytesRead;
-			wrapper->m_ptr += bytesRead;
-			if (wrapper->m_bytesLeft == 0) {				// got complete message
-				addToRXQueue(m_RXIP[m_RXIPPriority], m_RXIPPriority);
-				m_RXIP[m_RXIPPriority] = NULL;
-				m_RXSM = true;
-				m_RXIPMsgPtr = (unsigned char *)&m_syntroMessage;
-				m_RXIPBytesLeft = sizeof(SYNTRO_MESSAGE);
-			}
+			bytesUsed = qMin(m_RXBufferEnd - m_RXBufferNext, wrapper->m_bytesLeft);
+			memcpy(wrapper->m_ptr, m_RXBuffer + m_RXBufferNext, bytesUsed);
+			m_RXBufferNext += bytesUsed;
+			wrapper->m_bytesLeft -= bytesUsed;
+			wrapper->m_ptr += bytesUsed;
+			if (wrapper->m_bytesLeft == 0)					// got complete message
+				receiveComplete();
 		}
 	}
 }
 
 int SyntroLink::trySending(SyntroSocket *sock)
 {
-	int bytesSent;
 	int priority;
-	SyntroMessageWrapper *wrapper;
 
 	QMutexLocker locker(&m_TXLock);
 
 	if (sock == NULL)
 		return 0;
 
-	priority = SYNTROLINK_HIGHPRI;
+	for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+		if (m_TXPolicy[priority] == SYNTROLINK_TXPOLICY_DROPOLDEST)
+			trimTXQueue(priority);
+	}
 
-	while(1) {
-		if (m_TXIP[priority] == NULL) {
-			m_TXIP[priority] = getTXHead(priority);
+	if (m_TXBatchMessages > 1)
+		trySendingBatch(sock);
+	else
+		trySendingSingle(sock);
 
-			if (m_TXIP[priority] == NULL) {
-				priority++;
+	for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+		if (isTXCongested(priority) && TXQueueDrained(priority))
+			setTXCongested(priority, false);
+	}
+	return 0;
+}
 
-				if (priority > SYNTROLINK_LOWPRI)
-					return 0;								// nothing to do and no error
+//	trySendingSingle sends queued messages one segment at a time. A frame that has been
+//	started is always finished first, otherwise the scheduler picks the priority to go next.
 
-				continue;
-			}
+int SyntroLink::trySendingSingle(SyntroSocket *sock)
+{
+	int bytesSent;
+	int priority;
+	int frameLen;
+	SyntroMessageWrapper *wrapper;
+	SyntroMessageWrapper *candidate[SYNTROLINK_PRIORITIES];
+	SYNTRO_IOVEC vec[3];
+
+	while(1) {
+		frameLen = 0;										// not charged to the scheduler
+
+		for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+			if ((m_TXIP[priority] != NULL) && TXInFrame(m_TXIP[priority]))
+				break;
+		}
+
+		if (priority > SYNTROLINK_LOWPRI) {
+			for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++)
+				candidate[priority] = (m_TXIP[priority] != NULL) ? m_TXIP[priority] : m_TXQueue[priority].peek();
+			if ((priority = scheduleTX(candidate, NULL)) == -1)
+				return 0;									// nothing to do and no error
+			if (m_TXIP[priority] == NULL)
+				m_TXIP[priority] = getTXHead(priority);
+			frameLen = TXFrameLeft(m_TXIP[priority]);
 		}
 
 		wrapper = m_TXIP[priority];
-	
-		bytesSent = sock->sockSend(wrapper->m_ptr, wrapper->m_bytesLeft);
-		if (bytesSent <= 0)
+
+		getTXSegments(wrapper, vec);
+		bytesSent = sock->sockSend(vec[0].data, vec[0].len);	// one segment at a time
+		if (bytesSent <= 0) {
+			if (frameLen > 0)
+				m_TXScheduler->cancel(priority, frameLen);
 			return 0;										// assume buffer full
+		}
 
-		wrapper->m_bytesLeft -= bytesSent;
-		wrapper->m_ptr += bytesSent;
+		advanceTX(wrapper, bytesSent);
 
 		if (wrapper->m_bytesLeft == 0) {					// finished this message
+			TXComplete(wrapper, priority);
 			delete m_TXIP[priority];
 			m_TXIP[priority] = NULL;
 		}
 	}
 }
 
+//	trySendingBatch collects queued messages in the order the scheduler chooses and sends them
+//	with a single gather write. A frame that was partially sent last time always goes first so that
+//	a body is never interleaved with another frame. Only the current fragment of a fragmented
+//	message is included so that other priorities get another look in before the next one.
+//	Messages stay on their queues until they have actually been sent.
+
+int SyntroLink::trySendingBatch(SyntroSocket *sock)
+{
+	SyntroMessageWrapper *batch[SYNTROLINK_TXBATCH_MAX];
+	int batchPriority[SYNTROLINK_TXBATCH_MAX];
+	int batchLen[SYNTROLINK_TXBATCH_MAX];
+	SyntroMessageWrapper *candidate[SYNTROLINK_PRIORITIES];
+	bool blocked[SYNTROLINK_PRIORITIES];
+	SYNTRO_IOVEC vec[SYNTRO_IOVEC_MAX];
+	SyntroMessageWrapper *wrapper;
+	int count;
+	int vecCount;
+	int bytes;
+	int bytesSent;
+	int partialPriority;
+	int priority;
+	int index;
+	int seg;
+	bool complete;
+
+	while (1) {
+		count = 0;
+		vecCount = 0;
+		bytes = 0;
+		partialPriority = -1;
+
+		for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+			wrapper = m_TXIP[priority];
+			if ((wrapper != NULL) && TXInFrame(wrapper)) {
+				seg = getTXSegments(wrapper, vec);
+				vecCount = seg;
+				for (index = 0; index < seg; index++)
+					bytes += vec[index].len;
+				batchPriority[count] = priority;
+				batchLen[count] = 0;						// not charged to the scheduler
+				batch[count++] = wrapper;
+				partialPriority = priority;
+				break;
+			}
+		}
+
+		for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+			blocked[priority] = (priority == partialPriority) && TXMoreFrames(m_TXIP[priority]);
+			if (blocked[priority])
+				candidate[priority] = NULL;
+			else if (priority == partialPriority)
+				candidate[priority] = m_TXQueue[priority].peek();
+			else if (m_TXIP[priority] != NULL)
+				candidate[priority] = m_TXIP[priority];
+			else
+				candidate[priority] = m_TXQueue[priority].peek();
+		}
+
+		while ((count < m_TXBatchMessages) && (bytes < m_TXBatchBytes)) {
+			if ((priority = scheduleTX(candidate, blocked)) == -1)
+				break;
+			wrapper = candidate[priority];
+			seg = getTXSegments(wrapper, vec + vecCount);
+			for (index = 0; index < seg; index++)
+				bytes += vec[vecCount + index].len;
+			vecCount += seg;
+			batchPriority[count] = priority;
+			batchLen[count] = TXFrameLeft(wrapper);
+			batch[count++] = wrapper;
+
+			if (TXMoreFrames(wrapper)) {
+				candidate[priority] = NULL;					// nothing else at this priority can go yet
+				blocked[priority] = true;
+			} else if (wrapper == m_TXIP[priority]) {
+				candidate[priority] = m_TXQueue[priority].peek();
+			} else {
+				candidate[priority] = m_TXQueue[priority].next(wrapper);
+			}
+		}
+
+		if (count == 0)
+			return 0;										// nothing to do and no error
+
+		bytesSent = sock->sockSendVector(vec, vecCount);
+		if (bytesSent < 0)
+			bytesSent = 0;
+
+		complete = bytesSent == bytes;
+
+		//	now retire whatever was sent. Messages are in queue order within each priority so
+		//	anything not already in progress must be at the head of its queue by now. Frames
+		//	that didn't get sent at all are handed back to the scheduler.
+
+		for (index = 0; index < count; index++) {
+			wrapper = batch[index];
+			priority = batchPriority[index];
+
+			if (bytesSent == 0) {
+				if (batchLen[index] > 0)
+					m_TXScheduler->cancel(priority, batchLen[index]);
+				continue;
+			}
+
+			if (m_TXIP[priority] != wrapper)
+				m_TXIP[priority] = getTXHead(priority);
+
+			seg = qMin(bytesSent, TXFrameLeft(wrapper));
+			advanceTX(wrapper, seg);
+			bytesSent -= seg;
+
+			if (wrapper->m_bytesLeft == 0) {
+				TXComplete(wrapper, priority);
+				delete wrapper;
+				m_TXIP[priority] = NULL;
+			}
+		}
+
+		if (!complete)
+			return 0;										// assume buffer full
+	}
+}
+
+//	scheduleTX gets the next frame of each candidate ready and asks the scheduler which to send.
+//	blocked (if not NULL) marks priorities that have more to send that can't go yet.
+
+int SyntroLink::scheduleTX(SyntroMessageWrapper **candidate, bool *blocked)
+{
+	int frameLen[SYNTROLINK_PRIORITIES];
+
+	for (int priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+		if ((blocked != NULL) && blocked[priority]) {
+			frameLen[priority] = -1;
+		} else if (candidate[priority] == NULL) {
+			frameLen[priority] = 0;
+		} else {
+			startTXFrame(candidate[priority], priority);
+			frameLen[priority] = TXFrameLeft(candidate[priority]);
+		}
+	}
+	return m_TXScheduler->select(frameLen);
+}
+
+//	TXComplete updates the latency stats when the last of a message has been sent
+
+void SyntroLink::TXComplete(SyntroMessageWrapper *wrapper, int priority)
+{
+	qint64 latency = latencyTimer.now() - wrapper->m_queueTime;
+
+	m_TXLatency[priority].messages++;
+	m_TXLatency[priority].totalLatency += latency;
+	if (latency > m_TXLatency[priority].maxLatency)
+		m_TXLatency[priority].maxLatency = latency;
+}
+
+//	startTXFrame gets the next frame of a message ready if the last one has been sent. A message
+//	that's small enough (or when fragmentation is off) is a single frame that starts with its own
+//	header. Otherwise the message's own header is skipped and each fragment gets a new one.
+
+void SyntroLink::startTXFrame(SyntroMessageWrapper *wrapper, int priority)
+{
+	int len;
+
+	if (!wrapper->m_fragment) {
+		if ((m_TXFragmentSize == 0) || (wrapper->m_bytesLeft < wrapper->m_len))
+			return;											// not fragmenting or already started
+		if ((wrapper->m_len - (int)sizeof(SYNTRO_MESSAGE)) <= m_TXFragmentSize)
+			return;											// fits in one frame
+		advanceTX(wrapper, sizeof(SYNTRO_MESSAGE));
+		wrapper->m_fragment = true;
+	}
+
+	if ((wrapper->m_fragHeaderLeft > 0) || (wrapper->m_fragBodyLeft > 0))
+		return;												// current fragment not finished
+
+	len = wrapper->m_bytesLeft;
+	if ((m_TXFragmentSize > 0) && (len > m_TXFragmentSize))
+		len = m_TXFragmentSize;
+
+	wrapper->m_fragHeader.cmd = wrapper->m_msg->cmd;
+	wrapper->m_fragHeader.flags = priority;
+	if (len < wrapper->m_bytesLeft)
+		wrapper->m_fragHeader.flags |= SYNTROLINK_FRAGMENT;
+	wrapper->m_fragHeader.spare = 0;
+	SyntroUtils::convertIntToUC4(len + sizeof(SYNTRO_MESSAGE), wrapper->m_fragHeader.len);
+	computeChecksum(&wrapper->m_fragHeader);
+
+	wrapper->m_fragHeaderLeft = sizeof(SYNTRO_MESSAGE);
+	wrapper->m_fragBodyLeft = len;
+}
+
+//	TXFrameLeft returns the number of bytes left to be sent in the current frame
+
+int SyntroLink::TXFrameLeft(SyntroMessageWrapper *wrapper)
+{
+	if (wrapper->m_fragment)
+		return wrapper->m_fragHeaderLeft + wrapper->m_fragBodyLeft;
+	return wrapper->m_bytesLeft;
+}
+
+//	TXInFrame returns true if part of the current frame has been sent
+
+bool SyntroLink::TXInFrame(SyntroMessageWrapper *wrapper)
+{
+	if (wrapper->m_fragment)
+		return (wrapper->m_fragHeaderLeft < (int)sizeof(SYNTRO_MESSAGE)) && (TXFrameLeft(wrapper) > 0);
+	return wrapper->m_bytesLeft < wrapper->m_len;
+}
+
+//	TXMoreFrames returns true if there are more fragments to go after the current one
+
+bool SyntroLink::TXMoreFrames(SyntroMessageWrapper *wrapper)
+{
+	return wrapper->m_fragment && (wrapper->m_bytesLeft > wrapper->m_fragBodyLeft);
+}
+
+//	getTXSegments fills in the unsent parts of the current frame. This is the fragment header
+//	if there is one, then the rest of the private part and then the shared payload, so up to
+//	three segments.
+
+int SyntroLink::getTXSegments(SyntroMessageWrapper *wrapper, SYNTRO_IOVEC *vec)
+{
+	int count = 0;
+	int bytesLeft = wrapper->m_bytesLeft;
+	int privateLeft = wrapper->m_bytesLeft - wrapper->m_sharedLen;
+
+	if (wrapper->m_fragment) {
+		if (wrapper->m_fragHeaderLeft > 0) {
+			vec[count].data = (unsigned char *)&wrapper->m_fragHeader + sizeof(SYNTRO_MESSAGE) - wrapper->m_fragHeaderLeft;
+			vec[count++].len = wrapper->m_fragHeaderLeft;
+		}
+		bytesLeft = wrapper->m_fragBodyLeft;
+		if (bytesLeft == 0)
+			return count;
+	}
+
+	if (privateLeft > 0) {
+		vec[count].data = wrapper->m_ptr;
+		vec[count++].len = qMin(privateLeft, bytesLeft);
+		bytesLeft -= privateLeft;
+		if (bytesLeft <= 0)
+			return count;
+		vec[count].data = wrapper->m_sharedPtr;
+		vec[count++].len = bytesLeft;
+		return count;
+	}
+
+	vec[count].data = wrapper->m_sharedPtr + wrapper->m_sharedLen - wrapper->m_bytesLeft;
+	vec[count++].len = bytesLeft;
+	return count;
+}
+
+//	advanceTX moves the message on by bytes that have been accepted by the socket
+
+void SyntroLink::advanceTX(SyntroMessageWrapper *wrapper, int bytes)
+{
+	int privateLeft = wrapper->m_bytesLeft - wrapper->m_sharedLen;
+	int headerBytes;
+
+	if (wrapper->m_fragment) {
+		headerBytes = qMin(bytes, wrapper->m_fragHeaderLeft);
+		wrapper->m_fragHeaderLeft -= headerBytes;
+		bytes -= headerBytes;
+		wrapper->m_fragBodyLeft -= bytes;
+	}
+
+	if (privateLeft > 0)
+		wrapper->m_ptr += qMin(bytes, privateLeft);
+	wrapper->m_bytesLeft -= bytes;
+}
+
+void SyntroLink::setTXBatch(int maxMessages, int maxBytes)
+{
+	QMutexLocker locker(&m_TXLock);
+
+	if (maxMessages > SYNTROLINK_TXBATCH_MAX)
+		maxMessages = SYNTROLINK_TXBATCH_MAX;
+	if (maxBytes < 1)
+		maxBytes = 1;
+	m_TXBatchMessages = maxMessages;
+	m_TXBatchBytes = maxBytes;
+}
+
+//	setTXScheduler replaces the scheduler used to decide which priority sends next
+
+void SyntroLink::setTXScheduler(SyntroLinkScheduler *scheduler)
+{
+	QMutexLocker locker(&m_TXLock);
+
+	delete m_TXScheduler;
+	if (scheduler == NULL)
+		scheduler = new SyntroLinkStrictScheduler();
+	m_TXScheduler = scheduler;
+}
+
+//	getTXLatency returns the latency stats for a priority since they were last reset
+
+void SyntroLink::getTXLatency(int priority, SYNTROLINK_LATENCY *latency, bool reset)
+{
+	QMutexLocker locker(&m_TXLock);
+
+	*latency = m_TXLatency[priority];
+	if (reset)
+		memset(&m_TXLatency[priority], 0, sizeof(SYNTROLINK_LATENCY));
+}
+
+//	setTXFragmentSize sets the max data bytes per fragment. Messages already being sent as
+//	fragments just carry on with the new size (or finish in one go if it's now 0).
+
+void SyntroLink::setTXFragmentSize(int fragmentSize)
+{
+	QMutexLocker locker(&m_TXLock);
+
+	if (fragmentSize < 0)
+		fragmentSize = 0;
+	m_TXFragmentSize = fragmentSize;
+}
+
 
 SyntroLink::SyntroLink(const QString& logTag)
 {
 	m_logTag = logTag;
 	for (int i = 0; i < SYNTROLINK_PRIORITIES; i++) {
-		m_TXHead[i] = NULL;
-		m_TXTail[i] = NULL;
-		m_RXHead[i] = NULL;
-		m_RXTail[i] = NULL;
 		m_RXIP[i] = NULL;
 		m_TXIP[i] = NULL;
 	}
 
 	m_RXSM = true;
-	m_RXIPMsgPtr = (unsigned char *)&m_syntroMessage;
 	m_RXIPBytesLeft = sizeof(SYNTRO_MESSAGE);
+	m_RXIPPriority = SYNTROLINK_HIGHPRI;
+	m_RXIPFragment = false;
+
+	for (int i = 0; i < SYNTROLINK_PRIORITIES; i++) {
+		m_TXMaxMessages[i] = 0;
+		m_TXMaxBytes[i] = 0;
+		m_TXPolicy[i] = SYNTROLINK_TXPOLICY_DROPOLDEST;
+		m_TXDropped[i] = 0;
+		m_TXCongested[i] = 0;
+		memset(&m_TXLatency[i], 0, sizeof(SYNTROLINK_LATENCY));
+	}
+	m_backpressureHandler = NULL;
+
+	m_TXBatchMessages = SYNTROLINK_TXBATCH_MESSAGES;
+	m_TXBatchBytes = SYNTROLINK_TXBATCH_BYTES;
+	m_TXFragmentSize = 0;
+	m_TXScheduler = new SyntroLinkStrictScheduler();
+
+	m_RXBuffer = (unsigned char *)malloc(SYNTROLINK_RXBUFFER_SIZE);
+	m_RXBufferNext = 0;
+	m_RXBufferEnd = 0;
 }
 
 SyntroLink::~SyntroLink(void)
 {
 	clearTXQueue();
 	clearRXQueue();
+	free(m_RXBuffer);
+	delete m_TXScheduler;
 }
 
 
 void SyntroLink::addToTXQueue(SyntroMessageWrapper *wrapper, int priority)
 {
-	if (m_TXHead[priority] == NULL) {
-		m_TXHead[priority] = wrapper;
-		m_TXTail[priority] = wrapper;
-		wrapper->m_next = NULL;
-		return;
-	}
-
-	m_TXTail[priority]->m_next = wrapper;
-	m_TXTail[priority] = wrapper;
-	wrapper->m_next = NULL;
+	m_TXQueue[priority].add(wrapper);
 }
 
 
 void	SyntroLink::addToRXQueue(SyntroMessageWrapper *wrapper, int priority)
 {
-	if (m_RXHead[priority] == NULL) {
-		m_RXHead[priority] = wrapper;
-		m_RXTail[priority] = wrapper;
-		wrapper->m_next = NULL;
-		return;
-	}
-
-	m_RXTail[priority]->m_next = wrapper;
-	m_RXTail[priority] = wrapper;
-	wrapper->m_next = NULL;
+	m_RXQueue[priority].add(wrapper);
 }
 
 
 SyntroMessageWrapper *SyntroLink::getTXHead(int priority)
 {
-	SyntroMessageWrapper *wrapper;
-
-	if (m_TXHead[priority] == NULL)
-		return NULL;
-
-	wrapper = m_TXHead[priority];
-	m_TXHead[priority] = wrapper->m_next;
-	return wrapper;
+	return m_TXQueue[priority].remove();
 }
 
 SyntroMessageWrapper *SyntroLink::getRXHead(int priority)
 {
-	SyntroMessageWrapper *wrapper;
-
-	if (m_RXHead[priority] == NULL)
-		return NULL;
-
-	wrapper = m_RXHead[priority];
-	m_RXHead[priority] = wrapper->m_next;
-	return wrapper;
+	return m_RXQueue[priority].remove();
 }
 
 
 void SyntroLink::clearTXQueue()
 {
+	SyntroMessageWrapper *wrapper;
+
 	for (int i = 0; i < SYNTROLINK_PRIORITIES; i++) {
-		while (m_TXHead[i] != NULL)
-			delete getTXHead(i);
+		while ((wrapper = getTXHead(i)) != NULL)
+			delete wrapper;
 
 		if (m_TXIP[i] != NULL)
 			delete m_TXIP[i];
@@ -307,16 +1001,28 @@ void SyntroLink::clearTXQueue()
 
 void SyntroLink::flushReceive(SyntroSocket *sock)
 {
-	unsigned char buf[1000];
+	m_RXBufferNext = m_RXBufferEnd = 0;						// discard anything buffered too
 
-	while (sock->sockReceive(buf, 1000) > 0)
+	while (sock->sockReceive(m_RXBuffer, SYNTROLINK_RXBUFFER_SIZE) > 0)
 		;
 }
 
+//	receiveComplete queues the message in progress once its body has been received. If more
+//	fragments follow it stays in progress until the last one has arrived.
+
+void SyntroLink::receiveComplete()
+{
+	if (!m_RXIPFragment) {
+		addToRXQueue(m_RXIP[m_RXIPPriority], m_RXIPPriority);
+		m_RXIP[m_RXIPPriority] = NULL;
+	}
+	m_RXSM = true;
+	m_RXIPBytesLeft = sizeof(SYNTRO_MESSAGE);
+}
+
 void SyntroLink::resetReceive(int priority)
 {
 	m_RXSM = true;
-	m_RXIPMsgPtr = (unsigned char *)&m_syntroMessage;
 	m_RXIPBytesLeft = sizeof(SYNTRO_MESSAGE);
 
 	if (m_RXIP[priority] != NULL) {
@@ -327,9 +1033,11 @@ void SyntroLink::resetReceive(int priority)
 
 void SyntroLink::clearRXQueue()
 {
+	SyntroMessageWrapper *wrapper;
+
 	for (int i = 0; i < SYNTROLINK_PRIORITIES; i++) {
-		while (m_RXHead[i] != NULL)
-			delete getRXHead(i);
+		while ((wrapper = getRXHead(i)) != NULL)
+			delete wrapper;
 
 		if (m_RXIP[i] != NULL)
 			delete m_RXIP[i];
@@ -20,6 +20,35 @@
 #ifndef _SYNTROLINK_H_
 #define _SYNTROLINK_H_
 
+#include "SyntroSocket.h"
+#include "SyntroPool.h"
+#include "SyntroLinkScheduler.h"
+
+//	SyntroSharedBuffer is a reference counted, malloced buffer that can be queued on
+//	any number of SyntroLinks at the same time. It's used by SyntroControl so that a multicast
+//	payload is only stored once no matter how many subscribers it is sent to. The buffer
+//	starts with a single reference held by the creator and is freed when the last reference
+//	is released.
+
+class SYNTROLIB_EXPORT SyntroSharedBuffer
+{
+public:
+	SyntroSharedBuffer(unsigned char *data, int len);		// takes ownership of malloced data
+
+	void addRef();											// adds a reference for a new user
+	void release();											// removes a reference and frees if it was the last
+
+	unsigned char *data() { return m_data; }
+	int length() { return m_len; }
+
+private:
+	~SyntroSharedBuffer();									// only release() may delete the object
+
+	QAtomicInt m_refCount;									// the number of current users
+	unsigned char *m_data;									// the malloced data
+	int m_len;												// length of the data
+};
+
 //	The internal version of SYNTROMESSAGE
 
 class SYNTROLIB_EXPORT SyntroMessageWrapper
@@ -28,17 +57,125 @@ public:
 	SyntroMessageWrapper(void);
 	~SyntroMessageWrapper(void);
 
+	static void *operator new(size_t size) { return SyntroPool::alloc((int)size); }
+	static void operator delete(void *ptr) { SyntroPool::release(ptr); }
+
 	SYNTRO_MESSAGE *m_msg;									// message buffer pointer
 	int m_len;												// total length
-	SyntroMessageWrapper *m_next;							// pointer to next in chain
+	QAtomicPointer<SyntroMessageWrapper> m_next;			// pointer to next in chain
 	int m_bytesLeft;										// bytes left to be received or sent
 	unsigned char *m_ptr;									// pointer in m_pMsg while receiving or transmitting
 
+//	for shared payload transmit
+
+	SyntroSharedBuffer *m_shared;							// shared payload sent after m_msg (NULL if none)
+	unsigned char *m_sharedPtr;								// start of the shared part of the payload
+	int m_sharedLen;										// length of the shared part of the payload
+
+//	for fragmented transmit
+
+	bool m_fragment;										// true if being sent as fragments
+	SYNTRO_MESSAGE m_fragHeader;							// header of the current fragment
+	int m_fragHeaderLeft;									// bytes of m_fragHeader left to be sent
+	int m_fragBodyLeft;										// bytes of the current fragment's data left to be sent
+	qint64 m_queueTime;										// when it was queued for the latency stats
+
 //	for receive
 
 	int m_cmd;												// the current command
+	int m_RXSize;											// bytes allocated for m_msg while fragments are received
+};
+
+
+//	SyntroLinkQueue is a lock free queue of SyntroMessageWrappers chained through m_next. Any number
+//	of threads may add to a queue at the same time but only one thread may remove from it (or look
+//	at it) at a time. It uses the usual intrusive MPSC design with a stub node so that adding is a
+//	single atomic exchange and removing needs no atomic read-modify-write at all in the normal case.
+//	Depth and high water mark are maintained for stats.
+
+class SYNTROLIB_EXPORT SyntroLinkQueue
+{
+public:
+	SyntroLinkQueue();
+
+	void add(SyntroMessageWrapper *wrapper);				// may be called by any thread
+	SyntroMessageWrapper *remove();							// consumer only - returns NULL if empty
+	SyntroMessageWrapper *peek();							// consumer only - the one remove would return
+	SyntroMessageWrapper *next(SyntroMessageWrapper *wrapper);	// consumer only - the one after wrapper
+
+	int depth();											// number of messages on the queue
+	int highWater();										// max depth seen
+	int bytes();											// total length of messages on the queue
+
+private:
+	void link(SyntroMessageWrapper *wrapper);				// adds to the chain without touching the stats
+
+	SyntroMessageWrapper m_stub;							// always in the chain when it would be empty
+	QAtomicPointer<SyntroMessageWrapper> m_tail;			// last in chain - updated by producers
+	SyntroMessageWrapper *m_head;							// first in chain - only used by the consumer
+	QAtomicInt m_depth;
+	QAtomicInt m_highWater;
+	QAtomicInt m_bytes;
+};
+
+//	TX queue limits. Each priority of a link can be given a max number of messages and bytes
+//	(0 means no limit). When a new message would exceed a limit the policy decides what happens:
+//
+//	SYNTROLINK_TXPOLICY_DROPOLDEST - the oldest queued messages are discarded to make room
+//	SYNTROLINK_TXPOLICY_DROPNEWEST - the new message is discarded
+//	SYNTROLINK_TXPOLICY_REJECT - the new message is discarded and send returns false
+//
+//	A message is never dropped once transmission has started and a queue is always allowed to
+//	hold at least one message, however large.
+
+#define	SYNTROLINK_TXPOLICY_DROPOLDEST		0
+#define	SYNTROLINK_TXPOLICY_DROPNEWEST		1
+#define	SYNTROLINK_TXPOLICY_REJECT			2
+
+class SyntroLink;
+
+//	SyntroLinkBackpressure can be implemented by the owner of a SyntroLink to find out when a TX
+//	queue hits its limits (congested is true) and when it has drained to half of them again
+//	(congested is false). It may be called from the thread calling send or the one calling trySending.
+
+class SYNTROLIB_EXPORT SyntroLinkBackpressure
+{
+public:
+	virtual ~SyntroLinkBackpressure() {}
+	virtual void linkBackpressure(SyntroLink *link, int priority, bool congested) = 0;
 };
 
+//	Transmit batching. When enabled, trySending collects up to maxMessages queued messages
+//	(or maxBytes, whichever comes first) in strict priority order and passes them to the
+//	socket as a single gather write.
+
+#define	SYNTROLINK_TXBATCH_MESSAGES		32					// default max messages per batch
+#define	SYNTROLINK_TXBATCH_BYTES		(64 * 1024)			// default max bytes per batch
+#define	SYNTROLINK_TXBATCH_MAX			(SYNTRO_IOVEC_MAX / 3)	// limit - each message may need three segments
+
+//	Transmit fragmentation. When a fragment size is set, a message whose data is larger than that
+//	is sent as a number of frames, each with its own SYNTRO_MESSAGE header carrying the message's
+//	cmd and priority. SYNTROLINK_FRAGMENT is set in all but the last one and the receiver puts the
+//	data back together before queuing the message. Higher priority frames can be sent between the
+//	fragments so that a large low priority message doesn't hold them up for its whole length.
+//	Peers must be running a SyntroLib that understands fragments so it's off by default.
+
+#define	SYNTROLINK_TXFRAGMENT_SIZE		(16 * 1024)			// suggested fragment size when enabled
+
+//	Receive buffering. tryReceiving reads into a per link buffer of this size and parses as many
+//	messages out of each read as it can.
+
+#define	SYNTROLINK_RXBUFFER_SIZE		(64 * 1024)			// size of the receive buffer
+
+//	SYNTROLINK_LATENCY holds the transmit latency stats for a priority. Latency is measured from
+//	when a message is queued to when the last of it has been passed to the socket.
+
+typedef struct
+{
+	qint64 messages;										// number of messages sent
+	qint64 totalLatency;									// sum of their latencies in uS
+	qint64 maxLatency;										// the worst latency in uS
+} SYNTROLINK_LATENCY;
 
 //	The SyntroLink class itself
 
@@ -48,39 +185,87 @@ public:
 	SyntroLink(const QString& logTag);
 	~SyntroLink(void);
 
-	void send(int cmd, int len, int priority, SYNTRO_MESSAGE *syntroMessage);
+	bool send(int cmd, int len, int priority, SYNTRO_MESSAGE *syntroMessage);
+	bool sendShared(int cmd, int headerLen, int priority, SYNTRO_MESSAGE *syntroMessage,
+				SyntroSharedBuffer *shared, unsigned char *sharedPtr, int sharedLen);
 	bool receive(int priority, int *cmd, int *len, SYNTRO_MESSAGE **syntroMessage);
 
 	int tryReceiving(SyntroSocket *sock);
 	int trySending(SyntroSocket *sock);
 
+	void setTXBatch(int maxMessages, int maxBytes);			// maxMessages <= 1 disables batching
+	void setTXFragmentSize(int fragmentSize);				// 0 disables fragmentation
+	void setTXScheduler(SyntroLinkScheduler *scheduler);	// takes ownership, NULL restores strict priority
+	void getTXLatency(int priority, SYNTROLINK_LATENCY *latency, bool reset = false);
+
+	int getTXQueueDepth(int priority) { return m_TXQueue[priority].depth(); }
+	int getTXQueueHighWater(int priority) { return m_TXQueue[priority].highWater(); }
+	int getRXQueueDepth(int priority) { return m_RXQueue[priority].depth(); }
+	int getRXQueueHighWater(int priority) { return m_RXQueue[priority].highWater(); }
+
+	void setTXQueueLimits(int priority, int maxMessages, int maxBytes, int policy);
+	void setBackpressureHandler(SyntroLinkBackpressure *handler) { m_backpressureHandler = handler; }
+	int getTXDropped(int priority);							// messages dropped or rejected at this priority
+	bool isTXCongested(int priority);						// true if the queue has hit its limits and not yet drained
+
 protected:
 	void clearTXQueue();
 	void clearRXQueue();
 	void resetReceive(int priority);
 	void flushReceive(SyntroSocket *sock);
+	void receiveComplete();
 	SyntroMessageWrapper *getTXHead(int priority);
 	SyntroMessageWrapper *getRXHead(int priority);
 	void addToTXQueue(SyntroMessageWrapper *wrapper, int nPri);
 	void addToRXQueue(SyntroMessageWrapper *wrapper, int nPri);
 	void computeChecksum(SYNTRO_MESSAGE *syntroMessage);
 	bool checkChecksum(SYNTRO_MESSAGE *syntroMessage);
+	bool TXQueueFull(int priority, int len);
+	bool TXQueueOverLimit(int priority);
+	bool TXQueueDrained(int priority);
+	void trimTXQueue(int priority);
+	void setTXCongested(int priority, bool congested);
+	bool queueTX(SyntroMessageWrapper *wrapper, int priority);
+	int trySendingSingle(SyntroSocket *sock);
+	int trySendingBatch(SyntroSocket *sock);
+	int getTXSegments(SyntroMessageWrapper *wrapper, SYNTRO_IOVEC *vec);
+	void advanceTX(SyntroMessageWrapper *wrapper, int bytes);
+	void startTXFrame(SyntroMessageWrapper *wrapper, int priority);
+	int TXFrameLeft(SyntroMessageWrapper *wrapper);
+	bool TXInFrame(SyntroMessageWrapper *wrapper);
+	bool TXMoreFrames(SyntroMessageWrapper *wrapper);
+	int scheduleTX(SyntroMessageWrapper **candidate, bool *blocked);
+	void TXComplete(SyntroMessageWrapper *wrapper, int priority);
 
-	SyntroMessageWrapper *m_TXHead[SYNTROLINK_PRIORITIES];	// head of transmit list
-	SyntroMessageWrapper *m_TXTail[SYNTROLINK_PRIORITIES];	// tail of transmit list
-	SyntroMessageWrapper *m_RXHead[SYNTROLINK_PRIORITIES];	// head of receive list
-	SyntroMessageWrapper *m_RXTail[SYNTROLINK_PRIORITIES];	// tail of receive list
+	SyntroLinkQueue m_TXQueue[SYNTROLINK_PRIORITIES];		// transmit queues - added to by any thread
+	SyntroLinkQueue m_RXQueue[SYNTROLINK_PRIORITIES];		// receive queues - added to by tryReceiving
 
 	SyntroMessageWrapper *m_TXIP[SYNTROLINK_PRIORITIES];	// in progress TX object
 	SyntroMessageWrapper *m_RXIP[SYNTROLINK_PRIORITIES];	// in progress RX object
 	bool m_RXSM;											// true if waiting for SYNTROMESSAGE header
-	unsigned char *m_RXIPMsgPtr;							// pointer into message header
 	int m_RXIPBytesLeft;
 	SYNTRO_MESSAGE m_syntroMessage;							// for receive
 	int m_RXIPPriority;										// the current priority being received
+	bool m_RXIPFragment;									// true if more fragments follow the current frame
+	unsigned char *m_RXBuffer;								// receive buffer
+	int m_RXBufferNext;										// offset of next unparsed byte in m_RXBuffer
+	int m_RXBufferEnd;										// offset of end of valid data in m_RXBuffer
+
+	int m_TXMaxMessages[SYNTROLINK_PRIORITIES];				// max messages on each TX queue (0 = no limit)
+	int m_TXMaxBytes[SYNTROLINK_PRIORITIES];				// max bytes on each TX queue (0 = no limit)
+	int m_TXPolicy[SYNTROLINK_PRIORITIES];					// what to do when a limit is hit
+	QAtomicInt m_TXDropped[SYNTROLINK_PRIORITIES];			// messages dropped or rejected
+	QAtomicInt m_TXCongested[SYNTROLINK_PRIORITIES];		// 1 if limits have been hit
+	SyntroLinkBackpressure *m_backpressureHandler;			// told about congestion changes
+
+	int m_TXBatchMessages;									// max messages per transmit batch
+	int m_TXBatchBytes;										// max bytes per transmit batch
+	int m_TXFragmentSize;									// max data bytes per fragment (0 = don't fragment)
+	SyntroLinkScheduler *m_TXScheduler;						// decides which priority sends next
+	SYNTROLINK_LATENCY m_TXLatency[SYNTROLINK_PRIORITIES];	// protected by m_TXLock
 
-	QMutex m_RXLock;
-	QMutex m_TXLock;
+	QMutex m_RXLock;										// serializes tryReceiving
+	QMutex m_TXLock;										// serializes trySending
 
 	QString m_logTag;
 };
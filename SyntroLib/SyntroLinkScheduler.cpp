@@ -0,0 +1,172 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroLib
+//
+//  SyntroLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "SyntroLinkScheduler.h"
+
+#define	SYNTROLINK_SCHED_WFQ_SCALE		256					// scales WFQ costs to keep precision
+
+SyntroLinkScheduler::SyntroLinkScheduler()
+{
+	m_weight[SYNTROLINK_HIGHPRI] = SYNTROLINK_SCHED_HIGHPRI_WEIGHT;
+	m_weight[SYNTROLINK_MEDHIGHPRI] = SYNTROLINK_SCHED_MEDHIGHPRI_WEIGHT;
+	m_weight[SYNTROLINK_MEDPRI] = SYNTROLINK_SCHED_MEDPRI_WEIGHT;
+	m_weight[SYNTROLINK_LOWPRI] = SYNTROLINK_SCHED_LOWPRI_WEIGHT;
+}
+
+SyntroLinkScheduler *SyntroLinkScheduler::create(int mode)
+{
+	switch (mode) {
+		case SYNTROLINK_SCHED_WFQ:
+			return new SyntroLinkWFQScheduler();
+
+		case SYNTROLINK_SCHED_DRR:
+			return new SyntroLinkDRRScheduler();
+
+		default:
+			return new SyntroLinkStrictScheduler();
+	}
+}
+
+void SyntroLinkScheduler::setWeight(int priority, int weight)
+{
+	if (weight < 1)
+		weight = 1;
+	m_weight[priority] = weight;
+}
+
+//	SyntroLinkStrictScheduler
+
+int SyntroLinkStrictScheduler::select(int *frameLen)
+{
+	for (int priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+		if (frameLen[priority] > 0)
+			return priority;
+	}
+	return -1;
+}
+
+//	SyntroLinkWFQScheduler
+//
+//	This is self clocked fair queuing. Each frame gets a finish tag that's its cost added to the
+//	priority's last finish tag. A priority that has just become active starts from the tag of the
+//	frame last selected instead so that it can't use up credit from while it was idle. The frame
+//	with the lowest tag goes next, ties going to the higher priority.
+
+SyntroLinkWFQScheduler::SyntroLinkWFQScheduler()
+{
+	m_virtualTime = 0;
+	for (int priority = 0; priority < SYNTROLINK_PRIORITIES; priority++) {
+		m_finish[priority] = 0;
+		m_active[priority] = false;
+	}
+}
+
+int SyntroLinkWFQScheduler::select(int *frameLen)
+{
+	int best = -1;
+	qint64 bestTag = 0;
+	qint64 tag;
+
+	for (int priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+		if (frameLen[priority] == 0) {
+			m_active[priority] = false;
+			continue;
+		}
+		if (!m_active[priority]) {
+			m_active[priority] = true;
+			m_finish[priority] = qMax(m_virtualTime, m_finish[priority]);
+		}
+		if (frameLen[priority] < 0)
+			continue;
+		tag = m_finish[priority] + cost(priority, frameLen[priority]);
+		if ((best == -1) || (tag < bestTag)) {
+			best = priority;
+			bestTag = tag;
+		}
+	}
+
+	if (best != -1) {
+		m_finish[best] = bestTag;
+		m_virtualTime = bestTag;
+	}
+	return best;
+}
+
+void SyntroLinkWFQScheduler::cancel(int priority, int len)
+{
+	m_finish[priority] -= cost(priority, len);
+}
+
+qint64 SyntroLinkWFQScheduler::cost(int priority, int len)
+{
+	return ((qint64)len * SYNTROLINK_SCHED_WFQ_SCALE) / m_weight[priority];
+}
+
+//	SyntroLinkDRRScheduler
+//
+//	Priorities are visited in turn. Each visit adds the priority's quantum to its deficit and it
+//	keeps being selected until the next frame is bigger than what's left. A priority with nothing
+//	to send loses whatever it had left.
+
+SyntroLinkDRRScheduler::SyntroLinkDRRScheduler()
+{
+	for (int priority = 0; priority < SYNTROLINK_PRIORITIES; priority++)
+		m_deficit[priority] = 0;
+	m_current = SYNTROLINK_HIGHPRI;
+	m_newVisit = true;
+}
+
+int SyntroLinkDRRScheduler::select(int *frameLen)
+{
+	int priority;
+
+	for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+		if (frameLen[priority] > 0)
+			break;
+	}
+	if (priority > SYNTROLINK_LOWPRI) {
+		for (priority = SYNTROLINK_HIGHPRI; priority <= SYNTROLINK_LOWPRI; priority++) {
+			if (frameLen[priority] == 0)
+				m_deficit[priority] = 0;
+		}
+		return -1;											// nothing that can be sent
+	}
+
+	while (1) {
+		if (frameLen[m_current] == 0) {
+			m_deficit[m_current] = 0;
+		} else if (frameLen[m_current] > 0) {
+			if (m_newVisit) {
+				m_deficit[m_current] += m_weight[m_current] * SYNTROLINK_SCHED_QUANTUM;
+				m_newVisit = false;
+			}
+			if (m_deficit[m_current] >= frameLen[m_current]) {
+				m_deficit[m_current] -= frameLen[m_current];
+				return m_current;
+			}
+		}
+		m_current = (m_current + 1) % SYNTROLINK_PRIORITIES;
+		m_newVisit = true;
+	}
+}
+
+void SyntroLinkDRRScheduler::cancel(int priority, int len)
+{
+	m_deficit[priority] += len;
+}
@@ -0,0 +1,102 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroLib
+//
+//  SyntroLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef	_SYNTROLINKSCHEDULER_H
+#define	_SYNTROLINKSCHEDULER_H
+
+#include "SyntroUtils.h"
+
+//	A SyntroLinkScheduler decides which priority a SyntroLink sends from next. It's asked each time
+//	a new frame (a whole message or one fragment) is about to be sent and is given the length of the
+//	next frame at each priority. This is 0 if there's nothing to send or -1 if there is but it can't
+//	go yet (the rest of a fragmented message already in the batch). A frame that has been started is
+//	always finished without asking. Schedulers are only used by the thread calling trySending.
+//
+//	SYNTROLINK_SCHED_STRICT - always the highest priority with something to send (the default)
+//	SYNTROLINK_SCHED_WFQ - weighted fair queuing, bytes are shared out in proportion to the weights
+//	SYNTROLINK_SCHED_DRR - deficit round robin, each priority gets weight * quantum bytes per round
+//
+//	Weights only matter to WFQ and DRR. A priority with nothing to send doesn't build up credit.
+
+#define	SYNTROLINK_SCHED_STRICT			0
+#define	SYNTROLINK_SCHED_WFQ			1
+#define	SYNTROLINK_SCHED_DRR			2
+
+#define	SYNTROLINK_SCHED_HIGHPRI_WEIGHT		8				// default weights
+#define	SYNTROLINK_SCHED_MEDHIGHPRI_WEIGHT	4
+#define	SYNTROLINK_SCHED_MEDPRI_WEIGHT		2
+#define	SYNTROLINK_SCHED_LOWPRI_WEIGHT		1
+
+#define	SYNTROLINK_SCHED_QUANTUM		(4 * 1024)			// DRR bytes per round per unit of weight
+
+class SYNTROLIB_EXPORT SyntroLinkScheduler
+{
+public:
+	SyntroLinkScheduler();
+	virtual ~SyntroLinkScheduler() {}
+
+	static SyntroLinkScheduler *create(int mode);			// returns a new one of the standard schedulers
+
+	virtual int select(int *frameLen) = 0;					// returns the priority to send next or -1 if none
+	virtual void cancel(int, int) { return; }				// a selected frame (priority, len) couldn't be sent
+
+	void setWeight(int priority, int weight);				// weights must be at least 1
+	int getWeight(int priority) { return m_weight[priority]; }
+
+protected:
+	int m_weight[SYNTROLINK_PRIORITIES];
+};
+
+class SYNTROLIB_EXPORT SyntroLinkStrictScheduler : public SyntroLinkScheduler
+{
+public:
+	int select(int *frameLen);
+};
+
+class SYNTROLIB_EXPORT SyntroLinkWFQScheduler : public SyntroLinkScheduler
+{
+public:
+	SyntroLinkWFQScheduler();
+
+	int select(int *frameLen);
+	void cancel(int priority, int len);
+
+private:
+	qint64 cost(int priority, int len);						// virtual time taken to send len bytes
+
+	qint64 m_virtualTime;									// finish tag of the last frame selected
+	qint64 m_finish[SYNTROLINK_PRIORITIES];					// finish tag of the last frame at each priority
+	bool m_active[SYNTROLINK_PRIORITIES];					// true if the priority has had something to send
+};
+
+class SYNTROLIB_EXPORT SyntroLinkDRRScheduler : public SyntroLinkScheduler
+{
+public:
+	SyntroLinkDRRScheduler();
+
+	int select(int *frameLen);
+	void cancel(int priority, int len);
+
+private:
+	int m_deficit[SYNTROLINK_PRIORITIES];					// bytes each priority may still send this round
+	int m_current;											// the priority being served
+	bool m_newVisit;										// true if m_current hasn't had its quantum yet
+};
+
+#endif	// _SYNTROLINKSCHEDULER_H
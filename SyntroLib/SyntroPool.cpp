@@ -0,0 +1,311 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroLib
+//
+//  SyntroLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "SyntroPool.h"
+
+#include <qthreadstorage.h>
+
+class SyntroPoolCache;
+
+//	Every block starts with a SYNTRO_POOL_BLOCK so release knows which class it came from and
+//	which thread's cache it belongs to. The header is 16 bytes to keep the user part suitably aligned.
+
+typedef struct _SYNTRO_POOL_BLOCK
+{
+	int sizeClass;											// size class or -1 if from malloc
+	union {
+		struct _SYNTRO_POOL_BLOCK *next;					// next in free list when cached
+		SyntroPoolCache *owner;								// cache of the allocating thread when in use
+	};
+} SYNTRO_POOL_BLOCK;
+
+#define	SYNTROPOOL_HEADER				16					// space reserved for SYNTRO_POOL_BLOCK
+#define	SYNTROPOOL_PUBLISH				256					// allocations between publishing the counters
+
+#define	SYNTROPOOL_RETIRED				((SYNTRO_POOL_BLOCK *)1)	// remote list value when no thread owns the cache
+
+//	SyntroPoolCache is the per thread cache. The free lists and counters are only touched by the
+//	owning thread. Blocks freed by other threads are pushed onto m_remote and the owner takes
+//	the whole list back when it runs out of a class. When a thread exits its cache is kept for
+//	the next new thread, as blocks it allocated may still be in use.
+
+class SyntroPoolCache
+{
+public:
+	SyntroPoolCache();
+
+	void adopt();											// makes the cache the current thread's
+	void retire();											// frees the cached blocks when the thread exits
+	void remoteRelease(SYNTRO_POOL_BLOCK *block);			// returns a block freed by another thread
+	void drainRemote();										// moves returned blocks to the free lists
+	void cacheBlock(SYNTRO_POOL_BLOCK *block);				// puts a block on its free list or frees it
+	void publish();											// copies the counters to m_published
+
+	SYNTRO_POOL_BLOCK *m_free[SYNTROPOOL_CLASSES];			// free list for each class
+	int m_count[SYNTROPOOL_CLASSES];						// number of blocks on each free list
+	QAtomicPointer<SYNTRO_POOL_BLOCK> m_remote;				// blocks freed by other threads
+
+	qint64 m_allocs;
+	qint64 m_hits;
+	qint64 m_oversize;
+	qint64 m_bytesHeld;
+
+	SYNTRO_POOL_STATS m_published;							// counters as last published - protected by poolLock
+};
+
+//	SyntroPoolOwner is what the thread storage holds. QThreadStorage deletes it when the thread
+//	exits and that retires the cache rather than deleting it.
+
+class SyntroPoolOwner
+{
+public:
+	SyntroPoolOwner(SyntroPoolCache *cache) { m_cache = cache; }
+	~SyntroPoolOwner() { m_cache->retire(); }
+
+	SyntroPoolCache *m_cache;
+};
+
+static QThreadStorage<SyntroPoolOwner *> poolOwner;
+static QMutex poolLock;										// protects the lists, poolRetired and m_published
+static QList<SyntroPoolCache *> poolCaches;					// caches of all current threads
+static QList<SyntroPoolCache *> poolIdle;					// caches of threads that have gone
+static SYNTRO_POOL_STATS poolRetired;						// stats from threads that have gone
+
+//	Qt4 doesn't have the explicit load function so this helper hides the difference.
+
+static inline SYNTRO_POOL_BLOCK *loadAcquire(QAtomicPointer<SYNTRO_POOL_BLOCK>& ptr)
+{
+#if QT_VERSION < 0x050000
+	return ptr.fetchAndAddAcquire(0);
+#else
+	return ptr.loadAcquire();
+#endif
+}
+
+SyntroPoolCache::SyntroPoolCache()
+	: m_remote(SYNTROPOOL_RETIRED)
+{
+	for (int i = 0; i < SYNTROPOOL_CLASSES; i++) {
+		m_free[i] = NULL;
+		m_count[i] = 0;
+	}
+	m_allocs = 0;
+	m_hits = 0;
+	m_oversize = 0;
+	m_bytesHeld = 0;
+	memset(&m_published, 0, sizeof(SYNTRO_POOL_STATS));
+}
+
+void SyntroPoolCache::adopt()
+{
+	m_remote.fetchAndStoreOrdered(NULL);					// other threads can return blocks again
+}
+
+void SyntroPoolCache::retire()
+{
+	SYNTRO_POOL_BLOCK *block;
+	SYNTRO_POOL_BLOCK *next;
+
+	block = m_remote.fetchAndStoreOrdered(SYNTROPOOL_RETIRED);
+	for (; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+
+	for (int i = 0; i < SYNTROPOOL_CLASSES; i++) {
+		while ((block = m_free[i]) != NULL) {
+			m_free[i] = block->next;
+			free(block);
+		}
+		m_count[i] = 0;
+	}
+
+	QMutexLocker locker(&poolLock);
+	poolCaches.removeOne(this);
+	poolIdle.append(this);
+	poolRetired.allocs += m_allocs;
+	poolRetired.hits += m_hits;
+	poolRetired.oversize += m_oversize;
+	m_allocs = 0;
+	m_hits = 0;
+	m_oversize = 0;
+	m_bytesHeld = 0;
+	memset(&m_published, 0, sizeof(SYNTRO_POOL_STATS));
+}
+
+//	remoteRelease pushes the block onto the remote list. If the owning thread has gone the block
+//	is simply freed.
+
+void SyntroPoolCache::remoteRelease(SYNTRO_POOL_BLOCK *block)
+{
+	SYNTRO_POOL_BLOCK *head;
+
+	do {
+		head = loadAcquire(m_remote);
+		if (head == SYNTROPOOL_RETIRED) {
+			free(block);
+			return;
+		}
+		block->next = head;
+	} while (!m_remote.testAndSetRelease(head, block));
+}
+
+void SyntroPoolCache::drainRemote()
+{
+	SYNTRO_POOL_BLOCK *block;
+	SYNTRO_POOL_BLOCK *next;
+
+	if (loadAcquire(m_remote) == NULL)
+		return;
+
+	block = m_remote.fetchAndStoreAcquire(NULL);
+	for (; block != NULL; block = next) {
+		next = block->next;
+		cacheBlock(block);
+	}
+}
+
+void SyntroPoolCache::cacheBlock(SYNTRO_POOL_BLOCK *block)
+{
+	int sizeClass = block->sizeClass;
+
+	if (m_count[sizeClass] >= SYNTROPOOL_MAX_CACHED) {
+		free(block);										// cache is full
+		return;
+	}
+	block->next = m_free[sizeClass];
+	m_free[sizeClass] = block;
+	m_count[sizeClass]++;
+	m_bytesHeld += SYNTROPOOL_MIN_BLOCK << sizeClass;
+}
+
+void SyntroPoolCache::publish()
+{
+	QMutexLocker locker(&poolLock);
+	m_published.allocs = m_allocs;
+	m_published.hits = m_hits;
+	m_published.oversize = m_oversize;
+	m_published.bytesHeld = m_bytesHeld;
+}
+
+//	getPoolCache returns the current thread's cache, reusing one left by a thread that has
+//	gone if there is one.
+
+static SyntroPoolCache *getPoolCache()
+{
+	SyntroPoolCache *cache;
+
+	if (poolOwner.hasLocalData())
+		return poolOwner.localData()->m_cache;
+
+	poolLock.lock();
+	if (poolIdle.isEmpty())
+		cache = new SyntroPoolCache();
+	else
+		cache = poolIdle.takeFirst();
+	poolCaches.append(cache);
+	poolLock.unlock();
+
+	cache->adopt();
+	poolOwner.setLocalData(new SyntroPoolOwner(cache));
+	return cache;
+}
+
+void *SyntroPool::alloc(int size)
+{
+	SyntroPoolCache *cache = getPoolCache();
+	SYNTRO_POOL_BLOCK *block;
+	int sizeClass;
+
+	if ((++cache->m_allocs % SYNTROPOOL_PUBLISH) == 0)
+		cache->publish();
+
+	if (size > SYNTROPOOL_MAX_BLOCK) {
+		cache->m_oversize++;
+		block = (SYNTRO_POOL_BLOCK *)malloc(SYNTROPOOL_HEADER + size);
+		block->sizeClass = -1;
+		block->owner = NULL;
+		return (unsigned char *)block + SYNTROPOOL_HEADER;
+	}
+
+	for (sizeClass = 0; (SYNTROPOOL_MIN_BLOCK << sizeClass) < size; sizeClass++)
+		;
+
+	if (cache->m_free[sizeClass] == NULL)
+		cache->drainRemote();
+
+	if ((block = cache->m_free[sizeClass]) != NULL) {
+		cache->m_free[sizeClass] = block->next;
+		cache->m_count[sizeClass]--;
+		cache->m_bytesHeld -= SYNTROPOOL_MIN_BLOCK << sizeClass;
+		cache->m_hits++;
+	} else {
+		block = (SYNTRO_POOL_BLOCK *)malloc(SYNTROPOOL_HEADER + (SYNTROPOOL_MIN_BLOCK << sizeClass));
+		block->sizeClass = sizeClass;
+	}
+	block->owner = cache;
+	return (unsigned char *)block + SYNTROPOOL_HEADER;
+}
+
+//	release puts a block back in the cache it came from. If that belongs to another thread it's
+//	returned through the remote list so that the allocating thread gets it back.
+
+void SyntroPool::release(void *ptr)
+{
+	SyntroPoolCache *cache;
+	SYNTRO_POOL_BLOCK *block;
+
+	if (ptr == NULL)
+		return;
+
+	block = (SYNTRO_POOL_BLOCK *)((unsigned char *)ptr - SYNTROPOOL_HEADER);
+
+	if (block->sizeClass < 0) {
+		free(block);
+		return;
+	}
+
+	cache = getPoolCache();
+	if (block->owner != cache) {
+		block->owner->remoteRelease(block);
+		return;
+	}
+	cache->cacheBlock(block);
+}
+
+//	getStats adds up the counters each cache last published. Caches publish every
+//	SYNTROPOOL_PUBLISH allocations so the result lags a little behind.
+
+void SyntroPool::getStats(SYNTRO_POOL_STATS *stats)
+{
+	SyntroPoolCache *cache;
+
+	QMutexLocker locker(&poolLock);
+
+	*stats = poolRetired;
+	stats->threads = poolCaches.count();
+
+	for (int i = 0; i < poolCaches.count(); i++) {
+		cache = poolCaches.at(i);
+		stats->allocs += cache->m_published.allocs;
+		stats->hits += cache->m_published.hits;
+		stats->oversize += cache->m_published.oversize;
+		stats->bytesHeld += cache->m_published.bytesHeld;
+	}
+}
@@ -0,0 +1,56 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroLib
+//
+//  SyntroLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef	_SYNTROPOOL_H
+#define	_SYNTROPOOL_H
+
+#include "SyntroUtils.h"
+
+//	SyntroPool is a size class allocator for the small, short lived objects that pass through
+//	every SyntroLink. Each thread keeps its own cache of free blocks so allocating and freeing
+//	never takes a lock. A block may be freed by any thread - if that isn't the thread that
+//	allocated it, it's handed back to the allocating thread's cache through a lock free list.
+//	Requests larger than the biggest size class go straight to malloc.
+
+#define	SYNTROPOOL_CLASSES				8					// number of size classes
+#define	SYNTROPOOL_MIN_BLOCK			32					// smallest size class - each class doubles
+#define	SYNTROPOOL_MAX_BLOCK			(SYNTROPOOL_MIN_BLOCK << (SYNTROPOOL_CLASSES - 1))
+#define	SYNTROPOOL_MAX_CACHED			256					// max free blocks per class per thread
+
+//	SYNTRO_POOL_STATS is filled in by SyntroPool::getStats. Counts include threads that have exited.
+//	Blocks on a remote list aren't included in bytesHeld until their owner takes them back.
+
+typedef struct
+{
+	qint64 allocs;											// total allocations
+	qint64 hits;											// allocations satisfied from a cache
+	qint64 oversize;										// allocations too big for the pool
+	qint64 bytesHeld;										// bytes sitting in free blocks in caches
+	int threads;											// number of threads that currently have a cache
+} SYNTRO_POOL_STATS;
+
+class SYNTROLIB_EXPORT SyntroPool
+{
+public:
+	static void *alloc(int size);							// allocates at least size bytes
+	static void release(void *ptr);							// frees a block obtained from alloc
+	static void getStats(SYNTRO_POOL_STATS *stats);			// gets the current stats
+};
+
+#endif	// _SYNTROPOOL_H
@@ -0,0 +1,204 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroLib
+//
+//  SyntroLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "SyntroSharedRing.h"
+
+#include <quuid.h>
+
+#define	SYNTRO_SHM_HEADERSIZE	(2 * sizeof(SYNTRO_SHM_RING))
+
+static inline int loadAcquire(QAtomicInt& val)
+{
+#if QT_VERSION < 0x050000
+	return val.fetchAndAddAcquire(0);
+#else
+	return val.loadAcquire();
+#endif
+}
+
+static inline void storeRelease(QAtomicInt& val, int newVal)
+{
+#if QT_VERSION < 0x050000
+	val.fetchAndStoreRelease(newVal);
+#else
+	val.storeRelease(newVal);
+#endif
+}
+
+SyntroSharedRing::SyntroSharedRing()
+{
+	m_logTag = "SyntroSharedRing";
+	m_memory = new QSharedMemory();
+	m_key[0] = 0;
+	m_TXRing = m_RXRing = NULL;
+	m_TXData = m_RXData = NULL;
+	m_TXSize = m_RXSize = 0;
+}
+
+SyntroSharedRing::~SyntroSharedRing()
+{
+	delete m_memory;										// detaches and, if last, destroys the segment
+}
+
+bool SyntroSharedRing::create(int ringSize)
+{
+	SYNTRO_SHM_RING *ring;
+
+	//	The key is random so that another process can't guess it and attach first
+
+	qsnprintf(m_key, SYNTRO_SHM_KEYLEN, "SyntroShm-%s", QUuid::createUuid().toRfc4122().toHex().constData());
+	m_memory->setKey(m_key);
+	if (!m_memory->create((int)SYNTRO_SHM_HEADERSIZE + 2 * ringSize)) {
+		logWarn(QString("Failed to create shared memory %1 - %2").arg(m_key).arg(m_memory->errorString()));
+		return false;
+	}
+	memset(m_memory->data(), 0, SYNTRO_SHM_HEADERSIZE);
+	ring = (SYNTRO_SHM_RING *)m_memory->data();
+	ring[0].size = ringSize;
+	ring[1].size = ringSize;
+	setRings(true);
+	return true;
+}
+
+bool SyntroSharedRing::attach(const char *key)
+{
+	SYNTRO_SHM_RING *ring;
+
+	qstrncpy(m_key, key, SYNTRO_SHM_KEYLEN);
+	m_memory->setKey(m_key);
+	if (!m_memory->attach()) {
+		logWarn(QString("Failed to attach shared memory %1 - %2").arg(m_key).arg(m_memory->errorString()));
+		return false;
+	}
+	ring = (SYNTRO_SHM_RING *)m_memory->data();
+	if ((m_memory->size() < (int)SYNTRO_SHM_HEADERSIZE) || (ring[0].size <= 0) || (ring[1].size <= 0) ||
+			(m_memory->size() < (int)SYNTRO_SHM_HEADERSIZE + ring[0].size + ring[1].size)) {
+		logWarn(QString("Shared memory %1 has invalid layout").arg(m_key));
+		m_memory->detach();
+		return false;
+	}
+	setRings(false);
+	return true;
+}
+
+//	Ring 0 carries data from the creator to the attacher, ring 1 the other way
+
+void SyntroSharedRing::setRings(bool creator)
+{
+	SYNTRO_SHM_RING *ring = (SYNTRO_SHM_RING *)m_memory->data();
+	unsigned char *data = (unsigned char *)m_memory->data() + SYNTRO_SHM_HEADERSIZE;
+
+	if (creator) {
+		m_TXRing = ring;
+		m_TXData = data;
+		m_RXRing = ring + 1;
+		m_RXData = data + ring[0].size;
+	} else {
+		m_TXRing = ring + 1;
+		m_TXData = data + ring[0].size;
+		m_RXRing = ring;
+		m_RXData = data;
+	}
+	m_TXSize = m_TXRing->size;								// keep private copies as the other side could change them
+	m_RXSize = m_RXRing->size;
+}
+
+const char *SyntroSharedRing::key()
+{
+	return m_key;
+}
+
+//	write copies as much of buf as will fit. If the ring is too full it sets writerWaiting and checks
+//	again so that space freed by the reader in the meantime can't be missed. Offsets written by the
+//	other process are range checked and -1 returned if the ring is corrupt.
+
+int SyntroSharedRing::write(const void *buf, int len)
+{
+	int size = m_TXSize;
+	int head = loadAcquire(m_TXRing->head);
+	int tail = loadAcquire(m_TXRing->tail);
+	int space;
+	int chunk;
+
+	if (((unsigned)head >= (unsigned)size) || ((unsigned)tail >= (unsigned)size))
+		return -1;
+	space = (tail - head - 1 + size) % size;
+	if (space < len) {
+		m_TXRing->writerWaiting.fetchAndStoreOrdered(1);
+		tail = loadAcquire(m_TXRing->tail);
+		if ((unsigned)tail >= (unsigned)size)
+			return -1;
+		space = (tail - head - 1 + size) % size;
+	}
+	if (len > space)
+		len = space;
+	if (len == 0)
+		return 0;
+
+	chunk = qMin(len, size - head);
+	memcpy(m_TXData + head, buf, chunk);
+	if (chunk < len)
+		memcpy(m_TXData, (const unsigned char *)buf + chunk, len - chunk);
+	storeRelease(m_TXRing->head, (head + len) % size);
+	return len;
+}
+
+//	read copies out up to len bytes. If the ring is empty it sets readerWaiting and checks again.
+//	As for write, -1 is returned if the ring is corrupt.
+
+int SyntroSharedRing::read(void *buf, int len)
+{
+	int size = m_RXSize;
+	int tail = loadAcquire(m_RXRing->tail);
+	int head = loadAcquire(m_RXRing->head);
+	int avail;
+	int chunk;
+
+	if (((unsigned)head >= (unsigned)size) || ((unsigned)tail >= (unsigned)size))
+		return -1;
+	avail = (head - tail + size) % size;
+	if (avail == 0) {
+		m_RXRing->readerWaiting.fetchAndStoreOrdered(1);
+		head = loadAcquire(m_RXRing->head);
+		if ((unsigned)head >= (unsigned)size)
+			return -1;
+		avail = (head - tail + size) % size;
+	}
+	if (len > avail)
+		len = avail;
+	if (len == 0)
+		return 0;
+
+	chunk = qMin(len, size - tail);
+	memcpy(buf, m_RXData + tail, chunk);
+	if (chunk < len)
+		memcpy((unsigned char *)buf + chunk, m_RXData, len - chunk);
+	storeRelease(m_RXRing->tail, (tail + len) % size);
+	return len;
+}
+
+bool SyntroSharedRing::wakeReader()
+{
+	return m_TXRing->readerWaiting.fetchAndStoreOrdered(0) != 0;
+}
+
+bool SyntroSharedRing::wakeWriter()
+{
+	return m_RXRing->writerWaiting.fetchAndStoreOrdered(0) != 0;
+}
@@ -0,0 +1,99 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//	
+//  This file is part of SyntroLib
+//
+//  SyntroLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef	_SYNTROSHAREDRING_H
+#define	_SYNTROSHAREDRING_H
+
+#include "SyntroUtils.h"
+
+#include <qsharedmemory.h>
+
+//	SyntroSharedRing carries a SyntroLink between two processes on the same machine through a
+//	shared memory segment holding one byte ring for each direction. The connecting side creates
+//	the segment and the accepting side attaches to it. Each ring has a single writer and a single
+//	reader so no locks are needed.
+//
+//	When the reader finds its ring empty it sets a flag. A writer that then adds data sees the flag
+//	and must wake the reader (SyntroSocket does this with one byte on the link's TCP connection).
+//	Writers that find the ring full do the same in the other direction.
+
+#define	SYNTRO_SHM_RINGSIZE				(SYNTRO_MESSAGE_MAX * 8)	// default bytes in each direction
+#define	SYNTRO_SHM_KEYLEN				56					// max length of segment key including 0
+
+//	The preamble is the first thing a connecting side sends on its TCP connection to request
+//	a shared memory link. Its first byte cannot be the start of a SYNTRO_MESSAGE. The accepting
+//	side replies with a single ACK or NAK byte. After that, bytes on the TCP connection are just
+//	wake ups.
+
+#define	SYNTRO_SHM_MAGIC				"\xa5SyntShm"		// compared as 8 bytes - the 0 is not sent
+#define	SYNTRO_SHM_ACK					'A'
+#define	SYNTRO_SHM_NAK					'N'
+#define	SYNTRO_SHM_WAKE					'W'
+
+typedef struct
+{
+	char magic[8];											// SYNTRO_SHM_MAGIC
+	char key[SYNTRO_SHM_KEYLEN];							// the segment key
+} SYNTRO_SHM_PREAMBLE;
+
+//	SYNTRO_SHM_RING is the header of one ring. Offsets wrap at size and one byte is always left
+//	free so that head == tail means empty.
+
+typedef struct
+{
+	QAtomicInt head;										// offset of next byte to write
+	QAtomicInt tail;										// offset of next byte to read
+	QAtomicInt readerWaiting;								// set when the reader found the ring empty
+	QAtomicInt writerWaiting;								// set when the writer found the ring full
+	int size;												// size of the data area
+	int spare[11];											// pad to 64 bytes
+} SYNTRO_SHM_RING;
+
+class SYNTROLIB_EXPORT SyntroSharedRing
+{
+public:
+	SyntroSharedRing();
+	~SyntroSharedRing();
+
+	bool create(int ringSize);								// creates a new segment with a random key
+	bool attach(const char *key);							// attaches to a segment created by the other side
+	const char *key();										// the segment key
+
+	int write(const void *buf, int len);					// returns bytes written which may be short, -1 if corrupt
+	int read(void *buf, int len);							// returns bytes read, 0 if none, -1 if corrupt
+	bool wakeReader();										// true if the reader must be woken after writes
+	bool wakeWriter();										// true if the writer must be woken after reads
+
+private:
+	void setRings(bool creator);
+
+	QSharedMemory *m_memory;
+	char m_key[SYNTRO_SHM_KEYLEN];
+
+	SYNTRO_SHM_RING *m_TXRing;								// the ring this side writes
+	unsigned char *m_TXData;
+	SYNTRO_SHM_RING *m_RXRing;								// the ring this side reads
+	unsigned char *m_RXData;
+	int m_TXSize;											// ring sizes
+	int m_RXSize;
+
+	QString m_logTag;
+};
+
+#endif	// _SYNTROSHAREDRING_H
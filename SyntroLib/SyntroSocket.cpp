@@ -17,8 +17,53 @@
 //  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+//	The system socket headers must come first as SyntroSocket.h has its own idea of SOCK_STREAM
+//	and SOCK_DGRAM. They are only needed for the gather write, raw sockets and socket options.
+
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+static const int systemSockStream = SOCK_STREAM;			// for Unix domain sockets
+#undef	SOCK_STREAM
+#undef	SOCK_DGRAM
+#endif
+
 #include "SyntroSocket.h"
 
+#ifdef __linux__
+//	localSocketAddress fills in the abstract Unix domain name used for port. Abstract names
+//	vanish with the last descriptor so there is nothing to clean up after a crash.
+
+static socklen_t localSocketAddress(int port, struct sockaddr_un *addr)
+{
+	int len;
+
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	len = qsnprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "SyntroControl.%d", port);
+	return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+#endif
+
+//	isLoopback is true if address can only be another process on this machine. Accepted links
+//	from anywhere else are never allowed shared memory.
+
+static bool isLoopback(const QHostAddress& address)
+{
+	return address.isInSubnet(QHostAddress(QHostAddress::LocalHost), 8) ||
+			(address == QHostAddress(QHostAddress::LocalHostIPv6));
+}
+
 // SyntroSocket
 
 //  This constructor only used by the Hello system
@@ -26,6 +71,7 @@
 SyntroSocket::SyntroSocket(const QString& logTag)
 {
 	m_logTag = logTag;
+	m_sockType = -1;
 	clearSocket();
 }
 
@@ -33,6 +79,7 @@ SyntroSocket::SyntroSocket(const QString& logTag)
 
 SyntroSocket::SyntroSocket(SyntroThread *thread, int connectionID, bool encrypt)
 {
+	m_sockType = -1;
 	clearSocket();
 	m_ownerThread = thread;
 	m_connectionID = connectionID;
@@ -52,6 +99,15 @@ void SyntroSocket::clearSocket()
 	m_UDPSocket = NULL;
 	m_server = NULL;
 	m_state = -1;
+	m_writeLimit = SYNTROSOCKET_WRITE_LIMIT;
+	m_rawFd = -1;
+	m_poller = NULL;
+	m_local = false;
+	memset(&m_options, 0, sizeof(m_options));
+	m_optionsPending = false;
+	m_shm = NULL;
+	m_shmState = SYNTROSOCKET_SHM_NONE;
+	m_shmAllowed = false;
 }
 
 //	Set nFlags = true for reuseaddr
@@ -114,20 +170,148 @@ bool SyntroSocket::sockConnect(const char *addr, int port)
 	return true;
 }
 
-bool SyntroSocket::sockAccept(SyntroSocket& sock, char *IpAddr, int *port)
+//	sockConnectLocal connects to a SyntroControl's Unix domain listener. The descriptor is handed to
+//	the QTcpSocket so everything after this is the same as for TCP. Connecting is immediate so
+//	false means there is no local listener and the caller should use sockConnect.
+
+bool SyntroSocket::sockConnectLocal(int port)
 {
+#ifdef __linux__
+	struct sockaddr_un addr;
+	socklen_t addrLen;
+	int fd;
+
+	if ((m_sockType != SOCK_STREAM) || m_encrypt)
+		return false;
+
+	addrLen = localSocketAddress(port, &addr);
+	fd = ::socket(AF_UNIX, systemSockStream | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return false;
+	if (::connect(fd, (struct sockaddr *)&addr, addrLen) != 0) {
+		::close(fd);										// no listener or its backlog is full
+		return false;
+	}
+	if (!m_TCPSocket->setSocketDescriptor(fd)) {
+		logWarn(QString("Failed to adopt local socket - %1").arg(m_TCPSocket->errorString()));
+		::close(fd);
+		return false;
+	}
+	m_local = true;
+	if (m_state != QAbstractSocket::ConnectedState)
+		onState(QAbstractSocket::ConnectedState);			// in case Qt didn't signal the change
+	onConnect();											// Qt doesn't emit connected() for an adopted descriptor
+	return true;
+#else
+	Q_UNUSED(port);
+	return false;
+#endif
+}
+
+bool SyntroSocket::sockAccept(SyntroSocket& sock, char *IpAddr, int *port, SyntroSocketPoller *poller)
+{
+	if (m_poller != NULL)
+		return sockAcceptRaw(sock, IpAddr, port, (poller != NULL) ? poller : m_poller);
+
     sock.m_TCPSocket = m_server->nextPendingConnection();
-   	strcpy(IpAddr, (char *)sock.m_TCPSocket->peerAddress().toString().toLocal8Bit().constData());
-    *port = (int)sock.m_TCPSocket->peerPort();
+	if (m_local) {
+		strcpy(IpAddr, "127.0.0.1");
+		*port = SYNTROSOCKET_LOCAL_PORTBASE + (int)sock.m_TCPSocket->socketDescriptor();
+		sock.m_local = true;
+	} else {
+	   	strcpy(IpAddr, (char *)sock.m_TCPSocket->peerAddress().toString().toLocal8Bit().constData());
+	    *port = (int)sock.m_TCPSocket->peerPort();
+	}
 	sock.m_sockType = SOCK_STREAM;
 	sock.m_ownerThread = m_ownerThread;
 	sock.m_state = QAbstractSocket::ConnectedState;
     sock.m_encrypt = m_server->usingSSL();
+	if (m_shmState == SYNTROSOCKET_SHM_PROBE) {
+		sock.m_shmState = SYNTROSOCKET_SHM_PROBE;
+		sock.m_shmAllowed = m_shmAllowed && (m_local || isLoopback(sock.m_TCPSocket->peerAddress()));
+	}
 	return true;
 }
 
+//	sockSetPoller makes a listener accept connections as raw non-blocking sockets that are driven
+//	by poller rather than by QTcpSocket signals. It must be called before sockListen. SSL listeners
+//	always use Qt.
+
+bool SyntroSocket::sockSetPoller(SyntroSocketPoller *poller)
+{
+	if (m_sockType != SOCK_SERVER) {
+		logError(QString("Incorrect socket type for SetPoller %1").arg(m_sockType));
+		return false;
+	}
+	if (m_encrypt || (poller == NULL) || !poller->isValid())
+		return false;
+	m_poller = poller;
+	m_server->setRawAccept(true);
+	return true;
+}
+
+//	sockAcceptRaw takes the next raw descriptor from the listener and attaches it to sock, polled
+//	by poller. The message codes are set by the caller before control returns to the event loop
+//	(or, if poller belongs to another thread, before its dispatch lock is released) so no poll
+//	events can be lost.
+
+bool SyntroSocket::sockAcceptRaw(SyntroSocket& sock, char *IpAddr, int *port, SyntroSocketPoller *poller)
+{
+#ifdef __linux__
+	struct sockaddr_storage addr;
+	socklen_t addrLen = sizeof(addr);
+	QHostAddress ha;
+	int fd;
+
+	fd = m_server->nextPendingDescriptor();
+	if (fd == -1)
+		return false;
+
+	if ((::getpeername(fd, (struct sockaddr *)&addr, &addrLen) != 0) ||
+			(::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) ||
+			!poller->add(&sock, fd)) {
+		logWarn(QString("Failed to set up accepted socket - %1").arg(strerror(errno)));
+		::close(fd);
+		return false;
+	}
+	if (addr.ss_family == AF_UNIX) {
+		strcpy(IpAddr, "127.0.0.1");
+		*port = SYNTROSOCKET_LOCAL_PORTBASE + fd;
+		sock.m_local = true;
+	} else {
+		ha.setAddress((struct sockaddr *)&addr);
+		strcpy(IpAddr, qPrintable(ha.toString()));
+		if (addr.ss_family == AF_INET6)
+			*port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+		else
+			*port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+	}
+
+	sock.m_rawFd = fd;
+	sock.m_poller = poller;
+	sock.m_sockType = SOCK_STREAM;
+	sock.m_ownerThread = m_ownerThread;
+	sock.m_state = QAbstractSocket::ConnectedState;
+	sock.m_encrypt = false;
+	if (m_shmState == SYNTROSOCKET_SHM_PROBE) {
+		sock.m_shmState = SYNTROSOCKET_SHM_PROBE;
+		sock.m_shmAllowed = m_shmAllowed && (sock.m_local || isLoopback(ha));
+	}
+	return true;
+#else
+	Q_UNUSED(sock);
+	Q_UNUSED(IpAddr);
+	Q_UNUSED(port);
+	Q_UNUSED(poller);
+	return false;
+#endif
+}
+
 bool SyntroSocket::sockClose()
 {
+	if (m_shm != NULL)
+		delete m_shm;
+
 	switch (m_sockType) {
 		case SOCK_DGRAM:
 			disconnect(m_UDPSocket, 0, 0, 0);
@@ -137,6 +321,13 @@ bool SyntroSocket::sockClose()
 			break;
 
 		case SOCK_STREAM:
+#ifdef __linux__
+			if (m_rawFd != -1) {
+				m_poller->remove(this, m_rawFd);
+				::close(m_rawFd);
+				break;
+			}
+#endif
 		    disconnect(m_TCPSocket, 0, 0, 0);
 		    m_TCPSocket->close();
 		    delete m_TCPSocket;
@@ -163,6 +354,45 @@ int	SyntroSocket::sockListen()
     return m_server->listen(QHostAddress::Any, m_sockPort);
 }
 
+//	sockListenLocal listens on the abstract Unix domain name for the socket's port. As with TCP,
+//	this fails if another process already has it. The listening descriptor is given to the
+//	TCPServer so accepting works exactly as for sockListen.
+
+int SyntroSocket::sockListenLocal()
+{
+#ifdef __linux__
+	struct sockaddr_un addr;
+	socklen_t addrLen;
+	int fd;
+
+	if (m_sockType != SOCK_SERVER) {
+		logError(QString("Incorrect socket type for listen %1").arg(m_sockType));
+		return false;
+	}
+	if (m_encrypt)
+		return false;
+
+	addrLen = localSocketAddress(m_sockPort, &addr);
+	fd = ::socket(AF_UNIX, systemSockStream | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return false;
+	if ((::bind(fd, (struct sockaddr *)&addr, addrLen) != 0) || (::listen(fd, SOMAXCONN) != 0)) {
+		logWarn(QString("Failed to listen on local socket %1 - %2").arg(addr.sun_path + 1).arg(strerror(errno)));
+		::close(fd);
+		return false;
+	}
+	if (!m_server->setSocketDescriptor(fd)) {
+		logWarn(QString("Failed to adopt local listener - %1").arg(m_server->errorString()));
+		::close(fd);
+		return false;
+	}
+	m_local = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
 
 int	SyntroSocket::sockReceive(void *lpBuf, int nBufLen)
 {
@@ -173,7 +403,9 @@ int	SyntroSocket::sockReceive(void *lpBuf, int nBufLen)
 		case SOCK_STREAM:
 			if (m_state != QAbstractSocket::ConnectedState)
 				return 0;
-		    return m_TCPSocket->read((char *)lpBuf, nBufLen);
+			if (m_shmState != SYNTROSOCKET_SHM_NONE)
+				return sockReceiveShared(lpBuf, nBufLen);
+			return sockStreamRead(lpBuf, nBufLen);
 
 		default:
 			logError(QString("Incorrect socket type for receive %1").arg(m_sockType));
@@ -181,6 +413,52 @@ int	SyntroSocket::sockReceive(void *lpBuf, int nBufLen)
 	}
 }
 
+int SyntroSocket::sockStreamRead(void *buf, int len)
+{
+#ifdef __linux__
+	if (m_rawFd != -1) {
+		int bytesRead = (int)::recv(m_rawFd, buf, len, MSG_DONTWAIT);
+		if (bytesRead < 0)
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+		if ((bytesRead > 0) && m_options.quickAck)
+			sockSetIntOption(m_rawFd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+		return bytesRead;									// 0 here is EOF which the poller reports as a close
+	}
+	if (m_options.quickAck) {								// the kernel clears quick ack mode so keep rearming it
+		int bytesRead = m_TCPSocket->read((char *)buf, len);
+		if (bytesRead > 0)
+			sockSetIntOption(sockDescriptor(), IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+		return bytesRead;
+	}
+#endif
+    return m_TCPSocket->read((char *)buf, len);
+}
+
+int SyntroSocket::sockStreamPeek(void *buf, int len)
+{
+#ifdef __linux__
+	if (m_rawFd != -1) {
+		int bytesRead = (int)::recv(m_rawFd, buf, len, MSG_DONTWAIT | MSG_PEEK);
+		return (bytesRead < 0) ? 0 : bytesRead;
+	}
+#endif
+    return m_TCPSocket->peek((char *)buf, len);
+}
+
+//	sockStreamWrite is only used for the shared memory handshake and wake ups so it bypasses
+//	the write limit and flushes Qt's buffer straight away.
+
+int SyntroSocket::sockStreamWrite(const void *buf, int len)
+{
+#ifdef __linux__
+	if (m_rawFd != -1)
+		return (int)::send(m_rawFd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+	int bytesSent = m_TCPSocket->write((const char *)buf, len);
+	m_TCPSocket->flush();
+	return bytesSent;
+}
+
 int	SyntroSocket::sockSend(void *lpBuf, int nBufLen)
 {
 	if (m_sockType != SOCK_STREAM) {
@@ -189,35 +467,377 @@ int	SyntroSocket::sockSend(void *lpBuf, int nBufLen)
 	}
 	if (m_state != QAbstractSocket::ConnectedState)
 		return 0;
+	if (m_shmState != SYNTROSOCKET_SHM_NONE) {
+		SYNTRO_IOVEC vec;
+
+		vec.data = (unsigned char *)lpBuf;
+		vec.len = nBufLen;
+		return sockSendShared(&vec, 1);
+	}
+#ifdef __linux__
+	if (m_rawFd != -1) {
+		int bytesSent = (int)::send(m_rawFd, lpBuf, nBufLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (bytesSent < 0)
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+		return bytesSent;									// the poller reports when there is space again
+	}
+#endif
+	if (m_TCPSocket->bytesToWrite() >= m_writeLimit)
+		return 0;											// wait for Qt to drain its buffer
   	return m_TCPSocket->write((char *)lpBuf, nBufLen); 
 }
 
+//	sockSendVector sends count segments as one operation. If Qt has nothing buffered for the socket,
+//	as much as possible is handed straight to the kernel in a single gather write. Anything left over
+//	is then buffered by Qt as usual so ordering is maintained. Raw sockets have no Qt buffer so only
+//	what the kernel accepts is sent. Returns the number of bytes accepted.
+
+int	SyntroSocket::sockSendVector(SYNTRO_IOVEC *vec, int count)
+{
+	int index = 0;
+	int offset = 0;
+	int total = 0;
+	int bytesSent;
+
+	if (m_sockType != SOCK_STREAM) {
+		logError(QString("Incorrect socket type for send vector %1").arg(m_sockType));
+		return 0;
+	}
+	if (m_state != QAbstractSocket::ConnectedState)
+		return 0;
+	if (m_shmState != SYNTROSOCKET_SHM_NONE)
+		return sockSendShared(vec, count);
+	if ((m_rawFd == -1) && (m_TCPSocket->bytesToWrite() >= m_writeLimit))
+		return 0;											// wait for Qt to drain its buffer
+
+	if (count > SYNTRO_IOVEC_MAX)
+		count = SYNTRO_IOVEC_MAX;
+
+#ifdef __linux__
+	if ((m_rawFd != -1) || (!m_encrypt && (m_TCPSocket->bytesToWrite() == 0))) {
+		struct iovec iov[SYNTRO_IOVEC_MAX];
+		struct msghdr msg;
+
+		for (int i = 0; i < count; i++) {
+			iov[i].iov_base = vec[i].data;
+			iov[i].iov_len = vec[i].len;
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+
+		if (m_rawFd != -1) {
+			bytesSent = (int)::sendmsg(m_rawFd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+			return (bytesSent > 0) ? bytesSent : 0;
+		}
+		bytesSent = (int)::sendmsg(m_TCPSocket->socketDescriptor(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (bytesSent > 0) {
+			total = bytesSent;
+			while ((index < count) && (bytesSent >= vec[index].len))
+				bytesSent -= vec[index++].len;
+			offset = bytesSent;								// part of the next segment that went
+		}
+	}
+#endif
+
+	for (; index < count; index++, offset = 0) {
+		bytesSent = m_TCPSocket->write((char *)vec[index].data + offset, vec[index].len - offset);
+		if (bytesSent <= 0)
+			break;
+		total += bytesSent;
+		if (bytesSent < (vec[index].len - offset))
+			break;											// Qt didn't take it all
+	}
+	return total;
+}
+
+//	Shared memory links
+//
+//	A connecting stream socket that has asked for shared memory creates the rings when it connects
+//	and sends the preamble. Until the reply arrives sends and receives do nothing so SyntroLink just
+//	holds its data. The accepting side peeks at the first bytes of each new link. Anything other than
+//	a preamble means an ordinary TCP link. Only links from the Unix domain listener or a loopback
+//	address may attach - anything else is refused. Once active, the TCP connection only carries wake ups
+//	and is still used to detect the other side going away.
+
+bool SyntroSocket::sockSetSharedMemory(bool enable)
+{
+	if (m_encrypt)
+		return false;										// SSL links always use TCP
+
+	switch (m_sockType) {
+		case SOCK_STREAM:
+			m_shmState = enable ? SYNTROSOCKET_SHM_REQUEST : SYNTROSOCKET_SHM_NONE;
+			return true;
+
+		case SOCK_SERVER:
+			m_shmState = SYNTROSOCKET_SHM_PROBE;			// always probe so a refusal can be sent
+			m_shmAllowed = enable;
+			return true;
+
+		default:
+			logError(QString("Incorrect socket type for SetSharedMemory %1").arg(m_sockType));
+			return false;
+	}
+}
+
+void SyntroSocket::sockStartSharedMemory()
+{
+	SYNTRO_SHM_PREAMBLE preamble;
+
+	m_shm = new SyntroSharedRing();
+	if (m_shm->create(SYNTRO_SHM_RINGSIZE)) {
+		memset(&preamble, 0, sizeof(preamble));
+		memcpy(preamble.magic, SYNTRO_SHM_MAGIC, sizeof(preamble.magic));
+		qstrncpy(preamble.key, m_shm->key(), SYNTRO_SHM_KEYLEN);
+		if (sockStreamWrite(&preamble, sizeof(preamble)) == (int)sizeof(preamble)) {
+			m_shmState = SYNTROSOCKET_SHM_PENDING;
+			return;
+		}
+	}
+	delete m_shm;
+	m_shm = NULL;
+	m_shmState = SYNTROSOCKET_SHM_NONE;
+}
+
+//	sockSharedMemoryEvent is called when the TCP connection of a shared memory socket has data.
+//	It returns true if the owner should be told about a receive.
+
+bool SyntroSocket::sockSharedMemoryEvent()
+{
+	SYNTRO_SHM_PREAMBLE preamble;
+	char buf[64];
+	int bytesRead;
+
+	switch (m_shmState) {
+		case SYNTROSOCKET_SHM_PENDING:
+			if (sockStreamRead(buf, 1) <= 0)
+				return false;
+			if (buf[0] == SYNTRO_SHM_ACK) {
+				m_shmState = SYNTROSOCKET_SHM_ACTIVE;
+				logInfo(QString("Link using shared memory %1").arg(m_shm->key()));
+			} else {
+				logInfo("Shared memory refused, link using TCP");
+				delete m_shm;
+				m_shm = NULL;
+				m_shmState = SYNTROSOCKET_SHM_NONE;
+			}
+			onSend(0);										// anything held back can go now
+			return true;
+
+		case SYNTROSOCKET_SHM_PROBE:
+			bytesRead = sockStreamPeek(&preamble, sizeof(preamble));
+			if (bytesRead <= 0)
+				return false;
+			if (preamble.magic[0] != SYNTRO_SHM_MAGIC[0]) {
+				m_shmState = SYNTROSOCKET_SHM_NONE;			// an ordinary link
+				return true;
+			}
+			if (bytesRead < (int)sizeof(preamble))
+				return false;								// wait for the rest
+			sockStreamRead(&preamble, sizeof(preamble));
+			preamble.key[SYNTRO_SHM_KEYLEN - 1] = 0;
+			m_shm = new SyntroSharedRing();
+			if (m_shmAllowed && (memcmp(preamble.magic, SYNTRO_SHM_MAGIC, sizeof(preamble.magic)) == 0) &&
+					m_shm->attach(preamble.key)) {
+				buf[0] = SYNTRO_SHM_ACK;
+				m_shmState = SYNTROSOCKET_SHM_ACTIVE;
+			} else {
+				buf[0] = SYNTRO_SHM_NAK;
+				delete m_shm;
+				m_shm = NULL;
+				m_shmState = SYNTROSOCKET_SHM_NONE;
+			}
+			sockStreamWrite(buf, 1);
+			return true;
+
+		case SYNTROSOCKET_SHM_ACTIVE:
+			while (sockStreamRead(buf, sizeof(buf)) > 0)
+				;											// just wake ups
+			onSend(0);										// may be space for a waiting writer
+			return true;
+
+		default:
+			return true;
+	}
+}
+
+int SyntroSocket::sockReceiveShared(void *buf, int len)
+{
+	int bytesRead;
+
+	if (m_shmState != SYNTROSOCKET_SHM_ACTIVE)
+		return 0;											// still negotiating
+	bytesRead = m_shm->read(buf, len);
+	if (bytesRead < 0) {
+		logError(QString("Shared memory %1 is corrupt").arg(m_shm->key()));
+		return -1;
+	}
+	if ((bytesRead > 0) && m_shm->wakeWriter())
+		sockWake();
+	return bytesRead;
+}
+
+int SyntroSocket::sockSendShared(SYNTRO_IOVEC *vec, int count)
+{
+	int total = 0;
+	int bytesSent;
+
+	if (m_shmState != SYNTROSOCKET_SHM_ACTIVE)
+		return 0;											// still negotiating
+	for (int i = 0; i < count; i++) {
+		bytesSent = m_shm->write(vec[i].data, vec[i].len);
+		if (bytesSent < 0) {
+			logError(QString("Shared memory %1 is corrupt").arg(m_shm->key()));
+			break;
+		}
+		total += bytesSent;
+		if (bytesSent < vec[i].len)
+			break;											// ring full
+	}
+	if ((total > 0) && m_shm->wakeReader())
+		sockWake();
+	return total;
+}
+
+void SyntroSocket::sockWake()
+{
+	char wake = SYNTRO_SHM_WAKE;
+
+	sockStreamWrite(&wake, 1);
+}
+
+void SyntroSocket::sockSetWriteLimit(int limit)
+{
+	m_writeLimit = limit;
+}
+
 bool SyntroSocket::sockEnableBroadcast(int)
 {
     return true;
 }
 
+//	sockSetReceiveBufSize sets the kernel receive buffer and for a stream also limits Qt's own read buffer
+
 bool SyntroSocket::sockSetReceiveBufSize(int nSize)
 {
-	if (m_sockType != SOCK_STREAM) {
+	if ((m_sockType != SOCK_STREAM) && (m_sockType != SOCK_DGRAM)) {
 		logError(QString("Incorrect socket type for SetReceiveBufferSize %1").arg(m_sockType));
 		return false;
 	}
-    m_TCPSocket->setReadBufferSize(nSize);
-	return true;
+	if ((m_sockType == SOCK_STREAM) && (m_rawFd == -1))
+	    m_TCPSocket->setReadBufferSize(nSize);
+	m_options.receiveBufSize = nSize;
+	return sockApplyOptions();
 }
 
-bool SyntroSocket::sockSetSendBufSize(int)
+bool SyntroSocket::sockSetSendBufSize(int nSize)
 {
-	if (m_sockType != SOCK_STREAM) {
+	if ((m_sockType != SOCK_STREAM) && (m_sockType != SOCK_DGRAM)) {
 		logError(QString("Incorrect socket type for SetSendBufferSize %1").arg(m_sockType));
 		return false;
 	}
+	m_options.sendBufSize = nSize;
+	return sockApplyOptions();
+}
 
-//	logDebug(QString("SetSendBufferSize not implemented"));
+//	sockSetOptions sets all the kernel options for a stream socket. An outgoing socket has no
+//	descriptor until it connects so in that case the options are applied from onState.
+
+bool SyntroSocket::sockSetOptions(const SYNTRO_SOCKET_OPTIONS *options)
+{
+	if (m_sockType != SOCK_STREAM) {
+		logError(QString("Incorrect socket type for SetOptions %1").arg(m_sockType));
+		return false;
+	}
+	m_options = *options;
+	if ((m_rawFd == -1) && (m_options.receiveBufSize > 0))
+	    m_TCPSocket->setReadBufferSize(m_options.receiveBufSize);
+	return sockApplyOptions();
+}
+
+int SyntroSocket::sockDescriptor()
+{
+	if (m_rawFd != -1)
+		return m_rawFd;
+	if ((m_sockType == SOCK_STREAM) && (m_TCPSocket != NULL))
+		return (int)m_TCPSocket->socketDescriptor();
+	if ((m_sockType == SOCK_DGRAM) && (m_UDPSocket != NULL))
+		return (int)m_UDPSocket->socketDescriptor();
+	return -1;
+}
+
+bool SyntroSocket::sockApplyOptions()
+{
+	int fd = sockDescriptor();
+
+	if (fd == -1) {
+		m_optionsPending = true;							// try again when connected
+		return true;
+	}
+	m_optionsPending = false;
+
+#ifdef __linux__
+	if (m_options.sendBufSize > 0)
+		sockSetIntOption(fd, SOL_SOCKET, SO_SNDBUF, m_options.sendBufSize, "SO_SNDBUF");
+	if (m_options.receiveBufSize > 0)
+		sockSetIntOption(fd, SOL_SOCKET, SO_RCVBUF, m_options.receiveBufSize, "SO_RCVBUF");
+	if (m_local || (m_sockType == SOCK_DGRAM)) {
+		m_options.quickAck = false;							// the rest only apply to TCP
+		return true;
+	}
+	sockSetIntOption(fd, IPPROTO_TCP, TCP_NODELAY, m_options.noDelay ? 1 : 0, "TCP_NODELAY");
+	if (m_options.quickAck)
+		sockSetIntOption(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+#ifdef TCP_NOTSENT_LOWAT
+	if (m_options.notSentLowat > 0)
+		sockSetIntOption(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, m_options.notSentLowat, "TCP_NOTSENT_LOWAT");
+#endif
+	if (m_options.keepAliveIdle > 0) {
+		sockSetIntOption(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+		sockSetIntOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, m_options.keepAliveIdle, "TCP_KEEPIDLE");
+		if (m_options.keepAliveInterval > 0)
+			sockSetIntOption(fd, IPPROTO_TCP, TCP_KEEPINTVL, m_options.keepAliveInterval, "TCP_KEEPINTVL");
+		if (m_options.keepAliveCount > 0)
+			sockSetIntOption(fd, IPPROTO_TCP, TCP_KEEPCNT, m_options.keepAliveCount, "TCP_KEEPCNT");
+	}
+#else
+	if (m_sockType == SOCK_DGRAM) {
+#if QT_VERSION >= 0x050300
+		if (m_options.sendBufSize > 0)
+			m_UDPSocket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, m_options.sendBufSize);
+		if (m_options.receiveBufSize > 0)
+			m_UDPSocket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, m_options.receiveBufSize);
+#endif
+		return true;
+	}
+	m_TCPSocket->setSocketOption(QAbstractSocket::LowDelayOption, m_options.noDelay ? 1 : 0);
+	if (m_options.keepAliveIdle > 0)
+		m_TCPSocket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+#if QT_VERSION >= 0x050300
+	if (m_options.sendBufSize > 0)
+		m_TCPSocket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, m_options.sendBufSize);
+	if (m_options.receiveBufSize > 0)
+		m_TCPSocket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, m_options.receiveBufSize);
+#endif
+#endif
 	return true;
 }
 
+void SyntroSocket::sockSetIntOption(int fd, int level, int option, int value, const char *name)
+{
+#ifdef __linux__
+	if (::setsockopt(fd, level, option, &value, sizeof(value)) != 0)
+		logWarn(QString("Failed to set %1 to %2 - %3").arg(name).arg(value).arg(strerror(errno)));
+#else
+	Q_UNUSED(fd);
+	Q_UNUSED(level);
+	Q_UNUSED(option);
+	Q_UNUSED(value);
+	Q_UNUSED(name);
+#endif
+}
+
 
 int SyntroSocket::sockSendTo(const void *buf, int bufLen, int hostPort, char *host)
 {
@@ -255,6 +875,54 @@ int		SyntroSocket::sockPendingDatagramSize()
 	return m_UDPSocket->pendingDatagramSize();
 }
 
+//	sockJoinGroup and sockLeaveGroup manage IP multicast group membership of a datagram socket.
+//	On Linux a socket bound to the wildcard address would otherwise receive the traffic for
+//	every group joined by any socket on the machine so IP_MULTICAST_ALL is turned off.
+
+bool SyntroSocket::sockJoinGroup(const char *group)
+{
+	if (m_sockType != SOCK_DGRAM) {
+		logError(QString("Incorrect socket type for JoinGroup %1").arg(m_sockType));
+		return false;
+	}
+#if defined(__linux__) && defined(IP_MULTICAST_ALL)
+	sockSetIntOption(sockDescriptor(), IPPROTO_IP, IP_MULTICAST_ALL, 0, "IP_MULTICAST_ALL");
+#endif
+	if (!m_UDPSocket->joinMulticastGroup(QHostAddress(group))) {
+		logWarn(QString("Failed to join group %1 - %2").arg(group).arg(m_UDPSocket->errorString()));
+		return false;
+	}
+	return true;
+}
+
+bool SyntroSocket::sockLeaveGroup(const char *group)
+{
+	if (m_sockType != SOCK_DGRAM) {
+		logError(QString("Incorrect socket type for LeaveGroup %1").arg(m_sockType));
+		return false;
+	}
+	return m_UDPSocket->leaveMulticastGroup(QHostAddress(group));
+}
+
+bool SyntroSocket::sockSetMulticastTTL(int ttl)
+{
+	if (m_sockType != SOCK_DGRAM) {
+		logError(QString("Incorrect socket type for SetMulticastTTL %1").arg(m_sockType));
+		return false;
+	}
+	m_UDPSocket->setSocketOption(QAbstractSocket::MulticastTtlOption, ttl);
+	return true;
+}
+
+int SyntroSocket::sockLocalPort()
+{
+	if (m_sockType != SOCK_DGRAM) {
+		logError(QString("Incorrect socket type for LocalPort %1").arg(m_sockType));
+		return 0;
+	}
+	return m_UDPSocket->localPort();
+}
+
 
 SyntroSocket::~SyntroSocket()
 {
@@ -281,6 +949,8 @@ void SyntroSocket::sockSetConnectMsg(int msg)
 		return;
 	}
 	m_onConnectMsg = msg;
+	if (m_rawFd != -1)
+		return;												// raw sockets are already connected
     connect(m_TCPSocket, SIGNAL(connected()), this, SLOT(onConnect()));
 }
 
@@ -302,6 +972,8 @@ void SyntroSocket::sockSetCloseMsg(int msg)
 		return;
 	}
 	m_onCloseMsg = msg;
+	if (m_rawFd != -1)
+		return;												// the poller generates the close
     connect(m_TCPSocket, SIGNAL(disconnected()), this, SLOT(onClose()));
 }
 
@@ -315,7 +987,8 @@ void SyntroSocket::sockSetReceiveMsg(int msg)
 			break;
 
 		case SOCK_STREAM:
-		    connect(m_TCPSocket, SIGNAL(readyRead()), this, SLOT(onReceive()), Qt::DirectConnection);
+			if (m_rawFd == -1)
+			    connect(m_TCPSocket, SIGNAL(readyRead()), this, SLOT(onReceive()), Qt::DirectConnection);
 			break;
 
 		default:
@@ -334,7 +1007,8 @@ void SyntroSocket::sockSetSendMsg(int msg)
 			break;
 
 		case SOCK_STREAM:
-		    connect(m_TCPSocket, SIGNAL(bytesWritten(qint64)), this, SLOT(onSend(qint64)), Qt::DirectConnection);
+			if (m_rawFd == -1)
+			    connect(m_TCPSocket, SIGNAL(bytesWritten(qint64)), this, SLOT(onSend(qint64)), Qt::DirectConnection);
 			break;
 
 		default:
@@ -355,21 +1029,38 @@ void SyntroSocket::onAccept()
 		m_ownerThread->postThreadMessage(m_onAcceptMsg, m_connectionID, NULL);
 }
 
+//	Raw sockets are called from their poller in the owning thread so the message is
+//	dispatched directly rather than queued.
+
 void SyntroSocket::onClose()
 {
-	if (m_onCloseMsg != -1)
+	if (m_onCloseMsg == -1)
+		return;
+	if (m_rawFd != -1)
+		m_ownerThread->dispatchThreadMessage(m_onCloseMsg, m_connectionID, NULL);
+	else
 		m_ownerThread->postThreadMessage(m_onCloseMsg, m_connectionID, NULL);
 }
 
 void SyntroSocket::onReceive()
 {
-	if (m_onReceiveMsg != -1)
+	if ((m_shmState != SYNTROSOCKET_SHM_NONE) && !sockSharedMemoryEvent())
+		return;
+	if (m_onReceiveMsg == -1)
+		return;
+	if (m_rawFd != -1)
+		m_ownerThread->dispatchThreadMessage(m_onReceiveMsg, m_connectionID, NULL);
+	else
 		m_ownerThread->postThreadMessage(m_onReceiveMsg, m_connectionID, NULL);
 }
 
 void	SyntroSocket::onSend(qint64)
 {
-	if (m_onSendMsg != -1)
+	if (m_onSendMsg == -1)
+		return;
+	if (m_rawFd != -1)
+		m_ownerThread->dispatchThreadMessage(m_onSendMsg, m_connectionID, NULL);
+	else
 		m_ownerThread->postThreadMessage(m_onSendMsg, m_connectionID, NULL);
 }
 
@@ -400,6 +1091,10 @@ void SyntroSocket::onState(QAbstractSocket::SocketState socketState)
 			logDebug(QString("TCP socket state %1").arg(socketState));
 			break;
 	}
+	if ((socketState == QAbstractSocket::ConnectedState) && m_optionsPending)
+		sockApplyOptions();
+	if ((socketState == QAbstractSocket::ConnectedState) && (m_shmState == SYNTROSOCKET_SHM_REQUEST))
+		sockStartSharedMemory();
 	if ((socketState == QAbstractSocket::UnconnectedState) && (m_state < QAbstractSocket::ConnectedState)) {
         logDebug("onClose generated by onState"); 
 		onClose();									// no signal generated in this situation
@@ -435,9 +1130,39 @@ void SyntroSocket::sslErrors(const QList<QSslError> & errors) {
 TCPServer::TCPServer(QObject *parent) : QTcpServer(parent)
 {
     m_encrypt = false;
+    m_rawAccept = false;
     m_logTag = "TCPServer";
 }
 
+TCPServer::~TCPServer()
+{
+#ifdef __linux__
+    while (!m_pendingDescriptors.isEmpty())
+        ::close(m_pendingDescriptors.takeFirst());
+#endif
+}
+
+//	In raw mode the descriptor is just queued. QTcpServer still emits newConnection.
+
+#if QT_VERSION < 0x050000
+void TCPServer::incomingConnection(int socket)
+#else
+void TCPServer::incomingConnection(qintptr socket)
+#endif
+{
+    if (m_rawAccept)
+        m_pendingDescriptors.append((int)socket);
+    else
+        QTcpServer::incomingConnection(socket);
+}
+
+int TCPServer::nextPendingDescriptor()
+{
+    if (m_pendingDescriptors.isEmpty())
+        return -1;
+    return m_pendingDescriptors.takeFirst();
+}
+
 //----------------------------------------------------------
 //
 //  SSLServer
@@ -510,4 +1235,127 @@ void SSLServer::sslErrors(const QList<QSslError> & errors) {
     QSslSocket *sslSocket = qobject_cast<QSslSocket*>(sender());
     sslSocket->ignoreSslErrors();
 
-}
\ No newline at end of file
+}
+//----------------------------------------------------------
+//
+//  SyntroSocketPoller
+
+SyntroSocketPoller::SyntroSocketPoller(QObject *parent) : QObject(parent)
+{
+	m_logTag = "SyntroSocketPoller";
+	m_epollFd = -1;
+	m_notifier = NULL;
+	m_events = NULL;
+	m_eventCount = 0;
+	m_current = NULL;
+	m_dispatchLock = NULL;
+
+#ifdef __linux__
+	m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epollFd == -1) {
+		logWarn(QString("Failed to create epoll set - %1").arg(strerror(errno)));
+		return;
+	}
+	m_events = (struct epoll_event *)malloc(SYNTROSOCKET_POLL_EVENTS * sizeof(struct epoll_event));
+	m_notifier = new QSocketNotifier(m_epollFd, QSocketNotifier::Read, this);
+	connect(m_notifier, SIGNAL(activated(int)), this, SLOT(poll()));
+#endif
+}
+
+SyntroSocketPoller::~SyntroSocketPoller()
+{
+	if (m_notifier != NULL)
+		delete m_notifier;
+#ifdef __linux__
+	if (m_epollFd != -1)
+		::close(m_epollFd);
+#endif
+	if (m_events != NULL)
+		free(m_events);
+}
+
+bool SyntroSocketPoller::isValid()
+{
+	return m_epollFd != -1;
+}
+
+bool SyntroSocketPoller::add(SyntroSocket *sock, int fd)
+{
+#ifdef __linux__
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = sock;
+	if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) == 0)
+		return true;
+#else
+	Q_UNUSED(sock);
+	Q_UNUSED(fd);
+#endif
+	return false;
+}
+
+//	remove may be called while poll is dispatching (a close handler deleting the socket for example)
+//	so any events still to be dispatched for sock are cancelled.
+
+void SyntroSocketPoller::remove(SyntroSocket *sock, int fd)
+{
+#ifdef __linux__
+	epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, NULL);
+	if (m_current == sock)
+		m_current = NULL;
+	for (int i = 0; i < m_eventCount; i++) {
+		if (m_events[i].data.ptr == sock)
+			m_events[i].data.ptr = NULL;
+	}
+#else
+	Q_UNUSED(sock);
+	Q_UNUSED(fd);
+#endif
+}
+
+//	setDispatchLock sets a lock that poll holds while it dispatches. Another thread that holds the
+//	lock can then safely remove and close sockets in the set. It must be recursive if the handlers
+//	also take it.
+
+void SyntroSocketPoller::setDispatchLock(QMutex *lock)
+{
+	m_dispatchLock = lock;
+}
+
+//	poll is called when the epoll set has events. For each ready socket the receive handler runs first
+//	so data that arrived before a close is processed, then the send handler if there is space and
+//	finally the close handler if the peer has gone.
+
+void SyntroSocketPoller::poll()
+{
+#ifdef __linux__
+	SyntroSocket *sock;
+	unsigned int events;
+	int count;
+
+	do {
+		QMutexLocker locker(m_dispatchLock);				// does nothing if there isn't one
+
+		count = epoll_wait(m_epollFd, m_events, SYNTROSOCKET_POLL_EVENTS, 0);
+		if (count <= 0)
+			return;
+		m_eventCount = count;
+		for (int i = 0; i < count; i++) {
+			if ((sock = (SyntroSocket *)m_events[i].data.ptr) == NULL)
+				continue;									// removed earlier in this pass
+			events = m_events[i].events;
+			m_current = sock;
+			if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				sock->onReceive();
+			if ((m_current != NULL) && (events & EPOLLOUT))
+				sock->onSend(0);
+			if ((m_current != NULL) && (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+				sock->onClose();
+		}
+		m_current = NULL;
+		m_eventCount = 0;
+	} while (count == SYNTROSOCKET_POLL_EVENTS);
+#endif
+}
@@ -22,9 +22,11 @@
 
 #include "SyntroUtils.h"
 #include "SyntroThread.h"
+#include "SyntroSharedRing.h"
 
 #include <qsslsocket.h>
 #include <qsslcipher.h>
+#include <qsocketnotifier.h>
 
 //	Define the standard socket types if necessary
 
@@ -34,14 +36,71 @@
 #define	SOCK_SERVER		2
 #endif
 
+//	SYNTROSOCKET_WRITE_LIMIT is the default max number of bytes Qt may be holding for a stream
+//	socket. Sends are refused above this so that queued data backs up into the SyntroLink queues
+//	where it can be managed.
+
+#define	SYNTROSOCKET_WRITE_LIMIT	(SYNTRO_MESSAGE_MAX * 2)
+
+//	Unix domain links have no peer port so accepted ones report SYNTROSOCKET_LOCAL_PORTBASE plus
+//	their descriptor to keep them distinct from each other and from TCP ports
+
+#define	SYNTROSOCKET_LOCAL_PORTBASE	65536
+
+//	Shared memory states for a stream socket
+
+#define	SYNTROSOCKET_SHM_NONE		0						// plain TCP
+#define	SYNTROSOCKET_SHM_REQUEST	1						// connecting - will send the preamble when connected
+#define	SYNTROSOCKET_SHM_PENDING	2						// preamble sent, waiting for the reply
+#define	SYNTROSOCKET_SHM_PROBE		3						// accepted - checking first bytes for a preamble
+#define	SYNTROSOCKET_SHM_ACTIVE		4						// data goes through the shared memory rings
+
+//	SYNTRO_IOVEC describes one segment of a gather write
+
+#define	SYNTRO_IOVEC_MAX		256							// max segments in a single gather write
+
+typedef struct
+{
+	unsigned char *data;									// start of the segment
+	int len;												// length of the segment
+} SYNTRO_IOVEC;
+
+//	SYNTRO_SOCKET_OPTIONS is the kernel tuning applied to a stream socket. Zero values leave
+//	the system default in place. The Linux specific options are ignored elsewhere.
+
+typedef struct
+{
+	int sendBufSize;										// SO_SNDBUF in bytes
+	int receiveBufSize;										// SO_RCVBUF in bytes
+	bool noDelay;											// TCP_NODELAY - send small control messages immediately
+	bool quickAck;											// TCP_QUICKACK - rearmed after every receive
+	int notSentLowat;										// TCP_NOTSENT_LOWAT in bytes
+	int keepAliveIdle;										// seconds idle before keepalive probes start (0 = no keepalive)
+	int keepAliveInterval;									// seconds between keepalive probes
+	int keepAliveCount;										// unanswered probes before the link is dropped
+} SYNTRO_SOCKET_OPTIONS;
+
+//	TCPServer can hand out raw descriptors for accepted connections instead of QTcpSockets.
+//	This is used when accepted links are driven by a SyntroSocketPoller.
+
 class TCPServer : public QTcpServer
 {
 public:
     TCPServer(QObject *parent = 0);
+    virtual ~TCPServer();
     bool usingSSL() { return m_encrypt; }
+    void setRawAccept(bool raw) { m_rawAccept = raw; }
+    int nextPendingDescriptor();                            // returns -1 if none waiting
 
 protected:
+#if QT_VERSION < 0x050000
+    virtual void incomingConnection(int socket);
+#else
+    virtual void incomingConnection(qintptr socket);
+#endif
     bool m_encrypt;
+    bool m_rawAccept;                                       // if accepted connections are kept as raw descriptors
+    QList<int> m_pendingDescriptors;                        // raw descriptors waiting for sockAccept
 
     QString m_logTag;
 };
@@ -67,6 +126,44 @@ protected slots:
 };
 
 
+class SyntroSocket;
+
+//	SyntroSocketPoller drives accepted stream sockets from an edge triggered epoll set (Linux only).
+//	One poller serves all the raw sockets of a thread. Its epoll descriptor is watched by a single
+//	QSocketNotifier and ready sockets are dispatched straight into the owning thread's processMessage
+//	rather than via a posted thread message per readyRead. As the set is edge triggered, receive
+//	handlers must read until sockReceive returns 0. If another thread needs to close sockets in the
+//	set, it must hold the dispatch lock while it does so.
+
+#define	SYNTROSOCKET_POLL_EVENTS		64					// max events collected per epoll_wait
+
+class SYNTROLIB_EXPORT SyntroSocketPoller : public QObject
+{
+	Q_OBJECT
+
+public:
+	SyntroSocketPoller(QObject *parent = 0);
+	virtual ~SyntroSocketPoller();
+
+	bool isValid();											// true if epoll is available
+	bool add(SyntroSocket *sock, int fd);					// start polling fd on behalf of sock
+	void remove(SyntroSocket *sock, int fd);				// stop polling - safe from within a dispatch
+	void setDispatchLock(QMutex *lock);						// held by poll while dispatching (NULL = none)
+
+public slots:
+	void poll();
+
+private:
+	int m_epollFd;
+	QSocketNotifier *m_notifier;							// watches m_epollFd in the owning thread's event loop
+	struct epoll_event *m_events;							// events being dispatched
+	int m_eventCount;										// number of valid entries in m_events
+	SyntroSocket *m_current;								// socket being dispatched or NULL if it was removed
+	QMutex *m_dispatchLock;									// held while dispatching or NULL
+
+	QString m_logTag;
+};
+
 class SYNTROLIB_EXPORT SyntroSocket : public QObject
 {
 	Q_OBJECT
@@ -86,16 +183,28 @@ public:
     bool sockEnableBroadcast(int flag);
 	bool sockSetReceiveBufSize(int size);
 	bool sockSetSendBufSize(int size);
+	bool sockSetOptions(const SYNTRO_SOCKET_OPTIONS *options);	// applied now or as soon as the socket connects
+	bool sockSetSharedMemory(bool enable);					// stream - request shared memory, listener - allow accepted links to use it
+	void sockSetWriteLimit(int limit);						// max bytes buffered by Qt before sends are refused
 	int sockSendTo(const void *buf, int bufLen, int hostPort, char *host = NULL);
 	int sockReceiveFrom(void *buf, int bufLen, char *IpAddr, unsigned int *port, int flags = 0);
 	int sockCreate(int socketPort, int socketType, int flags = 0);
 	bool sockConnect(const char *addr, int port);
-	bool sockAccept(SyntroSocket& sock, char *IpAddr, int *port);
+	bool sockConnectLocal(int port);						// connect to a local listener - false if there isn't one
+	bool sockAccept(SyntroSocket& sock, char *IpAddr, int *port, SyntroSocketPoller *poller = NULL);	// poller overrides the listener's
+	bool sockSetPoller(SyntroSocketPoller *poller);			// listener only - accepted links use raw sockets driven by poller
+	bool sockIsPolled() { return m_rawFd != -1; }			// true if a raw socket driven by a poller
 	bool sockClose();
 	int sockListen();
+	int sockListenLocal();									// listen on the Unix domain name for the port (Linux only)
 	int sockReceive(void *buf, int bufLen);
 	int sockSend(void *buf, int bufLen);
+	int sockSendVector(SYNTRO_IOVEC *vec, int count);		// gather write of count segments
 	int sockPendingDatagramSize();
+	bool sockJoinGroup(const char *group);					// join an IP multicast group (datagram only)
+	bool sockLeaveGroup(const char *group);
+	bool sockSetMulticastTTL(int ttl);
+	int sockLocalPort();									// the port a datagram socket is bound to
     bool usingSSL() { return m_encrypt; }
 
 public slots:
@@ -120,6 +229,18 @@ protected:
 	TCPServer *m_server;                                    // This could be SSLServer if SSL in use
 
 	void clearSocket();										// clear up all socket fields
+	bool sockAcceptRaw(SyntroSocket& sock, char *IpAddr, int *port, SyntroSocketPoller *poller);
+	int sockDescriptor();									// the kernel descriptor or -1 if none yet
+	bool sockApplyOptions();								// applies m_options to the descriptor
+	void sockSetIntOption(int fd, int level, int option, int value, const char *name);
+	int sockStreamRead(void *buf, int len);					// reads the TCP connection itself
+	int sockStreamPeek(void *buf, int len);
+	int sockStreamWrite(const void *buf, int len);
+	void sockStartSharedMemory();							// creates the rings and sends the preamble
+	bool sockSharedMemoryEvent();							// handles TCP data on a shared memory socket
+	int sockReceiveShared(void *buf, int len);
+	int sockSendShared(SYNTRO_IOVEC *vec, int count);
+	void sockWake();										// wakes the other side of a shared memory link
 	int m_onConnectMsg;
 	int m_onAcceptMsg;
 	int m_onCloseMsg;
@@ -127,6 +248,19 @@ protected:
 	int m_onSendMsg;
 
 	int m_state;											// last reported socket state
+	int m_writeLimit;										// max bytes that can be waiting in Qt's write buffer
+
+	int m_rawFd;											// descriptor if a raw socket driven by m_poller, else -1
+	SyntroSocketPoller *m_poller;							// the poller for raw sockets (and for those accepted by a listener)
+
+	SYNTRO_SOCKET_OPTIONS m_options;						// the kernel options for the socket
+	bool m_optionsPending;									// if m_options still need to be applied on connect
+
+	bool m_local;											// if a Unix domain socket
+
+	SyntroSharedRing *m_shm;								// the shared memory rings if in use
+	int m_shmState;											// SYNTROSOCKET_SHM_* state
+	bool m_shmAllowed;										// listener - if accepted links may use shared memory
 
 	QString m_logTag;
 };
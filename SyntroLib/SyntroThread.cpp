@@ -17,9 +17,16 @@
 //  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 #include "SyntroThread.h"
 #include "LogWrapper.h"
 
+#include <qelapsedtimer.h>
+
 /*!
     \class SyntroThread
     \brief SyntroThread is a lightweight wrapper for threading.
@@ -54,6 +61,9 @@ SyntroThread::SyntroThread(const QString& threadName, const QString& logTag)
 	m_name = threadName;
 	m_logTag = logTag;
 	m_event = QEvent::registerEventType();					// get an event number
+	m_mailbox = NULL;
+	m_mailboxEvent = -1;
+	m_mailboxNotifier = NULL;
 }
 
 /*!
@@ -62,6 +72,38 @@ SyntroThread::SyntroThread(const QString& threadName, const QString& logTag)
 
 SyntroThread::~SyntroThread()
 {
+	if (m_mailbox != NULL)
+		delete m_mailbox;
+}
+
+/*!
+	useMailbox() makes postThreadMessage() use a SyntroThreadMailbox instead of the Qt event queue. 
+	Posting then needs no lock, and no allocation unless the mailbox's ring of preallocated slots is full,
+	and the thread processes messages in batches. It must be 
+	called before resumeThread(), normally from the constructor of the derived class. Messages are 
+	still delivered to processMessage() in the order they were posted.
+*/
+
+void SyntroThread::useMailbox()
+{
+	if (m_mailbox != NULL)
+		return;
+	m_mailbox = new SyntroThreadMailbox();
+	if (m_mailbox->wakeFd() == -1)
+		m_mailboxEvent = QEvent::registerEventType();		// no eventfd so wake with a posted event
+}
+
+/*!
+	Fills in \a stats with the mailbox queue depth and latency stats. If \a reset is true, the counts 
+	are cleared afterwards. Returns false if the thread isn't using a mailbox.
+*/
+
+bool SyntroThread::getMailboxStats(SYNTROTHREAD_MAILBOX_STATS *stats, bool reset)
+{
+	if (m_mailbox == NULL)
+		return false;
+	m_mailbox->getStats(stats, reset);
+	return true;
 }
 
 /*!
@@ -118,6 +160,10 @@ void SyntroThread::exitThread()
 
 void SyntroThread::internalRunLoop()
 {
+	if ((m_mailbox != NULL) && (m_mailbox->wakeFd() != -1)) {	// the notifier must be created in this thread
+		m_mailboxNotifier = new QSocketNotifier(m_mailbox->wakeFd(), QSocketNotifier::Read, this);
+		connect(m_mailboxNotifier, SIGNAL(activated(int)), this, SLOT(mailboxReady()));
+	}
 	initThread();
 	emit running();
 }
@@ -159,6 +205,12 @@ bool SyntroThread::processMessage(SyntroThreadMsg* msg)
 
 void SyntroThread::postThreadMessage(int message, int intParam, void *ptrParam)
 {
+	if (m_mailbox != NULL) {
+		if (m_mailbox->post(message, intParam, ptrParam))
+			qApp->postEvent(this, new QEvent((QEvent::Type)m_mailboxEvent));
+		return;
+	}
+
 	SyntroThreadMsg *msg = new SyntroThreadMsg((QEvent::Type)m_event);
 	msg->message = message;
 	msg->intParam = intParam;
@@ -166,6 +218,22 @@ void SyntroThread::postThreadMessage(int message, int intParam, void *ptrParam)
 	qApp->postEvent(this, msg);
 }
 
+/*!
+	This function processes a message immediately by calling processMessage() directly. It must only be called
+	from the thread's own event loop. It avoids the allocation and event queue round trip of postThreadMessage()
+	and is used by SyntroSocketPoller to dispatch socket events.
+*/
+
+void SyntroThread::dispatchThreadMessage(int message, int intParam, void *ptrParam)
+{
+	SyntroThreadMsg msg((QEvent::Type)m_event);
+
+	msg.message = message;
+	msg.intParam = intParam;
+	msg.ptrParam = ptrParam;
+	processMessage(&msg);
+}
+
 /*!
 	\internal
 */
@@ -176,7 +244,329 @@ bool SyntroThread::eventFilter(QObject *obj, QEvent *event)
 		processMessage((SyntroThreadMsg *)event);
 		return true;
 	}
+	if ((m_mailbox != NULL) && (event->type() == m_mailboxEvent)) {
+		mailboxReady();
+		return true;
+	}
 
 	//	Just do default processing 
     return QObject::eventFilter(obj, event);
  }
+
+/*!
+	\internal
+
+	Processes a batch of mailbox messages. If there are more than SYNTROTHREAD_MAILBOX_BATCH waiting, 
+	the thread wakes itself again so that socket and timer events get a look in between batches.
+*/
+
+void SyntroThread::mailboxReady()
+{
+	SyntroThreadMsg msg((QEvent::Type)m_event);
+	int count;
+
+	m_mailbox->startBatch();
+	for (count = 0; count < SYNTROTHREAD_MAILBOX_BATCH; count++) {
+		if (!m_mailbox->get(&msg.message, &msg.intParam, &msg.ptrParam))
+			break;
+		processMessage(&msg);
+	}
+	m_mailbox->endBatch();
+
+	if ((count == SYNTROTHREAD_MAILBOX_BATCH) && m_mailbox->wake())
+		qApp->postEvent(this, new QEvent((QEvent::Type)m_mailboxEvent));
+}
+
+//	SyntroThreadMailbox
+//
+//	mailboxTimer provides the uS clock for the latency stats
+
+static struct MailboxTimer
+{
+	MailboxTimer() { timer.start(); }
+	qint64 now() { return timer.nsecsElapsed() / 1000; }
+	QElapsedTimer timer;
+} mailboxTimer;
+
+//	Qt4 doesn't have the explicit load and store functions so these helpers hide the difference.
+
+static inline SyntroMailboxEntry *loadAcquire(QAtomicPointer<SyntroMailboxEntry>& ptr)
+{
+#if QT_VERSION < 0x050000
+	return ptr.fetchAndAddAcquire(0);
+#else
+	return ptr.loadAcquire();
+#endif
+}
+
+static inline void storeRelease(QAtomicPointer<SyntroMailboxEntry>& ptr, SyntroMailboxEntry *value)
+{
+#if QT_VERSION < 0x050000
+	ptr.fetchAndStoreRelease(value);
+#else
+	ptr.storeRelease(value);
+#endif
+}
+
+static inline int loadInt(QAtomicInt& value)
+{
+#if QT_VERSION < 0x050000
+	return value;
+#else
+	return value.load();
+#endif
+}
+
+static inline int loadAcquireInt(QAtomicInt& value)
+{
+#if QT_VERSION < 0x050000
+	return value.fetchAndAddAcquire(0);
+#else
+	return value.loadAcquire();
+#endif
+}
+
+static inline void storeReleaseInt(QAtomicInt& value, int newValue)
+{
+#if QT_VERSION < 0x050000
+	value.fetchAndStoreRelease(newValue);
+#else
+	value.storeRelease(newValue);
+#endif
+}
+
+SyntroThreadMailbox::SyntroThreadMailbox()
+{
+	m_slots = new SyntroMailboxSlot[SYNTROTHREAD_MAILBOX_SLOTS];
+	for (int i = 0; i < SYNTROTHREAD_MAILBOX_SLOTS; i++)
+		m_slots[i].seq = i;									// free for the first lap
+	m_enqueuePos = 0;
+	m_dequeuePos = 0;
+	m_overflow = 0;
+
+	m_stub.next = NULL;
+	m_tail = &m_stub;
+	m_head = &m_stub;
+	m_depth = 0;
+	m_highWater = 0;
+	m_wakePending = 0;
+	memset(&m_batch, 0, sizeof(SYNTROTHREAD_MAILBOX_STATS));
+	memset(&m_stats, 0, sizeof(SYNTROTHREAD_MAILBOX_STATS));
+
+	m_wakeFd = -1;
+#ifdef __linux__
+	m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+}
+
+SyntroThreadMailbox::~SyntroThreadMailbox()
+{
+	int message;
+	int intParam;
+	void *ptrParam;
+
+	while (get(&message, &intParam, &ptrParam))
+		;													// frees any entries left behind
+	delete [] m_slots;
+#ifdef __linux__
+	if (m_wakeFd != -1)
+		::close(m_wakeFd);
+#endif
+}
+
+//	post adds a message and wakes the consumer if it isn't already awake. Once anything has gone
+//	on the overflow chain everything else does too until the consumer has emptied it, otherwise a
+//	later message could get into the ring and be processed first.
+
+bool SyntroThreadMailbox::post(int message, int intParam, void *ptrParam)
+{
+	SyntroMailboxEntry *entry;
+	qint64 now = mailboxTimer.now();
+	int depth;
+	int highWater;
+
+	depth = m_depth.fetchAndAddRelaxed(1) + 1;
+	while (depth > (highWater = loadInt(m_highWater))) {
+		if (m_highWater.testAndSetRelaxed(highWater, depth))
+			break;
+	}
+	if ((loadAcquireInt(m_overflow) != 0) || !postSlot(message, intParam, ptrParam, now)) {
+		m_overflow.fetchAndAddOrdered(1);					// before it can be seen on the chain
+		entry = new SyntroMailboxEntry;
+		entry->message = message;
+		entry->intParam = intParam;
+		entry->ptrParam = ptrParam;
+		entry->postTime = now;
+		link(entry);
+	}
+	return wake();
+}
+
+//	postSlot claims the next ring position if its slot is free. A slot's seq equals the position
+//	when it's free to post to and the position plus one once it holds a message.
+
+bool SyntroThreadMailbox::postSlot(int message, int intParam, void *ptrParam, qint64 now)
+{
+	SyntroMailboxSlot *slot;
+	unsigned int pos = (unsigned int)loadInt(m_enqueuePos);
+	int diff;
+
+	while (1) {
+		slot = m_slots + (pos & (SYNTROTHREAD_MAILBOX_SLOTS - 1));
+		diff = (int)((unsigned int)loadAcquireInt(slot->seq) - pos);
+		if (diff == 0) {
+			if (m_enqueuePos.testAndSetRelaxed((int)pos, (int)(pos + 1)))
+				break;										// it's mine
+		} else if (diff < 0) {
+			return false;									// full - the consumer hasn't got to it yet
+		}
+		pos = (unsigned int)loadInt(m_enqueuePos);			// another producer got there first
+	}
+	slot->message = message;
+	slot->intParam = intParam;
+	slot->ptrParam = ptrParam;
+	slot->postTime = now;
+	storeReleaseInt(slot->seq, (int)(pos + 1));				// now visible to the consumer
+	return true;
+}
+
+//	wake signals the consumer unless it has been signalled already. The entry must be linked first
+//	as the consumer clears m_wakePending before it looks at the queue.
+
+bool SyntroThreadMailbox::wake()
+{
+	if (!m_wakePending.testAndSetOrdered(0, 1))
+		return false;										// already signalled
+#ifdef __linux__
+	if (m_wakeFd != -1) {
+		quint64 one = 1;
+		ssize_t result = ::write(m_wakeFd, &one, sizeof(one));	// can only fail if the counter is huge
+		Q_UNUSED(result);
+		return false;
+	}
+#endif
+	return true;
+}
+
+void SyntroThreadMailbox::link(SyntroMailboxEntry *entry)
+{
+	SyntroMailboxEntry *prev;
+
+	entry->next = NULL;
+	prev = m_tail.fetchAndStoreOrdered(entry);
+	storeRelease(prev->next, entry);						// now visible to the consumer
+}
+
+void SyntroThreadMailbox::startBatch()
+{
+#ifdef __linux__
+	if (m_wakeFd != -1) {
+		quint64 count;
+		ssize_t result = ::read(m_wakeFd, &count, sizeof(count));	// fails harmlessly if already clear
+		Q_UNUSED(result);
+	}
+#endif
+	m_wakePending.fetchAndStoreOrdered(0);					// any post from now on signals again
+	m_batch.wakeups++;
+}
+
+//	get takes from the ring first as anything there was posted before the chain was started
+
+bool SyntroThreadMailbox::get(int *message, int *intParam, void **ptrParam)
+{
+	qint64 postTime;
+	qint64 latency;
+
+	if (!getSlot(message, intParam, ptrParam, &postTime)) {
+		if (loadAcquireInt(m_overflow) == 0)
+			return false;
+		if (!getOverflow(message, intParam, ptrParam, &postTime))
+			return false;
+		m_overflow.fetchAndAddOrdered(-1);					// after it's been taken off the chain
+	}
+	m_depth.fetchAndAddRelaxed(-1);
+
+	latency = mailboxTimer.now() - postTime;
+	m_batch.messages++;
+	m_batch.totalLatency += latency;
+	if (latency > m_batch.maxLatency)
+		m_batch.maxLatency = latency;
+	return true;
+}
+
+//	getSlot frees the slot for the next lap of the ring once the message has been copied out
+
+bool SyntroThreadMailbox::getSlot(int *message, int *intParam, void **ptrParam, qint64 *postTime)
+{
+	SyntroMailboxSlot *slot = m_slots + (m_dequeuePos & (SYNTROTHREAD_MAILBOX_SLOTS - 1));
+
+	if ((unsigned int)loadAcquireInt(slot->seq) != (m_dequeuePos + 1))
+		return false;										// empty or still being filled in
+	*message = slot->message;
+	*intParam = slot->intParam;
+	*ptrParam = slot->ptrParam;
+	*postTime = slot->postTime;
+	storeReleaseInt(slot->seq, (int)(m_dequeuePos + SYNTROTHREAD_MAILBOX_SLOTS));
+	m_dequeuePos++;
+	return true;
+}
+
+//	getOverflow only returns false if the chain is empty. If a producer has been caught between
+//	swapping the tail and linking in its entry, this waits for it to finish.
+
+bool SyntroThreadMailbox::getOverflow(int *message, int *intParam, void **ptrParam, qint64 *postTime)
+{
+	SyntroMailboxEntry *head = m_head;
+	SyntroMailboxEntry *next = loadAcquire(head->next);
+
+	if (head == &m_stub) {									// skip over the stub
+		if (next == NULL)
+			return false;									// empty
+		m_head = next;
+		head = next;
+		next = loadAcquire(next->next);
+	}
+
+	if (next == NULL) {										// head may be the last one
+		if (head == loadAcquire(m_tail))
+			link(&m_stub);									// put the stub back so head can be removed
+		while ((next = loadAcquire(head->next)) == NULL)
+			QThread::yieldCurrentThread();					// a producer is part way through a post
+	}
+
+	m_head = next;
+
+	*message = head->message;
+	*intParam = head->intParam;
+	*ptrParam = head->ptrParam;
+	*postTime = head->postTime;
+	delete head;
+	return true;
+}
+
+//	endBatch folds the batch stats into the totals so the lock is only taken once per wakeup
+
+void SyntroThreadMailbox::endBatch()
+{
+	QMutexLocker locker(&m_statsLock);
+
+	m_stats.messages += m_batch.messages;
+	m_stats.wakeups += m_batch.wakeups;
+	m_stats.totalLatency += m_batch.totalLatency;
+	if (m_batch.maxLatency > m_stats.maxLatency)
+		m_stats.maxLatency = m_batch.maxLatency;
+	memset(&m_batch, 0, sizeof(SYNTROTHREAD_MAILBOX_STATS));
+}
+
+void SyntroThreadMailbox::getStats(SYNTROTHREAD_MAILBOX_STATS *stats, bool reset)
+{
+	QMutexLocker locker(&m_statsLock);
+
+	*stats = m_stats;
+	stats->depth = loadInt(m_depth);
+	stats->highWater = loadInt(m_highWater);
+	if (reset) {
+		memset(&m_stats, 0, sizeof(SYNTROTHREAD_MAILBOX_STATS));
+		m_highWater = stats->depth;
+	}
+}
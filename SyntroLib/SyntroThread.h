@@ -21,6 +21,9 @@
 #define		_SYNTROTHREAD_H_
 
 #include "SyntroUtils.h"
+#include "SyntroPool.h"
+
+#include <qsocketnotifier.h>
 
 //	Inter-thread message defs
 
@@ -30,11 +33,11 @@
 #define	ENDPOINT_ONCLOSE_MESSAGE		(2)	
 #define	ENDPOINT_ONRECEIVE_MESSAGE		(3)	
 #define	ENDPOINT_ONSEND_MESSAGE			(4)	
+#define	ENDPOINT_ONBACKPRESSURE_MESSAGE	(5)					// SyntroLink TX queue congestion change
 
 #define	ENDPOINT_MESSAGE_START			ENDPOINT_ONCONNECT_MESSAGE	// start of endpoint message range
-#define	ENDPOINT_MESSAGE_END			ENDPOINT_ONSEND_MESSAGE		// end of endpoint message range
+#define	ENDPOINT_MESSAGE_END			ENDPOINT_ONBACKPRESSURE_MESSAGE	// end of endpoint message range
 
-//#define	SYNTROTHREAD_TIMER_MESSAGE		(5)					// message used by the SyntroThread timer
 #define	HELLO_ONRECEIVE_MESSAGE			(6)					// used for received hello messages
 #define	HELLO_STATUS_CHANGE_MESSAGE		(7)					// send to owner when hello status changes for a device
 
@@ -53,6 +56,97 @@ public:
 	void	*ptrParam;
 };
 
+//	SyntroThreadMailbox is an optional replacement for the Qt event queue used by postThreadMessage.
+//	Messages go into a ring of SYNTROTHREAD_MAILBOX_SLOTS fixed size slots allocated with the mailbox,
+//	so posting doesn't allocate anything or take Qt's posted event lock. If the ring is full, messages
+//	overflow onto a lock free MPSC chain (the same design as SyntroLinkQueue) of allocated entries until
+//	it has been emptied, so nothing is lost and each poster's messages stay in order. The owning thread
+//	is only woken when the mailbox goes from idle to busy - via an eventfd on Linux or a single posted
+//	event elsewhere - and it then processes up to SYNTROTHREAD_MAILBOX_BATCH messages per wakeup.
+
+#define	SYNTROTHREAD_MAILBOX_SLOTS		1024				// slots in the ring - must be a power of 2
+#define	SYNTROTHREAD_MAILBOX_BATCH		64					// max messages processed per wakeup
+
+//	SYNTROTHREAD_MAILBOX_STATS is filled in by SyntroThread::getMailboxStats. Latency is measured from
+//	when a message is posted to when processMessage is called for it.
+
+typedef struct
+{
+	int depth;												// messages waiting now
+	int highWater;											// max messages waiting
+	qint64 messages;										// messages processed
+	qint64 wakeups;											// number of times the thread was woken
+	qint64 totalLatency;									// sum of the latencies in uS
+	qint64 maxLatency;										// the worst latency in uS
+} SYNTROTHREAD_MAILBOX_STATS;
+
+//	SyntroMailboxSlot is a slot in the ring. seq says whether it is free or holds a message for the
+//	current lap of the ring.
+
+typedef struct
+{
+	QAtomicInt seq;
+	int message;
+	int intParam;
+	void *ptrParam;
+	qint64 postTime;										// when it was posted in uS
+} SyntroMailboxSlot;
+
+//	SyntroMailboxEntry is an overflow message
+
+class SyntroMailboxEntry
+{
+public:
+	static void *operator new(size_t size) { return SyntroPool::alloc((int)size); }
+	static void operator delete(void *ptr) { SyntroPool::release(ptr); }
+
+	int message;
+	int intParam;
+	void *ptrParam;
+	qint64 postTime;										// when it was posted in uS
+	QAtomicPointer<SyntroMailboxEntry> next;				// pointer to next in chain
+};
+
+class SYNTROLIB_EXPORT SyntroThreadMailbox
+{
+public:
+	SyntroThreadMailbox();
+	~SyntroThreadMailbox();
+
+	int wakeFd() { return m_wakeFd; }						// eventfd to watch or -1 if wake events are posted
+
+	bool post(int message, int intParam, void *ptrParam);	// any thread - returns true if a wake event must be posted
+	bool wake();											// any thread - returns true if a wake event must be posted
+
+	void startBatch();										// consumer only - call when woken, before get
+	bool get(int *message, int *intParam, void **ptrParam);	// consumer only - returns false if empty
+	void endBatch();										// consumer only - updates the stats
+	void getStats(SYNTROTHREAD_MAILBOX_STATS *stats, bool reset);
+
+private:
+	bool postSlot(int message, int intParam, void *ptrParam, qint64 now);	// false if the ring is full
+	bool getSlot(int *message, int *intParam, void **ptrParam, qint64 *postTime);	// false if nothing is ready
+	bool getOverflow(int *message, int *intParam, void **ptrParam, qint64 *postTime);	// false if the chain is empty
+	void link(SyntroMailboxEntry *entry);					// adds to the chain
+
+	SyntroMailboxSlot *m_slots;								// the ring
+	QAtomicInt m_enqueuePos;								// next ring position to post to - updated by producers
+	unsigned int m_dequeuePos;								// next ring position to get from - only used by the consumer
+	QAtomicInt m_overflow;									// messages on the chain
+
+	SyntroMailboxEntry m_stub;								// always in the chain when it would be empty
+	QAtomicPointer<SyntroMailboxEntry> m_tail;				// last in chain - updated by producers
+	SyntroMailboxEntry *m_head;								// first in chain - only used by the consumer
+	QAtomicInt m_depth;
+	QAtomicInt m_highWater;
+	QAtomicInt m_wakePending;								// 1 if the consumer has been signalled and not yet run
+	int m_wakeFd;
+
+	SYNTROTHREAD_MAILBOX_STATS m_batch;						// consumer's stats for the current batch
+	SYNTROTHREAD_MAILBOX_STATS m_stats;						// accumulated stats
+	QMutex m_statsLock;
+};
+
 class InternalThread : public QThread
 {
 	Q_OBJECT
@@ -70,17 +164,21 @@ public:
 	virtual ~SyntroThread();
 
 	virtual void postThreadMessage(int message, int intParam, void *ptrParam);	// post a message to the thread
+	void dispatchThreadMessage(int message, int intParam, void *ptrParam);	// process a message now - caller must be in the thread
 	virtual void resumeThread();							// this must be called to get thread going
 	
 	void exitThread();										// called to close thread down
 
 	bool isRunning();										// returns true if task no exiting
 
+	bool getMailboxStats(SYNTROTHREAD_MAILBOX_STATS *stats, bool reset = false);	// false if no mailbox
+
 	InternalThread *thread() { return m_thread; }
 
 public slots:
 	void internalRunLoop();
 	void cleanup();
+	void mailboxReady();
 
 signals:
 	void running();											// emitted when everything set up and thread active
@@ -95,6 +193,8 @@ protected:
     inline void msleep(unsigned long msecs) { thread()->msleep(msecs); }
 	bool eventFilter(QObject *obj, QEvent *event);
 
+	void useMailbox();										// call before resumeThread to post via a SyntroThreadMailbox
+
 	int m_event;											// the event used for Syntro thread message
 
 	QString m_logTag;
@@ -102,6 +202,10 @@ protected:
 private:
 	QString m_name;											// the task name - for debugging mostly
 	InternalThread *m_thread;								// the underlying thread
+
+	SyntroThreadMailbox *m_mailbox;							// the mailbox or NULL if using the Qt event queue
+	int m_mailboxEvent;										// event used to wake the thread if there's no eventfd
+	QSocketNotifier *m_mailboxNotifier;						// watches the mailbox eventfd
 };
 
 #endif		//_SYNTROTHREAD_H_
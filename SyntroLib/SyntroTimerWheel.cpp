@@ -0,0 +1,152 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//
+//  This file is part of SyntroLib
+//
+//  SyntroLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "SyntroTimerWheel.h"
+#include "SyntroClock.h"
+
+#define	SYNTRO_TIMERWHEEL_MASK			(SYNTRO_TIMERWHEEL_SLOTS - 1)
+#define	SYNTRO_TIMERWHEEL_RANGE			((qint64)1 << (SYNTRO_TIMERWHEEL_BITS * SYNTRO_TIMERWHEEL_LEVELS))
+
+SyntroTimerWheel::SyntroTimerWheel(int tick)
+{
+	m_tick = (tick < 1) ? 1 : tick;
+	m_currentTick = SyntroClock() / m_tick;
+	m_count = 0;
+	m_expired = NULL;
+	memset(m_wheel, 0, sizeof(m_wheel));
+}
+
+void SyntroTimerWheel::initTimer(SYNTRO_TIMER *timer, int id, void *context)
+{
+	memset(timer, 0, sizeof(SYNTRO_TIMER));
+	timer->id = id;
+	timer->context = context;
+}
+
+void SyntroTimerWheel::start(SYNTRO_TIMER *timer, qint64 deadline)
+{
+	if (timer->list != NULL)
+		unlink(timer);
+	else
+		m_count++;
+	timer->deadline = deadline;
+	timer->tick = (deadline + m_tick - 1) / m_tick;
+	add(timer);
+}
+
+void SyntroTimerWheel::stop(SYNTRO_TIMER *timer)
+{
+	if (timer->list == NULL)
+		return;
+	unlink(timer);
+	m_count--;
+}
+
+//	expired advances the wheel a tick at a time up to now. When the wheel is empty it just jumps.
+
+SYNTRO_TIMER *SyntroTimerWheel::expired(qint64 now)
+{
+	SYNTRO_TIMER *timer;
+	qint64 nowTick = now / m_tick;
+	int slot, level;
+
+	while ((m_expired == NULL) && (m_currentTick < nowTick)) {
+		if (m_count == 0) {
+			m_currentTick = nowTick;
+			break;
+		}
+		m_currentTick++;
+
+		//	Cascade higher levels when a lower one wraps
+
+		for (level = 1; level < SYNTRO_TIMERWHEEL_LEVELS; level++) {
+			if (((m_currentTick >> (SYNTRO_TIMERWHEEL_BITS * (level - 1))) & SYNTRO_TIMERWHEEL_MASK) != 0)
+				break;
+			cascade(level);
+		}
+
+		slot = (int)(m_currentTick & SYNTRO_TIMERWHEEL_MASK);
+		while ((timer = m_wheel[0][slot]) != NULL) {
+			unlink(timer);
+			link(timer, &m_expired);
+		}
+	}
+
+	if ((timer = m_expired) == NULL)
+		return NULL;
+	unlink(timer);
+	m_count--;
+	return timer;
+}
+
+//	add puts the timer on the lowest level that covers its tick. A timer further away than the
+//	whole wheel goes in the last slot of the top level and is placed again when it's cascaded.
+
+void SyntroTimerWheel::add(SYNTRO_TIMER *timer)
+{
+	qint64 delta = timer->tick - m_currentTick;
+	qint64 tick = timer->tick;
+	int level;
+
+	if (delta <= 0) {
+		link(timer, &m_expired);
+		return;
+	}
+	if (delta >= SYNTRO_TIMERWHEEL_RANGE)
+		tick = m_currentTick + SYNTRO_TIMERWHEEL_RANGE - 1;
+
+	for (level = 0; level < SYNTRO_TIMERWHEEL_LEVELS - 1; level++) {
+		if (delta < ((qint64)1 << (SYNTRO_TIMERWHEEL_BITS * (level + 1))))
+			break;
+	}
+	link(timer, &m_wheel[level][(tick >> (SYNTRO_TIMERWHEEL_BITS * level)) & SYNTRO_TIMERWHEEL_MASK]);
+}
+
+void SyntroTimerWheel::cascade(int level)
+{
+	SYNTRO_TIMER *timer;
+	int slot = (int)((m_currentTick >> (SYNTRO_TIMERWHEEL_BITS * level)) & SYNTRO_TIMERWHEEL_MASK);
+
+	while ((timer = m_wheel[level][slot]) != NULL) {
+		unlink(timer);
+		add(timer);
+	}
+}
+
+void SyntroTimerWheel::link(SYNTRO_TIMER *timer, SYNTRO_TIMER **list)
+{
+	timer->list = list;
+	timer->prev = NULL;
+	timer->next = *list;
+	if (*list != NULL)
+		(*list)->prev = timer;
+	*list = timer;
+}
+
+void SyntroTimerWheel::unlink(SYNTRO_TIMER *timer)
+{
+	if (timer->prev != NULL)
+		timer->prev->next = timer->next;
+	else
+		*(timer->list) = timer->next;
+	if (timer->next != NULL)
+		timer->next->prev = timer->prev;
+	timer->list = NULL;
+	timer->prev = timer->next = NULL;
+}
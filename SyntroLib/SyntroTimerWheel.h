@@ -0,0 +1,79 @@
+//
+//  Copyright (c) 2014 Scott Ellis and Richard Barnett
+//
+//  This file is part of SyntroLib
+//
+//  SyntroLib is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  SyntroLib is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with SyntroLib.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef	_SYNTROTIMERWHEEL_H
+#define	_SYNTROTIMERWHEEL_H
+
+#include "SyntroUtils.h"
+
+//	SyntroTimerWheel is a hierarchical timer wheel for the deadlines that background routines
+//	would otherwise find by scanning their tables. Starting and stopping a timer is O(1) and
+//	getting the expired timers costs time in proportion to the number that have expired.
+//
+//	Timers are SYNTRO_TIMER structures that belong to the caller, usually embedded in the entry
+//	they time, so the wheel never allocates. The caller sets id and context to identify the entry.
+//	A timer must be stopped before the memory holding it is reused. A wheel is not thread safe -
+//	it must only be used by one thread or under the owner's lock.
+//
+//	Deadlines are in SyntroClock units and are rounded up to the wheel's tick.
+
+#define	SYNTRO_TIMERWHEEL_TICK			10					// default tick in SyntroClock units
+#define	SYNTRO_TIMERWHEEL_BITS			6					// each level has 64 slots
+#define	SYNTRO_TIMERWHEEL_SLOTS			(1 << SYNTRO_TIMERWHEEL_BITS)
+#define	SYNTRO_TIMERWHEEL_LEVELS		4					// 64^4 ticks before a timer has to be cascaded again
+
+typedef struct _SYNTRO_TIMER
+{
+	int id;													// for the caller's use
+	void *context;											// for the caller's use
+	qint64 deadline;										// SyntroClock time at which it expires
+	qint64 tick;											// deadline in ticks
+	struct _SYNTRO_TIMER **list;							// the list it's on or NULL if not active
+	struct _SYNTRO_TIMER *prev;
+	struct _SYNTRO_TIMER *next;
+} SYNTRO_TIMER;
+
+class SYNTROLIB_EXPORT SyntroTimerWheel
+{
+public:
+	SyntroTimerWheel(int tick = SYNTRO_TIMERWHEEL_TICK);
+
+	static void initTimer(SYNTRO_TIMER *timer, int id, void *context);	// must be called before first use
+
+	void start(SYNTRO_TIMER *timer, qint64 deadline);		// starts or restarts the timer
+	void stop(SYNTRO_TIMER *timer);							// does nothing if the timer isn't active
+	static bool isActive(SYNTRO_TIMER *timer) { return timer->list != NULL; }
+
+	SYNTRO_TIMER *expired(qint64 now);						// removes and returns an expired timer, NULL if none
+	int count() { return m_count; }							// number of active timers
+
+private:
+	void add(SYNTRO_TIMER *timer);							// puts the timer in the right slot for its tick
+	void link(SYNTRO_TIMER *timer, SYNTRO_TIMER **list);
+	void unlink(SYNTRO_TIMER *timer);
+	void cascade(int level);								// moves the current slot of a level down
+
+	int m_tick;												// SyntroClock units per tick
+	qint64 m_currentTick;									// timers up to this tick have expired
+	int m_count;
+	SYNTRO_TIMER *m_expired;								// timers waiting to be returned by expired
+	SYNTRO_TIMER *m_wheel[SYNTRO_TIMERWHEEL_LEVELS][SYNTRO_TIMERWHEEL_SLOTS];
+};
+
+#endif	// _SYNTROTIMERWHEEL_H
@@ -178,11 +178,160 @@ bool SyntroUtils::checkDaemonModeFlag(int argc, char *argv[])
 	This function, typically called in the app's client thread, can be used to determine if the multicast
 	service send window is currently open. \a seq is the current send sequence number, \a ack is the last received ack sequence
 	number. Returns true if the window is open, false otherwise.
+
+	The difference is taken modulo 256 so the window stays correct when \a seq wraps past 255 before
+	\a ack does. Without the cast the difference would be negative just after the wrap and the window
+	would look open however many messages were outstanding.
 */
 
 bool SyntroUtils::isSendOK(unsigned char seq, unsigned char ack)
 {
-	return (seq - ack) < SYNTRO_MAX_WINDOW;
+	return (unsigned char)(seq - ack) < SYNTRO_MAX_WINDOW;
+}
+
+/*!
+	Updates the best effort receive state \a rx for a datagram with sequence number \a seq.
+	Returns true if the datagram should be processed. Returns false if a later datagram has
+	already been processed, in which case this one is counted as late and should be dropped.
+	A jump of more than SYNTRO_BESTEFFORT_RESYNC either way is taken to mean that the sender
+	has restarted its sequence numbers rather than that datagrams were lost.
+*/
+
+bool SyntroUtils::bestEffortAccept(SYNTRO_BESTEFFORT_RX *rx, quint32 seq)
+{
+	qint32 gap;
+
+	if (rx->started) {
+		gap = (qint32)(seq - rx->nextSeq);
+		if ((gap < 0) && (gap > -SYNTRO_BESTEFFORT_RESYNC)) {
+			rx->late++;
+			return false;
+		}
+		if ((gap > 0) && (gap < SYNTRO_BESTEFFORT_RESYNC))
+			rx->lost += gap;
+	}
+	rx->started = true;
+	rx->nextSeq = seq + 1;
+	rx->received++;
+	return true;
+}
+
+/*!
+	Tells the best effort receive state \a rx that \a seq is the next sequence number the sender
+	will use. This is needed when the sender has started a new registration so that its first
+	datagrams aren't taken as late.
+*/
+
+void SyntroUtils::bestEffortSync(SYNTRO_BESTEFFORT_RX *rx, quint32 seq)
+{
+	if (!rx->started || ((qint32)(seq - rx->nextSeq) < 0)) {
+		rx->started = true;
+		rx->nextSeq = seq;
+	}
+}
+
+/*!
+	Initializes the adaptive send window \a sw. The window starts at \a minWindow and is kept
+	between \a minWindow and \a maxWindow. Both are limited to the range 1 to SYNTRO_WINDOW_LIMIT.
+*/
+
+void SyntroUtils::sendWindowInit(SYNTRO_SEND_WINDOW *sw, int minWindow, int maxWindow)
+{
+	memset(sw, 0, sizeof(SYNTRO_SEND_WINDOW));
+	if (minWindow < 1)
+		minWindow = 1;
+	if (minWindow > SYNTRO_WINDOW_LIMIT)
+		minWindow = SYNTRO_WINDOW_LIMIT;
+	if (maxWindow < minWindow)
+		maxWindow = minWindow;
+	if (maxWindow > SYNTRO_WINDOW_LIMIT)
+		maxWindow = SYNTRO_WINDOW_LIMIT;
+	sw->minWindow = minWindow;
+	sw->maxWindow = maxWindow;
+	sw->window = minWindow;
+}
+
+/*!
+	Returns true if the window \a sw is open. \a sendSeq is the next send sequence number and
+	\a ackSeq is the last received ack sequence number.
+*/
+
+bool SyntroUtils::sendWindowOpen(SYNTRO_SEND_WINDOW *sw, unsigned char sendSeq, unsigned char ackSeq)
+{
+	return (unsigned char)(sendSeq - ackSeq) < sw->window;
+}
+
+/*!
+	Tells the window \a sw that the message with sequence number \a seq was sent at \a now. If no
+	message is being timed this one is.
+*/
+
+void SyntroUtils::sendWindowSent(SYNTRO_SEND_WINDOW *sw, unsigned char seq, qint64 now)
+{
+	if (sw->timing)
+		return;
+	sw->timing = true;
+	sw->timedSeq = seq;
+	sw->timedSent = now;
+	sw->timedDelivered = sw->delivered;
+}
+
+/*!
+	Updates the window \a sw when an ack with sequence number \a ackSeq arrives at \a now.
+	\a lastAckSeq is the previous ack sequence number. Duplicate and stale acks are ignored.
+	If the ack covers the timed message the RTT and delivery rate are sampled and the window resized.
+*/
+
+void SyntroUtils::sendWindowAcked(SYNTRO_SEND_WINDOW *sw, unsigned char lastAckSeq, unsigned char ackSeq, qint64 now)
+{
+	int advance = (unsigned char)(ackSeq - lastAckSeq);
+	qint64 rtt;
+	double rate;
+	int window;
+
+	if ((advance == 0) || (advance > SYNTRO_WINDOW_LIMIT))
+		return;
+	sw->delivered += advance;
+
+	if (!sw->timing || ((unsigned char)(ackSeq - sw->timedSeq - 1) >= SYNTRO_WINDOW_LIMIT))
+		return;												// timed message not acked yet
+	sw->timing = false;
+
+	rtt = now - sw->timedSent;
+	if (rtt < 1)
+		rtt = 1;
+	rate = (double)(sw->delivered - sw->timedDelivered) / (double)rtt;
+
+	if ((sw->rtt == 0) || syntroTimerExpired(now, sw->filterStart, SYNTRO_WINDOW_FILTER)) {
+		sw->filterStart = now;								// start a new filter period
+		sw->minRTT = rtt;
+		sw->maxRate = rate;
+	} else {
+		if (rtt < sw->minRTT)
+			sw->minRTT = rtt;
+		if (rate > sw->maxRate)
+			sw->maxRate = rate;
+	}
+	sw->rtt = (sw->rtt == 0) ? rtt : (7 * sw->rtt + rtt) / 8;
+
+	window = (int)(SYNTRO_WINDOW_GAIN * sw->maxRate * (double)sw->minRTT + 0.5);
+	if (window < sw->minWindow)
+		window = sw->minWindow;
+	if (window > sw->maxWindow)
+		window = sw->maxWindow;
+	sw->window = window;
+}
+
+/*!
+	Called when the sender gives up waiting for acks and opens the window \a sw regardless. Any
+	timing in progress is abandoned and the window drops back to the minimum so that it has to be
+	earned again.
+*/
+
+void SyntroUtils::sendWindowReset(SYNTRO_SEND_WINDOW *sw)
+{
+	sw->timing = false;
+	sw->window = sw->minWindow;
 }
 
 /*!
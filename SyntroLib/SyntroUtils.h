@@ -29,22 +29,63 @@
 //	Standard Qt includes for SyntroLib
 
 #include <qmutex.h>
+#include <qatomic.h>
 #include <qabstractsocket.h>
 #include <qtcpserver.h>
 #include <qudpsocket.h>
 #include <qtcpsocket.h>
 #include <qthread.h>
-#include <qapplication.h>
 #include <qstringlist.h>
 #include <qqueue.h>
 #include <qnetworkinterface.h>
 #include <qdatetime.h>
 #include <qsettings.h>
+
+//	The GUI headers are only pulled in for users built with them so that code like the tests
+//	can use SyntroLib with just core and network
+
+#if defined(QT_WIDGETS_LIB) || ((QT_VERSION < 0x050000) && defined(QT_GUI_LIB))
+#include <qapplication.h>
 #include <qlabel.h>
+#else
+#include <qcoreapplication.h>
+#endif
 
 class SyntroSocket;
 class SyntroClockObject;
 
+//	SYNTRO_BESTEFFORT_RX keeps track of the datagrams received on a best effort channel
+
+typedef struct
+{
+	bool started;											// true once the first datagram has arrived
+	quint32 nextSeq;										// the seq expected next
+	qint64 received;										// datagrams accepted
+	qint64 lost;											// seqs that never arrived
+	qint64 late;											// datagrams dropped as a later one had already arrived
+} SYNTRO_BESTEFFORT_RX;
+
+//	SYNTRO_SEND_WINDOW sizes the ack window of a multicast sender. One message per round trip is
+//	timed to get the ack RTT and the delivery rate over that RTT. The window is the messages that
+//	could be delivered in the min RTT at the max rate times SYNTRO_WINDOW_GAIN so it keeps growing
+//	until the path is full and the RTT starts to rise.
+
+typedef struct
+{
+	int minWindow;											// the window never gets smaller than this
+	int maxWindow;											// or larger than this
+	int window;												// the current window in messages
+	bool timing;											// true if a message is being timed
+	unsigned char timedSeq;									// the seq of the timed message
+	qint64 timedSent;										// when it was sent
+	qint64 timedDelivered;									// value of delivered when it was sent
+	qint64 delivered;										// messages acked so far
+	qint64 rtt;												// smoothed RTT (0 until the first sample)
+	qint64 minRTT;											// min RTT in the current filter period
+	double maxRate;											// max delivery rate in messages per clock in the period
+	qint64 filterStart;										// when the current filter period started
+} SYNTRO_SEND_WINDOW;
+
 //	Debug message and error display macros
 
 #ifdef _DEBUG
@@ -82,6 +123,17 @@ class SyntroClockObject;
 #define	SYNTRO_PARAMS_LOG_HBINTERVAL	"logHeartbeatInterval"	// time between sent heartbeats for log
 #define	SYNTRO_PARAMS_LOG_HBTIMEOUT		"logHeartbeatTimeout"	// number of hb intervals without hb before timeout for log
 #define SYNTRO_PARAMS_ENCRYPT_LINK      "encryptLink"       // true if use SSL for links
+#define	SYNTRO_PARAMS_TXFRAGMENT_SIZE	"TXFragmentSize"	// max bytes per fragment of large messages sent (0 = don't fragment)
+#define	SYNTRO_PARAMS_TXSCHEDULER		"TXScheduler"		// SYNTROLINK_SCHED_* value used to pick the next priority to send
+#define	SYNTRO_PARAMS_TXSCHEDULER_WEIGHTS	"TXSchedulerWeights"	// list of scheduler weights, high priority first
+#define	SYNTRO_PARAMS_SHAREDMEMORY		"SharedMemory"		// true to use shared memory to a SyntroControl on the same machine
+#define	SYNTRO_PARAMS_UNIXSOCKET		"UnixSocket"		// true to use a Unix domain socket to a SyntroControl on the same machine
+#define	SYNTRO_PARAMS_MULTICASTGROUPS	"MulticastGroups"	// true to accept multicast services on IP multicast groups from SyntroControl
+#define	SYNTRO_PARAMS_BESTEFFORT		"BestEffort"		// true to let best effort services use UDP datagrams to and from SyntroControl
+#define	SYNTRO_PARAMS_MULTICAST_WINDOW_MIN	"MulticastWindowMin"	// smallest ack window for local multicast services
+#define	SYNTRO_PARAMS_MULTICAST_WINDOW_MAX	"MulticastWindowMax"	// largest ack window for local multicast services
+#define	SYNTRO_PARAMS_MULTICAST_ACK_COUNT	"MulticastAckCount"	// messages received on a remote multicast service per ack (1 = ack every message)
+#define	SYNTRO_PARAMS_MULTICAST_ACK_INTERVAL	"MulticastAckInterval"	// longest time in ms that an ack is held back
 
 #define	SYNTRO_PARAMS_CONTROL_NAMES		"controlNames"		// ordered list of SyntroControls as an array
 #define	SYNTRO_PARAMS_CONTROL_NAME		"controlName"		// an entry in the array
@@ -161,6 +213,13 @@ public:
 	static bool checkConsoleModeFlag(int argc, char *argv[]);	// checks if console mode
 	static bool checkDaemonModeFlag(int argc, char *argv[]);
     static bool isSendOK(unsigned char sendSeq, unsigned char ackSeq);
+	static bool bestEffortAccept(SYNTRO_BESTEFFORT_RX *rx, quint32 seq);	// updates rx - false if the datagram is stale
+	static void bestEffortSync(SYNTRO_BESTEFFORT_RX *rx, quint32 seq);	// seq is the next one the sender will use
+	static void sendWindowInit(SYNTRO_SEND_WINDOW *sw, int minWindow, int maxWindow);
+	static bool sendWindowOpen(SYNTRO_SEND_WINDOW *sw, unsigned char sendSeq, unsigned char ackSeq);
+	static void sendWindowSent(SYNTRO_SEND_WINDOW *sw, unsigned char seq, qint64 now);	// call for each message sent
+	static void sendWindowAcked(SYNTRO_SEND_WINDOW *sw, unsigned char lastAckSeq, unsigned char ackSeq, qint64 now);
+	static void sendWindowReset(SYNTRO_SEND_WINDOW *sw);	// call when the window is forced open after a timeout
     static SYNTRO_EHEAD *createEHEAD(SYNTRO_UID *sourceUID, int sourcePort, 
 					SYNTRO_UID *destUID, int destPort, unsigned char seq, int len); 
     static void swapEHead(SYNTRO_EHEAD *ehead);		// swaps UIDs and port numbers